@@ -0,0 +1,732 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre-bench.c
+
+  Measure the scoring engine, stage by stage, on the files named on the
+  command line -- normally corpora made by fkre-corpus. For each file,
+  each stage is timed on its own:
+
+    read      -- reading the file into memory
+    decode    -- decoding UTF-8 into characters
+    classify-scalar, classify-table
+              -- the classification of each character, done in each of
+                 the ways described below, on text already decoded
+    tokenize  -- the tokenizer and counters, on text already decoded
+    syllables -- counting syllables, on words already split out
+    score     -- the whole of fkre_context_feed(), from memory, to
+                 the metrics
+
+  and reported as throughput, time per word, klib allocations per MB,
+  and the peak resident size of the process so far. Where the system
+  allows it, the hardware counters -- cycles and instructions per byte,
+  and branch, L1 data cache and last-level cache misses per KB -- are
+  read at the same points as the clock, and reported too. The allocations
+  are counted in a separate run of each stage, so that counting them
+  does not slow the timed runs. Clocks are read at chunk boundaries,
+  never per character or per word. The results can be written as JSON,
+  and compared with those of an earlier run.
+
+  A file whose name contains "html" is scored in HTML mode.
+
+  This program uses the library's internal interfaces, so it must be
+  linked with the static library.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_internal.h"
+#include "perf-counters.h"
+
+#define BENCH_BLOCK 65536
+#define BENCH_MAX_RESULTS 1024
+
+static const char *stages[] =
+  {
+  "read", "decode", "classify-scalar", "classify-table", "tokenize",
+  "syllables", "score"
+  };
+#define NSTAGES (sizeof (stages) / sizeof (stages[0]))
+
+enum
+  {
+  STAGE_READ = 0, STAGE_DECODE, STAGE_CLASSIFY_SCALAR, STAGE_CLASSIFY_TABLE,
+  STAGE_TOKENIZE, STAGE_SYLLABLES, STAGE_SCORE
+  };
+
+static BOOL have_counters = FALSE;
+
+/*============================================================================
+  
+  Timer
+
+  The time, and the hardware counts, of the timed parts of one run of a
+  stage. A timed part starts with bench_start() and ends with
+  bench_stop(), which adds to the totals
+
+  ==========================================================================*/
+typedef struct _Timer
+  {
+  double seconds;
+  PerfValues counters;
+  } Timer;
+
+typedef struct _Mark
+  {
+  double t;
+  PerfValues counters;
+  } Mark;
+
+/*============================================================================
+  
+  Result
+
+  ==========================================================================*/
+typedef struct _Result
+  {
+  char corpus[256];
+  const char *stage;
+  size_t bytes;
+  int64_t words;
+  double seconds;
+  PerfValues counters;
+  long peak_rss_kb;
+  double allocs_per_mb;
+  // From the baseline, or 0
+  double baseline_seconds;
+  } Result;
+
+/*============================================================================
+  
+  bench_now
+
+  ==========================================================================*/
+static double bench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+static long bench_peak_rss (void)
+  {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+  }
+
+/*============================================================================
+  
+  bench_timer_init, bench_start, bench_stop
+
+  ==========================================================================*/
+static void bench_timer_init (Timer *timer)
+  {
+  timer->seconds = 0;
+  perf_counters_zero (&timer->counters);
+  }
+
+static void bench_start (Mark *mark)
+  {
+  if (have_counters) perf_counters_read (&mark->counters);
+  mark->t = bench_now ();
+  }
+
+static void bench_stop (const Mark *mark, Timer *timer)
+  {
+  double t = bench_now ();
+  if (have_counters)
+    {
+    PerfValues now;
+    perf_counters_read (&now);
+    perf_counters_add (&timer->counters, &mark->counters, &now);
+    }
+  timer->seconds += t - mark->t;
+  }
+
+/*============================================================================
+  
+  bench_read
+
+  ==========================================================================*/
+static BYTE *bench_read (const char *path, size_t *length, Timer *timer)
+  {
+  Mark mark;
+  bench_start (&mark);
+  int fd = open (path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat sb;
+  fstat (fd, &sb);
+  BYTE *data = malloc (sb.st_size + 1);
+  size_t n = 0;
+  ssize_t r;
+  while ((r = read (fd, data + n,
+       sb.st_size - n < BENCH_BLOCK ? sb.st_size - n : BENCH_BLOCK)) > 0)
+    n += r;
+  close (fd);
+  *length = n;
+  bench_stop (&mark, timer);
+  return data;
+  }
+
+/*============================================================================
+  
+  bench_decode
+
+  ==========================================================================*/
+static void bench_decode (FKREContext *context, const BYTE *data,
+      size_t length, UTF32 *scratch, Timer *timer)
+  {
+  fkre_context_reset (context);
+  Mark mark;
+  bench_start (&mark);
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  while (p < end)
+    fkre_decode (context, &p, end, scratch, FKRE_SCRATCH_SIZE);
+  bench_stop (&mark, timer);
+  }
+
+/*============================================================================
+  
+  Character classification
+
+  The tokenizer's inner loop is the classification of each character. 
+  Each way of doing it is timed on its own, on text already decoded, 
+  and must count the same characters of each type as the others:
+
+    scalar -- fkre_classify(), as the tokenizer calls it
+    table  -- a lookup in a table of the Basic Multilingual Plane, built
+              from fkre_classify(), which classifies nothing above it
+              as anything but text
+
+  ==========================================================================*/
+typedef struct _ClassCounts
+  {
+  int64_t n[TYPE_TEXT + 1];
+  } ClassCounts;
+
+typedef void (*ClassifyFn) (BOOL html, const UTF32 *s, size_t n,
+   ClassCounts *counts);
+
+static BYTE classify_table[2][0x10000];
+
+static void classify_scalar (BOOL html, const UTF32 *s, size_t n,
+      ClassCounts *counts)
+  {
+  for (size_t i = 0; i < n; i++)
+    counts->n[fkre_classify (html, s[i])]++;
+  }
+
+static void classify_table_init (void)
+  {
+  for (int html = 0; html < 2; html++)
+    for (int c = 0; c < 0x10000; c++)
+      classify_table[html][c] = fkre_classify (html, c);
+  }
+
+static void classify_lookup (BOOL html, const UTF32 *s, size_t n,
+      ClassCounts *counts)
+  {
+  const BYTE *table = classify_table[html ? 1 : 0];
+  for (size_t i = 0; i < n; i++)
+    {
+    UTF32 c = s[i];
+    counts->n[c < 0x10000 ? table[c] : TYPE_TEXT]++;
+    }
+  }
+
+/*============================================================================
+  
+  bench_classify
+
+  ==========================================================================*/
+static void bench_classify (FKREContext *context, const BYTE *data,
+      size_t length, UTF32 *scratch, ClassifyFn fn, BOOL html,
+      ClassCounts *counts, Timer *timer)
+  {
+  fkre_context_reset (context);
+  memset (counts, 0, sizeof (ClassCounts));
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  while (p < end)
+    {
+    size_t n = fkre_decode (context, &p, end, scratch, FKRE_SCRATCH_SIZE);
+    Mark mark;
+    bench_start (&mark);
+    fn (html, scratch, n, counts);
+    bench_stop (&mark, timer);
+    }
+  }
+
+/*============================================================================
+  
+  bench_tokenize
+
+  ==========================================================================*/
+static void bench_tokenize (FKREContext *context, const BYTE *data,
+      size_t length, UTF32 *scratch, Timer *timer)
+  {
+  fkre_context_reset (context);
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  Mark mark;
+  while (p < end)
+    {
+    size_t n = fkre_decode (context, &p, end, scratch, FKRE_SCRATCH_SIZE);
+    bench_start (&mark);
+    fkre_process (context, scratch, n);
+    bench_stop (&mark, timer);
+    }
+  bench_start (&mark);
+  fkre_context_finish (context);
+  bench_stop (&mark, timer);
+  }
+
+/*============================================================================
+  
+  bench_syllables
+
+  The words are split out of each chunk of text as the tokenizer would,
+  stripped to their letters, and only then timed
+
+  ==========================================================================*/
+static void bench_syllables (FKREContext *context, const BYTE *data,
+      size_t length, UTF32 *scratch, int64_t *nwords, Timer *timer)
+  {
+  fkre_context_reset (context);
+  int64_t count = 0;
+  int size = 1024;
+  KString **words = malloc (size * sizeof (KString *));
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  volatile int total = 0;
+  while (p < end)
+    {
+    size_t n = fkre_decode (context, &p, end, scratch, FKRE_SCRATCH_SIZE);
+    int w = 0;
+    KString *word = NULL;
+    for (size_t i = 0; i <= n; i++)
+      {
+      UTF32 c = i < n ? scratch[i] : ' ';
+      if (fkre_classify (FALSE, c) == TYPE_WHITE)
+        {
+        if (word && kstring_length (word) > 0)
+          {
+          if (w == size)
+            {
+            size *= 2;
+            words = realloc (words, size * sizeof (KString *));
+            }
+          words[w++] = word;
+          word = NULL;
+          }
+        }
+      else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+          || (c >= 192 && c <= 255))
+        {
+        if (!word) word = kstring_new_empty ();
+        kstring_append_char (word, c);
+        }
+      }
+    if (word) kstring_destroy (word);
+
+    Mark mark;
+    bench_start (&mark);
+    for (int i = 0; i < w; i++)
+      total += fkre_count_syllables (words[i]);
+    bench_stop (&mark, timer);
+
+    for (int i = 0; i < w; i++) kstring_destroy (words[i]);
+    count += w;
+    }
+  free (words);
+  *nwords = count;
+  }
+
+/*============================================================================
+  
+  bench_score
+
+  ==========================================================================*/
+static void bench_score (FKREContext *context, const BYTE *data,
+      size_t length, int64_t *nwords, Timer *timer)
+  {
+  fkre_context_reset (context);
+  Mark mark;
+  bench_start (&mark);
+  for (size_t i = 0; i < length; i += BENCH_BLOCK)
+    fkre_context_feed (context, data + i,
+      length - i < BENCH_BLOCK ? length - i : BENCH_BLOCK);
+  fkre_context_finish (context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (context, &metrics);
+  bench_stop (&mark, timer);
+  *nwords = metrics.words;
+  }
+
+/*============================================================================
+  
+  bench_stage
+
+  Run one stage but reading, adding its time to 'timer'
+
+  ==========================================================================*/
+static void bench_stage (int stage, FKREContext *context, BOOL html,
+      const BYTE *data, size_t length, UTF32 *scratch, int64_t *nwords,
+      Timer *timer)
+  {
+  ClassCounts scalar, table;
+  switch (stage)
+    {
+    case STAGE_DECODE:
+      bench_decode (context, data, length, scratch, timer);
+      break;
+    case STAGE_CLASSIFY_SCALAR:
+      bench_classify (context, data, length, scratch, classify_scalar,
+        html, &scalar, timer);
+      break;
+    case STAGE_CLASSIFY_TABLE:
+      {
+      // Check the table against fkre_classify(), outside the timing
+      Timer unused;
+      bench_timer_init (&unused);
+      bench_classify (context, data, length, scratch, classify_lookup,
+        html, &table, timer);
+      bench_classify (context, data, length, scratch, classify_scalar,
+        html, &scalar, &unused);
+      if (memcmp (&scalar, &table, sizeof (ClassCounts)) != 0)
+        {
+        fprintf (stderr, "classify-table counts differ from "
+          "classify-scalar\n");
+        exit (1);
+        }
+      }
+      break;
+    case STAGE_TOKENIZE:
+      bench_tokenize (context, data, length, scratch, timer);
+      break;
+    case STAGE_SYLLABLES:
+      bench_syllables (context, data, length, scratch, nwords, timer);
+      break;
+    case STAGE_SCORE:
+      bench_score (context, data, length, nwords, timer);
+      break;
+    }
+  }
+
+/*============================================================================
+  
+  bench_file
+
+  Run every stage on one file, 'repeat' times, keeping the best time,
+  and the counts of the run that made it
+
+  ==========================================================================*/
+static int bench_file (const char *path, int repeat, Result *results)
+  {
+  char *copy = strdup (path);
+  char corpus[256];
+  snprintf (corpus, sizeof (corpus), "%s", basename (copy));
+  free (copy);
+  char *dot = strrchr (corpus, '.');
+  if (dot) *dot = 0;
+
+  BOOL html = strstr (corpus, "html") != NULL;
+  FKREContext *context = fkre_context_new (html ? FKRE_FLAG_HTML : 0);
+  UTF32 *scratch = malloc (FKRE_SCRATCH_SIZE * sizeof (UTF32));
+
+  Timer best[NSTAGES];
+  long rss[NSTAGES];
+  for (int s = 0; s < NSTAGES; s++) best[s].seconds = 1e300;
+  size_t length = 0;
+  BYTE *data = NULL;
+  int64_t words = 0, syllable_words = 0;
+  for (int r = 0; r < repeat; r++)
+    {
+    Timer t;
+    bench_timer_init (&t);
+    free (data);
+    data = bench_read (path, &length, &t);
+    if (!data)
+      {
+      fprintf (stderr, "Can't read '%s': %s\n", path, strerror (errno));
+      free (scratch);
+      fkre_context_destroy (context);
+      return 0;
+      }
+    if (t.seconds < best[STAGE_READ].seconds) best[STAGE_READ] = t;
+    rss[STAGE_READ] = bench_peak_rss ();
+
+    for (int s = STAGE_DECODE; s < NSTAGES; s++)
+      {
+      bench_timer_init (&t);
+      bench_stage (s, context, html, data, length, scratch,
+        s == STAGE_SYLLABLES ? &syllable_words : &words, &t);
+      if (t.seconds < best[s].seconds) best[s] = t;
+      rss[s] = bench_peak_rss ();
+      }
+    }
+
+  // Allocations -- including reallocations -- for each stage but 
+  //   reading, which doesn't use klib
+  int64_t allocs[NSTAGES];
+  memset (allocs, 0, sizeof (allocs));
+  kalloc_set_counting (TRUE);
+  for (int s = STAGE_DECODE; s < NSTAGES; s++)
+    {
+    KAllocStats before, after;
+    int64_t n;
+    Timer unused;
+    bench_timer_init (&unused);
+    kalloc_get_thread_stats (&before);
+    bench_stage (s, context, html, data, length, scratch, &n, &unused);
+    kalloc_get_thread_stats (&after);
+    allocs[s] = after.mallocs + after.reallocs 
+      - before.mallocs - before.reallocs;
+    }
+  kalloc_set_counting (FALSE);
+
+  for (int s = 0; s < NSTAGES; s++)
+    {
+    Result *result = &results[s];
+    memset (result, 0, sizeof (Result));
+    snprintf (result->corpus, sizeof (result->corpus), "%s", corpus);
+    result->stage = stages[s];
+    result->bytes = length;
+    result->words = (s == STAGE_SYLLABLES) ? syllable_words : words;
+    result->seconds = best[s].seconds;
+    result->counters = best[s].counters;
+    result->peak_rss_kb = rss[s];
+    result->allocs_per_mb = length > 0 ? allocs[s] * 1048576.0 / length : 0;
+    }
+
+  free (data);
+  free (scratch);
+  fkre_context_destroy (context);
+  return NSTAGES;
+  }
+
+/*============================================================================
+  
+  bench_load_baseline
+
+  Read the times from an earlier run's JSON, which has one result per
+  line
+
+  ==========================================================================*/
+static void bench_load_baseline (const char *path, Result *results,
+      int nresults)
+  {
+  FILE *f = fopen (path, "r");
+  if (!f)
+    {
+    fprintf (stderr, "Can't read baseline '%s': %s\n", path,
+      strerror (errno));
+    return;
+    }
+  char line[1024];
+  while (fgets (line, sizeof (line), f))
+    {
+    char corpus[256], stage[32];
+    double seconds;
+    if (sscanf (line, " {\"corpus\":\"%255[^\"]\",\"stage\":\"%31[^\"]\","
+          "\"bytes\":%*u,\"words\":%*d,\"seconds\":%lf",
+          corpus, stage, &seconds) != 3)
+      continue;
+    for (int i = 0; i < nresults; i++)
+      if (strcmp (results[i].corpus, corpus) == 0
+          && strcmp (results[i].stage, stage) == 0)
+        results[i].baseline_seconds = seconds;
+    }
+  fclose (f);
+  }
+
+/*============================================================================
+  
+  bench_mb_per_s
+
+  ==========================================================================*/
+static double bench_mb_per_s (const Result *r)
+  {
+  return r->seconds > 0 ? r->bytes / 1048576.0 / r->seconds : 0;
+  }
+
+static double bench_ns_per_word (const Result *r)
+  {
+  return r->words > 0 ? r->seconds * 1e9 / r->words : 0;
+  }
+
+/*============================================================================
+  
+  bench_per_unit
+
+  A counter per byte or per KB, or -1 if it isn't available
+
+  ==========================================================================*/
+static double bench_per_unit (const Result *r, PerfCounter counter)
+  {
+  int64_t v = r->counters.v[counter];
+  if (v < 0 || r->bytes == 0) return -1;
+  double unit = (counter == PERF_CYCLES || counter == PERF_INSTRUCTIONS) 
+    ? 1 : 1024;
+  return v * unit / r->bytes;
+  }
+
+static const char *counter_fields[PERF_COUNT] =
+  {
+  "cycles_per_byte", "instructions_per_byte", "branch_misses_per_kb",
+  "l1d_misses_per_kb", "llc_misses_per_kb"
+  };
+
+static const char *counter_headings[PERF_COUNT] =
+  {
+  "cyc/B", "ins/B", "br-miss/KB", "L1D-miss/KB", "LLC-miss/KB"
+  };
+
+/*============================================================================
+  
+  bench_write_json
+
+  ==========================================================================*/
+static void bench_write_json (FILE *f, const Result *results, int nresults)
+  {
+  fprintf (f, "[\n");
+  for (int i = 0; i < nresults; i++)
+    {
+    const Result *r = &results[i];
+    fprintf (f, "{\"corpus\":\"%s\",\"stage\":\"%s\",\"bytes\":%zu,"
+      "\"words\":%lld,\"seconds\":%.6f,\"mb_per_s\":%.3f,"
+      "\"ns_per_word\":%.2f,\"allocs_per_mb\":%.0f,\"peak_rss_kb\":%ld",
+      r->corpus, r->stage, r->bytes, (long long)r->words, r->seconds,
+      bench_mb_per_s (r), bench_ns_per_word (r), r->allocs_per_mb,
+      r->peak_rss_kb);
+    for (int c = 0; c < PERF_COUNT; c++)
+      {
+      double v = bench_per_unit (r, c);
+      if (v < 0)
+        fprintf (f, ",\"%s\":null", counter_fields[c]);
+      else
+        fprintf (f, ",\"%s\":%.3f", counter_fields[c], v);
+      }
+    if (r->baseline_seconds > 0)
+      fprintf (f, ",\"baseline_seconds\":%.6f,\"speedup\":%.3f",
+        r->baseline_seconds, r->baseline_seconds / r->seconds);
+    fprintf (f, "}%s\n", i < nresults - 1 ? "," : "");
+    }
+  fprintf (f, "]\n");
+  }
+
+/*============================================================================
+  
+  bench_write_table
+
+  The counter columns are left out if no counter is available
+
+  ==========================================================================*/
+static void bench_write_table (FILE *f, const Result *results, int nresults,
+      BOOL baseline)
+  {
+  fprintf (f, "%-24s %-16s %10s %10s %12s %12s", "corpus", "stage",
+    "MB/s", "ns/word", "allocs/MB", "peak RSS KB");
+  if (have_counters)
+    for (int c = 0; c < PERF_COUNT; c++)
+      fprintf (f, " %11s", counter_headings[c]);
+  fprintf (f, "%s\n", baseline ? "    speedup" : "");
+  for (int i = 0; i < nresults; i++)
+    {
+    const Result *r = &results[i];
+    fprintf (f, "%-24s %-16s %10.2f %10.1f %12.0f %12ld", r->corpus, 
+      r->stage, bench_mb_per_s (r), bench_ns_per_word (r), 
+      r->allocs_per_mb, r->peak_rss_kb);
+    if (have_counters)
+      for (int c = 0; c < PERF_COUNT; c++)
+        {
+        double v = bench_per_unit (r, c);
+        if (v < 0)
+          fprintf (f, " %11s", "-");
+        else
+          fprintf (f, " %11.3f", v);
+        }
+    if (baseline && r->baseline_seconds > 0)
+      fprintf (f, "     %5.2fx", r->baseline_seconds / r->seconds);
+    fprintf (f, "\n");
+    }
+  }
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int repeat = 1;
+  const char *output = NULL;
+  const char *baseline = NULL;
+  int opt;
+  while ((opt = getopt (argc, argv, "n:o:b:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'n': repeat = atoi (optarg); break;
+      case 'o': output = optarg; break;
+      case 'b': baseline = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-n repeat] [-o results.json] "
+          "[-b baseline.json] {corpus files...}\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+  if (repeat < 1) repeat = 1;
+
+  have_counters = perf_counters_open () > 0;
+  if (!have_counters)
+    fprintf (stderr, "Hardware counters are not available; "
+      "reporting times only\n");
+  classify_table_init ();
+
+  Result *results = malloc (BENCH_MAX_RESULTS * sizeof (Result));
+  int nresults = 0;
+  for (int i = optind; i < argc
+       && nresults + NSTAGES <= BENCH_MAX_RESULTS; i++)
+    nresults += bench_file (argv[i], repeat, results + nresults);
+
+  if (baseline) bench_load_baseline (baseline, results, nresults);
+  bench_write_table (stdout, results, nresults, baseline != NULL);
+  int ret = 0;
+  if (output)
+    {
+    FILE *f = fopen (output, "w");
+    if (f)
+      {
+      bench_write_json (f, results, nresults);
+      fclose (f);
+      }
+    else
+      {
+      fprintf (stderr, "Can't write '%s': %s\n", output, strerror (errno));
+      ret = 1;
+      }
+    }
+  free (results);
+  perf_counters_close ();
+  return ret;
+  }
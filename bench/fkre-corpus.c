@@ -0,0 +1,348 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre-corpus.c
+
+  Generate synthetic documents for benchmarking. The same kind, size,
+  and seed always give the same bytes, so that results from different
+  builds, or different machines, are measured on the same text.
+
+    plain        -- English-like prose, in sentences and paragraphs
+    html         -- the same, marked up, with headings and attributes
+    unicode      -- prose in which most characters are multi-byte:
+                    accented Latin, Greek, Cyrillic, CJK, emoji, and
+                    Unicode spaces and punctuation
+    pathological -- the inputs the tokenizer finds hardest: words
+                    thousands of letters long, sentences that never
+                    end, runs of punctuation, invalid and truncated
+                    UTF-8, NULs, and unclosed tags
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+static const char *words[] =
+  {
+  "the", "of", "and", "a", "to", "in", "is", "was", "it", "that", "for",
+  "on", "with", "as", "by", "this", "be", "at", "from", "or", "an",
+  "cat", "house", "river", "morning", "government", "information",
+  "development", "particularly", "understanding", "responsibility",
+  "walked", "considered", "established", "described", "completed",
+  "quickly", "beautiful", "necessary", "interesting", "everybody",
+  "whatever", "machine", "reading", "writer", "sentence", "paragraph",
+  "simple", "difficult", "readability", "estimate", "syllable",
+  "algorithm", "approximately", "communication", "organisation",
+  "the", "the", "and", "of", "a"
+  };
+#define NWORDS (sizeof (words) / sizeof (words[0]))
+
+static const char *unicode_words[] =
+  {
+  "café", "naïve", "résumé", "façade", "über", "smörgåsbord", "jalapeño",
+  "αλφάβητο", "λόγος", "ψυχή", "слово", "читать", "предложение",
+  "漢字", "読みやすさ", "文章", "가독성", "😀", "👍🏽", "🇬🇧",
+  "coöperate", "Ångström", "Øresund", "straße", "œuvre", "ﬁnance"
+  };
+#define NUNICODE (sizeof (unicode_words) / sizeof (unicode_words[0]))
+
+static const char *unicode_spaces[] =
+  {
+  " ", " ", " ", "\xC2\xA0", "\xE2\x80\x83", "\xE2\x80\x89",
+  "\xE2\x80\xAF"
+  };
+#define NSPACES (sizeof (unicode_spaces) / sizeof (unicode_spaces[0]))
+
+static const char *unicode_ends[] =
+  {
+  ".", "?", "!", "…", "。", ".\xE2\x80\x9D"
+  };
+#define NENDS (sizeof (unicode_ends) / sizeof (unicode_ends[0]))
+
+/*============================================================================
+  
+  Generator
+
+  The output is buffered, and cut off at exactly the size asked for
+
+  ==========================================================================*/
+typedef struct _Generator
+  {
+  uint64_t state;
+  uint64_t size;
+  uint64_t written;
+  } Generator;
+
+static uint64_t gen_random (Generator *g)
+  {
+  // xorshift64*
+  g->state ^= g->state >> 12;
+  g->state ^= g->state << 25;
+  g->state ^= g->state >> 27;
+  return g->state * 0x2545F4914F6CDD1DULL;
+  }
+
+static int gen_below (Generator *g, int n)
+  {
+  return (int)((gen_random (g) >> 33) % (uint64_t)n);
+  }
+
+static int gen_done (const Generator *g)
+  {
+  return g->written >= g->size;
+  }
+
+static void gen_write (Generator *g, const char *s, size_t length)
+  {
+  if (g->written + length > g->size) length = g->size - g->written;
+  fwrite (s, 1, length, stdout);
+  g->written += length;
+  }
+
+static void gen_puts (Generator *g, const char *s)
+  {
+  gen_write (g, s, strlen (s));
+  }
+
+/*============================================================================
+  
+  gen_sentence
+
+  ==========================================================================*/
+static void gen_sentence (Generator *g, int unicode)
+  {
+  int n = 3 + gen_below (g, 25);
+  for (int i = 0; i < n; i++)
+    {
+    if (i > 0)
+      gen_puts (g, unicode ? unicode_spaces[gen_below (g, NSPACES)] : " ");
+    if (unicode && gen_below (g, 3) > 0)
+      gen_puts (g, unicode_words[gen_below (g, NUNICODE)]);
+    else
+      {
+      const char *w = words[gen_below (g, NWORDS)];
+      if (i == 0)
+        {
+        char cap[64];
+        snprintf (cap, sizeof (cap), "%c%s", w[0] - 32, w + 1);
+        gen_puts (g, cap);
+        }
+      else
+        gen_puts (g, w);
+      }
+    if (i < n - 1 && gen_below (g, 12) == 0) gen_puts (g, ",");
+    }
+  if (unicode)
+    gen_puts (g, unicode_ends[gen_below (g, NENDS)]);
+  else
+    gen_puts (g, gen_below (g, 8) == 0 ? "?" : ".");
+  }
+
+/*============================================================================
+  
+  gen_plain
+
+  ==========================================================================*/
+static void gen_plain (Generator *g, int unicode)
+  {
+  while (!gen_done (g))
+    {
+    int n = 1 + gen_below (g, 8);
+    for (int i = 0; i < n && !gen_done (g); i++)
+      {
+      if (i > 0) gen_puts (g, " ");
+      gen_sentence (g, unicode);
+      }
+    gen_puts (g, "\n\n");
+    }
+  }
+
+/*============================================================================
+  
+  gen_html
+
+  ==========================================================================*/
+static void gen_html (Generator *g)
+  {
+  gen_puts (g, "<!DOCTYPE html>\n<html><head><title>Corpus</title>"
+    "<meta charset=\"utf-8\"></head>\n<body>\n");
+  while (!gen_done (g))
+    {
+    if (gen_below (g, 10) == 0)
+      {
+      gen_puts (g, "<h2 class=\"section\">");
+      gen_sentence (g, 0);
+      gen_puts (g, "</h2>\n");
+      }
+    gen_puts (g, "<p style=\"margin: 0 0 1em 0\">");
+    int n = 1 + gen_below (g, 6);
+    for (int i = 0; i < n && !gen_done (g); i++)
+      {
+      if (i > 0) gen_puts (g, " ");
+      switch (gen_below (g, 6))
+        {
+        case 0:
+          gen_puts (g, "<a href=\"https://example.com/page?id=1&amp;x=2\">");
+          gen_sentence (g, 0);
+          gen_puts (g, "</a>");
+          break;
+        case 1:
+          gen_puts (g, "<em>");
+          gen_sentence (g, 0);
+          gen_puts (g, "</em>");
+          break;
+        default:
+          gen_sentence (g, 0);
+        }
+      }
+    gen_puts (g, "</p>\n");
+    }
+  }
+
+/*============================================================================
+  
+  gen_pathological
+
+  ==========================================================================*/
+static void gen_pathological (Generator *g)
+  {
+  static const char *invalid[] =
+    {
+    "\xFF", "\xC0\xAF", "\xE2\x82", "\xF0\x9F\x98", "\xED\xA0\x80",
+    "\xF8\x88\x80\x80\x80", "\x80\x80", "\0"
+    };
+  while (!gen_done (g))
+    {
+    switch (gen_below (g, 6))
+      {
+      case 0:
+        {
+        // A word thousands of letters long
+        int n = 1000 + gen_below (g, 9000);
+        for (int i = 0; i < n && !gen_done (g); i++)
+          gen_write (g, &"aeioubcdfgxyz"[gen_below (g, 13)], 1);
+        gen_puts (g, " ");
+        break;
+        }
+      case 1:
+        {
+        // A sentence that never ends
+        int n = 500 + gen_below (g, 2000);
+        for (int i = 0; i < n && !gen_done (g); i++)
+          {
+          gen_puts (g, words[gen_below (g, NWORDS)]);
+          gen_puts (g, " ");
+          }
+        break;
+        }
+      case 2:
+        {
+        // Punctuation, and things that are nearly words
+        static const char punct[] = ".?!,;:-'\"()[]{}<>/\\|";
+        int n = 200 + gen_below (g, 800);
+        for (int i = 0; i < n && !gen_done (g); i++)
+          gen_write (g, &punct[gen_below (g, sizeof (punct) - 1)], 1);
+        gen_puts (g, " . ? .. ?? 1.2.3 ... ");
+        break;
+        }
+      case 3:
+        {
+        // Invalid and truncated UTF-8, and NULs
+        int n = 100 + gen_below (g, 400);
+        for (int i = 0; i < n && !gen_done (g); i++)
+          {
+          const char *s = invalid[gen_below (g, 8)];
+          gen_write (g, s, s[0] ? strlen (s) : 1);
+          if (gen_below (g, 4) == 0) gen_puts (g, "word");
+          }
+        gen_puts (g, " ");
+        break;
+        }
+      case 4:
+        // An unclosed tag, which swallows everything in HTML mode
+        gen_puts (g, "<h1 title=\"never closed ");
+        gen_sentence (g, 0);
+        gen_puts (g, " ");
+        break;
+      default:
+        // Whitespace and little else
+        for (int i = 0; i < 200 && !gen_done (g); i++)
+          gen_write (g, &" \t\n\r"[gen_below (g, 4)], 1);
+      }
+    }
+  }
+
+/*============================================================================
+  
+  parse_size
+
+  A number of bytes, with an optional K, M, or G suffix
+
+  ==========================================================================*/
+static uint64_t parse_size (const char *s)
+  {
+  char *end;
+  uint64_t n = strtoull (s, &end, 10);
+  switch (*end)
+    {
+    case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    }
+  return n;
+  }
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  const char *kind = "plain";
+  uint64_t size = 1 << 20;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt (argc, argv, "k:s:r:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'k': kind = optarg; break;
+      case 's': size = parse_size (optarg); break;
+      case 'r': seed = strtoull (optarg, NULL, 10); break;
+      default:
+        fprintf (stderr, "Usage: %s [-k plain|html|unicode|pathological] "
+          "[-s size[K|M|G]] [-r seed]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+
+  Generator g;
+  // The seed must not be zero, and nearby seeds should not give
+  //   nearby sequences
+  g.state = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+  g.size = size;
+  g.written = 0;
+
+  if (strcmp (kind, "plain") == 0)
+    gen_plain (&g, 0);
+  else if (strcmp (kind, "unicode") == 0)
+    gen_plain (&g, 1);
+  else if (strcmp (kind, "html") == 0)
+    gen_html (&g);
+  else if (strcmp (kind, "pathological") == 0)
+    gen_pathological (&g);
+  else
+    {
+    fprintf (stderr, "%s: unknown kind '%s'\n", argv[0], kind);
+    return 1;
+    }
+  return fflush (stdout) == 0 ? 0 : 1;
+  }
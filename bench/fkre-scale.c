@@ -0,0 +1,533 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre-scale.c
+
+  Measure how scoring scales with the number of threads, and with the
+  size of the documents. The text of each file named on the command
+  line -- normally a corpus made by fkre-corpus -- is scored in two
+  ways, on 1, 2, 4... threads, up to the number asked for:
+
+    batch -- split into files of about the same size, each a separate
+             document, found and scored by the directory walker, as
+             'fkre -r' does. Each piece size is a separate workload,
+             so that many small files can be compared with a few
+             large ones
+    lines -- as one large file, whose lines are scored on several
+             threads, as 'fkre --lines' does, and passed back in order
+
+  For each workload and number of threads, the best time of the runs
+  is reported as throughput, speedup and efficiency relative to one
+  thread, throughput per thread, and CPU time. For the batch path, the
+  imbalance is the most bytes scored by one thread, over the mean. A
+  speedup that falls away while CPU time rises points to contention
+  -- on a lock, a queue, or cache lines that threads share by
+  accident. Every run must count the same words, whatever the number
+  of threads, or the program fails.
+
+  The pieces are written once, to a directory for each corpus and
+  piece size, and reused on later runs.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_lines.h"
+#include "fkre_walk.h"
+
+#define SCALE_MAX_PIECES 16
+#define SCALE_MAX_RESULTS 4096
+#define SCALE_CACHE_LINE 64
+
+/*============================================================================
+  
+  ScaleThread
+
+  What one of the walker's threads has done. Each is on cache lines of
+  its own, so that the threads don't slow each other down by writing
+  to the same line
+
+  ==========================================================================*/
+typedef struct _ScaleThread
+  {
+  FKREContext *context;
+  int64_t bytes;
+  int64_t files;
+  } __attribute__ ((aligned (SCALE_CACHE_LINE))) ScaleThread;
+
+/*============================================================================
+  
+  ScaleRun
+
+  The state shared by the threads of one run. The totals are kept
+  under a lock, as fkre keeps its output
+
+  ==========================================================================*/
+typedef struct _ScaleRun
+  {
+  ScaleThread *threads;
+  pthread_mutex_t lock;
+  FKREMetrics total;
+  int64_t documents;
+  } ScaleRun;
+
+/*============================================================================
+  
+  Result
+
+  ==========================================================================*/
+typedef struct _Result
+  {
+  char workload[256];
+  const char *path;
+  size_t piece_bytes;
+  int64_t documents;
+  int64_t bytes;
+  int64_t words;
+  int threads;
+  double seconds;
+  double cpu_seconds;
+  // The most bytes scored by one thread over the mean, or 0 if not known
+  double imbalance;
+  // The time for one thread
+  double base_seconds;
+  } Result;
+
+/*============================================================================
+  
+  scale_now, scale_cpu
+
+  ==========================================================================*/
+static double scale_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+static double scale_cpu (void)
+  {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  }
+
+/*============================================================================
+  
+  parse_size
+
+  A number of bytes, with an optional K, M, or G suffix
+
+  ==========================================================================*/
+static size_t parse_size (const char *s)
+  {
+  char *end;
+  size_t n = strtoull (s, &end, 10);
+  switch (*end)
+    {
+    case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    }
+  return n;
+  }
+
+/*============================================================================
+  
+  scale_split
+
+  Write the file 'path' to the directory 'dir' in pieces of at least
+  'size' bytes, each ending at a line end, unless the directory
+  already exists. Returns the number of pieces, or -1 on error
+
+  ==========================================================================*/
+static int scale_split (const char *path, const char *dir, size_t size)
+  {
+  struct stat sb;
+  if (stat (dir, &sb) == 0)
+    {
+    // Already written
+    int n = 0;
+    char name[PATH_MAX + 32];
+    do
+      snprintf (name, sizeof (name), "%s/piece-%06d.txt", dir, n++);
+    while (access (name, F_OK) == 0);
+    return n - 1;
+    }
+
+  FILE *in = fopen (path, "r");
+  if (!in) return -1;
+  char *tmp;
+  if (asprintf (&tmp, "%s.tmp", dir) < 0) { fclose (in); return -1; }
+  if (mkdir (tmp, 0755) != 0 && errno != EEXIST)
+    {
+    free (tmp);
+    fclose (in);
+    return -1;
+    }
+
+  int n = 0;
+  int c = fgetc (in);
+  while (c != EOF)
+    {
+    char name[PATH_MAX + 32];
+    snprintf (name, sizeof (name), "%s/piece-%06d.txt", tmp, n++);
+    FILE *out = fopen (name, "w");
+    if (!out) { n = -1; break; }
+    size_t written = 0;
+    while (c != EOF)
+      {
+      fputc (c, out);
+      written++;
+      if (c == '\n' && written >= size) { c = fgetc (in); break; }
+      c = fgetc (in);
+      }
+    fclose (out);
+    }
+  fclose (in);
+  // Renamed only when complete, so that a run that is interrupted
+  //   doesn't leave a short set of pieces behind
+  if (n >= 0 && rename (tmp, dir) != 0) n = -1;
+  free (tmp);
+  return n;
+  }
+
+/*============================================================================
+  
+  scale_walk_callback
+
+  ==========================================================================*/
+static void scale_walk_callback (void *user_data, int thread,
+      const char *path, int dirfd, const char *name)
+  {
+  ScaleRun *run = user_data;
+  ScaleThread *t = &run->threads[thread];
+  int fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  struct stat sb;
+  int64_t size = fstat (fd, &sb) == 0 ? sb.st_size : 0;
+  fkre_context_reset (t->context);
+  BOOL ok = fkre_feed_fd (t->context, fd);
+  close (fd);
+  if (!ok) return;
+  fkre_context_finish (t->context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (t->context, &metrics);
+  t->bytes += size;
+  t->files++;
+  pthread_mutex_lock (&run->lock);
+  fkre_metrics_add (&run->total, &metrics);
+  run->documents++;
+  pthread_mutex_unlock (&run->lock);
+  }
+
+/*============================================================================
+  
+  scale_lines_callback
+
+  ==========================================================================*/
+static void scale_lines_callback (void *user_data, int64_t line,
+      const FKREMetrics *metrics)
+  {
+  ScaleRun *run = user_data;
+  fkre_metrics_add (&run->total, metrics);
+  run->documents++;
+  }
+
+/*============================================================================
+  
+  scale_run
+
+  Score a workload once on 'threads' threads, filling in the counts and
+  times of 'result'. Returns FALSE if the text can't be read
+
+  ==========================================================================*/
+static BOOL scale_run (const char *target, BOOL batch, unsigned flags,
+      int threads, Result *result)
+  {
+  ScaleRun run;
+  memset (&run, 0, sizeof (run));
+  run.total.size = sizeof (FKREMetrics);
+  pthread_mutex_init (&run.lock, NULL);
+  BOOL ok = TRUE;
+
+  double start = scale_now ();
+  double cpu = scale_cpu ();
+  if (batch)
+    {
+    if (posix_memalign ((void **)&run.threads, SCALE_CACHE_LINE,
+          threads * sizeof (ScaleThread)) != 0)
+      return FALSE;
+    memset (run.threads, 0, threads * sizeof (ScaleThread));
+    for (int i = 0; i < threads; i++)
+      run.threads[i].context = fkre_context_new (flags);
+    FKREWalk *walk = fkre_walk_new ();
+    char *roots[1] = { (char *)target };
+    ok = fkre_walk_run (walk, roots, 1, threads, scale_walk_callback,
+      &run) == 0;
+    fkre_walk_destroy (walk);
+    }
+  else
+    {
+    int fd = open (target, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd >= 0 && fstat (fd, &sb) == 0) result->bytes = sb.st_size;
+    ok = fd >= 0
+      && fkre_lines_score_fd (fd, flags, threads, scale_lines_callback,
+           &run);
+    if (fd >= 0) close (fd);
+    }
+  result->seconds = scale_now () - start;
+  result->cpu_seconds = scale_cpu () - cpu;
+
+  result->documents = run.documents;
+  result->words = run.total.words;
+  result->imbalance = 0;
+  if (batch)
+    {
+    int64_t most = 0;
+    for (int i = 0; i < threads; i++)
+      {
+      result->bytes += run.threads[i].bytes;
+      if (run.threads[i].bytes > most) most = run.threads[i].bytes;
+      fkre_context_destroy (run.threads[i].context);
+      }
+    if (result->bytes > 0)
+      result->imbalance = (double)most * threads / result->bytes;
+    free (run.threads);
+    }
+  pthread_mutex_destroy (&run.lock);
+  return ok;
+  }
+
+/*============================================================================
+  
+  scale_workload
+
+  Run one workload on each number of threads, 'repeat' times each,
+  keeping the best time. Returns the number of results
+
+  ==========================================================================*/
+static int scale_workload (const char *workload, const char *target,
+      BOOL batch, size_t piece_bytes, unsigned flags, int max_threads,
+      int repeat, Result *results)
+  {
+  int n = 0;
+  for (int threads = 1; ; threads *= 2)
+    {
+    if (threads > max_threads) threads = max_threads;
+    Result *best = &results[n];
+    memset (best, 0, sizeof (Result));
+    best->seconds = 1e300;
+    for (int r = 0; r < repeat; r++)
+      {
+      Result result;
+      memset (&result, 0, sizeof (Result));
+      if (!scale_run (target, batch, flags, threads, &result))
+        {
+        fprintf (stderr, "Can't score '%s': %s\n", target,
+          strerror (errno));
+        return n;
+        }
+      if (result.seconds < best->seconds) *best = result;
+      }
+    snprintf (best->workload, sizeof (best->workload), "%s", workload);
+    best->path = batch ? "batch" : "lines";
+    best->piece_bytes = piece_bytes;
+    best->threads = threads;
+    best->base_seconds = results[0].seconds;
+    if (best->words != results[0].words
+        || best->documents != results[0].documents)
+      {
+      fprintf (stderr, "%s, %s, %d threads: %lld words in %lld documents, "
+        "but %lld in %lld on one thread\n", workload, best->path, threads,
+        (long long)best->words, (long long)best->documents,
+        (long long)results[0].words, (long long)results[0].documents);
+      exit (1);
+      }
+    n++;
+    if (threads == max_threads) break;
+    }
+  return n;
+  }
+
+/*============================================================================
+  
+  scale_mb_per_s, scale_speedup
+
+  ==========================================================================*/
+static double scale_mb_per_s (const Result *r)
+  {
+  return r->seconds > 0 ? r->bytes / 1048576.0 / r->seconds : 0;
+  }
+
+static double scale_speedup (const Result *r)
+  {
+  return r->seconds > 0 ? r->base_seconds / r->seconds : 0;
+  }
+
+/*============================================================================
+  
+  scale_write_json
+
+  ==========================================================================*/
+static void scale_write_json (FILE *f, const Result *results, int nresults)
+  {
+  fprintf (f, "[\n");
+  for (int i = 0; i < nresults; i++)
+    {
+    const Result *r = &results[i];
+    double speedup = scale_speedup (r);
+    fprintf (f, "{\"workload\":\"%s\",\"path\":\"%s\",\"piece_bytes\":%zu,"
+      "\"documents\":%lld,\"bytes\":%lld,\"words\":%lld,\"threads\":%d,"
+      "\"seconds\":%.6f,\"cpu_seconds\":%.6f,\"mb_per_s\":%.3f,"
+      "\"speedup\":%.3f,\"efficiency\":%.3f,\"mb_per_s_per_thread\":%.3f",
+      r->workload, r->path, r->piece_bytes, (long long)r->documents,
+      (long long)r->bytes, (long long)r->words, r->threads, r->seconds,
+      r->cpu_seconds, scale_mb_per_s (r), speedup, speedup / r->threads,
+      scale_mb_per_s (r) / r->threads);
+    if (r->imbalance > 0)
+      fprintf (f, ",\"imbalance\":%.3f", r->imbalance);
+    else
+      fprintf (f, ",\"imbalance\":null");
+    fprintf (f, "}%s\n", i < nresults - 1 ? "," : "");
+    }
+  fprintf (f, "]\n");
+  }
+
+/*============================================================================
+  
+  scale_write_table
+
+  ==========================================================================*/
+static void scale_write_table (FILE *f, const Result *results, int nresults)
+  {
+  fprintf (f, "%-24s %-6s %10s %8s %10s %8s %8s %12s %8s %9s\n", "workload",
+    "path", "documents", "threads", "MB/s", "speedup", "effic.",
+    "MB/s/thread", "CPU (s)", "imbalance");
+  for (int i = 0; i < nresults; i++)
+    {
+    const Result *r = &results[i];
+    double speedup = scale_speedup (r);
+    fprintf (f, "%-24s %-6s %10lld %8d %10.2f %7.2fx %8.2f %12.2f %8.3f",
+      r->workload, r->path, (long long)r->documents, r->threads,
+      scale_mb_per_s (r), speedup, speedup / r->threads,
+      scale_mb_per_s (r) / r->threads, r->cpu_seconds);
+    if (r->imbalance > 0)
+      fprintf (f, " %9.2f\n", r->imbalance);
+    else
+      fprintf (f, " %9s\n", "-");
+    }
+  }
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int repeat = 1;
+  int max_threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+  const char *output = NULL;
+  const char *dir = "build/bench/scale";
+  size_t pieces[SCALE_MAX_PIECES];
+  int npieces = 0;
+  int opt;
+  while ((opt = getopt (argc, argv, "n:t:p:d:o:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'n': repeat = atoi (optarg); break;
+      case 't': max_threads = atoi (optarg); break;
+      case 'p':
+        if (npieces < SCALE_MAX_PIECES) pieces[npieces++] = parse_size (optarg);
+        break;
+      case 'd': dir = optarg; break;
+      case 'o': output = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-n repeat] [-t max_threads] "
+          "[-p piece_size...] [-d pieces_dir] [-o results.json] "
+          "{corpus files...}\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+  if (repeat < 1) repeat = 1;
+  if (max_threads < 1) max_threads = 1;
+  if (npieces == 0) pieces[npieces++] = 4096;
+  mkdir (dir, 0755);
+
+  Result *results = malloc (SCALE_MAX_RESULTS * sizeof (Result));
+  int nresults = 0;
+  // Enough for every number of threads, of every workload of one file
+  int per_file = (npieces + 1) * 32;
+  for (int i = optind; i < argc
+       && nresults + per_file <= SCALE_MAX_RESULTS; i++)
+    {
+    const char *path = argv[i];
+    char *copy = strdup (path);
+    char corpus[200];
+    snprintf (corpus, sizeof (corpus), "%s", basename (copy));
+    free (copy);
+    char *dot = strrchr (corpus, '.');
+    if (dot) *dot = 0;
+    unsigned flags = strstr (corpus, "html") ? FKRE_FLAG_HTML : 0;
+
+    for (int p = 0; p < npieces; p++)
+      {
+      char workload[256], target[PATH_MAX];
+      snprintf (workload, sizeof (workload), "%s/%zu", corpus, pieces[p]);
+      snprintf (target, sizeof (target), "%s/%s-%zu", dir, corpus,
+        pieces[p]);
+      if (scale_split (path, target, pieces[p]) < 0)
+        {
+        fprintf (stderr, "Can't split '%s' into '%s': %s\n", path, target,
+          strerror (errno));
+        continue;
+        }
+      nresults += scale_workload (workload, target, TRUE, pieces[p],
+        flags, max_threads, repeat, results + nresults);
+      }
+    nresults += scale_workload (corpus, path, FALSE, 0, flags,
+      max_threads, repeat, results + nresults);
+    }
+
+  scale_write_table (stdout, results, nresults);
+  int ret = 0;
+  if (output)
+    {
+    FILE *f = fopen (output, "w");
+    if (f)
+      {
+      scale_write_json (f, results, nresults);
+      fclose (f);
+      }
+    else
+      {
+      fprintf (stderr, "Can't write '%s': %s\n", output, strerror (errno));
+      ret = 1;
+      }
+    }
+  free (results);
+  return ret;
+  }
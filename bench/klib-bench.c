@@ -0,0 +1,380 @@
+/*============================================================================
+  
+  FKRE 
+  
+  klib-bench.c
+
+  Microbenchmarks for the klib classes that the rest of the program is
+  built on: KString, KList, KProps, KBuffer, and the conversions
+  between UTF-8 and UTF-32.
+
+  Each operation is run on a series of sizes, doubling each time, and
+  reported as the time per operation at each size. The "growth" column
+  is the exponent of the change in that time since the previous size:
+  about 0 for an operation that takes constant time, about 1 for one
+  whose time is proportional to the size, and so on -- so a change in
+  the complexity of an operation shows up as a change in that column,
+  whatever the speed of the machine. A series stops at the largest size
+  asked for, or when one run takes longer than the time limit, so that
+  quadratic operations do not run for hours.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+#include <klib/klib.h>
+
+/*============================================================================
+  
+  Bench
+
+  A benchmark runs 'n' operations of its kind, and returns the time
+  they took, in seconds. Any setup that it does not want timed, it
+  does outside the part it times
+
+  ==========================================================================*/
+typedef double (*BenchFn) (size_t n);
+
+typedef struct _Bench
+  {
+  const char *name;
+  // What one operation is
+  const char *unit;
+  BenchFn fn;
+  } Bench;
+
+static volatile size_t sink;
+
+static double bench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+static void bench_free_nothing (void *p)
+  {
+  }
+
+/*============================================================================
+  
+  bench_text
+
+  'n' characters of text, as UTF-8, about a third of which are outside
+  ASCII. The caller must free the result
+
+  ==========================================================================*/
+static UTF8 *bench_text (size_t n)
+  {
+  static const char *pieces[] = { "a", "b", " ", "é", "λ", "字", "c" };
+  UTF8 *s = malloc (n * 3 + 1);
+  UTF8 *p = s;
+  for (size_t i = 0; i < n; i++)
+    {
+    const char *piece = pieces[i % 7];
+    size_t l = strlen (piece);
+    memcpy (p, piece, l);
+    p += l;
+    }
+  *p = 0;
+  return s;
+  }
+
+/*============================================================================
+  
+  KString
+
+  ==========================================================================*/
+static double bench_kstring_append_char (size_t n)
+  {
+  KString *s = kstring_new_empty ();
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    kstring_append_char (s, 'a' + i % 26);
+  double t = bench_now () - start;
+  kstring_destroy (s);
+  return t;
+  }
+
+static double bench_kstring_append_utf8 (size_t n)
+  {
+  KString *s = kstring_new_empty ();
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    kstring_append_utf8 (s, (const UTF8 *)"word ");
+  double t = bench_now () - start;
+  kstring_destroy (s);
+  return t;
+  }
+
+static double bench_kstring_get (size_t n)
+  {
+  UTF8 *text = bench_text (n);
+  KString *s = kstring_new_from_utf8 (text);
+  free (text);
+  size_t total = 0;
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    total += kstring_get (s, i);
+  double t = bench_now () - start;
+  sink = total;
+  kstring_destroy (s);
+  return t;
+  }
+
+static double bench_kstring_find_utf32 (size_t n)
+  {
+  // The worst case for a naive search: a haystack of 'n' a's and a b,
+  //   and a needle of 31 a's and a b. An operation is a haystack
+  //   character
+  UTF32 *haystack = malloc ((n + 2) * sizeof (UTF32));
+  for (size_t i = 0; i < n; i++) haystack[i] = 'a';
+  haystack[n] = 'b';
+  haystack[n + 1] = 0;
+  UTF32 needle[33];
+  for (int i = 0; i < 31; i++) needle[i] = 'a';
+  needle[31] = 'b';
+  needle[32] = 0;
+  KString *s = kstring_new_from_utf32 (haystack);
+  free (haystack);
+  double start = bench_now ();
+  sink = kstring_find_utf32 (s, needle);
+  double t = bench_now () - start;
+  kstring_destroy (s);
+  return t;
+  }
+
+static double bench_kstring_delete (size_t n)
+  {
+  // Delete the first character of an 'n'-character string, until it is
+  //   empty
+  UTF8 *text = bench_text (n);
+  KString *s = kstring_new_from_utf8 (text);
+  free (text);
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    kstring_delete (s, 0, 1);
+  double t = bench_now () - start;
+  kstring_destroy (s);
+  return t;
+  }
+
+/*============================================================================
+  
+  UTF conversion
+
+  ==========================================================================*/
+static double bench_utf8_to_utf32 (size_t n)
+  {
+  UTF8 *text = bench_text (n);
+  double start = bench_now ();
+  KString *s = kstring_new_from_utf8 (text);
+  double t = bench_now () - start;
+  free (text);
+  kstring_destroy (s);
+  return t;
+  }
+
+static double bench_utf32_to_utf8 (size_t n)
+  {
+  UTF8 *text = bench_text (n);
+  KString *s = kstring_new_from_utf8 (text);
+  free (text);
+  double start = bench_now ();
+  UTF8 *utf8 = kstring_to_utf8 (s);
+  double t = bench_now () - start;
+  free (utf8);
+  kstring_destroy (s);
+  return t;
+  }
+
+/*============================================================================
+  
+  KList
+
+  ==========================================================================*/
+static double bench_klist_append (size_t n)
+  {
+  KList *list = klist_new_empty (bench_free_nothing);
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    klist_append (list, (void *)(i + 1));
+  double t = bench_now () - start;
+  klist_destroy (list);
+  return t;
+  }
+
+static double bench_klist_get (size_t n)
+  {
+  KList *list = klist_new_empty (bench_free_nothing);
+  for (size_t i = 0; i < n; i++)
+    klist_append (list, (void *)(i + 1));
+  size_t total = 0;
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    total += (size_t)klist_get (list, i);
+  double t = bench_now () - start;
+  sink = total;
+  klist_destroy (list);
+  return t;
+  }
+
+static double bench_klist_remove_ref (size_t n)
+  {
+  // Remove the items from the front, as a queue would
+  KList *list = klist_new_empty (bench_free_nothing);
+  for (size_t i = 0; i < n; i++)
+    klist_append (list, (void *)(i + 1));
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    klist_remove_ref (list, (void *)(i + 1));
+  double t = bench_now () - start;
+  klist_destroy (list);
+  return t;
+  }
+
+/*============================================================================
+  
+  KProps
+
+  ==========================================================================*/
+static KProps *bench_props (size_t n)
+  {
+  KProps *props = kprops_new_empty ();
+  KString *value = kstring_new_from_utf8 ((const UTF8 *)"value");
+  for (size_t i = 0; i < n; i++)
+    {
+    KString *name = kstring_new_empty ();
+    kstring_append_printf (name, "name.%zu", i);
+    kprops_add (props, name, value);
+    kstring_destroy (name);
+    }
+  kstring_destroy (value);
+  return props;
+  }
+
+static double bench_kprops_add (size_t n)
+  {
+  double start = bench_now ();
+  KProps *props = bench_props (n);
+  double t = bench_now () - start;
+  kprops_destroy (props);
+  return t;
+  }
+
+static double bench_kprops_get (size_t n)
+  {
+  KProps *props = bench_props (n);
+  char name[32];
+  size_t found = 0;
+  double start = bench_now ();
+  for (size_t i = 0; i < n; i++)
+    {
+    snprintf (name, sizeof (name), "name.%zu", i);
+    if (kprops_get_utf8 (props, (const UTF8 *)name)) found++;
+    }
+  double t = bench_now () - start;
+  sink = found;
+  kprops_destroy (props);
+  return t;
+  }
+
+/*============================================================================
+  
+  KBuffer
+
+  ==========================================================================*/
+static double bench_kbuffer_new (size_t n)
+  {
+  BYTE *data = malloc (n);
+  memset (data, 'x', n);
+  double start = bench_now ();
+  KBuffer *b = kbuffer_new_from_data (data, n);
+  sink = kbuffer_get_data (b)[n - 1];
+  double t = bench_now () - start;
+  kbuffer_destroy (b);
+  free (data);
+  return t;
+  }
+
+static const Bench benches[] =
+  {
+  { "kstring_append_char", "char", bench_kstring_append_char },
+  { "kstring_append_utf8", "call", bench_kstring_append_utf8 },
+  { "kstring_get", "char", bench_kstring_get },
+  { "kstring_find_utf32", "char", bench_kstring_find_utf32 },
+  { "kstring_delete", "call", bench_kstring_delete },
+  { "utf8_to_utf32", "char", bench_utf8_to_utf32 },
+  { "utf32_to_utf8", "char", bench_utf32_to_utf8 },
+  { "klist_append", "item", bench_klist_append },
+  { "klist_get", "item", bench_klist_get },
+  { "klist_remove_ref", "item", bench_klist_remove_ref },
+  { "kprops_add", "prop", bench_kprops_add },
+  { "kprops_get", "prop", bench_kprops_get },
+  { "kbuffer_new", "byte", bench_kbuffer_new },
+  };
+#define NBENCHES (sizeof (benches) / sizeof (benches[0]))
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  size_t min = 16;
+  size_t max = 1 << 20;
+  double limit = 1.0;
+  const char *only = NULL;
+  int opt;
+  while ((opt = getopt (argc, argv, "m:M:t:b:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'm': min = strtoul (optarg, NULL, 10); break;
+      case 'M': max = strtoul (optarg, NULL, 10); break;
+      case 't': limit = atof (optarg); break;
+      case 'b': only = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-m min_size] [-M max_size] "
+          "[-t seconds] [-b benchmark]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+  if (min < 1) min = 1;
+
+  printf ("%-20s %10s %14s %8s\n", "benchmark", "size", "ns/op", "growth");
+  for (int b = 0; b < NBENCHES; b++)
+    {
+    const Bench *bench = &benches[b];
+    if (only && !strstr (bench->name, only)) continue;
+    double last = 0;
+    for (size_t n = min; n <= max; n *= 2)
+      {
+      // Small sizes are repeated until they take long enough to time
+      double t = 0;
+      int runs = 0;
+      do
+        {
+        t += bench->fn (n);
+        runs++;
+        } while (t < 0.01 && runs < 1000);
+      double ns = t / runs * 1e9 / n;
+      printf ("%-20s %10zu %11.1f/%-4s", bench->name, n, ns, bench->unit);
+      if (last > 0 && ns > 0)
+        printf (" %6.2f", log2 (ns / last));
+      printf ("\n");
+      fflush (stdout);
+      last = ns;
+      if (t / runs > limit) break;
+      }
+    }
+  return 0;
+  }
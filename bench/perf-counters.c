@@ -0,0 +1,147 @@
+/*============================================================================
+  
+  FKRE 
+  
+  perf-counters.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "perf-counters.h"
+
+static int fds[PERF_COUNT] = { -1, -1, -1, -1, -1 };
+
+static const char *names[PERF_COUNT] =
+  {
+  "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+  };
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*============================================================================
+  
+  perf_counter_open
+
+  ==========================================================================*/
+static int perf_counter_open (uint32_t type, uint64_t config)
+  {
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+/*============================================================================
+  
+  perf_counters_open
+
+  ==========================================================================*/
+int perf_counters_open (void)
+  {
+  uint64_t l1d = PERF_COUNT_HW_CACHE_L1D
+    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  fds[PERF_CYCLES] = perf_counter_open (PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_CPU_CYCLES);
+  fds[PERF_INSTRUCTIONS] = perf_counter_open (PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_INSTRUCTIONS);
+  fds[PERF_BRANCH_MISSES] = perf_counter_open (PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_BRANCH_MISSES);
+  fds[PERF_L1D_MISSES] = perf_counter_open (PERF_TYPE_HW_CACHE, l1d);
+  fds[PERF_LLC_MISSES] = perf_counter_open (PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_CACHE_MISSES);
+  int n = 0;
+  for (int i = 0; i < PERF_COUNT; i++)
+    if (fds[i] >= 0) n++;
+  return n;
+  }
+
+#else
+
+int perf_counters_open (void)
+  {
+  return 0;
+  }
+
+#endif
+
+/*============================================================================
+  
+  perf_counters_close
+
+  ==========================================================================*/
+void perf_counters_close (void)
+  {
+  for (int i = 0; i < PERF_COUNT; i++)
+    {
+    if (fds[i] >= 0) close (fds[i]);
+    fds[i] = -1;
+    }
+  }
+
+/*============================================================================
+  
+  perf_counters_read
+
+  ==========================================================================*/
+void perf_counters_read (PerfValues *values)
+  {
+  for (int i = 0; i < PERF_COUNT; i++)
+    {
+    uint64_t v;
+    if (fds[i] >= 0 && read (fds[i], &v, sizeof (v)) == sizeof (v))
+      values->v[i] = (int64_t)v;
+    else
+      values->v[i] = -1;
+    }
+  }
+
+/*============================================================================
+  
+  perf_counters_add
+
+  ==========================================================================*/
+void perf_counters_add (PerfValues *total, const PerfValues *start,
+      const PerfValues *end)
+  {
+  for (int i = 0; i < PERF_COUNT; i++)
+    {
+    if (total->v[i] < 0 || start->v[i] < 0 || end->v[i] < 0)
+      total->v[i] = -1;
+    else
+      total->v[i] += end->v[i] - start->v[i];
+    }
+  }
+
+/*============================================================================
+  
+  perf_counters_zero
+
+  ==========================================================================*/
+void perf_counters_zero (PerfValues *values)
+  {
+  for (int i = 0; i < PERF_COUNT; i++)
+    values->v[i] = fds[i] >= 0 ? 0 : -1;
+  }
+
+/*============================================================================
+  
+  perf_counter_name
+
+  ==========================================================================*/
+const char *perf_counter_name (PerfCounter counter)
+  {
+  return names[counter];
+  }
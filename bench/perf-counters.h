@@ -0,0 +1,55 @@
+/*============================================================================
+  
+  FKRE 
+  
+  perf-counters.h
+
+  Hardware performance counters for the benchmarks, read with Linux's
+  perf_event_open(). Only this process's own user-space work is
+  counted, which most systems allow without privileges. Where the
+  counters can't be had at all -- in many containers and virtual
+  machines, and on other systems -- each is simply marked unavailable,
+  and the benchmarks report times alone.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+typedef enum
+  {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS = 1,
+  PERF_BRANCH_MISSES = 2,
+  PERF_L1D_MISSES = 3,
+  PERF_LLC_MISSES = 4,
+  PERF_COUNT = 5
+  } PerfCounter;
+
+/** Counter values, or -1 for a counter that isn't available. */
+typedef struct _PerfValues
+  {
+  int64_t v[PERF_COUNT];
+  } PerfValues;
+
+/** Open the counters. Returns the number that are available, which may
+    be none. */
+extern int         perf_counters_open (void);
+extern void        perf_counters_close (void);
+
+/** Read the current values of the counters, which run all the time. */
+extern void        perf_counters_read (PerfValues *values);
+
+/** Add the difference between 'end' and 'start' to 'total'. A counter
+    that isn't available stays -1 in 'total'. */
+extern void        perf_counters_add (PerfValues *total,
+                     const PerfValues *start, const PerfValues *end);
+
+/** Set all the values to zero, or -1 for those that aren't available. */
+extern void        perf_counters_zero (PerfValues *values);
+
+/** A short name for a counter, for tables and JSON. */
+extern const char *perf_counter_name (PerfCounter counter);
@@ -0,0 +1,366 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre-client.c
+
+  A simple client for the fkre scoring server. It sends each named file
+  as a document, and prints the server's reply. With --bench it sends 
+  the files repeatedly, and reports throughput and latency instead.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <errno.h> 
+#include <getopt.h> 
+#include <unistd.h> 
+#include <time.h> 
+#include <sys/socket.h> 
+#include <sys/un.h> 
+#include <klib/klib.h> 
+#include "fkre_server.h" 
+
+/*============================================================================
+  
+  Document
+
+  ==========================================================================*/
+typedef struct _Document
+  {
+  const char *filename;
+  BYTE *frame;
+  size_t frame_length;
+  } Document;
+
+/*============================================================================
+  
+  Reply reader -- buffers the server's output, and splits it into lines
+
+  ==========================================================================*/
+typedef struct _Reader
+  {
+  int fd;
+  char buffer[65536];
+  size_t start;
+  size_t length;
+  } Reader;
+
+/*============================================================================
+  
+  client_now
+
+  ==========================================================================*/
+static double client_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+/*============================================================================
+  
+  client_read_line
+
+  Returns a pointer to the next reply line (without its newline), or 
+  NULL if the server closed the connection.
+
+  ==========================================================================*/
+static const char *client_read_line (Reader *r)
+  {
+  for (;;)
+    {
+    char *nl = memchr (r->buffer + r->start, '\n', r->length - r->start);
+    if (nl)
+      {
+      const char *line = r->buffer + r->start;
+      *nl = 0;
+      r->start = nl - r->buffer + 1;
+      return line;
+      }
+    if (r->start > 0)
+      {
+      memmove (r->buffer, r->buffer + r->start, r->length - r->start);
+      r->length -= r->start;
+      r->start = 0;
+      }
+    if (r->length == sizeof (r->buffer))
+      {
+      fprintf (stderr, "Reply too long\n");
+      return NULL;
+      }
+    ssize_t n = read (r->fd, r->buffer + r->length, 
+      sizeof (r->buffer) - r->length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return NULL;
+    r->length += n;
+    }
+  }
+
+/*============================================================================
+  
+  client_send
+
+  ==========================================================================*/
+static BOOL client_send (int fd, const BYTE *data, size_t length)
+  {
+  while (length > 0)
+    {
+    ssize_t n = send (fd, data, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    data += n;
+    length -= n;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  client_load
+
+  Read a file, and build the frame that will be sent for it
+
+  ==========================================================================*/
+static BOOL client_load (Document *d, const char *filename, BOOL html)
+  {
+  FILE *f = fopen (filename, "r");
+  if (!f) return FALSE;
+  fseek (f, 0, SEEK_END);
+  long size = ftell (f);
+  fseek (f, 0, SEEK_SET);
+  if (size < 0 || size > FKRE_SERVER_LENGTH_MASK)
+    {
+    fclose (f);
+    errno = EFBIG;
+    return FALSE;
+    }
+  d->filename = filename;
+  d->frame_length = size + 4;
+  d->frame = malloc (d->frame_length);
+  uint32_t header = (uint32_t)size | (html ? FKRE_SERVER_HTML_FLAG : 0);
+  d->frame[0] = header >> 24;
+  d->frame[1] = header >> 16;
+  d->frame[2] = header >> 8;
+  d->frame[3] = header;
+  BOOL ret = fread (d->frame + 4, 1, size, f) == (size_t)size;
+  fclose (f);
+  return ret;
+  }
+
+/*============================================================================
+  
+  client_connect
+
+  ==========================================================================*/
+static int client_connect (const char *socket_path)
+  {
+  struct sockaddr_un addr;
+  if (strlen (socket_path) >= sizeof (addr.sun_path))
+    {
+    errno = ENAMETOOLONG;
+    return -1;
+    }
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_path);
+  if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    {
+    int e = errno;
+    close (fd);
+    errno = e;
+    return -1;
+    }
+  return fd;
+  }
+
+/*============================================================================
+  
+  client_compare_double
+
+  ==========================================================================*/
+static int client_compare_double (const void *a, const void *b)
+  {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+  }
+
+/*============================================================================
+  
+  client_bench
+
+  Send 'requests' documents, cycling through the files, keeping up to
+  'depth' requests in flight. Latency is measured from the start of 
+  sending a request to the arrival of its reply, so with depth > 1 it
+  includes time spent queued behind earlier requests.
+
+  ==========================================================================*/
+static int client_bench (int fd, const Document *docs, int ndocs, 
+     int requests, int depth)
+  {
+  Reader reader;
+  reader.fd = fd;
+  reader.start = 0;
+  reader.length = 0;
+
+  double *sent = malloc (requests * sizeof (double));
+  double *latency = malloc (requests * sizeof (double));
+  uint64_t bytes = 0;
+  int next = 0, done = 0;
+
+  double start = client_now ();
+  while (done < requests)
+    {
+    while (next < requests && next - done < depth)
+      {
+      const Document *d = &docs[next % ndocs];
+      sent[next] = client_now ();
+      if (!client_send (fd, d->frame, d->frame_length))
+        {
+        fprintf (stderr, "Can't send request: %s\n", strerror (errno));
+        return errno;
+        }
+      bytes += d->frame_length - 4;
+      next++;
+      }
+    const char *line = client_read_line (&reader);
+    if (!line)
+      {
+      fprintf (stderr, "Server closed the connection\n");
+      return EPIPE;
+      }
+    latency[done] = client_now () - sent[done];
+    done++;
+    }
+  double elapsed = client_now () - start;
+
+  qsort (latency, requests, sizeof (double), client_compare_double);
+  printf ("Requests: %d\n", requests);
+  printf ("Pipeline depth: %d\n", depth);
+  printf ("Bytes: %lu\n", (unsigned long)bytes);
+  printf ("Elapsed: %.3f s\n", elapsed);
+  printf ("Throughput: %.0f requests/s, %.2f MB/s\n", requests / elapsed,
+    bytes / elapsed / 1e6);
+  printf ("Latency (us): min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+    latency[0] * 1e6, latency[requests / 2] * 1e6, 
+    latency[(int)(requests * 0.9)] * 1e6, latency[(int)(requests * 0.99)] * 1e6,
+    latency[requests - 1] * 1e6);
+
+  free (sent);
+  free (latency);
+  return 0;
+  }
+
+/*============================================================================
+  
+  client_show_usage
+
+  ==========================================================================*/
+static void client_show_usage (const char *argv0, FILE *f)
+  {
+  fprintf (f, "Usage: %s [options] {socket} {filenames...}\n", argv0);
+  fprintf (f, "    -b, --bench=N      Send N requests and report timings\n");
+  fprintf (f, "    -p, --pipeline=N   Keep up to N requests in flight\n");
+  fprintf (f, "    -t, --html         Files are HTML\n");
+  }
+
+/*============================================================================
+  
+  main 
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  BOOL html = FALSE;
+  int bench = 0;
+  int depth = 1;
+
+  static struct option long_options[] =
+    {
+      {"help", no_argument, NULL, 'h'},
+      {"bench", required_argument, NULL, 'b'},
+      {"pipeline", required_argument, NULL, 'p'},
+      {"html", no_argument, NULL, 't'},
+      {0, 0, 0, 0}
+    };
+
+  int opt;
+  while ((opt = getopt_long (argc, argv, "hb:p:t", long_options, NULL)) != -1)
+    {
+    switch (opt)
+      {
+      case 'b': bench = atoi (optarg); break;
+      case 'p': depth = atoi (optarg); break;
+      case 't': html = TRUE; break;
+      case 'h': 
+        client_show_usage (argv[0], stdout);
+        return 0;
+      default:
+        client_show_usage (argv[0], stderr);
+        return EINVAL;
+      }
+    }
+
+  if (argc - optind < 2 || depth < 1 || bench < 0)
+    {
+    client_show_usage (argv[0], stderr);
+    return EINVAL;
+    }
+
+  int ndocs = argc - optind - 1;
+  Document *docs = malloc (ndocs * sizeof (Document));
+  for (int i = 0; i < ndocs; i++)
+    {
+    if (!client_load (&docs[i], argv[optind + 1 + i], html))
+      {
+      fprintf (stderr, "Can't read '%s': %s\n", argv[optind + 1 + i], 
+        strerror (errno));
+      return errno;
+      }
+    }
+
+  int fd = client_connect (argv[optind]);
+  if (fd < 0)
+    {
+    fprintf (stderr, "Can't connect to '%s': %s\n", argv[optind], 
+      strerror (errno));
+    return errno;
+    }
+
+  int ret = 0;
+  if (bench > 0)
+    ret = client_bench (fd, docs, ndocs, bench, depth);
+  else
+    {
+    Reader reader;
+    reader.fd = fd;
+    reader.start = 0;
+    reader.length = 0;
+    for (int i = 0; i < ndocs && ret == 0; i++)
+      {
+      const char *line = NULL;
+      if (client_send (fd, docs[i].frame, docs[i].frame_length))
+        line = client_read_line (&reader);
+      if (line)
+        printf ("%s\t%s\n", docs[i].filename, line);
+      else
+        {
+        fprintf (stderr, "No reply for '%s'\n", docs[i].filename);
+        ret = EPIPE;
+        }
+      }
+    }
+
+  close (fd);
+  for (int i = 0; i < ndocs; i++)
+    free (docs[i].frame);
+  free (docs);
+  return ret;
+  }
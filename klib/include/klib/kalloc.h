@@ -0,0 +1,135 @@
+/*============================================================================
+  
+  klib
+  
+  kalloc.h
+
+  The allocator that klib classes use for their own memory, which a
+  program can replace -- with a pool or an arena, say -- and whose use
+  it can count.
+
+  By default, kmalloc(), krealloc() and kfree() are malloc(), realloc()
+  and free(), and cost one test of a flag that is almost never set.
+  Memory that klib hands to the caller to free, such as the result of
+  kstring_to_utf8(), or that the caller hands to klib, such as the data
+  of kbuffer_new_from_data_no_copy(), is always allocated with malloc(),
+  whatever allocator is set.
+
+  Counting is per thread: each thread counts its own calls, the bytes
+  it has allocated, and the bytes it has allocated and not yet freed,
+  with the most there have been. The bytes currently allocated, and
+  the most there have been, are also kept for the whole process. These are only
+  exact if counting was turned on before any klib object was created,
+  and, with an allocator of the program's own, if the allocator can
+  say how large a block is.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+typedef struct _KAllocator
+  {
+  void  *(*malloc) (size_t size, void *user_data);
+  void  *(*realloc) (void *p, size_t size, void *user_data);
+  void   (*free) (void *p, void *user_data);
+  // The usable size of the block 'p', or NULL if the allocator can't
+  //   tell, in which case the bytes currently allocated aren't counted
+  size_t (*size) (void *p, void *user_data);
+  void *user_data;
+  } KAllocator;
+
+typedef struct _KAllocStats
+  {
+  // Calls to kmalloc(), krealloc(), and kfree() with a block to free
+  int64_t mallocs;
+  int64_t reallocs;
+  int64_t frees;
+  // The total of the sizes asked for
+  int64_t bytes;
+  // The bytes allocated now, and the most there have been
+  int64_t live;
+  int64_t peak;
+  // The bytes the thread has allocated and not freed, and the most 
+  //   there have been. A block freed by another thread counts against
+  //   that thread instead. kalloc_get_stats() gives the largest peak
+  //   of any thread, and no thread_live
+  int64_t thread_live;
+  int64_t thread_peak;
+  } KAllocStats;
+
+// Not zero if an allocator is set, or counting is on, in which case
+//   allocation takes the slower path
+extern int kalloc_hooked;
+
+BEGIN_DECLS
+
+/** Use 'allocator' for klib's memory, or the standard allocator if it is
+    NULL. The allocator is copied. This must be done before any klib
+    object is created, or after all have been destroyed, since a block
+    must be freed by the allocator that allocated it. */
+extern void  kalloc_set_allocator (const KAllocator *allocator);
+
+/** Turn counting on or off. */
+extern void  kalloc_set_counting (BOOL counting);
+
+/** Get the counts for the calling thread. 'live' and 'peak' are those
+    for the whole process; 'thread_live' and 'thread_peak' are the 
+    calling thread's. */
+extern void  kalloc_get_thread_stats (KAllocStats *stats);
+
+/** Get the counts for all the threads that have ever allocated while
+    counting was on, added together. */
+extern void  kalloc_get_stats (KAllocStats *stats);
+
+extern void *kalloc_hooked_malloc (size_t size);
+extern void *kalloc_hooked_realloc (void *p, size_t size);
+extern void  kalloc_hooked_free (void *p);
+
+END_DECLS
+
+static inline void *kmalloc (size_t size)
+  {
+  if (__builtin_expect (kalloc_hooked, 0))
+    return kalloc_hooked_malloc (size);
+  return malloc (size);
+  }
+
+static inline void *krealloc (void *p, size_t size)
+  {
+  if (__builtin_expect (kalloc_hooked, 0))
+    return kalloc_hooked_realloc (p, size);
+  return realloc (p, size);
+  }
+
+static inline void kfree (void *p)
+  {
+  if (__builtin_expect (kalloc_hooked, 0))
+    kalloc_hooked_free (p);
+  else
+    free (p);
+  }
+
+// strndup(), but allocated with kmalloc(), so to be freed with kfree()
+static inline char *kstrndup (const char *s, size_t n)
+  {
+  size_t l = strnlen (s, n);
+  char *p = kmalloc (l + 1);
+  if (p)
+    {
+    memcpy (p, s, l);
+    p[l] = 0;
+    }
+  return p;
+  }
+
+static inline char *kstrdup (const char *s)
+  {
+  return kstrndup (s, strlen (s));
+  }
@@ -0,0 +1,47 @@
+/*============================================================================
+  
+  klib
+  
+  kinflate.h
+
+  A DEFLATE (RFC 1951) decompressor. The compressed data must all be in
+  memory -- typically, it's part of a mapped file -- but the output is
+  passed to a callback as it is produced, a block at a time, so that
+  it never all has to be in memory at once.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+typedef enum
+  {
+  KINFLATE_OK = 0,
+  // The data ended before the last block did
+  KINFLATE_TRUNCATED = 1,
+  // The data is not valid DEFLATE
+  KINFLATE_CORRUPT = 2,
+  // The callback asked for decompression to stop
+  KINFLATE_STOPPED = 3
+  } KInflateError;
+
+/** Called with each block of output. Returns FALSE to stop. */
+typedef BOOL (*KInflateFn) (void *user_data, const BYTE *data,
+               size_t length);
+
+BEGIN_DECLS
+
+/** Decompress the raw DEFLATE stream in 'in', passing the output to
+    'fn'. If 'consumed' is not NULL, it is set to the number of bytes
+    of input the stream occupied, so that any data that follows it can
+    be found. */
+extern KInflateError kinflate (const BYTE *in, size_t length,
+                       size_t *consumed, KInflateFn fn, void *user_data);
+
+END_DECLS
+
@@ -14,6 +14,7 @@
 
 #include <klib/types.h>
 #include <klib/defs.h>
+#include <klib/kalloc.h>
 #include <klib/klog.h>
 #include <klib/kbuffer.h>
 #include <klib/kstring.h>
@@ -6,7 +6,9 @@
 
   Definition of the KList class
 
-  This class holds a linked list of references. Once added, the references
+  This class holds a list of references, in an array that grows as
+  needed. Appending, and getting an item by its index, take the same 
+  time however long the list is. Once added, the references
   "belong" to the list, and should not be called or modified except 
   by removing them from the list, or destroying the list. 
 
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <klib/defs.h> 
 #include <klib/types.h> 
 #include <klib/kbuffer.h> 
@@ -31,12 +32,22 @@ typedef enum
   ZE_OPENWRITE = 5,
   // Zip structure OK, but compressed data defective in some way
   ZE_CORRUPT = 6,
+  // The entry is larger than can be extracted to memory
+  ZE_TOOBIG = 7,
   ZE_INTERNAL = -1
   } ZipError;
 
+// The largest entry that kzipfile_extract_to_memory() will allocate
+//   memory for. The size comes from the archive, which may be lying
+#define KZIPFILE_MEMORY_MAX ((uint64_t)1 << 30)
+
 struct _ZipFile;
 typedef struct _ZipFile ZipFile;
 
+/** Called with each block of an entry's contents as it is extracted. 
+    Returns FALSE to stop. */
+typedef BOOL (*KZipFn) (void *user_data, const BYTE *data, size_t length);
+
 BEGIN_DECLS
 
 ZipFile *kzipfile_create (const char *filename);
@@ -54,6 +65,15 @@ int      kzipfile_extract_all (const ZipFile *self,
 ZipError kzipfile_extract_to_buffer (const ZipFile *self, int n, 
             KBuffer **buffer);
 const char *kzipfile_get_filename (const ZipFile *self);
+/** The index of the entry with the name 'name', or -1. */
+int      kzipfile_find_entry (const ZipFile *self, const char *name);
+/** Extract an entry, passing its contents to 'fn' as they are 
+    decompressed, so that the whole entry need never be in memory. 
+    The size and CRC are checked at the end, so 'fn' may see data from
+    a corrupt entry before ZE_CORRUPT is returned. Returns ZE_OPENWRITE
+    if 'fn' stops the extraction. */
+ZipError kzipfile_extract_to_function (const ZipFile *self, int n, 
+           KZipFn fn, void *user_data);
 
 END_DECLS
 
@@ -0,0 +1,239 @@
+/*============================================================================
+  
+  klib
+  
+  kalloc.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <klib/kalloc.h>
+
+/*============================================================================
+  
+  KAllocThread
+
+  The counts for one thread. These are linked together, so that they
+  can be added up, and are never freed, so that the counts of threads
+  that have finished are still included
+
+  ==========================================================================*/
+typedef struct _KAllocThread
+  {
+  struct _KAllocThread *next;
+  KAllocStats stats;
+  } KAllocThread;
+
+int kalloc_hooked = 0;
+
+static KAllocator allocator;
+static BOOL have_allocator = FALSE;
+static BOOL counting = FALSE;
+static int64_t live = 0;
+static int64_t peak = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static KAllocThread *threads = NULL;
+static __thread KAllocThread *this_thread = NULL;
+
+/*============================================================================
+  
+  kalloc_update_hooked
+
+  ==========================================================================*/
+static void kalloc_update_hooked (void)
+  {
+  __atomic_store_n (&kalloc_hooked, have_allocator || counting,
+    __ATOMIC_RELEASE);
+  }
+
+/*============================================================================
+  
+  kalloc_set_allocator
+
+  ==========================================================================*/
+void kalloc_set_allocator (const KAllocator *a)
+  {
+  if (a)
+    {
+    allocator = *a;
+    have_allocator = TRUE;
+    }
+  else
+    {
+    memset (&allocator, 0, sizeof (KAllocator));
+    have_allocator = FALSE;
+    }
+  kalloc_update_hooked ();
+  }
+
+/*============================================================================
+  
+  kalloc_set_counting
+
+  ==========================================================================*/
+void kalloc_set_counting (BOOL c)
+  {
+  counting = c;
+  kalloc_update_hooked ();
+  }
+
+/*============================================================================
+  
+  kalloc_thread
+
+  The calling thread's counts, created the first time they are needed
+
+  ==========================================================================*/
+static KAllocStats *kalloc_thread (void)
+  {
+  if (!this_thread)
+    {
+    // Allocated with malloc(), so as not to be counted
+    KAllocThread *t = malloc (sizeof (KAllocThread));
+    memset (t, 0, sizeof (KAllocThread));
+    pthread_mutex_lock (&threads_lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock (&threads_lock);
+    this_thread = t;
+    }
+  return &this_thread->stats;
+  }
+
+/*============================================================================
+  
+  kalloc_size
+
+  ==========================================================================*/
+static int64_t kalloc_size (void *p)
+  {
+  if (!p) return 0;
+  if (!have_allocator) return malloc_usable_size (p);
+  if (allocator.size) return allocator.size (p, allocator.user_data);
+  return 0;
+  }
+
+/*============================================================================
+  
+  kalloc_count
+
+  Add to the counts of the calling thread, and to the bytes allocated
+  in the whole process. The thread's counts are only written by this
+  thread, but may be read by any
+
+  ==========================================================================*/
+static void kalloc_count (int64_t *calls, int64_t bytes, int64_t change)
+  {
+  KAllocStats *s = kalloc_thread ();
+  if (calls) __atomic_fetch_add (calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&s->bytes, bytes, __ATOMIC_RELAXED);
+  if (change == 0) return;
+  int64_t mine = s->thread_live + change;
+  __atomic_store_n (&s->thread_live, mine, __ATOMIC_RELAXED);
+  if (mine > s->thread_peak)
+    __atomic_store_n (&s->thread_peak, mine, __ATOMIC_RELAXED);
+  int64_t now = __atomic_add_fetch (&live, change, __ATOMIC_RELAXED);
+  int64_t p = __atomic_load_n (&peak, __ATOMIC_RELAXED);
+  while (now > p && !__atomic_compare_exchange_n (&peak, &p, now, TRUE,
+           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  }
+
+/*============================================================================
+  
+  kalloc_hooked_malloc
+
+  ==========================================================================*/
+void *kalloc_hooked_malloc (size_t size)
+  {
+  void *p = have_allocator ?
+    allocator.malloc (size, allocator.user_data) : malloc (size);
+  if (counting && p)
+    kalloc_count (&kalloc_thread()->mallocs, size, kalloc_size (p));
+  return p;
+  }
+
+/*============================================================================
+  
+  kalloc_hooked_realloc
+
+  ==========================================================================*/
+void *kalloc_hooked_realloc (void *p, size_t size)
+  {
+  int64_t old = counting ? kalloc_size (p) : 0;
+  void *q = have_allocator ?
+    allocator.realloc (p, size, allocator.user_data) : realloc (p, size);
+  if (counting && q)
+    kalloc_count (p ? &kalloc_thread()->reallocs : &kalloc_thread()->mallocs,
+      size, kalloc_size (q) - old);
+  return q;
+  }
+
+/*============================================================================
+  
+  kalloc_hooked_free
+
+  ==========================================================================*/
+void kalloc_hooked_free (void *p)
+  {
+  if (!p) return;
+  if (counting)
+    kalloc_count (&kalloc_thread()->frees, 0, -kalloc_size (p));
+  if (have_allocator)
+    allocator.free (p, allocator.user_data);
+  else
+    free (p);
+  }
+
+/*============================================================================
+  
+  kalloc_get_thread_stats
+
+  ==========================================================================*/
+void kalloc_get_thread_stats (KAllocStats *stats)
+  {
+  memset (stats, 0, sizeof (KAllocStats));
+  if (this_thread)
+    {
+    stats->mallocs = this_thread->stats.mallocs;
+    stats->reallocs = this_thread->stats.reallocs;
+    stats->frees = this_thread->stats.frees;
+    stats->bytes = this_thread->stats.bytes;
+    stats->thread_live = this_thread->stats.thread_live;
+    stats->thread_peak = this_thread->stats.thread_peak;
+    }
+  stats->live = __atomic_load_n (&live, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n (&peak, __ATOMIC_RELAXED);
+  }
+
+/*============================================================================
+  
+  kalloc_get_stats
+
+  ==========================================================================*/
+void kalloc_get_stats (KAllocStats *stats)
+  {
+  memset (stats, 0, sizeof (KAllocStats));
+  pthread_mutex_lock (&threads_lock);
+  for (KAllocThread *t = threads; t; t = t->next)
+    {
+    stats->mallocs += __atomic_load_n (&t->stats.mallocs, __ATOMIC_RELAXED);
+    stats->reallocs += __atomic_load_n (&t->stats.reallocs,
+      __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n (&t->stats.frees, __ATOMIC_RELAXED);
+    stats->bytes += __atomic_load_n (&t->stats.bytes, __ATOMIC_RELAXED);
+    int64_t p = __atomic_load_n (&t->stats.thread_peak, __ATOMIC_RELAXED);
+    if (p > stats->thread_peak) stats->thread_peak = p;
+    }
+  pthread_mutex_unlock (&threads_lock);
+  stats->live = __atomic_load_n (&live, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n (&peak, __ATOMIC_RELAXED);
+  }
@@ -16,6 +16,7 @@
 #include <errno.h>
 #include <string.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 #include <klib/knvp.h>
 #include <klib/kbuffer.h>
 #include <klib/kstring.h>
@@ -42,7 +43,7 @@ struct _KBuffer
 KBuffer *kbuffer_new_empty (void)
   {
   KLOG_IN
-  KBuffer *self = malloc (sizeof (KBuffer));
+  KBuffer *self = kmalloc (sizeof (KBuffer));
   self->length = 0;
   self->data = NULL;
   KLOG_OUT
@@ -64,7 +65,7 @@ KBuffer *kbuffer_new_from_data (const BYTE *b, int64_t size)
   BYTE *data = malloc (size * sizeof (int64_t));
   if (data)
     {
-    self = malloc (sizeof (KBuffer));
+    self = kmalloc (sizeof (KBuffer));
     self->length = size;
     self->data = data;
     memcpy (data, b, size);
@@ -89,7 +90,7 @@ KBuffer *kbuffer_new_from_data (const BYTE *b, int64_t size)
 extern KBuffer *kbuffer_new_from_data_no_copy (BYTE *b, int64_t size)
   {
   KLOG_IN
-  KBuffer *self = malloc (sizeof (KBuffer));
+  KBuffer *self = kmalloc (sizeof (KBuffer));
   self->length = size;
   self->data = b;
   KLOG_OUT
@@ -107,7 +108,7 @@ void kbuffer_destroy (KBuffer *self)
   if (self)
     {
     if (self->data) free (self->data);
-    free (self);
+    kfree (self);
     }
   KLOG_OUT
   }
@@ -0,0 +1,514 @@
+/*============================================================================
+  
+  klib
+  
+  kinflate.c
+
+  Huffman codes are decoded with a table indexed by the next FAST_BITS
+  bits of input, which gives the symbol and code length directly for
+  all the short codes -- that is, for nearly every symbol in practice.
+  Longer codes are decoded a bit at a time, from the counts of codes
+  of each length, as in Mark Adler's 'puff'.
+
+  Output goes into a buffer that keeps the last 32kB already passed to
+  the callback, since a match can refer back that far.
+
+  fkre links zlib to read gzip input, but klib does not use it: klib
+  has no dependencies of its own, so that libfkre, which bundles klib,
+  has none either, and the EPUB reader works wherever klib builds.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <klib/klog.h>
+#include <klib/kalloc.h>
+#include <klib/kinflate.h>
+
+#define KLOG_CLASS "klib.kinflate"
+
+#define FAST_BITS 10
+#define MAX_BITS 15
+// The furthest back a match can refer
+#define WINDOW 32768
+// The longest match
+#define MAX_MATCH 258
+// The output buffer holds the window, and the output not yet passed
+//   to the callback
+#define OUT_SIZE (WINDOW + 262144)
+
+/*============================================================================
+  
+  Huffman
+
+  A fast-table entry holds the symbol in the low nine bits, and the
+  code length above them. Zero means the code is longer than FAST_BITS,
+  or not in use.
+
+  ==========================================================================*/
+typedef struct _Huffman
+  {
+  uint16_t fast[1 << FAST_BITS];
+  uint16_t count[MAX_BITS + 1];
+  uint16_t symbol[288];
+  } Huffman;
+
+/*============================================================================
+  
+  Inflater
+
+  ==========================================================================*/
+typedef struct _Inflater
+  {
+  const BYTE *in;
+  size_t length;
+  size_t pos;
+  // Bits are taken from the bottom of the buffer. Bits above 'nbits'
+  //   may be set, but only ever to the value of the next input byte
+  uint64_t bits;
+  int nbits;
+  BYTE *out;
+  size_t out_pos;
+  size_t flushed;
+  KInflateFn fn;
+  void *user_data;
+  Huffman lit;
+  Huffman dist;
+  } Inflater;
+
+static const uint16_t length_base[29] =
+  {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+  };
+
+static const BYTE length_extra[29] =
+  {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+  };
+
+static const uint16_t dist_base[30] =
+  {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+  };
+
+static const BYTE dist_extra[30] =
+  {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+  };
+
+// The order in which the lengths of the code-length code are sent
+static const BYTE codelen_order[19] =
+  {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+  };
+
+/*============================================================================
+  
+  kinflate_refill
+
+  Fill the bit buffer to at least 56 bits, or as far as the input
+  allows
+
+  ==========================================================================*/
+static inline void kinflate_refill (Inflater *z)
+  {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (z->pos + 8 <= z->length)
+    {
+    uint64_t v;
+    memcpy (&v, z->in + z->pos, 8);
+    z->bits |= v << z->nbits;
+    z->pos += (63 - z->nbits) >> 3;
+    z->nbits |= 56;
+    return;
+    }
+#endif
+  while (z->nbits <= 56 && z->pos < z->length)
+    {
+    z->bits |= (uint64_t)z->in[z->pos++] << z->nbits;
+    z->nbits += 8;
+    }
+  }
+
+/*============================================================================
+  
+  kinflate_bits
+
+  Take n (<= 32) bits from the input
+
+  ==========================================================================*/
+static inline KInflateError kinflate_bits (Inflater *z, int n,
+      unsigned *value)
+  {
+  if (z->nbits < n)
+    {
+    kinflate_refill (z);
+    if (z->nbits < n) return KINFLATE_TRUNCATED;
+    }
+  *value = (unsigned)(z->bits & ((1ULL << n) - 1));
+  z->bits >>= n;
+  z->nbits -= n;
+  return KINFLATE_OK;
+  }
+
+/*============================================================================
+  
+  kinflate_build
+
+  Build the decoding tables for a code, given the length of the code
+  for each symbol. Returns FALSE if the lengths are over-subscribed, and
+  so don't describe a code. Incomplete codes are allowed, and any
+  attempt to decode a missing code is reported as corrupt.
+
+  ==========================================================================*/
+static BOOL kinflate_build (Huffman *h, const BYTE *lengths, int n)
+  {
+  memset (h->count, 0, sizeof (h->count));
+  for (int s = 0; s < n; s++) h->count[lengths[s]]++;
+  h->count[0] = 0;
+
+  int left = 1;
+  for (int len = 1; len <= MAX_BITS; len++)
+    {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) return FALSE;
+    }
+
+  uint16_t offs[MAX_BITS + 1];
+  offs[1] = 0;
+  for (int len = 1; len < MAX_BITS; len++)
+    offs[len + 1] = offs[len] + h->count[len];
+  for (int s = 0; s < n; s++)
+    if (lengths[s]) h->symbol[offs[lengths[s]]++] = s;
+
+  // Codes are assigned in order of length, and then of symbol; they
+  //   are sent most-significant bit first, so the table is indexed
+  //   by the code reversed
+  memset (h->fast, 0, sizeof (h->fast));
+  unsigned code = 0;
+  int index = 0;
+  for (int len = 1; len <= FAST_BITS; len++)
+    {
+    for (int i = 0; i < h->count[len]; i++)
+      {
+      unsigned rev = 0;
+      for (int b = 0; b < len; b++)
+        rev |= ((code >> b) & 1) << (len - 1 - b);
+      uint16_t entry = h->symbol[index++] | (len << 9);
+      for (unsigned r = rev; r < (1 << FAST_BITS); r += (1 << len))
+        h->fast[r] = entry;
+      code++;
+      }
+    code <<= 1;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  kinflate_decode
+
+  ==========================================================================*/
+static inline KInflateError kinflate_decode (Inflater *z,
+      const Huffman *h, unsigned *symbol)
+  {
+  if (z->nbits < MAX_BITS) kinflate_refill (z);
+  uint16_t entry = h->fast[z->bits & ((1 << FAST_BITS) - 1)];
+  if (entry)
+    {
+    int len = entry >> 9;
+    if (len > z->nbits) return KINFLATE_TRUNCATED;
+    z->bits >>= len;
+    z->nbits -= len;
+    *symbol = entry & 0x1FF;
+    return KINFLATE_OK;
+    }
+
+  int code = 0, first = 0, index = 0;
+  for (int len = 1; len <= MAX_BITS; len++)
+    {
+    if (len > z->nbits) return KINFLATE_TRUNCATED;
+    code |= (z->bits >> (len - 1)) & 1;
+    int count = h->count[len];
+    if (code - count < first)
+      {
+      z->bits >>= len;
+      z->nbits -= len;
+      *symbol = h->symbol[index + (code - first)];
+      return KINFLATE_OK;
+      }
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+    }
+  return KINFLATE_CORRUPT;
+  }
+
+/*============================================================================
+  
+  kinflate_flush
+
+  ==========================================================================*/
+static KInflateError kinflate_flush (Inflater *z)
+  {
+  if (z->out_pos > z->flushed)
+    {
+    if (!z->fn (z->user_data, z->out + z->flushed,
+         z->out_pos - z->flushed))
+      return KINFLATE_STOPPED;
+    z->flushed = z->out_pos;
+    }
+  return KINFLATE_OK;
+  }
+
+/*============================================================================
+  
+  kinflate_room
+
+  Make sure there is room in the output buffer for 'n' bytes, by
+  passing the output to the callback, and keeping only the window
+
+  ==========================================================================*/
+static inline KInflateError kinflate_room (Inflater *z, size_t n)
+  {
+  if (z->out_pos + n <= OUT_SIZE) return KINFLATE_OK;
+  KInflateError ret = kinflate_flush (z);
+  if (ret == KINFLATE_OK)
+    {
+    memmove (z->out, z->out + z->out_pos - WINDOW, WINDOW);
+    z->out_pos = z->flushed = WINDOW;
+    }
+  return ret;
+  }
+
+/*============================================================================
+  
+  kinflate_stored
+
+  ==========================================================================*/
+static KInflateError kinflate_stored (Inflater *z)
+  {
+  // Skip to a byte boundary, and return the whole bytes in the bit
+  //   buffer to the input
+  z->pos -= z->nbits / 8;
+  z->bits = 0;
+  z->nbits = 0;
+  if (z->pos + 4 > z->length) return KINFLATE_TRUNCATED;
+  const BYTE *p = z->in + z->pos;
+  size_t len = p[0] | (p[1] << 8);
+  size_t nlen = p[2] | (p[3] << 8);
+  if (len != (~nlen & 0xFFFF)) return KINFLATE_CORRUPT;
+  z->pos += 4;
+  if (z->pos + len > z->length) return KINFLATE_TRUNCATED;
+  while (len > 0)
+    {
+    KInflateError ret = kinflate_room (z, 1);
+    if (ret != KINFLATE_OK) return ret;
+    size_t n = OUT_SIZE - z->out_pos;
+    if (n > len) n = len;
+    memcpy (z->out + z->out_pos, z->in + z->pos, n);
+    z->out_pos += n;
+    z->pos += n;
+    len -= n;
+    }
+  return KINFLATE_OK;
+  }
+
+/*============================================================================
+  
+  kinflate_dynamic
+
+  Read the code lengths of a block with dynamic codes, and build the
+  tables
+
+  ==========================================================================*/
+static KInflateError kinflate_dynamic (Inflater *z)
+  {
+  KInflateError ret;
+  unsigned hlit, hdist, hclen;
+  if ((ret = kinflate_bits (z, 5, &hlit))) return ret;
+  if ((ret = kinflate_bits (z, 5, &hdist))) return ret;
+  if ((ret = kinflate_bits (z, 4, &hclen))) return ret;
+  hlit += 257;
+  hdist += 1;
+  hclen += 4;
+  if (hlit > 286 || hdist > 30) return KINFLATE_CORRUPT;
+
+  BYTE lengths[286 + 30];
+  memset (lengths, 0, 19);
+  for (unsigned i = 0; i < hclen; i++)
+    {
+    unsigned v;
+    if ((ret = kinflate_bits (z, 3, &v))) return ret;
+    lengths[codelen_order[i]] = v;
+    }
+  // The code-length code is only used here, so borrow the distance
+  //   tables for it
+  if (!kinflate_build (&z->dist, lengths, 19)) return KINFLATE_CORRUPT;
+
+  unsigned n = 0;
+  while (n < hlit + hdist)
+    {
+    unsigned symbol, repeat, value = 0;
+    if ((ret = kinflate_decode (z, &z->dist, &symbol))) return ret;
+    if (symbol < 16)
+      {
+      lengths[n++] = symbol;
+      continue;
+      }
+    if (symbol == 16)
+      {
+      if (n == 0) return KINFLATE_CORRUPT;
+      value = lengths[n - 1];
+      if ((ret = kinflate_bits (z, 2, &repeat))) return ret;
+      repeat += 3;
+      }
+    else if (symbol == 17)
+      {
+      if ((ret = kinflate_bits (z, 3, &repeat))) return ret;
+      repeat += 3;
+      }
+    else
+      {
+      if ((ret = kinflate_bits (z, 7, &repeat))) return ret;
+      repeat += 11;
+      }
+    if (n + repeat > hlit + hdist) return KINFLATE_CORRUPT;
+    memset (lengths + n, value, repeat);
+    n += repeat;
+    }
+
+  // Without an end-of-block code, the block could never end
+  if (lengths[256] == 0) return KINFLATE_CORRUPT;
+  if (!kinflate_build (&z->lit, lengths, hlit)) return KINFLATE_CORRUPT;
+  if (!kinflate_build (&z->dist, lengths + hlit, hdist))
+    return KINFLATE_CORRUPT;
+  return KINFLATE_OK;
+  }
+
+/*============================================================================
+  
+  kinflate_fixed
+
+  ==========================================================================*/
+static void kinflate_fixed (Inflater *z)
+  {
+  BYTE lengths[288];
+  memset (lengths, 8, 144);
+  memset (lengths + 144, 9, 112);
+  memset (lengths + 256, 7, 24);
+  memset (lengths + 280, 8, 8);
+  kinflate_build (&z->lit, lengths, 288);
+  memset (lengths, 5, 30);
+  kinflate_build (&z->dist, lengths, 30);
+  }
+
+/*============================================================================
+  
+  kinflate_codes
+
+  Decode the body of a compressed block
+
+  ==========================================================================*/
+static KInflateError kinflate_codes (Inflater *z)
+  {
+  KInflateError ret;
+  for (;;)
+    {
+    if ((ret = kinflate_room (z, MAX_MATCH))) return ret;
+    unsigned symbol;
+    if ((ret = kinflate_decode (z, &z->lit, &symbol))) return ret;
+    if (symbol < 256)
+      {
+      z->out[z->out_pos++] = symbol;
+      continue;
+      }
+    if (symbol == 256) return KINFLATE_OK;
+
+    symbol -= 257;
+    if (symbol >= 29) return KINFLATE_CORRUPT;
+    unsigned len, extra;
+    if ((ret = kinflate_bits (z, length_extra[symbol], &extra))) return ret;
+    len = length_base[symbol] + extra;
+
+    if ((ret = kinflate_decode (z, &z->dist, &symbol))) return ret;
+    if (symbol >= 30) return KINFLATE_CORRUPT;
+    unsigned dist;
+    if ((ret = kinflate_bits (z, dist_extra[symbol], &extra))) return ret;
+    dist = dist_base[symbol] + extra;
+    if (dist > z->out_pos) return KINFLATE_CORRUPT;
+
+    BYTE *d = z->out + z->out_pos;
+    const BYTE *s = d - dist;
+    if (dist >= len)
+      memcpy (d, s, len);
+    else
+      for (unsigned i = 0; i < len; i++) d[i] = s[i];
+    z->out_pos += len;
+    }
+  }
+
+/*============================================================================
+  
+  kinflate
+
+  ==========================================================================*/
+KInflateError kinflate (const BYTE *in, size_t length, size_t *consumed,
+      KInflateFn fn, void *user_data)
+  {
+  KLOG_IN
+  Inflater *z = kmalloc (sizeof (Inflater));
+  memset (z, 0, sizeof (Inflater));
+  z->in = in;
+  z->length = length;
+  z->fn = fn;
+  z->user_data = user_data;
+  z->out = kmalloc (OUT_SIZE);
+
+  KInflateError ret;
+  unsigned final;
+  do
+    {
+    unsigned type;
+    if ((ret = kinflate_bits (z, 1, &final))) break;
+    if ((ret = kinflate_bits (z, 2, &type))) break;
+    switch (type)
+      {
+      case 0:
+        ret = kinflate_stored (z);
+        break;
+      case 1:
+        kinflate_fixed (z);
+        ret = kinflate_codes (z);
+        break;
+      case 2:
+        ret = kinflate_dynamic (z);
+        if (ret == KINFLATE_OK) ret = kinflate_codes (z);
+        break;
+      default:
+        ret = KINFLATE_CORRUPT;
+      }
+    } while (ret == KINFLATE_OK && !final);
+
+  if (ret == KINFLATE_OK) ret = kinflate_flush (z);
+  if (consumed) *consumed = z->pos - z->nbits / 8;
+
+  kfree (z->out);
+  kfree (z);
+  KLOG_OUT
+  return ret;
+  }
+
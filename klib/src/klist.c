@@ -14,32 +14,28 @@
 #include <stdio.h>
 #include <assert.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 #include <klib/klist.h>
 
 #define KLOG_CLASS "klib.klist"
 
-/*============================================================================
-  
-  ListItem
-
-  ==========================================================================*/
-typedef struct _ListItem
-  {
-  struct _ListItem *next;
-  void *data;
-  } ListItem;
-
-
 /*============================================================================
   
   KList
 
+  The references are held in an array that doubles in size when it 
+  fills, so appending is cheap on average, and getting an item by 
+  its index costs the same wherever it is. 
+
   ==========================================================================*/
+#define KLIST_INITIAL_CAPACITY 8
+
 struct _KList
   {
   KListFreeFn free_fn;
-  ListItem *head;
+  void **items;
   size_t length;
+  size_t capacity;
   };
 
 
@@ -51,10 +47,11 @@ struct _KList
 extern KList *klist_new_empty (KListFreeFn free_fn)
   {
   KLOG_IN
-  KList *self = malloc (sizeof (KList));
+  KList *self = kmalloc (sizeof (KList));
   self->free_fn = free_fn;
   self->length = 0;
-  self->head = NULL;
+  self->capacity = 0;
+  self->items = NULL;
   KLOG_OUT
   return self;
   }
@@ -70,7 +67,8 @@ void klist_destroy (KList *self)
   if (self)
     {
     klist_clear (self);
-    free (self);
+    kfree (self->items);
+    kfree (self);
     }
   KLOG_OUT
   }
@@ -86,22 +84,13 @@ void klist_append (KList *self, void *ref)
   assert (self != NULL);
   assert (ref != NULL);
 
-  ListItem *i = malloc (sizeof (ListItem));
-  i->data = ref;
-  i->next = NULL;
-
-  if (self->head)
-    {
-    ListItem *l = self->head;
-    while (l->next)
-      l = l->next;
-    l->next = i;
-    }
-  else
+  if (self->length == self->capacity)
     {
-    self->head = i;
+    self->capacity = self->capacity ? self->capacity * 2 
+      : KLIST_INITIAL_CAPACITY;
+    self->items = krealloc (self->items, self->capacity * sizeof (void *));
     }
-
+  self->items[self->length] = ref;
   self->length++;
   KLOG_OUT
   }
@@ -116,14 +105,8 @@ void klist_clear (KList *self)
   KLOG_IN
   assert (self != NULL);
 
-  ListItem *l = self->head;
-  while (l)
-    {
-    self->free_fn (l->data);
-    ListItem *temp = l;
-    l = l->next;
-    free (temp);
-    }
+  for (size_t i = 0; i < self->length; i++)
+    self->free_fn (self->items[i]);
   
   self->length = 0;
   KLOG_OUT
@@ -140,15 +123,8 @@ void *klist_get (const KList *self, size_t index)
   assert (self != 0);
   assert (index >= 0);
   assert (index < self->length);
-  ListItem *l = self->head;
-  int i = 0;
-  while (l != NULL && i != index)
-    {
-    l = l->next;
-    i++;
-    }
   KLOG_OUT
-  return l->data;
+  return self->items[index];
   }
 
 /*============================================================================
@@ -175,32 +151,16 @@ void klist_remove (KList *self, const void *item, ListCompareFn fn)
   assert (self != NULL);
   assert (item != NULL);
   assert (fn != NULL);
-  ListItem *l = self->head;
-  ListItem *last_good = NULL;
-  while (l != NULL)
+  size_t kept = 0;
+  for (size_t i = 0; i < self->length; i++)
     {
-    if (fn (l->data, item, NULL) == 0)
-      {
-      if (l == self->head)
-        {
-        self->head = l->next; // l-> next might be null
-        }
-      else
-        {
-        if (last_good) last_good->next = l->next;
-        }
-      self->free_fn (l->data);
-      ListItem *temp = l->next;
-      free (l);
-      self->length--;
-      l = temp;
-      }
+    void *data = self->items[i];
+    if (fn (data, item, NULL) == 0)
+      self->free_fn (data);
     else
-      {
-      last_good = l;
-      l = l->next;
-      }
+      self->items[kept++] = data;
     }
+  self->length = kept;
   KLOG_OUT                        
   }
 
@@ -213,32 +173,16 @@ void klist_remove_ref (KList *self, const void *ref)
   {
   KLOG_IN
   assert (self != NULL);
-  ListItem *l = self->head;
-  ListItem *last_good = NULL;
-  while (l != NULL)
+  size_t kept = 0;
+  for (size_t i = 0; i < self->length; i++)
     {
-    if (l->data == ref)
-      {
-      if (l == self->head)
-        {
-        self->head = l->next; // l-> next might be null
-        }
-      else
-        {
-        if (last_good) last_good->next = l->next;
-        }
-      self->free_fn (l->data);
-      ListItem *temp = l->next;
-      self->length--;
-      free (l);
-      l = temp;
-      }
+    void *data = self->items[i];
+    if (data == ref)
+      self->free_fn (data);
     else
-      {
-      last_good = l;
-      l = l->next;
-      }
+      self->items[kept++] = data;
     }
+  self->length = kept;
   KLOG_OUT;
   }
 
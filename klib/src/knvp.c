@@ -13,6 +13,7 @@
 #include <klib/knvp.h>
 #include <klib/kstring.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 
 #define KLOG_CLASS "klib.knvp"
 
@@ -35,7 +36,7 @@ struct _KNVP
 KNVP *knvp_new (const KString *name, const KString *value)
   {
   KLOG_IN
-  KNVP *self = malloc (sizeof (KNVP));
+  KNVP *self = kmalloc (sizeof (KNVP));
   self->name = kstring_strdup (name);
   self->value = kstring_strdup (value);
   KLOG_OUT
@@ -50,7 +51,7 @@ KNVP *knvp_new (const KString *name, const KString *value)
 KNVP *knvp_new_from_utf8 (const UTF8 *name, const UTF8 *value)
   {
   KLOG_IN
-  KNVP *self = malloc (sizeof (KNVP));
+  KNVP *self = kmalloc (sizeof (KNVP));
   self->name = kstring_new_from_utf8 (name);
   self->value = kstring_new_from_utf8 (value);
   KLOG_OUT
@@ -69,7 +70,7 @@ void knvp_destroy (KNVP *self)
     {
     kstring_destroy (self->name);
     kstring_destroy (self->value);
-    free (self);
+    kfree (self);
     }
   KLOG_OUT
   }
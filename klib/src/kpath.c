@@ -23,6 +23,7 @@
 #include <klib/kstring.h>
 #include <klib/kpath.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 #include <klib/kbuffer.h>
 
 #define KLOG_CLASS "klib.kpath"
@@ -272,7 +273,7 @@ KBuffer *kpath_read_to_buffer (const KPath *self)
   int64_t size;
   if (kpath_size (self, &size))
     {
-    BYTE *b = malloc (size + sizeof (uint32_t));
+    BYTE *b = kmalloc (size + sizeof (uint32_t));
     if (b)
       {
       int fd = kpath_open_read (self);
@@ -282,7 +283,7 @@ KBuffer *kpath_read_to_buffer (const KPath *self)
         if (n == size)
           {
           ret = kbuffer_new_from_data (b, size);
-          free (b);  
+          kfree (b);  
           }
         else
           {
@@ -16,6 +16,7 @@
 #include <errno.h>
 #include <string.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 #include <klib/klist.h>
 #include <klib/kprops.h>
 #include <klib/knvp.h>
@@ -43,7 +44,7 @@ struct _KProps
 KProps *kprops_new_empty (void)
   {
   KLOG_IN
-  KProps *self = malloc (sizeof (KProps));
+  KProps *self = kmalloc (sizeof (KProps));
   self->list = klist_new_empty ((KListFreeFn)knvp_destroy);
   KLOG_OUT
   return self;
@@ -61,7 +62,7 @@ void kprops_destroy (KProps *self)
     {
     assert (self->list != NULL);
     klist_destroy (self->list);
-    free (self);
+    kfree (self);
     }
   KLOG_OUT
   }
@@ -18,6 +18,7 @@
 #include "convertutf.h" 
 #include <klib/kstring.h>
 #include <klib/klog.h>
+#include <klib/kalloc.h>
 
 #define KLOG_CLASS "klib.kstring"
 
@@ -37,14 +38,27 @@ struct _KString
   
   KString *kstring_new_empty
 
+  Returns NULL if memory is exhausted
+
   ==========================================================================*/
 KString *kstring_new_empty (void)
   {
   KLOG_IN
-  KString *self = malloc (sizeof (KString));
-  self->str = malloc(1);
-  self->str[0] = 0;
-  self->length = 0;
+  KString *self = kmalloc (sizeof (KString));
+  if (self)
+    {
+    self->str = kmalloc (sizeof (UTF32));
+    if (self->str)
+      {
+      self->str[0] = 0;
+      self->length = 0;
+      }
+    else
+      {
+      kfree (self);
+      self = NULL;
+      }
+    }
   KLOG_OUT
   return self;
   }
@@ -59,11 +73,11 @@ KString *kstring_new_from_utf8 (const UTF8 *_in)
   {
   KLOG_IN
   assert (_in != NULL);
-  KString *self = malloc (sizeof (KString));
+  KString *self = kmalloc (sizeof (KString));
 
   const UTF8* in = (UTF8 *)_in;
   int max_out = strlen ((char *)_in); // This is an absolute maximum
-  UTF32 *out = malloc ((max_out + 1) * sizeof (UTF32));
+  UTF32 *out = kmalloc ((max_out + 1) * sizeof (UTF32));
   memset (out, 0, max_out * sizeof (UTF32));
   UTF32 *out_temp = out;
 
@@ -88,9 +102,9 @@ KString *kstring_new_from_utf32 (const UTF32 *s)
   {
   KLOG_IN
   assert (s != NULL);
-  KString *self = malloc (sizeof (KString));
+  KString *self = kmalloc (sizeof (KString));
   self->length = kstring_length_utf32 (s);
-  self->str = malloc ((self->length + 1) * sizeof (UTF32));
+  self->str = kmalloc ((self->length + 1) * sizeof (UTF32));
   memcpy (self->str, s, (self->length + 1) * sizeof (UTF32));
   KLOG_OUT
   return self;
@@ -106,8 +120,8 @@ void kstring_destroy (KString *self)
   KLOG_IN
   if (self)
     {
-    if (self->str) free (self->str);
-    free (self);
+    if (self->str) kfree (self->str);
+    kfree (self);
     }
   KLOG_OUT
   }
@@ -123,7 +137,7 @@ void kstring_append (KString *self, const KString *s)
   assert (self != NULL);
   assert (s != NULL);
   int newlen = self->length + s->length;
-  self->str = realloc (self->str, (newlen + 1) * sizeof (UTF32));
+  self->str = krealloc (self->str, (newlen + 1) * sizeof (UTF32));
   memcpy (self->str + self->length, s->str, (s->length * sizeof (UTF32)));
   self->length = newlen;
   self->str [self->length] = 0;
@@ -144,7 +158,7 @@ void kstring_append_char (KString *self, UTF32 c)
   assert (self != NULL);
   assert (self->str != NULL);
 
-  self->str = realloc (self->str, (self->length + 2) * sizeof (UTF32)); 
+  self->str = krealloc (self->str, (self->length + 2) * sizeof (UTF32)); 
   self->str[self->length] = c;
   self->str[self->length + 1] = 0;
   self->length += 1;
@@ -195,7 +209,10 @@ void kstring_append_utf8 (KString *self, const UTF8 *s)
 void kstring_append_utf32 (KString *self, const UTF32 *s)
   {
   KLOG_IN
-  kstring_append_utf32 (self, s);
+  assert (s != NULL);
+  KString *temp = kstring_new_from_utf32 (s);
+  kstring_append (self, temp);
+  kstring_destroy (temp);
   KLOG_OUT
   }
 
@@ -223,8 +240,8 @@ void kstring_clear (KString *self)
   KLOG_IN
   assert (self != NULL);
   assert (self->str != NULL);
-  free (self->str);
-  self->str = malloc (sizeof (UTF32));
+  kfree (self->str);
+  self->str = kmalloc (sizeof (UTF32));
   self->str[0] = 0;
   self->length = 0;
   KLOG_OUT
@@ -244,11 +261,11 @@ void kstring_delete (KString *self, int pos, int len)
     kstring_delete (self, pos, lself - len);
   else
     {
-    UTF32 *buff = malloc ((lself - len + 2) * sizeof (UTF32));
+    UTF32 *buff = kmalloc ((lself - len + 2) * sizeof (UTF32));
     memcpy (buff, str, pos  * sizeof (UTF32));
     memcpy (buff + pos, str + pos + len,
       (1 + kstring_length_utf32 (str + pos + len)) * sizeof (UTF32));
-    free (self->str);
+    kfree (self->str);
     self->str = buff;
     self->length -= len;
     }
@@ -544,11 +561,11 @@ KString *kstring_substring (const KString *self, int start, int count)
     count = self->length - start;
   if (count + start >= self->length) 
     count = self->length - start;
-  UTF32 *s = malloc ((count + 1) * sizeof (UTF32));
+  UTF32 *s = kmalloc ((count + 1) * sizeof (UTF32));
   memcpy (s, self->str + start, count  * sizeof (UTF32));
   s[count] = 0;
   KString *ret = kstring_new_from_utf32 (s);
-  free (s);
+  kfree (s);
   KLOG_OUT
   return ret; 
   }
@@ -677,9 +694,9 @@ void kstring_trim_left (KString *self)
     }
 
   int new_len = l - pos;
-  UTF32 *s_new = malloc ((new_len + 1) * sizeof (UTF32));
+  UTF32 *s_new = kmalloc ((new_len + 1) * sizeof (UTF32));
   memcpy (s_new, self->str + pos, (new_len + 1) * sizeof (UTF32));
-  free (self->str);
+  kfree (self->str);
   self->str = s_new;
   self->length = new_len; 
   KLOG_OUT
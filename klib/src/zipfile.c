@@ -0,0 +1,661 @@
+/*============================================================================
+  
+  klib
+  
+  zipfile.c
+
+  The archive is mapped into memory, and its central directory read
+  into an index of entries, so that any entry can be found and
+  extracted without reading the rest of the archive. Once the contents
+  have been read, a ZipFile is not modified, so different threads can
+  extract entries from the same ZipFile at the same time.
+
+  Only stored and DEFLATE entries are supported, which is all that
+  EPUB and most other uses need. ZIP64 archives are supported.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <klib/klog.h>
+#include <klib/kalloc.h>
+#include <klib/kbuffer.h>
+#include <klib/kinflate.h>
+#include <klib/zipfile.h>
+
+#define KLOG_CLASS "klib.zipfile"
+
+#define SIG_LOCAL 0x04034b50
+#define SIG_CENTRAL 0x02014b50
+#define SIG_END 0x06054b50
+#define SIG_END64 0x06064b50
+#define SIG_LOCATOR64 0x07064b50
+
+#define METHOD_STORED 0
+#define METHOD_DEFLATE 8
+
+/*============================================================================
+  
+  ZipEntry
+
+  ==========================================================================*/
+typedef struct _ZipEntry
+  {
+  char *name;
+  int method;
+  uint32_t crc;
+  uint64_t compressed_size;
+  uint64_t size;
+  // Of the local header, not the data
+  uint64_t offset;
+  } ZipEntry;
+
+/*============================================================================
+  
+  ZipFile
+
+  ==========================================================================*/
+struct _ZipFile
+  {
+  char *filename;
+  int fd;
+  const BYTE *map;
+  size_t map_size;
+  ZipEntry *entries;
+  int num_entries;
+  uint32_t crc_table[256];
+  };
+
+/*============================================================================
+  
+  Extraction
+
+  The state passed through kinflate() to the caller's function, so that
+  the size and CRC of the output can be checked
+
+  ==========================================================================*/
+typedef struct _Extraction
+  {
+  const ZipFile *zipfile;
+  uint32_t crc;
+  uint64_t size;
+  uint64_t expected_size;
+  KZipFn fn;
+  void *user_data;
+  BOOL too_long;
+  BOOL stopped;
+  } Extraction;
+
+/*============================================================================
+  
+  Little-endian readers
+
+  ==========================================================================*/
+static inline uint16_t kzipfile_16 (const BYTE *p)
+  {
+  return p[0] | (p[1] << 8);
+  }
+
+static inline uint32_t kzipfile_32 (const BYTE *p)
+  {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+static inline uint64_t kzipfile_64 (const BYTE *p)
+  {
+  return kzipfile_32 (p) | ((uint64_t)kzipfile_32 (p + 4) << 32);
+  }
+
+/*============================================================================
+  
+  kzipfile_create
+
+  ==========================================================================*/
+ZipFile *kzipfile_create (const char *filename)
+  {
+  KLOG_IN
+  ZipFile *self = kmalloc (sizeof (ZipFile));
+  memset (self, 0, sizeof (ZipFile));
+  self->filename = kstrdup (filename);
+  self->fd = -1;
+  for (uint32_t i = 0; i < 256; i++)
+    {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    self->crc_table[i] = c;
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  kzipfile_destroy
+
+  ==========================================================================*/
+void kzipfile_destroy (ZipFile *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->num_entries; i++)
+      kfree (self->entries[i].name);
+    kfree (self->entries);
+    if (self->map) munmap ((void *)self->map, self->map_size);
+    if (self->fd >= 0) close (self->fd);
+    kfree (self->filename);
+    kfree (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  kzipfile_get_filename
+
+  ==========================================================================*/
+const char *kzipfile_get_filename (const ZipFile *self)
+  {
+  return self->filename;
+  }
+
+/*============================================================================
+  
+  kzipfile_find_end
+
+  Find the end-of-central-directory record, which is at the end of the
+  file, followed by a comment of up to 64kB. Returns its offset, or -1.
+
+  ==========================================================================*/
+static int64_t kzipfile_find_end (const ZipFile *self)
+  {
+  if (self->map_size < 22) return -1;
+  int64_t limit = (int64_t)self->map_size - 22 - 65535;
+  if (limit < 0) limit = 0;
+  for (int64_t p = self->map_size - 22; p >= limit; p--)
+    {
+    if (kzipfile_32 (self->map + p) == SIG_END
+         && p + 22 + kzipfile_16 (self->map + p + 20) == self->map_size)
+      return p;
+    }
+  return -1;
+  }
+
+/*============================================================================
+  
+  kzipfile_read_directory
+
+  ==========================================================================*/
+static ZipError kzipfile_read_directory (ZipFile *self)
+  {
+  int64_t end = kzipfile_find_end (self);
+  if (end < 0) return ZE_BADZIP;
+  const BYTE *e = self->map + end;
+  uint64_t count = kzipfile_16 (e + 10);
+  uint64_t dir_size = kzipfile_32 (e + 12);
+  uint64_t dir_offset = kzipfile_32 (e + 16);
+
+  // A ZIP64 archive has a locator just before the end record, which
+  //   points to a larger end record
+  if (end >= 20 && kzipfile_32 (e - 20) == SIG_LOCATOR64)
+    {
+    uint64_t end64 = kzipfile_64 (e - 20 + 8);
+    if (self->map_size < 56 || end64 > self->map_size - 56
+         || kzipfile_32 (self->map + end64) != SIG_END64)
+      return ZE_BADZIP;
+    const BYTE *e64 = self->map + end64;
+    count = kzipfile_64 (e64 + 32);
+    dir_size = kzipfile_64 (e64 + 40);
+    dir_offset = kzipfile_64 (e64 + 48);
+    }
+
+  if (dir_offset > self->map_size || dir_size > self->map_size - dir_offset
+       || count > dir_size / 46)
+    return ZE_BADZIP;
+
+  self->entries = kmalloc (count * sizeof (ZipEntry) + 1);
+  const BYTE *p = self->map + dir_offset;
+  const BYTE *limit = p + dir_size;
+  for (uint64_t i = 0; i < count; i++)
+    {
+    if (limit - p < 46 || kzipfile_32 (p) != SIG_CENTRAL) return ZE_BADZIP;
+    int name_length = kzipfile_16 (p + 28);
+    int extra_length = kzipfile_16 (p + 30);
+    int comment_length = kzipfile_16 (p + 32);
+    if (limit - p < 46 + name_length + extra_length + comment_length)
+      return ZE_BADZIP;
+
+    ZipEntry *entry = &self->entries[self->num_entries];
+    entry->method = kzipfile_16 (p + 10);
+    entry->crc = kzipfile_32 (p + 16);
+    entry->compressed_size = kzipfile_32 (p + 20);
+    entry->size = kzipfile_32 (p + 24);
+    entry->offset = kzipfile_32 (p + 42);
+
+    // In ZIP64, any of the sizes and offset that don't fit are
+    //   0xFFFFFFFF, and their real values are in an extra field, in
+    //   this order
+    const BYTE *x = p + 46 + name_length;
+    const BYTE *x_end = x + extra_length;
+    while (x_end - x >= 4)
+      {
+      int id = kzipfile_16 (x);
+      int len = kzipfile_16 (x + 2);
+      const BYTE *v = x + 4;
+      const BYTE *v_end = v + len;
+      if (v_end > x_end) break;
+      if (id == 0x0001)
+        {
+        if (entry->size == 0xFFFFFFFF && v_end - v >= 8)
+          { entry->size = kzipfile_64 (v); v += 8; }
+        if (entry->compressed_size == 0xFFFFFFFF && v_end - v >= 8)
+          { entry->compressed_size = kzipfile_64 (v); v += 8; }
+        if (entry->offset == 0xFFFFFFFF && v_end - v >= 8)
+          { entry->offset = kzipfile_64 (v); v += 8; }
+        }
+      x = v_end;
+      }
+
+    entry->name = kstrndup ((const char *)p + 46, name_length);
+    self->num_entries++;
+    p += 46 + name_length + extra_length + comment_length;
+    }
+  return ZE_OK;
+  }
+
+/*============================================================================
+  
+  kzipfile_read_contents
+
+  ==========================================================================*/
+ZipError kzipfile_read_contents (ZipFile *self)
+  {
+  KLOG_IN
+  ZipError ret = ZE_OK;
+  self->fd = open (self->filename, O_RDONLY | O_CLOEXEC);
+  if (self->fd >= 0)
+    {
+    struct stat sb;
+    if (fstat (self->fd, &sb) == 0 && sb.st_size > 0)
+      {
+      void *map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+        self->fd, 0);
+      if (map != MAP_FAILED)
+        {
+        self->map = map;
+        self->map_size = sb.st_size;
+        ret = kzipfile_read_directory (self);
+        }
+      else
+        ret = ZE_OPENREAD;
+      }
+    else
+      ret = ZE_BADZIP;
+    }
+  else
+    ret = ZE_OPENREAD;
+  if (ret != ZE_OK)
+    klog_debug (KLOG_CLASS, "Can't read '%s': error %d",
+      self->filename, ret);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  kzipfile_get_num_entries
+
+  ==========================================================================*/
+int kzipfile_get_num_entries (const ZipFile *self)
+  {
+  return self->num_entries;
+  }
+
+/*============================================================================
+  
+  kzipfile_get_entry_details
+
+  ==========================================================================*/
+void kzipfile_get_entry_details (const ZipFile *self, int n,
+      char *filename, int max_filename, uint64_t *size)
+  {
+  const ZipEntry *entry = &self->entries[n];
+  if (filename && max_filename > 0)
+    {
+    strncpy (filename, entry->name, max_filename - 1);
+    filename[max_filename - 1] = 0;
+    }
+  if (size) *size = entry->size;
+  }
+
+/*============================================================================
+  
+  kzipfile_find_entry
+
+  ==========================================================================*/
+int kzipfile_find_entry (const ZipFile *self, const char *name)
+  {
+  for (int i = 0; i < self->num_entries; i++)
+    if (strcmp (self->entries[i].name, name) == 0) return i;
+  return -1;
+  }
+
+/*============================================================================
+  
+  kzipfile_extraction_fn
+
+  ==========================================================================*/
+static BOOL kzipfile_extraction_fn (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  Extraction *x = user_data;
+  x->size += length;
+  // The size in the directory is used to allocate memory for the
+  //   output, so it mustn't be exceeded
+  if (x->size > x->expected_size)
+    {
+    x->too_long = TRUE;
+    return FALSE;
+    }
+  const uint32_t *table = x->zipfile->crc_table;
+  uint32_t crc = x->crc;
+  for (size_t i = 0; i < length; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  x->crc = crc;
+  if (!x->fn (x->user_data, data, length))
+    {
+    x->stopped = TRUE;
+    return FALSE;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  kzipfile_extract_to_function
+
+  ==========================================================================*/
+ZipError kzipfile_extract_to_function (const ZipFile *self, int n,
+      KZipFn fn, void *user_data)
+  {
+  KLOG_IN
+  if (n < 0 || n >= self->num_entries)
+    {
+    KLOG_OUT
+    return ZE_INTERNAL;
+    }
+  const ZipEntry *entry = &self->entries[n];
+  if (entry->method != METHOD_STORED && entry->method != METHOD_DEFLATE)
+    {
+    KLOG_OUT
+    return ZE_UNSUPPORTED_COMP;
+    }
+
+  // The local header repeats the name, and may have a different extra
+  //   field, so the data can only be found from it
+  if (entry->offset > self->map_size - 30
+       || kzipfile_32 (self->map + entry->offset) != SIG_LOCAL)
+    {
+    KLOG_OUT
+    return ZE_BADZIP;
+    }
+  const BYTE *local = self->map + entry->offset;
+  uint64_t start = entry->offset + 30 + kzipfile_16 (local + 26)
+    + kzipfile_16 (local + 28);
+  if (start > self->map_size
+       || entry->compressed_size > self->map_size - start)
+    {
+    KLOG_OUT
+    return ZE_BADZIP;
+    }
+
+  Extraction x;
+  x.zipfile = self;
+  x.crc = 0xFFFFFFFF;
+  x.size = 0;
+  x.expected_size = entry->size;
+  x.fn = fn;
+  x.user_data = user_data;
+  x.too_long = FALSE;
+  x.stopped = FALSE;
+
+  ZipError ret = ZE_OK;
+  if (entry->method == METHOD_STORED)
+    {
+    if (entry->compressed_size != entry->size)
+      ret = ZE_CORRUPT;
+    else if (entry->size > 0)
+      kzipfile_extraction_fn (&x, self->map + start, entry->size);
+    }
+  else
+    {
+    KInflateError e = kinflate (self->map + start, entry->compressed_size,
+      NULL, kzipfile_extraction_fn, &x);
+    if (e != KINFLATE_OK) ret = ZE_CORRUPT;
+    }
+
+  // If the caller's function stopped extraction, that's not the 
+  //   archive's fault
+  if (x.stopped)
+    ret = ZE_OPENWRITE;
+  else if (ret == ZE_OK && (x.size != entry->size
+       || (x.crc ^ 0xFFFFFFFF) != entry->crc))
+    ret = ZE_CORRUPT;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  kzipfile_memory_fn
+
+  ==========================================================================*/
+typedef struct _MemoryTarget
+  {
+  BYTE *data;
+  uint64_t length;
+  } MemoryTarget;
+
+static BOOL kzipfile_memory_fn (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  MemoryTarget *target = user_data;
+  // The extraction checks that the output does not exceed the size
+  //   the buffer was allocated for
+  memcpy (target->data + target->length, data, length);
+  target->length += length;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  kzipfile_extract_to_memory
+
+  ==========================================================================*/
+ZipError kzipfile_extract_to_memory (const ZipFile *self, int n,
+      BYTE **out, uint64_t *length)
+  {
+  KLOG_IN
+  if (n < 0 || n >= self->num_entries)
+    {
+    KLOG_OUT
+    return ZE_INTERNAL;
+    }
+  // The buffer is sized from the directory, and extraction stops at
+  //   that size, so a size that would wrap around when the terminator
+  //   is added -- 0xFFFFFFFFFFFFFFFF in a ZIP64 extra field, say --
+  //   would leave nothing to stop extraction overrunning it
+  uint64_t size = self->entries[n].size;
+  if (size >= SIZE_MAX || size > KZIPFILE_MEMORY_MAX)
+    {
+    klog_debug (KLOG_CLASS, "Entry %d of '%s' is too large: %llu bytes",
+      n, self->filename, (unsigned long long)size);
+    KLOG_OUT
+    return ZE_TOOBIG;
+    }
+  MemoryTarget target;
+  // Terminated with a zero that is not counted, so that text can be
+  //   used as a C string
+  target.data = malloc (size + 1);
+  target.length = 0;
+  if (!target.data)
+    {
+    KLOG_OUT
+    return ZE_INTERNAL;
+    }
+  ZipError ret = kzipfile_extract_to_function (self, n,
+    kzipfile_memory_fn, &target);
+  if (ret == ZE_OK)
+    {
+    target.data[target.length] = 0;
+    *out = target.data;
+    *length = target.length;
+    }
+  else
+    free (target.data);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  kzipfile_extract_to_buffer
+
+  ==========================================================================*/
+ZipError kzipfile_extract_to_buffer (const ZipFile *self, int n,
+      KBuffer **buffer)
+  {
+  KLOG_IN
+  BYTE *data;
+  uint64_t length;
+  ZipError ret = kzipfile_extract_to_memory (self, n, &data, &length);
+  if (ret == ZE_OK)
+    *buffer = kbuffer_new_from_data_no_copy (data, length);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  kzipfile_file_fn
+
+  ==========================================================================*/
+static BOOL kzipfile_file_fn (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  int fd = *(int *)user_data;
+  while (length > 0)
+    {
+    ssize_t n = write (fd, data, length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    data += n;
+    length -= n;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  kzipfile_extract_to_file
+
+  ==========================================================================*/
+ZipError kzipfile_extract_to_file (const ZipFile *self, int entry,
+      const char *filename)
+  {
+  KLOG_IN
+  ZipError ret;
+  int fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0)
+    {
+    ret = kzipfile_extract_to_function (self, entry, kzipfile_file_fn,
+      &fd);
+    if (close (fd) != 0 && ret == ZE_OK) ret = ZE_OPENWRITE;
+    }
+  else
+    ret = ZE_OPENWRITE;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  kzipfile_make_dirs
+
+  Create the directories leading to 'path' -- and 'path' itself, if
+  it ends with '/'
+
+  ==========================================================================*/
+static void kzipfile_make_dirs (char *path)
+  {
+  for (char *p = path + 1; *p; p++)
+    {
+    if (*p == '/')
+      {
+      *p = 0;
+      mkdir (path, 0755);
+      *p = '/';
+      }
+    }
+  }
+
+/*============================================================================
+  
+  kzipfile_extract_all
+
+  Returns ZE_OK, or the first error. Entries whose names are absolute,
+  or contain "..", and so could be written outside 'extract_path', are
+  never extracted.
+
+  ==========================================================================*/
+int kzipfile_extract_all (const ZipFile *self, const char *extract_path,
+      BOOL carry_on)
+  {
+  KLOG_IN
+  int ret = ZE_OK;
+  for (int i = 0; i < self->num_entries; i++)
+    {
+    const char *name = self->entries[i].name;
+    ZipError e = ZE_OK;
+    if (name[0] == '/' || strcmp (name, "..") == 0
+         || strncmp (name, "../", 3) == 0 || strstr (name, "/../")
+         || (strlen (name) >= 3
+              && strcmp (name + strlen (name) - 3, "/..") == 0))
+      e = ZE_OPENWRITE;
+    else
+      {
+      size_t length = strlen (extract_path) + strlen (name) + 2;
+      char *path = kmalloc (length);
+      if (!path)
+        e = ZE_INTERNAL;
+      else
+        {
+        snprintf (path, length, "%s/%s", extract_path, name);
+        kzipfile_make_dirs (path);
+        if (path[strlen (path) - 1] != '/')
+          e = kzipfile_extract_to_file (self, i, path);
+        kfree (path);
+        }
+      }
+    if (e != ZE_OK)
+      {
+      klog_debug (KLOG_CLASS, "Can't extract '%s': error %d", name, e);
+      if (ret == ZE_OK) ret = e;
+      if (!carry_on) break;
+      }
+    }
+  KLOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,248 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre.h
+
+  The public interface to the fkre readability engine.
+
+  A document is scored by creating a context, feeding it the document's
+  bytes (UTF-8 or ASCII) in as many pieces as is convenient, finishing
+  it, and then reading the metrics. The pieces can be split anywhere --
+  even in the middle of a multi-byte character -- and the results are
+  the same as if the whole document had been fed at once. A context 
+  can be reset and reused for any number of documents. 
+
+  Contexts are independent of one another, so different threads can
+  use different contexts at the same time. A single context must not be
+  used by more than one thread at once.
+
+  This header deliberately depends only on the standard C headers, and
+  all the types in it have fixed layouts, so that it can be used from
+  C++ and from other languages' foreign-function interfaces. New 
+  members are only ever added to the end of FKREMetrics, and the caller
+  says how large its version of the structure is, so programs built
+  against an older version of this header keep working with newer
+  versions of the library.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremented only if the interface changes incompatibly
+#define FKRE_ABI_VERSION 1
+
+// Flags for fkre_context_new()
+
+// Treat the text as HTML -- ignore tags, and count subheadings 
+#define FKRE_FLAG_HTML 0x0001
+
+// Treat the text as Markdown -- count headings as subheadings, end a 
+//   sentence at the end of each paragraph, list item, or heading, and
+//   ignore code, URLs, and markup
+#define FKRE_FLAG_MARKDOWN 0x0002
+
+// Treat the text as LaTeX source -- count sectioning commands as 
+//   subheadings, and ignore comments, commands, math, verbatim text,
+//   and the preamble
+#define FKRE_FLAG_LATEX 0x0004
+
+// Collect statistics, for fkre_context_get_stats() -- the time spent
+//   decoding, tokenizing and finishing, and the tokenizer's state 
+//   transitions. The clocks are read once for each block of text, not
+//   for each character
+#define FKRE_FLAG_STATS 0x0008
+
+struct _FKREContext;
+typedef struct _FKREContext FKREContext;
+
+struct _FKREDocument;
+typedef struct _FKREDocument FKREDocument;
+
+typedef struct _FKREMetrics
+  {
+  // The caller sets this to sizeof (FKREMetrics) before calling
+  //   fkre_context_get_metrics()
+  uint32_t size;
+  // The flags the context was created with
+  uint32_t flags;
+  int64_t words;
+  int64_t sentences;
+  int64_t syllables;
+  int64_t max_sentence_length;
+  int64_t passive_sentences;
+  // Subheadings are only counted in HTML mode
+  int64_t subheadings;
+  int64_t max_words_per_subheading;
+  // Zero if the score could not be calculated, because there were no
+  //   words or no sentences
+  int32_t have_score;
+  double score;
+  } FKREMetrics;
+
+// The number of states of the tokenizer, in FKREStats: between words, 
+//   in a tag, in white space, and in a word
+#define FKRE_STATS_STATES 4
+
+typedef struct _FKREStats
+  {
+  // The caller sets this to sizeof (FKREStats) before calling
+  //   fkre_context_get_stats()
+  uint32_t size;
+  uint32_t reserved;
+  // Documents finished, and the bytes, characters and words in them
+  int64_t documents;
+  int64_t bytes;
+  int64_t characters;
+  int64_t words;
+  // Wall-clock and CPU time, in seconds
+  double decode_seconds;
+  double decode_cpu_seconds;
+  double tokenize_seconds;
+  double tokenize_cpu_seconds;
+  // Finishing documents -- the words and sentences left open at the
+  //   end, and the final counts
+  double finish_seconds;
+  double finish_cpu_seconds;
+  // The number of characters on which the tokenizer moved from state
+  //   [from] to state [to], including staying in the same state
+  int64_t transitions[FKRE_STATS_STATES][FKRE_STATS_STATES];
+  } FKREStats;
+
+// Units for fkre_context_set_window()
+
+typedef enum
+  {
+  FKRE_WINDOW_SENTENCES = 1,
+  FKRE_WINDOW_WORDS = 2
+  } FKREWindowUnit;
+
+// Marks for fkre_context_mark()
+typedef enum
+  {
+  // The end of a paragraph, or other block of text: ends the sentence
+  //   in progress, even if it has no closing punctuation
+  FKRE_MARK_PARAGRAPH = 1,
+  // The start of a subheading, as an HTML <h1>...<h9> tag would be
+  FKRE_MARK_SUBHEADING = 2
+  } FKREMark;
+
+/** Called for each position of a sliding window. start and end are the
+    offsets, in characters (not bytes) from the start of the document, 
+    of the first and last characters in the window. */
+typedef void (*FKREWindowFn) (void *user_data, int64_t start, int64_t end,
+               double score);
+
+/** Create a context. Returns NULL if memory is exhausted. */
+extern FKREContext *fkre_context_new (unsigned flags);
+extern void         fkre_context_destroy (FKREContext *self);
+
+/** Clear the counters, ready to score another document. The flags and
+    window settings are retained. */
+extern void         fkre_context_reset (FKREContext *self);
+
+/** Feed the next part of the document. */
+extern void         fkre_context_feed (FKREContext *self, 
+                      const void *bytes, size_t length);
+
+/** Mark a point in the structure of the document, for callers that 
+    parse a document format themselves, and so know where paragraphs
+    and subheadings are. Subheadings marked this way are counted even
+    without FKRE_FLAG_HTML. Returns 0, or EINVAL if the mark is not
+    known. */
+extern int          fkre_context_mark (FKREContext *self, FKREMark mark);
+
+/** Mark the end of the document. Text that is fed after this is ignored
+    until the context is reset. */
+extern void         fkre_context_finish (FKREContext *self);
+
+/** Copy the metrics into the caller's structure, whose 'size' member
+    must be set. Normally called after fkre_context_finish(); if called
+    before, the metrics cover the text fed so far, except any word 
+    that might not be complete. Returns 0, or EINVAL if the size is too
+    small to be a valid FKREMetrics. */
+extern int          fkre_context_get_metrics (const FKREContext *self,
+                      FKREMetrics *metrics);
+
+/** Copy the statistics collected by a context created with 
+    FKRE_FLAG_STATS into the caller's structure, whose 'size' member
+    must be set. The statistics cover everything the context has done
+    since it was created; resetting it does not clear them. Only as 
+    much is copied as 'size' allows, so a caller built against an 
+    older, smaller FKREStats still works. Returns 0, or EINVAL if the
+    context does not collect statistics, or the size is too small to
+    hold the 'size' member. */
+extern int          fkre_context_get_stats (const FKREContext *self,
+                      FKREStats *stats);
+
+/** Score the document over a sliding window of the last 'size' 
+    sentences or words, calling 'fn' every 'stride' units, and once
+    more at the end of the document for any units not yet reported.
+    The window is maintained incrementally, so its size does not affect
+    the cost of scoring. Must be called before any text is fed. Returns
+    0, EINVAL if the size or stride is less than one, or ENOMEM if 
+    memory is exhausted, in which case the context has no window. */
+extern int          fkre_context_set_window (FKREContext *self, 
+                      FKREWindowUnit unit, int size, int stride,
+                      FKREWindowFn fn, void *user_data);
+
+/** Create an empty document, for programs, such as editors, that
+    need to score a document repeatedly as it changes. The document 
+    keeps a copy of its text, split into paragraphs, with the counts 
+    for each; an edit re-tokenizes only the paragraphs it touches. The
+    paragraphs are grouped into blocks of about 64, and an edit also
+    walks the list of blocks -- to find the offset, and to add up the
+    blocks' counts -- so it costs time in proportion to the size of the
+    edit, plus the number of blocks: a few thousand additions for a
+    document of a hundred thousand paragraphs. The metrics are always
+    the same as a context would give for the whole text. Returns NULL
+    if memory is exhausted. */
+extern FKREDocument *fkre_document_new (unsigned flags);
+extern void         fkre_document_destroy (FKREDocument *self);
+
+/** Replace 'remove' bytes of the text, starting at byte 'offset', with
+    'length' bytes from 'bytes'. Inserting text, or removing it, are 
+    special cases; so is loading a whole document into an empty one.
+    Offsets are in bytes, not characters, and should not fall inside
+    a multi-byte character. Takes time in proportion to 'remove' and
+    'length', and to the number of blocks, as described under
+    fkre_document_new(). Returns 0, EINVAL if the bytes to remove are
+    not all in the document, or ENOMEM. */
+extern int          fkre_document_replace (FKREDocument *self, 
+                      size_t offset, size_t remove, const void *bytes, 
+                      size_t length);
+
+/** The length of the document's text, in bytes. */
+extern size_t       fkre_document_length (const FKREDocument *self);
+
+/** Copy the metrics for the whole document into the caller's structure,
+    as for fkre_context_get_metrics(). */
+extern int          fkre_document_get_metrics (const FKREDocument *self,
+                      FKREMetrics *metrics);
+
+/** Add the metrics of a separate document -- a chapter of a book, say
+    -- to 'total': the counts are added, the maxima are the larger of 
+    the two, and the score is recalculated. 'total' should start with
+    all its members zero except 'size'. Returns 0, or EINVAL if either
+    size is too small. */
+extern int          fkre_metrics_add (FKREMetrics *total, 
+                      const FKREMetrics *part);
+
+/** The descriptive rating for a score -- "plain English", etc. */
+extern const char  *fkre_rating (double score);
+
+/** The version of the library, as a string. */
+extern const char  *fkre_version (void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,999 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre.c
+
+  Flesch-Kincaid
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <errno.h> 
+#include <time.h> 
+#include <klib/klib.h> 
+#include <fkre/fkre.h> 
+#include "fkre_internal.h" 
+
+// These are the code points of characters we will treat as vowel sounds,
+//   for the purposes of splitting a word into syllables
+#define VOWELS  { 'a', 'e', 'i', 'o', 'u', 'y', \
+                     0xE1 /*'á'*/, 0xE9 /*'é'*/, 0xEF /*'ï'*/}
+
+// Substituted for bytes that are not valid UTF-8
+#define REPLACEMENT_CHAR 0xFFFD
+
+#define KLOG_CLASS "fkre"
+
+/*============================================================================
+  
+  fkre_count_syllables
+
+  Split a word into syllables. The word is assumed to consist only of
+  pronounceable letters. The algorithm is very simple -- essentially a
+  syllable is a group of consonants separated by a group of vowels.
+
+  There are far more accurate ways to count syllables but, since all we
+  care about here is the average number of syllables per word, it hardly
+  seems worth burning a heap of extra CPU cycles.
+
+  ==========================================================================*/
+int fkre_count_syllables (const KString *word)
+  {
+  static UTF32 vowels[] = VOWELS; 
+  static int nvowels = sizeof (vowels) / sizeof (UTF32);
+  int n = 0;
+  BOOL last_vowel = FALSE;
+  int l = kstring_length (word); 
+  for (int i = 0 ; i < l; i++)
+    {
+    UTF32 wc = kstring_get (word, i);
+    BOOL got_vowel = FALSE;
+    for (int j = 0; j < nvowels; j++)
+      {
+      UTF32 v = vowels[j];
+      // Convert to lower case
+      if (v >= 65 && v <= 90) v += 32; // ASCII
+      if (v >= 192 && v <= 222) v += 32; // Extended latin
+      if ((v == wc) && last_vowel)
+        {
+        got_vowel = TRUE;
+        last_vowel = TRUE;
+        break;
+        }
+      else if (v == wc && !last_vowel)
+        {
+        n++;
+        got_vowel = TRUE;
+        last_vowel = TRUE;
+        break;
+        }
+      }
+    if (!got_vowel)
+      last_vowel = FALSE;
+    }
+  // 'es' on the end of a work is often not sounded as an extra syllable
+  if (kstring_ends_with_utf8 (word, (UTF8 *)"es")) 
+    n--;
+  // 'e' on the end of a work is usually not sounded
+  else if (kstring_ends_with_utf8 (word, (UTF8 *)"e"))
+    n--;
+  return n;
+  }
+
+
+/*============================================================================
+  
+  fkre_classify 
+
+  ==========================================================================*/
+Type fkre_classify (BOOL html, int c)
+  {
+  KLOG_IN
+  Type ret = TYPE_UNKNOWN;
+
+  if (html)
+    {
+    if (c == '<') ret = TYPE_STARTTAG; 
+    if (c == '>') ret = TYPE_ENDTAG; 
+    }
+
+  if (ret == TYPE_UNKNOWN)
+    {
+    // Various Unicode spaces
+    if (c >= 0x2000 && c <= 0x200A)
+      {
+      ret = TYPE_WHITE;
+      }
+    }
+
+  if (ret == TYPE_UNKNOWN)
+    {
+    switch (c)
+      {
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+      case 0x0B: // Line tab
+      case 0x85: // Next line 
+      case 0xA0: // NBSP 
+      case 0x2028: // Line sep 
+      case 0x2029: // Para sep 
+      case 0x202F: // Narrow NBSP 
+        ret = TYPE_WHITE;
+        break;
+      }
+    }
+
+  if (ret == TYPE_UNKNOWN)
+    ret = TYPE_TEXT;
+  return ret;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_got_subheading
+
+  ==========================================================================*/
+void fkre_got_subheading (FKREContext *context)
+  {
+  if (context->words_in_this_subheading > context->maximum_words_per_subheading)
+    context->maximum_words_per_subheading = context->words_in_this_subheading;
+  context->words_in_this_subheading = 0;
+  }
+
+
+/*============================================================================
+  
+  fkre_start_subheading
+
+  ==========================================================================*/
+void fkre_start_subheading (FKREContext *context)
+  {
+  if (context->subheadings == 0)
+    context->first_subheading_words = context->words_in_this_subheading;
+  else if (context->words_in_this_subheading > 
+             context->inner_max_words_per_subheading)
+    context->inner_max_words_per_subheading = 
+      context->words_in_this_subheading;
+  context->subheadings++; 
+  fkre_got_subheading (context); 
+  }
+
+/*============================================================================
+  
+  fkre_do_tag
+
+  ==========================================================================*/
+static void fkre_do_tag (FKREContext *context, const KString *tag)
+  {
+  KLOG_IN
+  // Be aware that tags have attributes
+  // printf ("** TAG %S\n", kstring_cstr (tag));
+
+  if (kstring_length(tag) >= 2)
+    {
+    if (kstring_get (tag, 0) == 'h'
+       || kstring_get (tag, 0) == 'H')
+      {
+      int c1 = kstring_get (tag, 1);
+      if (c1 >= '1' && c1 <= '9')
+        fkre_start_subheading (context);
+      }
+    }
+
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_extract_letters
+
+  ==========================================================================*/
+static KString *fkre_extract_letters (const KString *word)
+  {
+  KLOG_IN
+  KString *ret = kstring_new_empty();
+  int l = kstring_length (word);
+  for (int i = 0; i < l; i++)
+    {
+    UTF32 c = kstring_get (word, i);
+    if (
+       (c >= 'a' && c <= 'z') ||
+       (c >= 'A' && c <= 'Z') ||
+       (c >= 192 && c <= 255) // iso-8859-1 extended latin 
+       )
+    kstring_append_char (ret, c);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_end_sentence
+
+  ==========================================================================*/
+static void fkre_end_sentence (FKREContext *context)
+  {
+  klog_debug (KLOG_CLASS, "sentence length: %ld",   
+                (long)context->current_sentence_length);
+  if (context->current_sentence_length > context->max_sentence_length)
+    context->max_sentence_length = context->current_sentence_length;
+  if (context->sentences == 0)
+    context->first_sentence_length = context->current_sentence_length;
+  else if (context->current_sentence_length > 
+             context->inner_max_sentence_length)
+    context->inner_max_sentence_length = context->current_sentence_length;
+  context->sentences++;
+  context->current_sentence_length = 0;
+  }
+
+/*============================================================================
+  
+  fkre_do_word
+
+  ==========================================================================*/
+static void fkre_do_word (FKREContext *context, const KString *word)
+  {
+  KLOG_IN
+  // TODO remove HTML entities
+  klog_debug (KLOG_CLASS, "Got word %S", kstring_cstr (word));
+
+  BOOL end_sentence = FALSE;
+  if (kstring_ends_with_utf8 (word, (UTF8*)".")) 
+    end_sentence = TRUE;
+  if (kstring_ends_with_utf8 (word, (UTF8*)"?")) 
+    end_sentence = TRUE;
+  if (end_sentence) fkre_end_sentence (context);
+
+  // Now we've figured out whether this word ends a sentence or not,
+  //  strip all but letters.
+
+  KString *clean_word = fkre_extract_letters (word);
+  klog_debug (KLOG_CLASS, "Depunctuated word %S",  
+               kstring_cstr (clean_word));
+  int syls = 0;
+  if (kstring_length (clean_word) > 0)
+    {
+    syls = fkre_count_syllables (clean_word);
+    context->syllables += syls;
+    context->current_sentence_length++;
+    context->words_in_this_subheading++; 
+
+    if (syls > 1) 
+      {
+      if (kstring_ends_with_utf8 (clean_word, (UTF8*)"ed"))
+        { 
+        if (context->words == 0)
+          context->first_word_participle = TRUE;
+        if ((kstring_strcmp_utf8 (context->last_word, (UTF8*)"is") == 0)
+         || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"was") == 0)
+         || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"being") == 0))
+          {
+          klog_debug (KLOG_CLASS, "Passive expression %S %S", 
+            kstring_cstr (context->last_word), kstring_cstr(clean_word));
+          context->passive_sentences++;
+          }
+        }
+      }
+    kstring_destroy (context->last_word);
+    context->last_word = kstring_strdup (clean_word);
+    context->words++;
+    }
+  context->sentence_open = !end_sentence 
+    && (context->sentence_open || kstring_length (clean_word) > 0);
+
+  if (context->window)
+    fkre_window_word (context->window, syls, 
+      kstring_length (clean_word) > 0, end_sentence, 
+      context->word_start, context->word_end);
+
+  kstring_destroy (clean_word);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_process 
+
+  ==========================================================================*/
+void fkre_process (FKREContext *context, const UTF32 *text, size_t length)
+  {
+  if (context->markdown)
+    fkre_markdown_process (context, text, length);
+  else if (context->latex)
+    fkre_latex_process (context, text, length);
+  else
+    fkre_tokenize (context, text, length);
+  }
+
+/*============================================================================
+  
+  fkre_tokenize
+
+  ==========================================================================*/
+void fkre_tokenize (FKREContext *context, const UTF32 *text, size_t length)
+  {
+  State state = context->state;
+  KString *tag = context->tag;
+  KString *word = context->word;
+  int64_t *transitions = context->collect_stats ? 
+    &context->stats.transitions[0][0] : NULL;
+
+  for (size_t i = 0; i < length; i++)
+    {
+    int c = text[i];
+    State from = state;
+    Type type = fkre_classify (context->html, c);
+    if (state == STATE_TAG && type != TYPE_ENDTAG)
+      {
+      // If we've seen a start tag marker, then we don't pay any attention
+      //  to the contents, until we get to the end tag, even if we
+      //  hit end of file. Just buffer up the tag.
+      kstring_append_char (tag, c);
+      }
+    else
+      {
+      switch (state * 1000 + type)
+	{
+        //
+        // *** Events in START state *** 
+        //
+	case STATE_START * 1000 + TYPE_STARTTAG:
+          klog_trace (KLOG_CLASS, "Start tag at pos %ld; new state TAG");
+	  state = STATE_TAG;
+	  break;
+
+	case STATE_START * 1000 + TYPE_ENDTAG:
+	  // This should never happen in well-formed HTML. We ignore
+	  //   the end tag and carry on in start state
+          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
+                                     "new state START");
+	  state = STATE_START;
+	  break;
+
+	case STATE_START * 1000 + TYPE_WHITE:
+          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
+                                     "new state WHITE", i);
+	  state = STATE_WHITE;
+	  break;
+
+	case STATE_START * 1000 + TYPE_TEXT:
+          klog_trace (KLOG_CLASS, "Text at pos %ld; "
+                                     "new state TEXT", i);
+          context->word_start = context->position + i;
+          kstring_append_char (word, c);
+	  state = STATE_TEXT;
+	  break;
+
+        //
+        // *** Events in TAG state *** 
+        //
+	case STATE_TAG * 1000 + TYPE_ENDTAG:
+	  // Finished a tag. Go back to start state
+          klog_trace (KLOG_CLASS, "End tag at pos %ld", i);
+          fkre_do_tag (context, tag);
+          kstring_clear (tag);
+	  state = STATE_START;
+	  break;
+
+        //
+        // *** Events in WHITE state *** 
+        //
+	case STATE_WHITE * 1000 + TYPE_WHITE:
+          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
+                                     "stay in state WHITE", i);
+	  state = STATE_WHITE;
+	  break;
+
+	case STATE_WHITE * 1000 + TYPE_STARTTAG:
+          klog_trace (KLOG_CLASS, "Start tag at pos %ld; "
+                                     "new state TAG", i);
+	  state = STATE_TAG;
+	  break;
+
+	case STATE_WHITE * 1000 + TYPE_ENDTAG:
+          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
+                                     "new state START", i);
+	  state = STATE_START;
+	  break;
+
+	case STATE_WHITE * 1000 + TYPE_TEXT:
+          klog_trace (KLOG_CLASS, "Text at pos %ld; "
+                                     "new state TEXT", i);
+          context->word_start = context->position + i;
+          kstring_append_char (word, c);
+	  state = STATE_TEXT;
+	  break;
+
+        //
+        // *** Events in TEXT state *** 
+        //
+	case STATE_TEXT * 1000 + TYPE_WHITE:
+          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
+                                     "new state WHITE", i);
+          context->word_end = context->position + i;
+          fkre_do_word (context, word);
+          kstring_clear (word);
+	  state = STATE_WHITE;
+	  break;
+
+	case STATE_TEXT * 1000 + TYPE_STARTTAG:
+          klog_trace (KLOG_CLASS, "Start tag at pos %ld; "
+                                     "new state TAG");
+          context->word_end = context->position + i;
+          fkre_do_word (context, word);
+          kstring_clear (word);
+	  state = STATE_TAG;
+	  break;
+
+	case STATE_TEXT * 1000 + TYPE_ENDTAG:
+	  // This should never happen in well-formed HTML. We ignore
+	  //   the end tag and carry on in TEXT state
+          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
+                                     "stay in TEXT state");
+	  state = STATE_TEXT;
+	  break;
+
+	case STATE_TEXT * 1000 + TYPE_TEXT:
+          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
+                                     "stay in state WHITE", i);
+          kstring_append_char (word, c);
+	  state = STATE_TEXT;
+	  break;
+
+	default:
+          // This should never happen
+	  klog_error (KLOG_CLASS, 
+	    "Internal error: char %d(%c) of type %d "
+              "in state %d at position %ld", 
+              c, (char)c, type, state, (long)(context->position + i));
+	  state = STATE_START;
+	}
+      }
+    if (transitions) transitions[from * FKRE_STATS_STATES + state]++;
+    }
+
+  context->state = state;
+  context->position += length;
+  }
+
+/*============================================================================
+  
+  fkre_context_new
+
+  ==========================================================================*/
+FKREContext *fkre_context_new (unsigned flags)
+  {
+  KLOG_IN
+  FKREContext *self = malloc (sizeof (FKREContext));
+  if (self)
+    {
+    memset (self, 0, sizeof (FKREContext));
+    self->flags = flags;
+    self->html = (flags & FKRE_FLAG_HTML) != 0;
+    self->markdown = (flags & FKRE_FLAG_MARKDOWN) != 0;
+    self->state = STATE_START;
+    self->md_last_blank = TRUE;
+    self->word = kstring_new_empty ();
+    self->tag = kstring_new_empty ();
+    self->last_word = kstring_new_empty ();
+    self->scratch = malloc (FKRE_SCRATCH_SIZE * sizeof (UTF32));
+    if (flags & FKRE_FLAG_LATEX) self->latex = fkre_latex_new ();
+    self->collect_stats = (flags & FKRE_FLAG_STATS) != 0;
+    // Whatever was allocated is freed, as any context is destroyed
+    if (!self->word || !self->tag || !self->last_word || !self->scratch
+         || ((flags & FKRE_FLAG_LATEX) && !self->latex))
+      {
+      fkre_context_destroy (self);
+      self = NULL;
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_context_destroy
+
+  ==========================================================================*/
+void fkre_context_destroy (FKREContext *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    kstring_destroy (self->word);
+    kstring_destroy (self->tag);
+    kstring_destroy (self->last_word);
+    fkre_window_destroy (self->window);
+    free (self->scratch);
+    free (self->md_line);
+    free (self->md_held);
+    fkre_latex_destroy (self->latex);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_context_reset
+
+  Everything except the configuration, and the buffers that can be
+  reused, is cleared.
+
+  ==========================================================================*/
+void fkre_context_reset (FKREContext *self)
+  {
+  KLOG_IN
+  self->finished = FALSE;
+  self->words = 0;
+  self->sentences = 0;
+  self->current_sentence_length = 0;
+  self->max_sentence_length = 0;
+  self->syllables = 0;
+  self->words_in_this_subheading = 0;
+  self->subheadings = 0;
+  self->maximum_words_per_subheading = 0;
+  self->passive_sentences = 0;
+  self->first_sentence_length = 0;
+  self->inner_max_sentence_length = 0;
+  self->first_subheading_words = 0;
+  self->inner_max_words_per_subheading = 0;
+  self->first_word_participle = FALSE;
+  self->marked_subheadings = FALSE;
+  self->sentence_open = FALSE;
+  self->state = STATE_START;
+  kstring_clear (self->word);
+  kstring_clear (self->tag);
+  kstring_clear (self->last_word);
+  self->position = 0;
+  self->word_start = 0;
+  self->word_end = 0;
+  self->pending = 0;
+  self->pending_needed = 0;
+  if (self->window) fkre_window_reset (self->window);
+  fkre_markdown_reset (self);
+  if (self->latex) fkre_latex_reset (self->latex);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_decode
+
+  Decode UTF-8 from *in into at most 'max' characters, stopping at 'end'.
+  A multi-byte sequence that is cut off by the end of the input is 
+  held in the context, and completed by the next call. Invalid bytes
+  become U+FFFD, which is never part of a word, and NULs are dropped.
+  Returns the number of characters decoded, and advances *in.
+
+  ==========================================================================*/
+size_t fkre_decode (FKREContext *self, const BYTE **in, 
+      const BYTE *end, UTF32 *out, size_t max)
+  {
+  const BYTE *p = *in;
+  size_t n = 0;
+  while (p < end && n < max)
+    {
+    BYTE b = *p;
+    if (self->pending_needed == 0)
+      {
+      p++;
+      if (b < 0x80)
+        {
+        if (b != 0) out[n++] = b;
+        }
+      else if (b >= 0xC2 && b <= 0xDF)
+        {
+        self->pending = b & 0x1F;
+        self->pending_needed = 1;
+        }
+      else if (b >= 0xE0 && b <= 0xEF)
+        {
+        self->pending = b & 0x0F;
+        self->pending_needed = 2;
+        }
+      else if (b >= 0xF0 && b <= 0xF4)
+        {
+        self->pending = b & 0x07;
+        self->pending_needed = 3;
+        }
+      else
+        out[n++] = REPLACEMENT_CHAR;
+      }
+    else if ((b & 0xC0) != 0x80)
+      {
+      // A truncated sequence. Don't consume this byte -- it's the start
+      //   of whatever comes next
+      out[n++] = REPLACEMENT_CHAR;
+      self->pending_needed = 0;
+      }
+    else
+      {
+      p++;
+      self->pending = (self->pending << 6) | (b & 0x3F);
+      if (--self->pending_needed == 0)
+        {
+        UTF32 c = self->pending;
+        if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) 
+          c = REPLACEMENT_CHAR;
+        out[n++] = c;
+        }
+      }
+    }
+  *in = p;
+  return n;
+  }
+
+/*============================================================================
+  
+  fkre_clock
+
+  The wall-clock time, and this thread's CPU time, in seconds
+
+  ==========================================================================*/
+static void fkre_clock (double *wall, double *cpu)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  *wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+  *cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+/*============================================================================
+  
+  fkre_feed_timed
+
+  fkre_context_feed(), with the decoding and tokenizing of each block 
+  timed separately
+
+  ==========================================================================*/
+static void fkre_feed_timed (FKREContext *self, const BYTE *p, 
+      const BYTE *end)
+  {
+  FKREStats *stats = &self->stats;
+  stats->bytes += end - p;
+  double wall0, cpu0, wall1, cpu1, wall2, cpu2;
+  fkre_clock (&wall0, &cpu0);
+  while (p < end)
+    {
+    size_t n = fkre_decode (self, &p, end, self->scratch, 
+      FKRE_SCRATCH_SIZE);
+    fkre_clock (&wall1, &cpu1);
+    fkre_process (self, self->scratch, n);
+    fkre_clock (&wall2, &cpu2);
+    stats->characters += n;
+    stats->decode_seconds += wall1 - wall0;
+    stats->decode_cpu_seconds += cpu1 - cpu0;
+    stats->tokenize_seconds += wall2 - wall1;
+    stats->tokenize_cpu_seconds += cpu2 - cpu1;
+    wall0 = wall2;
+    cpu0 = cpu2;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_context_feed
+
+  ==========================================================================*/
+void fkre_context_feed (FKREContext *self, const void *bytes, size_t length)
+  {
+  KLOG_IN
+  if (self->finished)
+    ;
+  else if (self->collect_stats)
+    fkre_feed_timed (self, bytes, (const BYTE *)bytes + length);
+  else
+    {
+    const BYTE *p = bytes;
+    const BYTE *end = p + length;
+    while (p < end)
+      {
+      size_t n = fkre_decode (self, &p, end, self->scratch, 
+        FKRE_SCRATCH_SIZE);
+      fkre_process (self, self->scratch, n);
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_flush_word
+
+  A word that runs right up to the end of the text still counts
+
+  ==========================================================================*/
+static void fkre_flush_word (FKREContext *self)
+  {
+  if (self->state == STATE_TEXT)
+    {
+    self->word_end = self->position;
+    fkre_do_word (self, self->word);
+    kstring_clear (self->word);
+    self->state = STATE_WHITE;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_end_paragraph
+
+  ==========================================================================*/
+void fkre_end_paragraph (FKREContext *self)
+  {
+  fkre_flush_word (self);
+  // Only a sentence with words in it is ended, so that a paragraph 
+  //   that ends with a full stop isn't counted twice
+  if (self->sentence_open)
+    {
+    fkre_end_sentence (self);
+    self->sentence_open = FALSE;
+    // To a window, this looks like a word with no letters that ends
+    //   a sentence -- as a lone full stop would
+    if (self->window)
+      fkre_window_word (self->window, 0, FALSE, TRUE, 
+        self->position, self->position);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_context_flush
+
+  ==========================================================================*/
+void fkre_context_flush (FKREContext *self)
+  {
+  KLOG_IN
+  if (self->pending_needed > 0)
+    {
+    // The text ended part-way through a multi-byte character
+    UTF32 c = REPLACEMENT_CHAR;
+    self->pending_needed = 0;
+    fkre_process (self, &c, 1);
+    }
+
+  if (self->markdown) fkre_markdown_flush (self);
+  if (self->latex) fkre_latex_flush (self);
+  fkre_flush_word (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_context_finish
+
+  ==========================================================================*/
+void fkre_context_finish (FKREContext *self)
+  {
+  KLOG_IN
+  if (!self->finished)
+    {
+    double wall0, cpu0;
+    if (self->collect_stats) fkre_clock (&wall0, &cpu0);
+    fkre_context_flush (self);
+
+    // End of file is essentially a subheading, so far as calculating
+    //   the number of words per subheading
+    if (self->html || self->markdown || self->latex 
+        || self->marked_subheadings) 
+      fkre_got_subheading (self);
+
+    if (self->window) fkre_window_finish (self->window);
+    self->finished = TRUE;
+    if (self->collect_stats)
+      {
+      double wall1, cpu1;
+      fkre_clock (&wall1, &cpu1);
+      self->stats.finish_seconds += wall1 - wall0;
+      self->stats.finish_cpu_seconds += cpu1 - cpu0;
+      self->stats.documents++;
+      self->stats.words += self->words;
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_context_mark
+
+  ==========================================================================*/
+int fkre_context_mark (FKREContext *self, FKREMark mark)
+  {
+  KLOG_IN
+  int ret = 0;
+  if (self->finished)
+    ;
+  else if (mark == FKRE_MARK_PARAGRAPH)
+    {
+    fkre_context_flush (self);
+    fkre_end_paragraph (self);
+    }
+  else if (mark == FKRE_MARK_SUBHEADING)
+    {
+    fkre_context_flush (self);
+    self->marked_subheadings = TRUE;
+    fkre_start_subheading (self);
+    }
+  else
+    ret = EINVAL;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_metrics_score
+
+  ==========================================================================*/
+void fkre_metrics_score (FKREMetrics *m)
+  {
+  if (m->sentences > 0 && m->words > 0)
+    {
+    double twords = m->words;
+    double tsents = m->sentences;
+    double tsylls = m->syllables;
+    m->score = 206.835 
+       - 1.015 * (twords / tsents) 
+       - 84.6 * (tsylls / twords);
+    m->have_score = 1;
+    }
+  else
+    {
+    m->score = 0;
+    m->have_score = 0;
+    klog_debug (KLOG_CLASS, "Can't calculate FKRE score because some "
+                              "divisors are zero");
+    }
+  }
+
+/*============================================================================
+  
+  fkre_context_get_metrics
+
+  ==========================================================================*/
+int fkre_context_get_metrics (const FKREContext *self, FKREMetrics *metrics)
+  {
+  KLOG_IN
+  if (metrics->size < offsetof (FKREMetrics, score) + sizeof (double))
+    {
+    KLOG_OUT
+    return EINVAL;
+    }
+
+  FKREMetrics m;
+  memset (&m, 0, sizeof (FKREMetrics));
+  m.size = metrics->size < sizeof (FKREMetrics) ? 
+    metrics->size : sizeof (FKREMetrics);
+  m.flags = self->flags;
+  m.words = self->words;
+  m.sentences = self->sentences;
+  m.syllables = self->syllables;
+  m.max_sentence_length = self->max_sentence_length;
+  m.passive_sentences = self->passive_sentences;
+  m.subheadings = self->subheadings;
+  m.max_words_per_subheading = self->maximum_words_per_subheading;
+
+  fkre_metrics_score (&m);
+
+  // Copy only as much as the caller's version of the structure holds
+  memcpy (metrics, &m, m.size);
+  KLOG_OUT
+  return 0;
+  }
+
+/*============================================================================
+  
+  fkre_context_get_stats
+
+  ==========================================================================*/
+int fkre_context_get_stats (const FKREContext *self, FKREStats *stats)
+  {
+  KLOG_IN
+  if (!self->collect_stats || stats->size < offsetof (FKREStats, documents))
+    {
+    KLOG_OUT
+    return EINVAL;
+    }
+
+  // Copy only as much as the caller's version of the structure holds
+  uint32_t size = stats->size < sizeof (FKREStats) ?
+    stats->size : sizeof (FKREStats);
+  memcpy (stats, &self->stats, size);
+  stats->size = size;
+  KLOG_OUT
+  return 0;
+  }
+
+/*============================================================================
+  
+  fkre_metrics_add
+
+  ==========================================================================*/
+int fkre_metrics_add (FKREMetrics *total, const FKREMetrics *part)
+  {
+  KLOG_IN
+  size_t min = offsetof (FKREMetrics, score) + sizeof (double);
+  if (total->size < min || part->size < min)
+    {
+    KLOG_OUT
+    return EINVAL;
+    }
+
+  total->flags |= part->flags;
+  total->words += part->words;
+  total->sentences += part->sentences;
+  total->syllables += part->syllables;
+  total->passive_sentences += part->passive_sentences;
+  total->subheadings += part->subheadings;
+  if (part->max_sentence_length > total->max_sentence_length)
+    total->max_sentence_length = part->max_sentence_length;
+  if (part->max_words_per_subheading > total->max_words_per_subheading)
+    total->max_words_per_subheading = part->max_words_per_subheading;
+
+  fkre_metrics_score (total);
+  KLOG_OUT
+  return 0;
+  }
+
+/*============================================================================
+  
+  fkre_context_set_window
+
+  ==========================================================================*/
+int fkre_context_set_window (FKREContext *self, FKREWindowUnit unit, 
+      int size, int stride, FKREWindowFn fn, void *user_data)
+  {
+  KLOG_IN
+  int ret = 0;
+  if (size < 1 || stride < 1 || fn == NULL
+      || (unit != FKRE_WINDOW_SENTENCES && unit != FKRE_WINDOW_WORDS))
+    ret = EINVAL;
+  else
+    {
+    fkre_window_destroy (self->window);
+    self->window = fkre_window_new (unit, size, stride, fn, user_data);
+    if (!self->window) ret = ENOMEM;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_rating
+
+  ==========================================================================*/
+const char *fkre_rating (double score)
+  {
+  if (score > 90) return "very easy";
+  if (score > 80) return "easy";
+  if (score > 70) return "fairly easy";
+  if (score > 60) return "plain English";
+  if (score > 50) return "fairly difficult";
+  if (score > 30) return "difficult";
+  if (score > 10) return "very difficult";
+  return "extremely difficult";
+  }
+
+/*============================================================================
+  
+  fkre_version
+
+  ==========================================================================*/
+const char *fkre_version (void)
+  {
+  return VERSION;
+  }
@@ -0,0 +1,783 @@
+/*============================================================================
+  
+  libfkre
+
+  fkre_document.c
+
+  A document held as a list of paragraphs, each with the counts from
+  tokenizing it on its own, so that an edit need only re-tokenize the
+  paragraphs it touches.
+
+  The paragraphs are grouped into blocks of up to about
+  FKRE_BLOCK_SIZE, and each block keeps the combined counts for its
+  paragraphs. After an edit, the counts for the changed blocks are
+  combined afresh, and then the counts for all the blocks. So the cost
+  of an edit is a tokenization of the changed text, plus a handful of
+  additions for each block -- a hundred thousand paragraphs make
+  only a couple of thousand blocks.
+
+  The text is split into paragraphs at blank lines; a long run of text
+  with no blank lines is split at the first newline after
+  FKRE_PARAGRAPH_MAX bytes, so that it doesn't all have to be
+  re-tokenized every time it changes. The only thing that matters for
+  correctness is that the tokenizer, running over the whole document,
+  would be between words, and not inside an HTML tag, a Markdown
+  code fence, or anything that LaTeX skips, at the start of every 
+  paragraph. The state machine behaves the same way there as it
+  does at the start of a document, so the counts for a paragraph
+  don't depend on what comes before it. Every paragraph but the last
+  is kept ending in white space outside a tag, so that this is true.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_internal.h"
+
+#define KLOG_CLASS "fkre.document"
+
+// The number of paragraphs a block is meant to hold. Blocks are split
+//   when they get twice this large
+#define FKRE_BLOCK_SIZE 64
+
+// The length at which a paragraph with no blank lines is split at the
+//   next newline
+#define FKRE_PARAGRAPH_MAX 4096
+
+/*============================================================================
+  
+  FKREParagraph
+
+  ==========================================================================*/
+typedef struct _FKREParagraph
+  {
+  BYTE *text;
+  size_t length;
+  FKREPartial partial;
+  } FKREParagraph;
+
+/*============================================================================
+  
+  FKREBlock
+
+  ==========================================================================*/
+typedef struct _FKREBlock
+  {
+  FKREParagraph *paragraphs;
+  int count;
+  int capacity;
+  size_t length;
+  BOOL dirty;
+  FKREPartial partial;
+  } FKREBlock;
+
+/*============================================================================
+  
+  FKREDocument
+
+  ==========================================================================*/
+struct _FKREDocument
+  {
+  unsigned flags;
+  BOOL html;
+  BOOL markdown;
+  BOOL latex;
+  FKREBlock **blocks;
+  int nblocks;
+  int capacity;
+  size_t length;
+  FKREPartial total;
+  // Reused for tokenizing each paragraph
+  FKREContext *context;
+  };
+
+/*============================================================================
+  
+  fkre_partial_from_context
+
+  The counts for the text fed to the context, which must have been
+  flushed.
+
+  ==========================================================================*/
+void fkre_partial_from_context (const FKREContext *context,
+      FKREPartial *partial)
+  {
+  partial->words = context->words;
+  partial->syllables = context->syllables;
+  partial->passive_sentences = context->passive_sentences;
+  partial->sentences = context->sentences;
+  partial->sentence_head = context->first_sentence_length;
+  partial->sentence_max = context->inner_max_sentence_length;
+  partial->sentence_tail = context->current_sentence_length;
+  partial->subheadings = context->subheadings;
+  partial->subheading_head = context->first_subheading_words;
+  partial->subheading_max = context->inner_max_words_per_subheading;
+  partial->subheading_tail = context->words_in_this_subheading;
+  partial->first_participle = context->first_word_participle;
+  partial->last_auxiliary =
+       (kstring_strcmp_utf8 (context->last_word, (UTF8*)"is") == 0)
+    || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"was") == 0)
+    || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"being") == 0);
+  }
+
+/*============================================================================
+  
+  fkre_partial_merge_runs
+
+  Combine the runs of words between sentence ends, or between
+  subheadings. n is the number of ends in each piece.
+
+  ==========================================================================*/
+static void fkre_partial_merge_runs (int64_t *n, int64_t *head,
+     int64_t *max, int64_t *tail, int64_t rn, int64_t rhead,
+     int64_t rmax, int64_t rtail)
+  {
+  if (rn == 0)
+    {
+    *tail += rtail;
+    }
+  else if (*n == 0)
+    {
+    *head = *tail + rhead;
+    *max = rmax;
+    *tail = rtail;
+    }
+  else
+    {
+    // The run that straddles the join is now complete
+    int64_t joined = *tail + rhead;
+    if (joined > *max) *max = joined;
+    if (rmax > *max) *max = rmax;
+    *tail = rtail;
+    }
+  *n += rn;
+  }
+
+/*============================================================================
+  
+  fkre_partial_merge
+
+  Combine the counts for a piece of text with those for the piece
+  that immediately follows it.
+
+  ==========================================================================*/
+void fkre_partial_merge (FKREPartial *left, const FKREPartial *right)
+  {
+  if (left->last_auxiliary && right->first_participle)
+    left->passive_sentences++;
+  left->passive_sentences += right->passive_sentences;
+
+  if (left->words == 0)
+    left->first_participle = right->first_participle;
+  if (right->words > 0)
+    left->last_auxiliary = right->last_auxiliary;
+
+  left->words += right->words;
+  left->syllables += right->syllables;
+
+  fkre_partial_merge_runs (&left->sentences, &left->sentence_head,
+    &left->sentence_max, &left->sentence_tail, right->sentences,
+    right->sentence_head, right->sentence_max, right->sentence_tail);
+  fkre_partial_merge_runs (&left->subheadings, &left->subheading_head,
+    &left->subheading_max, &left->subheading_tail, right->subheadings,
+    right->subheading_head, right->subheading_max, right->subheading_tail);
+  }
+
+/*============================================================================
+  
+  fkre_document_new
+
+  ==========================================================================*/
+FKREDocument *fkre_document_new (unsigned flags)
+  {
+  KLOG_IN
+  FKREDocument *self = malloc (sizeof (FKREDocument));
+  if (self)
+    {
+    memset (self, 0, sizeof (FKREDocument));
+    self->flags = flags;
+    self->html = (flags & FKRE_FLAG_HTML) != 0;
+    self->markdown = (flags & FKRE_FLAG_MARKDOWN) != 0;
+    self->latex = (flags & FKRE_FLAG_LATEX) != 0;
+    self->context = fkre_context_new (flags);
+    if (!self->context)
+      {
+      free (self);
+      self = NULL;
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_block_destroy
+
+  ==========================================================================*/
+static void fkre_block_destroy (FKREBlock *block)
+  {
+  for (int i = 0; i < block->count; i++)
+    free (block->paragraphs[i].text);
+  free (block->paragraphs);
+  free (block);
+  }
+
+/*============================================================================
+  
+  fkre_document_destroy
+
+  ==========================================================================*/
+void fkre_document_destroy (FKREDocument *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->nblocks; i++)
+      fkre_block_destroy (self->blocks[i]);
+    free (self->blocks);
+    fkre_context_destroy (self->context);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_document_length
+
+  ==========================================================================*/
+size_t fkre_document_length (const FKREDocument *self)
+  {
+  return self->length;
+  }
+
+/*============================================================================
+  
+  fkre_document_insert_block
+
+  Insert a new, empty block at position b. Returns NULL if memory is
+  exhausted.
+
+  ==========================================================================*/
+static FKREBlock *fkre_document_insert_block (FKREDocument *self, int b)
+  {
+  if (self->nblocks == self->capacity)
+    {
+    int capacity = self->capacity ? self->capacity * 2 : 16;
+    FKREBlock **blocks = realloc (self->blocks,
+      capacity * sizeof (FKREBlock *));
+    if (!blocks) return NULL;
+    self->blocks = blocks;
+    self->capacity = capacity;
+    }
+  FKREBlock *block = malloc (sizeof (FKREBlock));
+  if (!block) return NULL;
+  memset (block, 0, sizeof (FKREBlock));
+  block->dirty = TRUE;
+  memmove (self->blocks + b + 1, self->blocks + b,
+    (self->nblocks - b) * sizeof (FKREBlock *));
+  self->blocks[b] = block;
+  self->nblocks++;
+  return block;
+  }
+
+/*============================================================================
+  
+  fkre_document_remove_block
+
+  ==========================================================================*/
+static void fkre_document_remove_block (FKREDocument *self, int b)
+  {
+  fkre_block_destroy (self->blocks[b]);
+  memmove (self->blocks + b, self->blocks + b + 1,
+    (self->nblocks - b - 1) * sizeof (FKREBlock *));
+  self->nblocks--;
+  }
+
+/*============================================================================
+  
+  fkre_document_split_block
+
+  Move the second half of a block that has grown too large into a new
+  block after it.
+
+  ==========================================================================*/
+static BOOL fkre_document_split_block (FKREDocument *self, int b)
+  {
+  FKREBlock *next = fkre_document_insert_block (self, b + 1);
+  if (!next) return FALSE;
+  FKREBlock *block = self->blocks[b];
+  int keep = block->count / 2;
+  int move = block->count - keep;
+  next->paragraphs = malloc (move * sizeof (FKREParagraph));
+  if (!next->paragraphs)
+    {
+    fkre_document_remove_block (self, b + 1);
+    return FALSE;
+    }
+  next->capacity = move;
+  memcpy (next->paragraphs, block->paragraphs + keep,
+    move * sizeof (FKREParagraph));
+  next->count = move;
+  for (int i = 0; i < move; i++)
+    next->length += next->paragraphs[i].length;
+  block->count = keep;
+  block->length -= next->length;
+  block->dirty = TRUE;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_document_add_paragraph
+
+  Tokenize a paragraph and insert it into block b at position i.
+
+  ==========================================================================*/
+static BOOL fkre_document_add_paragraph (FKREDocument *self, int b, int i,
+      BYTE *text, size_t length)
+  {
+  FKREBlock *block = self->blocks[b];
+  if (block->count == block->capacity)
+    {
+    int capacity = block->capacity ? block->capacity * 2 : FKRE_BLOCK_SIZE;
+    FKREParagraph *paragraphs = realloc (block->paragraphs,
+      capacity * sizeof (FKREParagraph));
+    if (!paragraphs) return FALSE;
+    block->paragraphs = paragraphs;
+    block->capacity = capacity;
+    }
+
+  FKREParagraph *p = block->paragraphs + i;
+  memmove (p + 1, p, (block->count - i) * sizeof (FKREParagraph));
+  p->text = text;
+  p->length = length;
+  FKREContext *context = self->context;
+  fkre_context_reset (context);
+  fkre_context_feed (context, text, length);
+  fkre_context_flush (context);
+  fkre_partial_from_context (context, &p->partial);
+
+  block->count++;
+  block->length += length;
+  block->dirty = TRUE;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_document_locate
+
+  Find the block and paragraph containing the byte at 'offset', and the
+  offset of the start of that paragraph. An offset at the end of the
+  document is taken to be in the last paragraph. Returns FALSE if the
+  document is empty.
+
+  ==========================================================================*/
+static BOOL fkre_document_locate (const FKREDocument *self, size_t offset,
+      int *b, int *i, size_t *start)
+  {
+  size_t s = 0;
+  for (int j = 0; j < self->nblocks; j++)
+    {
+    FKREBlock *block = self->blocks[j];
+    if (offset < s + block->length || j == self->nblocks - 1)
+      {
+      for (int k = 0; k < block->count; k++)
+        {
+        size_t l = block->paragraphs[k].length;
+        if (offset < s + l || k == block->count - 1)
+          {
+          *b = j;
+          *i = k;
+          *start = s;
+          return TRUE;
+          }
+        s += l;
+        }
+      }
+    else
+      s += block->length;
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_document_take
+
+  Remove the paragraph at block b, position i, returning its text. A
+  block that is left empty is not removed, so that positions in other
+  blocks stay valid; fkre_document_tidy() removes it later.
+
+  ==========================================================================*/
+static BYTE *fkre_document_take (FKREDocument *self, int b, int i,
+      size_t *length)
+  {
+  FKREBlock *block = self->blocks[b];
+  FKREParagraph *p = block->paragraphs + i;
+  BYTE *text = p->text;
+  *length = p->length;
+  block->length -= p->length;
+  block->count--;
+  memmove (p, p + 1, (block->count - i) * sizeof (FKREParagraph));
+  block->dirty = TRUE;
+  return text;
+  }
+
+/*============================================================================
+  
+  fkre_document_next
+
+  Move b and i on past the end of any blocks, to the next paragraph.
+  Returns FALSE if there isn't one.
+
+  ==========================================================================*/
+static BOOL fkre_document_next (const FKREDocument *self, int *b, int *i)
+  {
+  while (*b < self->nblocks && *i >= self->blocks[*b]->count)
+    {
+    (*b)++;
+    *i = 0;
+    }
+  return *b < self->nblocks;
+  }
+
+/*============================================================================
+  
+  fkre_document_tidy
+
+  Remove empty blocks, and recalculate the document's length.
+
+  ==========================================================================*/
+static void fkre_document_tidy (FKREDocument *self)
+  {
+  self->length = 0;
+  for (int j = self->nblocks - 1; j >= 0; j--)
+    {
+    if (self->blocks[j]->count == 0)
+      fkre_document_remove_block (self, j);
+    else
+      self->length += self->blocks[j]->length;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_is_white
+
+  Whether a byte is white space to the tokenizer. Only ASCII is
+  considered, which is enough to find places to split paragraphs.
+
+  ==========================================================================*/
+static BOOL fkre_is_white (BYTE b)
+  {
+  return b == ' ' || b == '\t' || b == '\n' || b == '\r' || b == 0x0B;
+  }
+
+/*============================================================================
+  
+  fkre_document_split
+
+  Find the end of the first paragraph in text, returning its length.
+  *complete is set if the paragraph ends at a point where another can
+  begin -- if not, the paragraph runs to the end of the text, and
+  needs whatever follows to be complete.
+
+  LaTeX has too many ways of hiding what follows from the processor --
+  the preamble, verbatim and math, arguments that are skipped, \verb 
+  -- to follow them here, so at each blank line the LaTeX processor 
+  itself is asked whether a paragraph could start after it.
+
+  ==========================================================================*/
+static size_t fkre_document_split (const FKREDocument *self,
+      const BYTE *text, size_t length, BOOL *complete)
+  {
+  BOOL in_tag = FALSE;
+  BOOL blank = FALSE;
+  // In Markdown, a fenced code block can have blank lines in it
+  BYTE fence = 0;
+  BOOL line_start = TRUE;
+  // The decoder drops NULs, so one can join the bytes either side of it
+  //   into Markdown markup that isn't seen here. A paragraph with a NUL
+  //   in it is not split
+  BOOL nul = FALSE;
+  // The text that has been fed to the LaTeX processor
+  FKREContext *context = self->context;
+  size_t fed = 0;
+  if (self->latex) fkre_context_reset (context);
+  for (size_t i = 0; i < length; i++)
+    {
+    BYTE c = text[i];
+    if (c == 0 && self->markdown) nul = TRUE;
+    if (self->html)
+      {
+      if (c == '<') in_tag = TRUE;
+      else if (c == '>') in_tag = FALSE;
+      }
+    if (self->markdown && line_start)
+      {
+      size_t j = i;
+      while (j < length && j - i < 3 && text[j] == ' ') j++;
+      size_t run = 0;
+      while (j + run < length && (text[j + run] == '`' 
+          || text[j + run] == '~') && text[j + run] == text[j]) 
+        run++;
+      if (run >= 3 && (!fence || text[j] == fence))
+        fence = fence ? 0 : text[j];
+      }
+    line_start = (c == '\n');
+    if (c == '\n' && !in_tag && !fence && !nul)
+      {
+      // A Markdown or LaTeX paragraph is only split at a blank line, 
+      //   since the end of a piece ends its sentence
+      if (blank || (i >= FKRE_PARAGRAPH_MAX && !self->markdown 
+          && !self->latex))
+        {
+        BOOL split = TRUE;
+        if (self->latex)
+          {
+          fkre_context_feed (context, text + fed, i + 1 - fed);
+          fed = i + 1;
+          split = fkre_latex_at_rest (context->latex);
+          }
+        if (split)
+          {
+          *complete = TRUE;
+          return i + 1;
+          }
+        }
+      blank = TRUE;
+      }
+    else if (c != ' ' && c != '\t' && c != '\r')
+      blank = FALSE;
+    // Markdown ignores only the carriage returns at the end of a line
+    else if (c == '\r' && self->markdown && i + 1 < length 
+        && text[i + 1] != '\r' && text[i + 1] != '\n')
+      blank = FALSE;
+    }
+  // A Markdown or LaTeX paragraph that doesn't end at a blank line runs
+  //   on into whatever follows it
+  *complete = length > 0 && !in_tag && !fence && !nul && !self->markdown 
+    && !self->latex && fkre_is_white (text[length - 1]);
+  return length;
+  }
+
+/*============================================================================
+  
+  fkre_document_update
+
+  Combine the counts for the blocks that have changed, and then for
+  the whole document.
+
+  ==========================================================================*/
+static void fkre_document_update (FKREDocument *self)
+  {
+  memset (&self->total, 0, sizeof (FKREPartial));
+  for (int j = 0; j < self->nblocks; j++)
+    {
+    FKREBlock *block = self->blocks[j];
+    if (block->dirty)
+      {
+      memset (&block->partial, 0, sizeof (FKREPartial));
+      for (int k = 0; k < block->count; k++)
+        fkre_partial_merge (&block->partial, &block->paragraphs[k].partial);
+      block->dirty = FALSE;
+      }
+    fkre_partial_merge (&self->total, &block->partial);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_document_replace
+
+  ==========================================================================*/
+int fkre_document_replace (FKREDocument *self, size_t offset,
+      size_t remove, const void *bytes, size_t length)
+  {
+  KLOG_IN
+  if (offset > self->length || remove > self->length - offset)
+    {
+    KLOG_OUT
+    return EINVAL;
+    }
+
+  // Gather the text of the paragraphs that the edit touches. An edit 
+  //   that removes nothing still changes the paragraph it falls in
+  int ret = 0;
+  int b = 0, i = 0;
+  size_t start = 0;
+  BYTE *region = NULL;
+  size_t region_length = 0;
+  if (fkre_document_locate (self, offset, &b, &i, &start))
+    {
+    do
+      {
+      size_t l;
+      BYTE *text = fkre_document_take (self, b, i, &l);
+      BYTE *r = realloc (region, region_length + l);
+      if (r)
+        {
+        region = r;
+        memcpy (region + region_length, text, l);
+        region_length += l;
+        }
+      else
+        ret = ENOMEM;
+      free (text);
+      } while (ret == 0 && start + region_length < offset + remove 
+          && fkre_document_next (self, &b, &i));
+    }
+
+  // Splice the new text into the old
+  BYTE *text = NULL;
+  size_t total = 0;
+  if (ret == 0)
+    {
+    size_t before = offset - start;
+    size_t after = region_length - before - remove;
+    total = before + length + after;
+    text = malloc (total > 0 ? total : 1);
+    if (text)
+      {
+      memcpy (text, region, before);
+      memcpy (text + before, bytes, length);
+      memcpy (text + before + length, region + before + remove, after);
+      }
+    else
+      ret = ENOMEM;
+    }
+  free (region);
+
+  // The new paragraphs go where the old ones were. If that was the
+  //   end of a block, they go on the end of it; if the document is
+  //   empty, they go in a new block
+  if (ret == 0 && b >= self->nblocks)
+    {
+    if (self->nblocks == 0)
+      {
+      if (!fkre_document_insert_block (self, 0)) ret = ENOMEM;
+      }
+    b = self->nblocks - 1;
+    i = ret == 0 ? self->blocks[b]->count : 0;
+    }
+
+  // Split the new text into paragraphs. If the last one ends in 
+  //   mid-word or in a tag, it is joined with the paragraph that
+  //   follows, and the split carries on
+  size_t done = 0;
+  while (ret == 0 && done < total)
+    {
+    BOOL complete;
+    size_t l = fkre_document_split (self, text + done, total - done,
+      &complete);
+    int nb = b, ni = i;
+    if (!complete && done + l == total 
+         && fkre_document_next (self, &nb, &ni))
+      {
+      size_t nl;
+      BYTE *next = fkre_document_take (self, nb, ni, &nl);
+      BYTE *t = realloc (text, total + nl);
+      if (t)
+        {
+        text = t;
+        memcpy (text + total, next, nl);
+        total += nl;
+        }
+      else
+        ret = ENOMEM;
+      free (next);
+      continue;
+      }
+
+    BYTE *p = malloc (l);
+    if (p) memcpy (p, text + done, l);
+    if (!p || !fkre_document_add_paragraph (self, b, i, p, l))
+      {
+      free (p);
+      ret = ENOMEM;
+      break;
+      }
+    done += l;
+    i++;
+    if (self->blocks[b]->count >= 2 * FKRE_BLOCK_SIZE)
+      {
+      if (!fkre_document_split_block (self, b)) 
+        ret = ENOMEM;
+      else if (i > self->blocks[b]->count)
+        {
+        i -= self->blocks[b]->count;
+        b++;
+        }
+      }
+    }
+  free (text);
+
+  // If memory ran out, some text may have been lost; but the document
+  //   is at least consistent with the text that it does hold
+  fkre_document_tidy (self);
+  fkre_document_update (self);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_document_get_metrics
+
+  ==========================================================================*/
+int fkre_document_get_metrics (const FKREDocument *self,
+      FKREMetrics *metrics)
+  {
+  KLOG_IN
+  if (metrics->size < offsetof (FKREMetrics, score) + sizeof (double))
+    {
+    KLOG_OUT
+    return EINVAL;
+    }
+
+  const FKREPartial *t = &self->total;
+  FKREMetrics m;
+  memset (&m, 0, sizeof (FKREMetrics));
+  m.size = metrics->size < sizeof (FKREMetrics) ?
+    metrics->size : sizeof (FKREMetrics);
+  m.flags = self->flags;
+  m.words = t->words;
+  m.sentences = t->sentences;
+  m.syllables = t->syllables;
+  m.passive_sentences = t->passive_sentences;
+  m.subheadings = t->subheadings;
+
+  // The run before the first sentence end is a complete sentence when
+  //   the whole document is taken together; the run after the last
+  //   is not
+  if (t->sentences > 0)
+    m.max_sentence_length = t->sentence_head > t->sentence_max ?
+      t->sentence_head : t->sentence_max;
+
+  // In HTML, Markdown, and LaTeX modes the end of the document closes 
+  //   the last subheading as well
+  if (self->html || self->markdown || self->latex)
+    {
+    int64_t max = t->subheading_tail;
+    if (t->subheadings > 0)
+      {
+      if (t->subheading_head > max) max = t->subheading_head;
+      if (t->subheading_max > max) max = t->subheading_max;
+      }
+    m.max_words_per_subheading = max;
+    }
+
+  fkre_metrics_score (&m);
+  memcpy (metrics, &m, m.size);
+  KLOG_OUT
+  return 0;
+  }
@@ -0,0 +1,229 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre_internal.h
+
+  Definitions shared between the parts of the library, which are not
+  part of its public interface.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+// The number of characters decoded from UTF-8 at a time, before being
+//   passed to the tokenizer
+#define FKRE_SCRATCH_SIZE 4096
+
+// Types and state for the finite-state machine used to split text 
+
+typedef enum 
+  {
+  STATE_START = 0, 
+  STATE_TAG = 1,
+  STATE_WHITE = 2,
+  STATE_TEXT = 3 
+  } State;
+
+typedef enum 
+  {
+  TYPE_UNKNOWN = 0, 
+  TYPE_STARTTAG = 1, 
+  TYPE_ENDTAG = 2, 
+  TYPE_WHITE = 3, 
+  TYPE_TEXT = 4, 
+  } Type;
+
+struct _FKREWindow;
+typedef struct _FKREWindow FKREWindow;
+
+struct _FKRELatex;
+typedef struct _FKRELatex FKRELatex;
+
+/*============================================================================
+  
+  FKREPartial
+
+  The counts for a piece of a document, tokenized on its own, in a form
+  that can be combined with the counts for the pieces either side of it.
+  Most counts just add up; the exceptions are those that depend on 
+  words either side of the join -- the sentence or subheading that
+  straddles it, and a passive expression split across it. For these we
+  keep the unfinished runs at the start ('head') and end ('tail') of
+  the piece, and the largest run wholly inside it. 
+
+  ==========================================================================*/
+typedef struct _FKREPartial
+  {
+  int64_t words;
+  int64_t syllables;
+  int64_t passive_sentences;
+  int64_t sentences;
+  int64_t sentence_head;
+  int64_t sentence_max;
+  int64_t sentence_tail;
+  int64_t subheadings;
+  int64_t subheading_head;
+  int64_t subheading_max;
+  int64_t subheading_tail;
+  // The first word is a participle, and the last a 'to be' verb, for 
+  //   the purposes of detecting passives
+  BOOL first_participle;
+  BOOL last_auxiliary;
+  } FKREPartial;
+
+/*============================================================================
+  
+  FKREContext
+
+  ==========================================================================*/
+struct _FKREContext
+  {
+  unsigned flags;
+  BOOL html;
+  BOOL finished;
+
+  // Counters
+  int64_t words;
+  int64_t sentences;
+  int64_t current_sentence_length;
+  int64_t max_sentence_length;
+  int64_t syllables;
+  int64_t words_in_this_subheading;
+  int64_t subheadings;
+  int64_t maximum_words_per_subheading;
+  int64_t passive_sentences;
+  // Subheadings have been marked by fkre_context_mark(), so the text
+  //   has structure even if it isn't HTML
+  BOOL marked_subheadings;
+  // There have been words since the last end of a sentence
+  BOOL sentence_open;
+
+  // The counts needed to make an FKREPartial, that aren't needed
+  //   for scoring a whole document
+  int64_t first_sentence_length;
+  int64_t inner_max_sentence_length;
+  int64_t first_subheading_words;
+  int64_t inner_max_words_per_subheading;
+  BOOL first_word_participle;
+
+  // Tokenizer state, carried over from one piece of text to the next
+  State state;
+  KString *word;
+  KString *tag;
+  KString *last_word;
+  // The number of characters tokenized so far, and the offsets of the
+  //   word being processed
+  int64_t position;
+  int64_t word_start;
+  int64_t word_end;
+
+  // UTF-8 decoder state -- the code point being assembled from a 
+  //   multi-byte sequence, and the number of bytes still needed
+  UTF32 pending;
+  int pending_needed;
+  UTF32 *scratch;
+
+  FKREWindow *window;
+
+  // Markdown state: the line being assembled, and the line before it,
+  //   held back in case this one turns it into a setext heading
+  BOOL markdown;
+  UTF32 *md_line;
+  size_t md_line_length;
+  size_t md_line_size;
+  UTF32 *md_held;
+  size_t md_held_length;
+  size_t md_held_size;
+  // The character and length of the fence, in a fenced code block
+  UTF32 md_fence;
+  size_t md_fence_length;
+  // The last line was blank, or in an indented code block, either of
+  //   which an indented line following it continues or starts
+  BOOL md_last_blank;
+  BOOL md_in_code;
+
+  // LaTeX state, only in LaTeX mode
+  FKRELatex *latex;
+
+  // Statistics, only with FKRE_FLAG_STATS
+  BOOL collect_stats;
+  FKREStats stats;
+  };
+
+BEGIN_DECLS
+
+/** Tokenize and count a block of characters, carrying on from wherever
+    the last block left off. This is the character-at-a-time state 
+    machine that all input eventually passes through, and it is the 
+    reference for 'make check': fed one character at a time, it must
+    count exactly what every faster way of scoring a document does. */
+extern void        fkre_process (FKREContext *context, const UTF32 *text, 
+                     size_t length);
+
+/** The state machine itself, without the Markdown line handling that 
+    fkre_process() puts in front of it in Markdown mode. */
+extern void        fkre_tokenize (FKREContext *context, const UTF32 *text, 
+                     size_t length);
+
+/** Decode UTF-8 from *in into at most 'max' characters, stopping at 
+    'end', and advance *in. A multi-byte character cut off by 'end' is
+    held in the context until the next call. */
+extern size_t      fkre_decode (FKREContext *context, const BYTE **in, 
+                     const BYTE *end, UTF32 *out, size_t max);
+
+/** Markdown mode's part of fkre_process(), and of flushing: the text
+    is handled a line at a time, and then passed to fkre_tokenize(). */
+extern void        fkre_markdown_process (FKREContext *context, 
+                     const UTF32 *text, size_t length);
+extern void        fkre_markdown_flush (FKREContext *context);
+extern void        fkre_markdown_reset (FKREContext *context);
+
+/** LaTeX mode's part of fkre_process(), and of flushing: markup is 
+    overwritten with spaces, and the rest passed to fkre_tokenize(). */
+extern FKRELatex  *fkre_latex_new (void);
+extern void        fkre_latex_destroy (FKRELatex *self);
+extern void        fkre_latex_reset (FKRELatex *self);
+extern void        fkre_latex_process (FKREContext *context, 
+                     const UTF32 *text, size_t length);
+extern void        fkre_latex_flush (FKREContext *context);
+/** Whether the LaTeX processor is in plain text, inside the document
+    body if there is one -- as it is at the start -- so that whatever 
+    follows would be processed as it would from the start. */
+extern BOOL        fkre_latex_at_rest (const FKRELatex *self);
+
+/** End the paragraph, and with it any sentence that is still open. */
+extern void        fkre_end_paragraph (FKREContext *context);
+extern void        fkre_start_subheading (FKREContext *context);
+
+extern Type        fkre_classify (BOOL html, int c);
+extern int         fkre_count_syllables (const KString *word);
+extern void        fkre_got_subheading (FKREContext *context);
+
+/** Process any word or character left incomplete at the end of the 
+    text fed so far, as if the text had ended there. */
+extern void        fkre_context_flush (FKREContext *context);
+
+/** Fill in the score, and whether there is one, from the counters. */
+extern void        fkre_metrics_score (FKREMetrics *metrics);
+
+extern void        fkre_partial_from_context (const FKREContext *context,
+                     FKREPartial *partial);
+extern void        fkre_partial_merge (FKREPartial *left, 
+                     const FKREPartial *right);
+
+extern FKREWindow *fkre_window_new (FKREWindowUnit unit, int size, 
+                     int stride, FKREWindowFn fn, void *user_data);
+extern void        fkre_window_destroy (FKREWindow *self);
+extern void        fkre_window_reset (FKREWindow *self);
+extern void        fkre_window_word (FKREWindow *self, int syllables, 
+                     BOOL has_letters, BOOL end_sentence, 
+                     int64_t start, int64_t end);
+extern void        fkre_window_finish (FKREWindow *self);
+
+END_DECLS
@@ -0,0 +1,686 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre_latex.c
+
+  LaTeX mode. A state machine of its own, a character at a time, in
+  front of the tokenizer. Comments, control sequences and their
+  options, the arguments of commands whose arguments aren't prose
+  (\cite, \ref, \label, \usepackage, ...), inline and display math,
+  verbatim-like environments, and the preamble are all overwritten
+  with spaces -- not deleted, so that offsets into the text stay the
+  same. What is left is the prose, which is tokenized as usual.
+  Sectioning commands start subheadings, and blank lines, \par,
+  \item, and the edges of environments end paragraphs.
+
+  Like the tokenizer, this carries its state from one block of text to
+  the next, so the text can be split anywhere.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_internal.h"
+
+#define KLOG_CLASS "fkre.latex"
+
+// Longer command and environment names are truncated; none that
+//   matter are this long
+#define FKRE_LATEX_MAX_NAME 31
+
+typedef enum
+  {
+  LATEX_TEXT = 0,
+  LATEX_COMMENT,
+  // Reading the name of a control sequence
+  LATEX_CONTROL,
+  // Between a control sequence and its arguments
+  LATEX_ARGS,
+  // Inside an argument that is being skipped
+  LATEX_SKIP_GROUP,
+  // Reading the name of an environment, after \begin or \end
+  LATEX_ENV_NAME,
+  // After a '$', which may be the first of two
+  LATEX_DOLLAR,
+  // Skipping until the end of math, or verbatim text
+  LATEX_MATH,
+  LATEX_VERBATIM,
+  // After \verb, which is followed by its delimiter
+  LATEX_VERB
+  } LatexState;
+
+// What a command does
+typedef enum
+  {
+  LATEX_CMD_SKIP = 0,
+  LATEX_CMD_SECTION,
+  LATEX_CMD_BEGIN,
+  LATEX_CMD_END,
+  LATEX_CMD_ITEM,
+  LATEX_CMD_PAR,
+  LATEX_CMD_VERB,
+  LATEX_CMD_DOCUMENTCLASS
+  } LatexCommand;
+
+/*============================================================================
+  
+  LatexEntry
+
+  A command or environment that needs special handling. 'args' is the
+  number of mandatory arguments that are skipped, not counted
+
+  ==========================================================================*/
+typedef struct _LatexEntry
+  {
+  const char *name;
+  LatexCommand command;
+  int args;
+  } LatexEntry;
+
+static const LatexEntry latex_commands[] =
+  {
+  { "part", LATEX_CMD_SECTION, 0 },
+  { "chapter", LATEX_CMD_SECTION, 0 },
+  { "section", LATEX_CMD_SECTION, 0 },
+  { "subsection", LATEX_CMD_SECTION, 0 },
+  { "subsubsection", LATEX_CMD_SECTION, 0 },
+  { "paragraph", LATEX_CMD_SECTION, 0 },
+  { "subparagraph", LATEX_CMD_SECTION, 0 },
+  { "begin", LATEX_CMD_BEGIN, 0 },
+  { "end", LATEX_CMD_END, 0 },
+  { "item", LATEX_CMD_ITEM, 0 },
+  { "bibitem", LATEX_CMD_ITEM, 1 },
+  { "par", LATEX_CMD_PAR, 0 },
+  { "verb", LATEX_CMD_VERB, 0 },
+  { "documentclass", LATEX_CMD_DOCUMENTCLASS, 1 },
+  { "cite", LATEX_CMD_SKIP, 1 },
+  { "citep", LATEX_CMD_SKIP, 1 },
+  { "citet", LATEX_CMD_SKIP, 1 },
+  { "nocite", LATEX_CMD_SKIP, 1 },
+  { "ref", LATEX_CMD_SKIP, 1 },
+  { "eqref", LATEX_CMD_SKIP, 1 },
+  { "pageref", LATEX_CMD_SKIP, 1 },
+  { "autoref", LATEX_CMD_SKIP, 1 },
+  { "cref", LATEX_CMD_SKIP, 1 },
+  { "Cref", LATEX_CMD_SKIP, 1 },
+  { "label", LATEX_CMD_SKIP, 1 },
+  { "index", LATEX_CMD_SKIP, 1 },
+  { "url", LATEX_CMD_SKIP, 1 },
+  { "href", LATEX_CMD_SKIP, 1 },
+  { "includegraphics", LATEX_CMD_SKIP, 1 },
+  { "input", LATEX_CMD_SKIP, 1 },
+  { "include", LATEX_CMD_SKIP, 1 },
+  { "usepackage", LATEX_CMD_SKIP, 1 },
+  { "bibliography", LATEX_CMD_SKIP, 1 },
+  { "bibliographystyle", LATEX_CMD_SKIP, 1 },
+  { "newcommand", LATEX_CMD_SKIP, 2 },
+  { "renewcommand", LATEX_CMD_SKIP, 2 },
+  { "providecommand", LATEX_CMD_SKIP, 2 },
+  { "newenvironment", LATEX_CMD_SKIP, 3 },
+  { "renewenvironment", LATEX_CMD_SKIP, 3 },
+  { "newtheorem", LATEX_CMD_SKIP, 2 },
+  { "setlength", LATEX_CMD_SKIP, 2 },
+  { "addtolength", LATEX_CMD_SKIP, 2 },
+  { "setcounter", LATEX_CMD_SKIP, 2 },
+  { "addtocounter", LATEX_CMD_SKIP, 2 },
+  { "vspace", LATEX_CMD_SKIP, 1 },
+  { "hspace", LATEX_CMD_SKIP, 1 },
+  { "pagestyle", LATEX_CMD_SKIP, 1 },
+  { "thispagestyle", LATEX_CMD_SKIP, 1 },
+  { "color", LATEX_CMD_SKIP, 1 },
+  { "textcolor", LATEX_CMD_SKIP, 1 },
+  { "definecolor", LATEX_CMD_SKIP, 3 },
+  { "author", LATEX_CMD_SKIP, 1 },
+  { "date", LATEX_CMD_SKIP, 1 },
+  { "thanks", LATEX_CMD_SKIP, 1 },
+  { NULL, 0, 0 }
+  };
+
+// Environments whose arguments aren't prose
+static const LatexEntry latex_environments[] =
+  {
+  { "tabular", LATEX_CMD_SKIP, 1 },
+  { "tabular*", LATEX_CMD_SKIP, 2 },
+  { "tabularx", LATEX_CMD_SKIP, 2 },
+  { "longtable", LATEX_CMD_SKIP, 1 },
+  { "array", LATEX_CMD_SKIP, 1 },
+  { "minipage", LATEX_CMD_SKIP, 1 },
+  { "multicols", LATEX_CMD_SKIP, 1 },
+  { "wrapfigure", LATEX_CMD_SKIP, 2 },
+  { "thebibliography", LATEX_CMD_SKIP, 1 },
+  { NULL, 0, 0 }
+  };
+
+// Environments whose contents are skipped, up to the \end
+static const char *const latex_verbatim[] =
+  {
+  "verbatim", "verbatim*", "Verbatim", "BVerbatim", "lstlisting",
+  "minted", "comment", "filecontents", "filecontents*", "alltt",
+  "tikzpicture", "picture", NULL
+  };
+
+static const char *const latex_math[] =
+  {
+  "equation", "equation*", "align", "align*", "alignat", "alignat*",
+  "gather", "gather*", "multline", "multline*", "flalign", "flalign*",
+  "eqnarray", "eqnarray*", "displaymath", "math", "dmath", "dmath*",
+  NULL
+  };
+
+/*============================================================================
+  
+  FKRELatex
+
+  ==========================================================================*/
+struct _FKRELatex
+  {
+  LatexState state;
+  size_t out_length;
+  // The command or environment name being read
+  char name[FKRE_LATEX_MAX_NAME + 1];
+  size_t name_length;
+  BOOL reading_name;
+  BOOL env_begin;
+  // The arguments still to be skipped
+  int skip_args;
+  // A sectioning command's argument is the next group
+  BOOL heading;
+  // Skipping a group: its delimiters, and how deeply nested
+  UTF32 group_open;
+  UTF32 group_close;
+  int group_depth;
+  BOOL escaped;
+  // The text that ends math or verbatim text, and how much of it has
+  //   been seen
+  UTF32 end[FKRE_LATEX_MAX_NAME + 8];
+  size_t end_length;
+  size_t matched;
+  BOOL dollar;
+  // Brace nesting in the text, and the depth of the heading's group
+  int depth;
+  int heading_depth;
+  // Consecutive newlines, two of which end a paragraph
+  int newlines;
+  // Skipping the argument of \verb, which ends with the line
+  BOOL verb;
+  // Outside \begin{document} ... \end{document}, when there is one
+  BOOL outside;
+  // Characters ready for the tokenizer -- last, so that resetting for
+  //   each document need not clear them
+  UTF32 out[FKRE_SCRATCH_SIZE];
+  };
+
+/*============================================================================
+  
+  fkre_latex_lookup
+
+  ==========================================================================*/
+static BOOL fkre_latex_in (const char *const *list, const char *name,
+      size_t length)
+  {
+  for (int i = 0; list[i]; i++)
+    if (strlen (list[i]) == length && memcmp (list[i], name, length) == 0)
+      return TRUE;
+  return FALSE;
+  }
+
+static const LatexEntry *fkre_latex_lookup (const LatexEntry *table,
+      const char *name)
+  {
+  for (int i = 0; table[i].name; i++)
+    if (strcmp (table[i].name, name) == 0) return &table[i];
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_latex_at_rest
+
+  ==========================================================================*/
+BOOL fkre_latex_at_rest (const FKRELatex *self)
+  {
+  return self->state == LATEX_TEXT && !self->outside;
+  }
+
+/*============================================================================
+  
+  fkre_latex_new
+
+  ==========================================================================*/
+FKRELatex *fkre_latex_new (void)
+  {
+  FKRELatex *self = malloc (sizeof (FKRELatex));
+  if (self) fkre_latex_reset (self);
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_latex_destroy
+
+  ==========================================================================*/
+void fkre_latex_destroy (FKRELatex *self)
+  {
+  free (self);
+  }
+
+/*============================================================================
+  
+  fkre_latex_reset
+
+  ==========================================================================*/
+void fkre_latex_reset (FKRELatex *self)
+  {
+  memset (self, 0, offsetof (FKRELatex, out));
+  self->state = LATEX_TEXT;
+  self->heading_depth = -1;
+  }
+
+/*============================================================================
+  
+  fkre_latex_emit
+
+  Pass the characters so far to the tokenizer -- before a subheading or
+  the end of a paragraph, which must come between the right words
+
+  ==========================================================================*/
+static void fkre_latex_emit (FKREContext *context, FKRELatex *self)
+  {
+  if (self->out_length > 0)
+    {
+    fkre_tokenize (context, self->out, self->out_length);
+    self->out_length = 0;
+    }
+  }
+
+static void fkre_latex_end_paragraph (FKREContext *context, FKRELatex *self)
+  {
+  if (self->outside) return;
+  fkre_latex_emit (context, self);
+  fkre_end_paragraph (context);
+  }
+
+/*============================================================================
+  
+  fkre_latex_skip_to
+
+  Skip until the text 'end' -- ASCII, or a name read from the text
+
+  ==========================================================================*/
+static void fkre_latex_skip_to (FKRELatex *self, LatexState state,
+      const char *end, BOOL dollar)
+  {
+  size_t l = strlen (end);
+  for (size_t i = 0; i < l; i++) self->end[i] = (BYTE)end[i];
+  self->end_length = l;
+  self->matched = 0;
+  self->dollar = dollar;
+  self->escaped = FALSE;
+  self->state = state;
+  }
+
+static void fkre_latex_skip_to_end (FKRELatex *self, LatexState state)
+  {
+  char end[FKRE_LATEX_MAX_NAME + 8];
+  snprintf (end, sizeof (end), "\\end{%s}", self->name);
+  fkre_latex_skip_to (self, state, end, FALSE);
+  }
+
+/*============================================================================
+  
+  fkre_latex_command
+
+  A control word has been read; decide what to do with it, and what
+  follows it
+
+  ==========================================================================*/
+static void fkre_latex_command (FKREContext *context, FKRELatex *self)
+  {
+  self->name[self->name_length] = 0;
+  const LatexEntry *e = fkre_latex_lookup (latex_commands, self->name);
+  self->state = LATEX_ARGS;
+  self->skip_args = e ? e->args : 0;
+  self->heading = FALSE;
+  if (!e) return;
+  switch (e->command)
+    {
+    case LATEX_CMD_SECTION:
+      fkre_latex_end_paragraph (context, self);
+      if (!self->outside)
+        {
+        fkre_latex_emit (context, self);
+        fkre_start_subheading (context);
+        }
+      self->heading = TRUE;
+      break;
+    case LATEX_CMD_BEGIN:
+    case LATEX_CMD_END:
+      self->state = LATEX_ENV_NAME;
+      self->env_begin = (e->command == LATEX_CMD_BEGIN);
+      self->reading_name = FALSE;
+      self->name_length = 0;
+      break;
+    case LATEX_CMD_ITEM:
+    case LATEX_CMD_PAR:
+      fkre_latex_end_paragraph (context, self);
+      break;
+    case LATEX_CMD_VERB:
+      self->state = LATEX_VERB;
+      break;
+    case LATEX_CMD_DOCUMENTCLASS:
+      // Everything up to \begin{document} is the preamble
+      self->outside = TRUE;
+      break;
+    default:;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_latex_environment
+
+  The name of an environment has been read
+
+  ==========================================================================*/
+static void fkre_latex_environment (FKREContext *context, FKRELatex *self)
+  {
+  self->name[self->name_length] = 0;
+  self->state = LATEX_ARGS;
+  self->skip_args = 0;
+  self->heading = FALSE;
+  if (strcmp (self->name, "document") == 0)
+    {
+    self->outside = self->env_begin ? FALSE : TRUE;
+    if (!self->env_begin) fkre_latex_emit (context, self);
+    return;
+    }
+  fkre_latex_end_paragraph (context, self);
+  if (!self->env_begin) return;
+  if (fkre_latex_in (latex_verbatim, self->name, self->name_length))
+    fkre_latex_skip_to_end (self, LATEX_VERBATIM);
+  else if (fkre_latex_in (latex_math, self->name, self->name_length))
+    fkre_latex_skip_to_end (self, LATEX_MATH);
+  else
+    {
+    const LatexEntry *e = fkre_latex_lookup (latex_environments,
+      self->name);
+    if (e) self->skip_args = e->args;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_latex_is_letter
+
+  ==========================================================================*/
+static BOOL fkre_latex_is_letter (UTF32 c)
+  {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+  }
+
+static BOOL fkre_latex_is_white (UTF32 c)
+  {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+/*============================================================================
+  
+  fkre_latex_process
+
+  ==========================================================================*/
+void fkre_latex_process (FKREContext *context, const UTF32 *text,
+      size_t length)
+  {
+  FKRELatex *self = context->latex;
+  size_t i = 0;
+  // The character whose newlines have been counted, so that one looked 
+  //   at twice is not counted twice
+  size_t counted = (size_t)-1;
+  while (i < length)
+    {
+    UTF32 c = text[i];
+    // What the tokenizer sees in place of c
+    UTF32 o = ' ';
+    // Whether c has been dealt with, or must be looked at again in the
+    //   new state
+    BOOL consumed = TRUE;
+
+    if (i != counted)
+      {
+      counted = i;
+      if (c == '\n') 
+        self->newlines++;
+      else if (!fkre_latex_is_white (c)) 
+        self->newlines = 0;
+      // As in TeX, a blank line ends everything but a verbatim
+      //   environment -- math, an argument, an unclosed brace -- so a
+      //   paragraph always starts from plain text
+      if (self->newlines == 2 && (self->state != LATEX_VERBATIM 
+          || self->verb))
+        {
+        self->state = LATEX_TEXT;
+        self->verb = FALSE;
+        self->depth = 0;
+        self->heading_depth = -1;
+        }
+      }
+
+    switch (self->state)
+      {
+      case LATEX_TEXT:
+        if (c == '%')
+          self->state = LATEX_COMMENT;
+        else if (c == '\\')
+          {
+          self->state = LATEX_CONTROL;
+          self->name_length = 0;
+          }
+        else if (c == '$')
+          self->state = LATEX_DOLLAR;
+        else if (c == '{')
+          self->depth++;
+        else if (c == '}')
+          {
+          if (self->depth == self->heading_depth)
+            {
+            fkre_latex_end_paragraph (context, self);
+            self->heading_depth = -1;
+            }
+          if (self->depth > 0) self->depth--;
+          }
+        else if (c == '~' || c == '&' || c == '^' || c == '_')
+          ;
+        else if (c == '\n')
+          {
+          o = c;
+          if (self->newlines == 2) fkre_latex_end_paragraph (context, self);
+          }
+        else if (!self->outside || fkre_latex_is_white (c)) 
+          o = c;
+        break;
+
+      case LATEX_COMMENT:
+        // The newline that ends a comment is still a newline
+        if (c == '\n')
+          {
+          self->state = LATEX_TEXT;
+          consumed = FALSE;
+          }
+        break;
+
+      case LATEX_CONTROL:
+        if (fkre_latex_is_letter (c))
+          {
+          if (self->name_length < FKRE_LATEX_MAX_NAME)
+            self->name[self->name_length++] = (char)c;
+          }
+        else if (self->name_length > 0)
+          {
+          // A starred form is handled like the plain one
+          if (c != '*') consumed = FALSE;
+          fkre_latex_command (context, self);
+          }
+        else if (c == '(')
+          fkre_latex_skip_to (self, LATEX_MATH, "\\)", FALSE);
+        else if (c == '[')
+          fkre_latex_skip_to (self, LATEX_MATH, "\\]", FALSE);
+        else if (c == '\\')
+          {
+          // A line break, which may have a length as an option
+          self->state = LATEX_ARGS;
+          self->skip_args = 0;
+          self->heading = FALSE;
+          }
+        else
+          {
+          // A control symbol: an escaped character, an accent, or a 
+          //   space
+          if (fkre_latex_is_white (c)) o = c;
+          self->state = LATEX_TEXT;
+          }
+        break;
+
+      case LATEX_ARGS:
+        if (fkre_latex_is_white (c))
+          o = c;
+        else if (c == '[')
+          {
+          self->state = LATEX_SKIP_GROUP;
+          self->group_open = '[';
+          self->group_close = ']';
+          self->group_depth = 1;
+          self->escaped = FALSE;
+          }
+        else if (c == '{' && self->skip_args > 0)
+          {
+          self->skip_args--;
+          self->state = LATEX_SKIP_GROUP;
+          self->group_open = '{';
+          self->group_close = '}';
+          self->group_depth = 1;
+          self->escaped = FALSE;
+          }
+        else if (c == '{' && self->heading)
+          {
+          self->heading = FALSE;
+          self->depth++;
+          self->heading_depth = self->depth;
+          self->state = LATEX_TEXT;
+          }
+        else
+          {
+          self->state = LATEX_TEXT;
+          consumed = FALSE;
+          }
+        break;
+
+      case LATEX_SKIP_GROUP:
+        if (self->escaped)
+          self->escaped = FALSE;
+        else if (c == '\\')
+          self->escaped = TRUE;
+        else if (c == self->group_open)
+          self->group_depth++;
+        else if (c == self->group_close && --self->group_depth == 0)
+          self->state = LATEX_ARGS;
+        break;
+
+      case LATEX_ENV_NAME:
+        if (!self->reading_name)
+          {
+          if (c == '{')
+            self->reading_name = TRUE;
+          else if (fkre_latex_is_white (c))
+            o = c;
+          else
+            {
+            self->state = LATEX_TEXT;
+            consumed = FALSE;
+            }
+          }
+        else if (c == '}')
+          fkre_latex_environment (context, self);
+        else if (self->name_length < FKRE_LATEX_MAX_NAME)
+          self->name[self->name_length++] = (char)c;
+        break;
+
+      case LATEX_DOLLAR:
+        if (c == '$')
+          fkre_latex_skip_to (self, LATEX_MATH, "$$", TRUE);
+        else
+          {
+          fkre_latex_skip_to (self, LATEX_MATH, "$", TRUE);
+          consumed = FALSE;
+          }
+        break;
+
+      case LATEX_MATH:
+      case LATEX_VERBATIM:
+        if (self->verb && c == '\n')
+          {
+          // \verb can't run past the end of the line
+          self->verb = FALSE;
+          self->state = LATEX_TEXT;
+          consumed = FALSE;
+          }
+        else if (self->dollar && (self->escaped || c == '\\'))
+          {
+          // An escaped '$' doesn't end math
+          self->escaped = !self->escaped;
+          self->matched = 0;
+          }
+        else if (c == self->end[self->matched])
+          {
+          if (++self->matched == self->end_length)
+            {
+            self->verb = FALSE;
+            self->state = LATEX_TEXT;
+            }
+          }
+        else
+          self->matched = (c == self->end[0]) ? 1 : 0;
+        break;
+
+      case LATEX_VERB:
+        if (c != '*')
+          {
+          self->end[0] = c;
+          self->end_length = 1;
+          self->matched = 0;
+          self->dollar = FALSE;
+          self->verb = TRUE;
+          self->state = LATEX_VERBATIM;
+          }
+        break;
+      }
+
+    if (consumed)
+      {
+      if (self->out_length == FKRE_SCRATCH_SIZE)
+        fkre_latex_emit (context, self);
+      self->out[self->out_length++] = o;
+      i++;
+      }
+    }
+  fkre_latex_emit (context, self);
+  }
+
+/*============================================================================
+  
+  fkre_latex_flush
+
+  ==========================================================================*/
+void fkre_latex_flush (FKREContext *context)
+  {
+  FKRELatex *self = context->latex;
+  fkre_latex_emit (context, self);
+  fkre_latex_end_paragraph (context, self);
+  }
@@ -0,0 +1,574 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre_markdown.c
+
+  Markdown mode. The text is gathered a line at a time, and each line
+  is classified -- as a heading, a code fence, code, a list item, or
+  paragraph text -- before it goes to the tokenizer. Markup within a
+  line is removed by overwriting it with spaces, rather than deleting
+  it, so that the offsets the tokenizer works out for words, and so
+  for windows, are still offsets into the original text. Lines that
+  aren't prose at all are not tokenized, but still count towards the
+  offsets.
+
+  Only the parts of Markdown that affect what counts as prose are
+  recognized: ATX and setext headings, fenced and indented code,
+  thematic breaks, block quotes, list markers, and link reference
+  definitions; and, within lines, code spans, links, images, autolinks,
+  inline HTML, bare URLs, emphasis, and backslash escapes.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_internal.h"
+
+#define KLOG_CLASS "fkre.markdown"
+
+/*============================================================================
+  
+  Character classes
+
+  ==========================================================================*/
+static BOOL fkre_md_is_space (UTF32 c)
+  {
+  return c == ' ' || c == '\t';
+  }
+
+static BOOL fkre_md_is_alnum (UTF32 c)
+  {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+    || (c >= '0' && c <= '9') || c >= 0x80;
+  }
+
+static BOOL fkre_md_is_punct (UTF32 c)
+  {
+  return c < 0x80 && c > ' ' && !fkre_md_is_alnum (c);
+  }
+
+/*============================================================================
+  
+  fkre_md_blank
+
+  ==========================================================================*/
+static void fkre_md_blank (UTF32 *line, size_t from, size_t to)
+  {
+  for (size_t i = from; i < to; i++) line[i] = ' ';
+  }
+
+/*============================================================================
+  
+  fkre_md_run
+
+  The number of times 'c' repeats, starting at 'from'
+
+  ==========================================================================*/
+static size_t fkre_md_run (const UTF32 *line, size_t from, size_t end,
+      UTF32 c)
+  {
+  size_t i = from;
+  while (i < end && line[i] == c) i++;
+  return i - from;
+  }
+
+/*============================================================================
+  
+  fkre_md_only
+
+  Whether the line from 'from' holds nothing but 'c' and white space
+
+  ==========================================================================*/
+static BOOL fkre_md_only (const UTF32 *line, size_t from, size_t end,
+      UTF32 c)
+  {
+  for (size_t i = from; i < end; i++)
+    if (line[i] != c && !fkre_md_is_space (line[i])) return FALSE;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_md_close
+
+  Find the bracket that closes the one at 'from', allowing for nesting
+  and escapes. Returns its index, or 0 if there isn't one
+
+  ==========================================================================*/
+static size_t fkre_md_close (const UTF32 *line, size_t from, size_t end,
+      UTF32 open, UTF32 close)
+  {
+  int depth = 0;
+  for (size_t i = from; i < end; i++)
+    {
+    if (line[i] == '\\')
+      i++;
+    else if (line[i] == open)
+      depth++;
+    else if (line[i] == close && --depth == 0)
+      return i;
+    }
+  return 0;
+  }
+
+/*============================================================================
+  
+  fkre_md_link
+
+  If a link -- [text](url) or [text][ref] -- starts at 'from', return
+  the index just past its end, and set *close to the index of the
+  bracket that closes its text. Otherwise return 0
+
+  ==========================================================================*/
+static size_t fkre_md_link (const UTF32 *line, size_t from, size_t end,
+      size_t *close)
+  {
+  size_t c = fkre_md_close (line, from, end, '[', ']');
+  if (c == 0 || c + 1 >= end) return 0;
+  size_t e = 0;
+  if (line[c + 1] == '(')
+    e = fkre_md_close (line, c + 1, end, '(', ')');
+  else if (line[c + 1] == '[')
+    e = fkre_md_close (line, c + 1, end, '[', ']');
+  if (e == 0) return 0;
+  *close = c;
+  return e + 1;
+  }
+
+/*============================================================================
+  
+  fkre_md_url_length
+
+  If a bare URL starts at 'from', return its length, not counting any
+  punctuation that ends the sentence it's in. Otherwise return 0
+
+  ==========================================================================*/
+static size_t fkre_md_url_length (const UTF32 *line, size_t from,
+      size_t end)
+  {
+  static const char *const prefixes[] = { "http://", "https://", "www." };
+  for (int p = 0; p < 3; p++)
+    {
+    const char *prefix = prefixes[p];
+    size_t l = strlen (prefix);
+    if (from + l > end) continue;
+    size_t i = 0;
+    while (i < l && line[from + i] == (UTF32)prefix[i]) i++;
+    if (i < l) continue;
+    size_t e = from + l;
+    while (e < end && !fkre_md_is_space (line[e])) e++;
+    while (e > from + l && (line[e - 1] == '.' || line[e - 1] == ','
+        || line[e - 1] == '?' || line[e - 1] == '!' || line[e - 1] == ')'))
+      e--;
+    return e - from;
+    }
+  return 0;
+  }
+
+/*============================================================================
+  
+  fkre_md_inline
+
+  Blank out the markup within a line, from 'from' to 'end', leaving the
+  text
+
+  ==========================================================================*/
+static void fkre_md_inline (UTF32 *line, size_t from, size_t end)
+  {
+  size_t i = from;
+  while (i < end)
+    {
+    UTF32 c = line[i];
+    BOOL word_start = (i == from || fkre_md_is_space (line[i - 1])
+      || line[i - 1] == '(');
+
+    if (c == '\\' && i + 1 < end && fkre_md_is_punct (line[i + 1]))
+      {
+      // The escaped character is text, whatever it is
+      line[i] = ' ';
+      i += 2;
+      continue;
+      }
+
+    if (c == '`')
+      {
+      // A code span ends with a run of backticks as long as the one
+      //   that starts it
+      size_t run = fkre_md_run (line, i, end, '`');
+      size_t j = i + run;
+      size_t found = 0;
+      while (j < end && !found)
+        {
+        if (line[j] == '`')
+          {
+          size_t r = fkre_md_run (line, j, end, '`');
+          if (r == run) found = j + r;
+          j += r;
+          }
+        else
+          j++;
+        }
+      size_t e = found ? found : i + run;
+      fkre_md_blank (line, i, e);
+      i = e;
+      continue;
+      }
+
+    size_t close;
+    if (c == '!' && i + 1 < end && line[i + 1] == '[')
+      {
+      // An image's alt text describes it; it isn't prose
+      size_t e = fkre_md_link (line, i + 1, end, &close);
+      if (e)
+        {
+        fkre_md_blank (line, i, e);
+        i = e;
+        continue;
+        }
+      }
+
+    if (c == '[')
+      {
+      // Keep a link's text, which may have markup of its own
+      size_t e = fkre_md_link (line, i, end, &close);
+      if (e)
+        {
+        line[i] = ' ';
+        fkre_md_blank (line, close, e);
+        i++;
+        continue;
+        }
+      }
+
+    if (c == '<' && i + 1 < end && (fkre_md_is_alnum (line[i + 1])
+        || line[i + 1] == '/' || line[i + 1] == '!'))
+      {
+      // An autolink, or inline HTML
+      size_t j = i + 1;
+      while (j < end && line[j] != '>') j++;
+      if (j < end)
+        {
+        fkre_md_blank (line, i, j + 1);
+        i = j + 1;
+        continue;
+        }
+      }
+
+    if (word_start)
+      {
+      size_t l = fkre_md_url_length (line, i, end);
+      if (l)
+        {
+        fkre_md_blank (line, i, i + l);
+        i += l;
+        continue;
+        }
+      }
+
+    // Emphasis. An underscore inside a word is part of it
+    if (c == '*' || c == '~')
+      line[i] = ' ';
+    else if (c == '_' && (i == from || !fkre_md_is_alnum (line[i - 1])
+        || i + 1 == end || !fkre_md_is_alnum (line[i + 1])))
+      line[i] = ' ';
+    i++;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_md_skip
+
+  Pass over a line that isn't prose
+
+  ==========================================================================*/
+static void fkre_md_skip (FKREContext *context, size_t length)
+  {
+  context->position += length;
+  }
+
+/*============================================================================
+  
+  fkre_md_release
+
+  Tokenize the line held back, now that it's known not to be a heading
+
+  ==========================================================================*/
+static void fkre_md_release (FKREContext *context)
+  {
+  if (context->md_held_length > 0)
+    {
+    fkre_tokenize (context, context->md_held, context->md_held_length);
+    context->md_held_length = 0;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_md_end_block
+
+  A line that starts a new block ends the paragraph before it
+
+  ==========================================================================*/
+static void fkre_md_end_block (FKREContext *context)
+  {
+  fkre_md_release (context);
+  fkre_end_paragraph (context);
+  }
+
+/*============================================================================
+  
+  fkre_md_list_marker
+
+  If a list item's marker starts at 'from', return its length
+
+  ==========================================================================*/
+static size_t fkre_md_list_marker (const UTF32 *line, size_t from,
+      size_t end)
+  {
+  UTF32 c = line[from];
+  size_t i = from;
+  if (c == '-' || c == '*' || c == '+')
+    i++;
+  else
+    {
+    while (i < end && i - from < 9 && line[i] >= '0' && line[i] <= '9') i++;
+    if (i == from || i >= end || (line[i] != '.' && line[i] != ')'))
+      return 0;
+    i++;
+    }
+  if (i < end && !fkre_md_is_space (line[i])) return 0;
+  return i - from;
+  }
+
+/*============================================================================
+  
+  fkre_md_line
+
+  Classify a complete line, and tokenize whatever prose it holds
+
+  ==========================================================================*/
+static void fkre_md_line (FKREContext *context, UTF32 *line, size_t length)
+  {
+  size_t end = length;
+  while (end > 0 && (line[end - 1] == '\n' || line[end - 1] == '\r')) end--;
+  size_t p = 0;
+  int column = 0;
+  while (p < end && fkre_md_is_space (line[p]))
+    {
+    column = line[p] == '\t' ? (column + 4) & ~3 : column + 1;
+    p++;
+    }
+
+  if (context->md_fence)
+    {
+    // Everything up to the closing fence is code
+    if (column < 4 && fkre_md_run (line, p, end, context->md_fence)
+          >= context->md_fence_length
+        && fkre_md_only (line, p, end, context->md_fence))
+      context->md_fence = 0;
+    fkre_md_skip (context, length);
+    return;
+    }
+
+  if (p == end)
+    {
+    fkre_md_end_block (context);
+    context->md_last_blank = TRUE;
+    fkre_md_skip (context, length);
+    return;
+    }
+
+  if (column >= 4 && context->md_held_length == 0
+      && (context->md_last_blank || context->md_in_code))
+    {
+    // Indented code, which can't interrupt a paragraph
+    context->md_in_code = TRUE;
+    context->md_last_blank = FALSE;
+    fkre_md_skip (context, length);
+    return;
+    }
+  context->md_last_blank = FALSE;
+  context->md_in_code = FALSE;
+
+  if (column < 4)
+    {
+    UTF32 c = line[p];
+    size_t run = fkre_md_run (line, p, end, c);
+
+    if ((c == '`' || c == '~') && run >= 3)
+      {
+      BOOL fence = TRUE;
+      // A backtick fence's info string can't contain backticks
+      for (size_t i = p + run; i < end && c == '`'; i++)
+        if (line[i] == '`') fence = FALSE;
+      if (fence)
+        {
+        fkre_md_end_block (context);
+        context->md_fence = c;
+        context->md_fence_length = run;
+        fkre_md_skip (context, length);
+        return;
+        }
+      }
+
+    if (c == '#' && run <= 6 && (p + run == end
+        || fkre_md_is_space (line[p + run])))
+      {
+      fkre_md_end_block (context);
+      fkre_start_subheading (context);
+      fkre_md_blank (line, 0, p + run);
+      // An optional closing run of #s
+      size_t e = end;
+      while (e > p + run && fkre_md_is_space (line[e - 1])) e--;
+      size_t h = e;
+      while (h > p + run && line[h - 1] == '#') h--;
+      if (h < e && fkre_md_is_space (line[h - 1]))
+        fkre_md_blank (line, h, e);
+      fkre_md_inline (line, p + run, end);
+      fkre_tokenize (context, line, length);
+      fkre_end_paragraph (context);
+      return;
+      }
+
+    if ((c == '=' || c == '-') && context->md_held_length > 0
+        && fkre_md_only (line, p, end, c))
+      {
+      // The line held back was a setext heading
+      fkre_start_subheading (context);
+      fkre_md_end_block (context);
+      fkre_md_skip (context, length);
+      return;
+      }
+
+    if ((c == '-' || c == '*' || c == '_'))
+      {
+      size_t n = 0;
+      for (size_t i = p; i < end; i++)
+        if (line[i] == c) n++;
+      if (n >= 3 && fkre_md_only (line, p, end, c))
+        {
+        // A thematic break
+        fkre_md_end_block (context);
+        fkre_md_skip (context, length);
+        return;
+        }
+      }
+
+    if (c == '[')
+      {
+      size_t close = fkre_md_close (line, p, end, '[', ']');
+      if (close && close + 1 < end && line[close + 1] == ':')
+        {
+        // A link reference definition
+        fkre_md_end_block (context);
+        fkre_md_skip (context, length);
+        return;
+        }
+      }
+
+    // Block quote markers, which may be nested
+    while (p < end && line[p] == '>')
+      {
+      line[p++] = ' ';
+      while (p < end && fkre_md_is_space (line[p])) p++;
+      }
+
+    size_t marker = p < end ? fkre_md_list_marker (line, p, end) : 0;
+    if (marker)
+      {
+      // Each list item is a paragraph of its own
+      fkre_md_end_block (context);
+      fkre_md_blank (line, p, p + marker);
+      fkre_md_inline (line, p + marker, end);
+      fkre_tokenize (context, line, length);
+      return;
+      }
+    }
+
+  // Paragraph text, which is held back until the next line shows
+  //   whether it's a setext heading
+  fkre_md_release (context);
+  fkre_md_inline (line, p, end);
+  UTF32 *held = context->md_held;
+  size_t held_size = context->md_held_size;
+  context->md_held = context->md_line;
+  context->md_held_size = context->md_line_size;
+  context->md_held_length = length;
+  context->md_line = held;
+  context->md_line_size = held_size;
+  }
+
+/*============================================================================
+  
+  fkre_markdown_process
+
+  ==========================================================================*/
+void fkre_markdown_process (FKREContext *context, const UTF32 *text,
+      size_t length)
+  {
+  size_t i = 0;
+  while (i < length)
+    {
+    size_t j = i;
+    while (j < length && text[j] != '\n') j++;
+    if (j < length) j++;
+    size_t n = j - i;
+    if (context->md_line_length + n > context->md_line_size)
+      {
+      context->md_line_size = (context->md_line_length + n) * 2;
+      context->md_line = realloc (context->md_line,
+        context->md_line_size * sizeof (UTF32));
+      }
+    memcpy (context->md_line + context->md_line_length, text + i,
+      n * sizeof (UTF32));
+    context->md_line_length += n;
+    if (text[j - 1] == '\n')
+      {
+      size_t l = context->md_line_length;
+      context->md_line_length = 0;
+      fkre_md_line (context, context->md_line, l);
+      }
+    i = j;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_markdown_flush
+
+  The text so far ends a line, and a paragraph
+
+  ==========================================================================*/
+void fkre_markdown_flush (FKREContext *context)
+  {
+  if (context->md_line_length > 0)
+    {
+    size_t l = context->md_line_length;
+    context->md_line_length = 0;
+    fkre_md_line (context, context->md_line, l);
+    }
+  fkre_md_end_block (context);
+  }
+
+/*============================================================================
+  
+  fkre_markdown_reset
+
+  ==========================================================================*/
+void fkre_markdown_reset (FKREContext *context)
+  {
+  context->md_line_length = 0;
+  context->md_held_length = 0;
+  context->md_fence = 0;
+  context->md_fence_length = 0;
+  context->md_last_blank = TRUE;
+  context->md_in_code = FALSE;
+  }
@@ -0,0 +1,265 @@
+/*============================================================================
+  
+  libfkre
+  
+  fkre_window.c
+
+  Sliding-window scores. The window keeps a fixed-size ring of 
+  per-sentence (or per-word) counts, and running totals over the ring. 
+  Adding a unit and evicting the oldest are both constant-time, 
+  whatever the size of the window.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <klib/klib.h> 
+#include "fkre_internal.h" 
+
+#define KLOG_CLASS "fkre.window"
+
+// One entry in the window's ring -- a sentence or a word, according to
+//   the window unit. start and end are character offsets into the text;
+//   end is that of the character after the last one
+
+typedef struct _FKREWindowItem
+  {
+  int words;
+  int sentences;
+  int syllables;
+  int64_t start;
+  int64_t end;
+  } FKREWindowItem;
+
+/*============================================================================
+  
+  FKREWindow
+
+  ==========================================================================*/
+struct _FKREWindow
+  {
+  FKREWindowUnit unit;
+  int size;
+  int stride;
+  FKREWindowItem *ring;
+  int head;
+  int count;
+  int since_emit;
+  int emitted;
+  int64_t words;
+  int64_t sentences;
+  int64_t syllables;
+  FKREWindowItem current;
+  FKREWindowFn fn;
+  void *user_data;
+  };
+
+/*============================================================================
+  
+  fkre_window_new
+
+  Returns NULL if memory is exhausted
+
+  ==========================================================================*/
+FKREWindow *fkre_window_new (FKREWindowUnit unit, int size, int stride,
+      FKREWindowFn fn, void *user_data)
+  {
+  KLOG_IN
+  FKREWindow *self = malloc (sizeof (FKREWindow));
+  if (self)
+    {
+    memset (self, 0, sizeof (FKREWindow));
+    self->unit = unit;
+    self->size = size;
+    self->stride = stride;
+    self->ring = malloc (size * sizeof (FKREWindowItem));
+    self->current.start = -1;
+    self->fn = fn;
+    self->user_data = user_data;
+    if (!self->ring)
+      {
+      free (self);
+      self = NULL;
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_window_destroy
+
+  ==========================================================================*/
+void fkre_window_destroy (FKREWindow *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    free (self->ring);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_window_reset
+
+  ==========================================================================*/
+void fkre_window_reset (FKREWindow *self)
+  {
+  KLOG_IN
+  self->head = 0;
+  self->count = 0;
+  self->since_emit = 0;
+  self->emitted = 0;
+  self->words = 0;
+  self->sentences = 0;
+  self->syllables = 0;
+  memset (&self->current, 0, sizeof (FKREWindowItem));
+  self->current.start = -1;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_window_emit
+
+  Report the character offsets of the first and last characters in the
+  window, and the FK score of the text in it. A window of words that 
+  contains no sentence end is treated as part of a single (long) 
+  sentence.
+
+  ==========================================================================*/
+static void fkre_window_emit (FKREWindow *self)
+  {
+  KLOG_IN
+  if (self->count > 0 && self->words > 0)
+    {
+    int oldest = (self->head - self->count + self->size) % self->size;
+    int newest = (self->head - 1 + self->size) % self->size;
+    double twords = self->words;
+    double tsents = self->sentences > 0 ? self->sentences : 1;
+    double tsylls = self->syllables;
+    double score = 206.835 
+       - 1.015 * (twords / tsents) 
+       - 84.6 * (tsylls / twords);
+    self->fn (self->user_data, self->ring[oldest].start, 
+      self->ring[newest].end - 1, score);
+    self->emitted++;
+    }
+  self->since_emit = 0;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_window_push
+
+  Add a sentence or word to the window, evicting the oldest if the
+  ring is full, and emit a score every 'stride' units once the window
+  has filled.
+
+  ==========================================================================*/
+static void fkre_window_push (FKREWindow *self, const FKREWindowItem *item)
+  {
+  KLOG_IN
+  if (self->count == self->size)
+    {
+    FKREWindowItem *old = &self->ring[self->head];
+    self->words -= old->words;
+    self->sentences -= old->sentences;
+    self->syllables -= old->syllables;
+    self->count--;
+    }
+  self->ring[self->head] = *item;
+  self->head = (self->head + 1) % self->size;
+  self->count++;
+  self->words += item->words;
+  self->sentences += item->sentences;
+  self->syllables += item->syllables;
+  self->since_emit++;
+  if (self->count == self->size && self->since_emit >= self->stride)
+    fkre_window_emit (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_window_word
+
+  Called for every word, with the number of syllables it has (which
+  might be zero, if it has no letters), and whether it ends a sentence.
+
+  ==========================================================================*/
+void fkre_window_word (FKREWindow *self, int syllables, BOOL has_letters,
+       BOOL end_sentence, int64_t start, int64_t end)
+  {
+  KLOG_IN
+  if (self->unit == FKRE_WINDOW_WORDS)
+    {
+    if (has_letters)
+      {
+      FKREWindowItem item = { 1, end_sentence ? 1 : 0, syllables, 
+        start, end };
+      fkre_window_push (self, &item);
+      }
+    else if (end_sentence && self->count > 0)
+      {
+      // Something like "42." ends a sentence, but isn't a word. Credit
+      //   the sentence end to the last word in the ring
+      int newest = (self->head - 1 + self->size) % self->size;
+      self->ring[newest].sentences++;
+      self->ring[newest].end = end;
+      self->sentences++;
+      }
+    }
+  else
+    {
+    FKREWindowItem *cur = &self->current;
+    if (has_letters)
+      {
+      if (cur->start < 0) cur->start = start;
+      cur->words++;
+      cur->syllables += syllables;
+      }
+    cur->end = end;
+    if (end_sentence)
+      {
+      if (cur->start < 0) cur->start = start;
+      cur->sentences = 1;
+      fkre_window_push (self, cur);
+      memset (cur, 0, sizeof (FKREWindowItem));
+      cur->start = -1;
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_window_finish
+
+  At the end of the text, emit a final score if there are units that 
+  have not been covered by an emitted window -- this includes the case
+  where the text is shorter than the window. In sentences, any words
+  after the last sentence end are a unit of their own.
+
+  ==========================================================================*/
+void fkre_window_finish (FKREWindow *self)
+  {
+  KLOG_IN
+  if (self->unit == FKRE_WINDOW_SENTENCES && self->current.words > 0)
+    {
+    fkre_window_push (self, &self->current);
+    memset (&self->current, 0, sizeof (FKREWindowItem));
+    self->current.start = -1;
+    }
+  if (self->since_emit > 0 || self->emitted == 0)
+    fkre_window_emit (self);
+  KLOG_OUT
+  }
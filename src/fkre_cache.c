@@ -0,0 +1,474 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_cache.c
+
+  Each result is a small text file, named after its key in hex, in a
+  subdirectory named after the first two hex digits, so that no one
+  directory gets too large. The file-status records are kept the same
+  way, under 'stat/', keyed by a hash of the file's device and inode.
+  Files are written to a temporary name and renamed, so that a reader
+  -- perhaps another fkre process sharing the cache -- never sees a
+  partial record. Anything that can't be parsed is treated as a miss.
+
+  A file that was modified in the last couple of seconds might be
+  modified again without its modification time changing, if the
+  filesystem's timestamps are coarse. So no status record is written
+  for such a file -- it will be hashed again next time.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_hash.h"
+#include "fkre_cache.h"
+
+#define KLOG_CLASS "fkre.cache"
+
+// Changed whenever the format of the cache files changes
+#define CACHE_FORMAT 1
+
+// Files modified more recently than this are not given status records
+#define RACY_SECONDS 2
+
+/*============================================================================
+  
+  FKRECache
+
+  ==========================================================================*/
+struct _FKRECache
+  {
+  char *dir;
+  unsigned flags;
+  // Mixed into every key, so that results from other versions of fkre,
+  //   or with other options, are never found
+  uint64_t seed;
+  // The counters are updated atomically, so that the cache can be
+  //   used from several threads at once
+  int64_t hits;
+  int64_t stat_hits;
+  int64_t misses;
+  // So that a write failure is only reported once
+  BOOL write_failed;
+  };
+
+/*============================================================================
+  
+  fkre_cache_new
+
+  ==========================================================================*/
+FKRECache *fkre_cache_new (const char *dir, unsigned flags)
+  {
+  KLOG_IN
+  FKRECache *self = NULL;
+  if (mkdir (dir, 0777) == 0 || errno == EEXIST)
+    {
+    self = malloc (sizeof (FKRECache));
+    memset (self, 0, sizeof (FKRECache));
+    self->dir = strdup (dir);
+    self->flags = flags;
+    char *id;
+    if (asprintf (&id, "%s %s %s %d %u", NAME, VERSION, fkre_version (),
+          CACHE_FORMAT, flags) >= 0)
+      {
+      self->seed = fkre_hash64 (id, strlen (id), 0);
+      free (id);
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_cache_destroy
+
+  ==========================================================================*/
+void fkre_cache_destroy (FKRECache *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    free (self->dir);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_cache_path
+
+  The path of the file for a key, under the subdirectory 'sub' (which
+  may be empty). The caller frees the result.
+
+  ==========================================================================*/
+static char *fkre_cache_path (const FKRECache *self, const char *sub,
+      uint64_t key)
+  {
+  char *path = NULL;
+  if (asprintf (&path, "%s/%s%02x/%014" PRIx64, self->dir, sub,
+        (unsigned)(key >> 56), (uint64_t)(key & 0x00FFFFFFFFFFFFFFULL)) < 0)
+    path = NULL;
+  return path;
+  }
+
+/*============================================================================
+  
+  fkre_cache_read
+
+  Read a (small) cache file into a buffer. Returns FALSE if it doesn't
+  exist or can't be read.
+
+  ==========================================================================*/
+static BOOL fkre_cache_read (const char *path, char *buff, size_t size)
+  {
+  BOOL ret = FALSE;
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+    ssize_t n = read (fd, buff, size - 1);
+    if (n > 0)
+      {
+      buff[n] = 0;
+      ret = TRUE;
+      }
+    close (fd);
+    }
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_cache_write
+
+  Write a cache file, atomically, creating its subdirectory if need be.
+
+  ==========================================================================*/
+static void fkre_cache_write (FKRECache *self, const char *path,
+      const char *data)
+  {
+  KLOG_IN
+  char *tmp = NULL;
+  int fd = -1;
+  if (asprintf (&tmp, "%s.XXXXXX", path) >= 0)
+    {
+    fd = mkstemp (tmp);
+    if (fd < 0 && errno == ENOENT)
+      {
+      // Make the subdirectories, and try again
+      char *dir = strdup (path);
+      for (char *p = dir + strlen (self->dir) + 1; *p; p++)
+        {
+        if (*p == '/')
+          {
+          *p = 0;
+          mkdir (dir, 0777);
+          *p = '/';
+          }
+        }
+      free (dir);
+      // A failed mkstemp() can leave the template changed
+      memcpy (tmp + strlen (tmp) - 6, "XXXXXX", 6);
+      fd = mkstemp (tmp);
+      }
+    }
+
+  BOOL ok = FALSE;
+  if (fd >= 0)
+    {
+    size_t l = strlen (data);
+    ok = (write (fd, data, l) == (ssize_t)l);
+    if (close (fd) != 0) ok = FALSE;
+    if (ok) ok = (rename (tmp, path) == 0);
+    if (!ok) unlink (tmp);
+    }
+
+  if (!ok && !self->write_failed)
+    {
+    klog_warn (KLOG_CLASS, "Can't write to cache '%s': %s", self->dir,
+      strerror (errno));
+    self->write_failed = TRUE;
+    }
+  free (tmp);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_cache_stat_key
+
+  The key under which the status record for a file is kept
+
+  ==========================================================================*/
+static uint64_t fkre_cache_stat_key (const FKRECache *self,
+      const struct stat *sb)
+  {
+  uint64_t id[2];
+  id[0] = sb->st_dev;
+  id[1] = sb->st_ino;
+  return fkre_hash64 (id, sizeof (id), self->seed);
+  }
+
+/*============================================================================
+  
+  fkre_cache_format_stat
+
+  ==========================================================================*/
+static void fkre_cache_format_stat (const struct stat *sb, uint64_t key,
+      char *buff, size_t size)
+  {
+  snprintf (buff, size, "fkre-stat %d %" PRId64 " %" PRId64 " %ld %" PRId64
+    " %ld %016" PRIx64 "\n", CACHE_FORMAT, (int64_t)sb->st_size,
+    (int64_t)sb->st_mtim.tv_sec, (long)sb->st_mtim.tv_nsec,
+    (int64_t)sb->st_ctim.tv_sec, (long)sb->st_ctim.tv_nsec, key);
+  }
+
+/*============================================================================
+  
+  fkre_cache_lookup_stat
+
+  Look for a status record that matches the file's current status, and
+  return the key it holds.
+
+  ==========================================================================*/
+static BOOL fkre_cache_lookup_stat (const FKRECache *self,
+      const struct stat *sb, uint64_t *key)
+  {
+  BOOL ret = FALSE;
+  char *path = fkre_cache_path (self, "stat/",
+    fkre_cache_stat_key (self, sb));
+  char buff[256];
+  if (path && fkre_cache_read (path, buff, sizeof (buff)))
+    {
+    // The record holds the status and the key; if the status matches,
+    //   the whole record will be the same as one written now
+    uint64_t k;
+    char *p = strrchr (buff, ' ');
+    if (p && sscanf (p + 1, "%" SCNx64, &k) == 1)
+      {
+      char expect[256];
+      fkre_cache_format_stat (sb, k, expect, sizeof (expect));
+      if (strcmp (buff, expect) == 0)
+        {
+        *key = k;
+        ret = TRUE;
+        }
+      }
+    }
+  free (path);
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_cache_store_stat
+
+  ==========================================================================*/
+static void fkre_cache_store_stat (FKRECache *self, const struct stat *sb,
+      uint64_t key)
+  {
+  time_t now = time (NULL);
+  if (sb->st_mtim.tv_sec >= now - RACY_SECONDS
+       || sb->st_ctim.tv_sec >= now - RACY_SECONDS)
+    return;
+  char *path = fkre_cache_path (self, "stat/",
+    fkre_cache_stat_key (self, sb));
+  if (path)
+    {
+    char buff[256];
+    fkre_cache_format_stat (sb, key, buff, sizeof (buff));
+    fkre_cache_write (self, path, buff);
+    free (path);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_cache_lookup
+
+  Look for the results stored under a key, for a file of the given
+  size. The size is stored as a check against hash collisions.
+
+  ==========================================================================*/
+static BOOL fkre_cache_lookup (const FKRECache *self, uint64_t key,
+      int64_t size, FKREMetrics *m)
+  {
+  BOOL ret = FALSE;
+  char *path = fkre_cache_path (self, "", key);
+  char buff[512];
+  if (path && fkre_cache_read (path, buff, sizeof (buff)))
+    {
+    int format, have_score;
+    int64_t stored_size;
+    char score[64];
+    if (sscanf (buff, "fkre-result %d %" SCNd64 " %" SCNd64 " %" SCNd64
+         " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64
+         " %d %63s", &format, &stored_size, &m->words, &m->sentences,
+         &m->syllables, &m->max_sentence_length, &m->passive_sentences,
+         &m->subheadings, &m->max_words_per_subheading, &have_score,
+         score) == 11
+        && format == CACHE_FORMAT && stored_size == size)
+      {
+      m->size = sizeof (FKREMetrics);
+      m->flags = self->flags;
+      m->have_score = have_score;
+      m->score = strtod (score, NULL);
+      ret = TRUE;
+      }
+    }
+  free (path);
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_cache_store
+
+  The score is stored in hex floating-point, so that it is read back
+  exactly.
+
+  ==========================================================================*/
+static void fkre_cache_store (FKRECache *self, uint64_t key, int64_t size,
+      const FKREMetrics *m)
+  {
+  char *path = fkre_cache_path (self, "", key);
+  if (path)
+    {
+    char buff[512];
+    snprintf (buff, sizeof (buff), "fkre-result %d %" PRId64 " %" PRId64
+      " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %"
+      PRId64 " %d %a\n", CACHE_FORMAT, size, m->words, m->sentences,
+      m->syllables, m->max_sentence_length, m->passive_sentences,
+      m->subheadings, m->max_words_per_subheading, (int)m->have_score,
+      m->score);
+    fkre_cache_write (self, path, buff);
+    free (path);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_cache_hash_file
+
+  ==========================================================================*/
+static BOOL fkre_cache_hash_file (const FKRECache *self, const char *filename,
+      uint64_t *key)
+  {
+  BOOL ret = FALSE;
+  int fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+    BYTE buff[FKRE_INPUT_BLOCK];
+    FKREHash hash;
+    fkre_hash_init (&hash, self->seed);
+    ssize_t n;
+    while ((n = read (fd, buff, sizeof (buff))) > 0
+        || (n < 0 && errno == EINTR))
+      {
+      if (n > 0) fkre_hash_update (&hash, buff, n);
+      }
+    ret = (n == 0);
+    *key = fkre_hash_final (&hash);
+    int e = errno;
+    close (fd);
+    errno = e;
+    }
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_cache_score_file
+
+  ==========================================================================*/
+BOOL fkre_cache_score_file (FKRECache *self, FKREContext *context,
+      const char *filename, FKREMetrics *metrics)
+  {
+  KLOG_IN
+  struct stat sb;
+  if (stat (filename, &sb) != 0)
+    {
+    KLOG_OUT
+    return FALSE;
+    }
+
+  uint64_t key;
+  if (fkre_cache_lookup_stat (self, &sb, &key)
+       && fkre_cache_lookup (self, key, sb.st_size, metrics))
+    {
+    klog_debug (KLOG_CLASS, "'%s' unchanged", filename);
+    __atomic_add_fetch (&self->hits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&self->stat_hits, 1, __ATOMIC_RELAXED);
+    KLOG_OUT
+    return TRUE;
+    }
+
+  if (!fkre_cache_hash_file (self, filename, &key))
+    {
+    KLOG_OUT
+    return FALSE;
+    }
+
+  BOOL ret = TRUE;
+  if (fkre_cache_lookup (self, key, sb.st_size, metrics))
+    {
+    klog_debug (KLOG_CLASS, "'%s' found in cache", filename);
+    __atomic_add_fetch (&self->hits, 1, __ATOMIC_RELAXED);
+    }
+  else
+    {
+    fkre_context_reset (context);
+    ret = fkre_feed_file (context, filename);
+    if (ret)
+      {
+      fkre_context_finish (context);
+      metrics->size = sizeof (FKREMetrics);
+      fkre_context_get_metrics (context, metrics);
+      __atomic_add_fetch (&self->misses, 1, __ATOMIC_RELAXED);
+      // If the file changed while it was being read, what was scored 
+      //   might not be what was hashed
+      struct stat sb2;
+      if (stat (filename, &sb2) == 0 && sb2.st_size == sb.st_size
+           && sb2.st_mtim.tv_sec == sb.st_mtim.tv_sec
+           && sb2.st_mtim.tv_nsec == sb.st_mtim.tv_nsec)
+        fkre_cache_store (self, key, sb.st_size, metrics);
+      else
+        {
+        KLOG_OUT
+        return ret;
+        }
+      }
+    }
+  if (ret) fkre_cache_store_stat (self, &sb, key);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_cache_get_stats
+
+  ==========================================================================*/
+void fkre_cache_get_stats (const FKRECache *self, int64_t *hits,
+      int64_t *stat_hits, int64_t *misses)
+  {
+  *hits = self->hits;
+  *stat_hits = self->stat_hits;
+  *misses = self->misses;
+  }
@@ -0,0 +1,52 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_cache.h
+
+  An on-disk cache of results, so that repeated runs over the same files
+  don't have to score them again.
+
+  Results are stored under a key made from a hash of the file's
+  contents, together with the version of fkre and the options that
+  affect scoring; so a file that has not changed, or has the same
+  contents as another, is found in the cache, and a change of version
+  or options never finds stale results. To save even reading the file,
+  the cache also records the key last found for each file, with its
+  inode, size, and modification times. If these have not changed, the
+  key is used without hashing the file.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+struct _FKRECache;
+typedef struct _FKRECache FKRECache;
+
+BEGIN_DECLS
+
+/** Open the cache in 'dir', creating the directory if necessary. 'flags'
+    are those the context is created with. Returns NULL, with errno set,
+    if the directory can't be created. */
+extern FKRECache *fkre_cache_new (const char *dir, unsigned flags);
+extern void       fkre_cache_destroy (FKRECache *self);
+
+/** Get the metrics for a file, from the cache if they are there, or by
+    scoring it with 'context' and storing the results if not. Returns
+    FALSE, with errno set, if the file can't be read. Failing to write
+    to the cache is not an error. */
+extern BOOL       fkre_cache_score_file (FKRECache *self,
+                    FKREContext *context, const char *filename,
+                    FKREMetrics *metrics);
+
+/** Get the number of files found in the cache, how many of those were
+    found without reading the file, and the number not found. */
+extern void       fkre_cache_get_stats (const FKRECache *self,
+                    int64_t *hits, int64_t *stat_hits, int64_t *misses);
+
+END_DECLS
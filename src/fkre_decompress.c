@@ -0,0 +1,284 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_decompress.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <klib/klib.h>
+#include "fkre_decompress.h"
+
+#define KLOG_CLASS "fkre.decompress"
+
+// The size of the blocks of compressed data read, and of decompressed
+//   data passed on
+#define FKRE_DECOMPRESS_BLOCK 65536
+
+/*============================================================================
+  
+  FKRESource
+
+  The compressed data: first the bytes already read, then the rest
+  of the file
+
+  ==========================================================================*/
+typedef struct _FKRESource
+  {
+  int fd;
+  const BYTE *head;
+  size_t head_length;
+  BOOL eof;
+  BYTE in[FKRE_DECOMPRESS_BLOCK];
+  BYTE out[FKRE_DECOMPRESS_BLOCK];
+  } FKRESource;
+
+/*============================================================================
+  
+  fkre_source_read
+
+  Fill the input buffer. Returns the number of bytes read -- zero at
+  the end of the file -- or -1 with errno set
+
+  ==========================================================================*/
+static ssize_t fkre_source_read (FKRESource *self)
+  {
+  if (self->head_length > 0)
+    {
+    size_t n = self->head_length;
+    memcpy (self->in, self->head, n);
+    self->head_length = 0;
+    return n;
+    }
+  ssize_t n;
+  do
+    {
+    n = read (self->fd, self->in, sizeof (self->in));
+    } while (n < 0 && errno == EINTR);
+  if (n == 0) self->eof = TRUE;
+  return n;
+  }
+
+/*============================================================================
+  
+  fkre_compression_detect
+
+  ==========================================================================*/
+FKRECompression fkre_compression_detect (const BYTE *data, size_t length)
+  {
+  if (length >= 2 && data[0] == 0x1F && data[1] == 0x8B)
+    return FKRE_COMPRESSION_GZIP;
+  if (length >= 6 && memcmp (data, "\xFD" "7zXZ\0", 6) == 0)
+    return FKRE_COMPRESSION_XZ;
+  if (length >= 4 && memcmp (data, "\x28\xB5\x2F\xFD", 4) == 0)
+    return FKRE_COMPRESSION_ZSTD;
+  return FKRE_COMPRESSION_NONE;
+  }
+
+/*============================================================================
+  
+  fkre_decompress_gzip
+
+  ==========================================================================*/
+static BOOL fkre_decompress_gzip (FKRESource *src,
+      FKREDecompressFn fn, void *user_data)
+  {
+  z_stream zs;
+  memset (&zs, 0, sizeof (zs));
+  // 15 + 16: a gzip header, with the largest window
+  if (inflateInit2 (&zs, 15 + 16) != Z_OK)
+    {
+    errno = ENOMEM;
+    return FALSE;
+    }
+
+  int err = 0;
+  BOOL in_stream = TRUE;
+  while (err == 0)
+    {
+    if (zs.avail_in == 0)
+      {
+      ssize_t n = fkre_source_read (src);
+      if (n < 0) { err = errno; break; }
+      if (n == 0) break;
+      zs.next_in = src->in;
+      zs.avail_in = n;
+      }
+    if (!in_stream)
+      {
+      // Another gzip member follows the last one
+      inflateReset (&zs);
+      in_stream = TRUE;
+      }
+    zs.next_out = src->out;
+    zs.avail_out = sizeof (src->out);
+    int ret = inflate (&zs, Z_NO_FLUSH);
+    size_t produced = sizeof (src->out) - zs.avail_out;
+    if (produced > 0 && !fn (user_data, src->out, produced))
+      err = ECANCELED;
+    else if (ret == Z_STREAM_END)
+      in_stream = FALSE;
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      err = EBADMSG;
+    }
+
+  if (err == 0 && in_stream) err = EBADMSG;
+  inflateEnd (&zs);
+  errno = err;
+  return err == 0;
+  }
+
+#ifdef HAVE_LZMA
+/*============================================================================
+  
+  fkre_decompress_xz
+
+  ==========================================================================*/
+static BOOL fkre_decompress_xz (FKRESource *src,
+      FKREDecompressFn fn, void *user_data)
+  {
+  lzma_stream ls = LZMA_STREAM_INIT;
+  if (lzma_stream_decoder (&ls, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+    {
+    errno = ENOMEM;
+    return FALSE;
+    }
+
+  int err = 0;
+  for (;;)
+    {
+    if (ls.avail_in == 0 && !src->eof)
+      {
+      ssize_t n = fkre_source_read (src);
+      if (n < 0) { err = errno; break; }
+      ls.next_in = src->in;
+      ls.avail_in = n;
+      }
+    ls.next_out = src->out;
+    ls.avail_out = sizeof (src->out);
+    lzma_ret ret = lzma_code (&ls, src->eof ? LZMA_FINISH : LZMA_RUN);
+    size_t produced = sizeof (src->out) - ls.avail_out;
+    if (produced > 0 && !fn (user_data, src->out, produced))
+      {
+      err = ECANCELED;
+      break;
+      }
+    if (ret == LZMA_STREAM_END) break;
+    if (ret != LZMA_OK)
+      {
+      err = EBADMSG;
+      break;
+      }
+    }
+
+  lzma_end (&ls);
+  errno = err;
+  return err == 0;
+  }
+#endif
+
+#ifdef HAVE_ZSTD
+/*============================================================================
+  
+  fkre_decompress_zstd
+
+  ==========================================================================*/
+static BOOL fkre_decompress_zstd (FKRESource *src,
+      FKREDecompressFn fn, void *user_data)
+  {
+  ZSTD_DStream *ds = ZSTD_createDStream ();
+  if (!ds)
+    {
+    errno = ENOMEM;
+    return FALSE;
+    }
+  ZSTD_initDStream (ds);
+
+  int err = 0;
+  // Zero when the last frame is complete
+  size_t hint = 0;
+  BOOL any = FALSE;
+  ZSTD_inBuffer in = { src->in, 0, 0 };
+  while (err == 0)
+    {
+    if (in.pos == in.size)
+      {
+      ssize_t n = fkre_source_read (src);
+      if (n < 0) { err = errno; break; }
+      if (n == 0) break;
+      in.size = n;
+      in.pos = 0;
+      }
+    ZSTD_outBuffer out = { src->out, sizeof (src->out), 0 };
+    hint = ZSTD_decompressStream (ds, &out, &in);
+    any = TRUE;
+    if (ZSTD_isError (hint))
+      err = EBADMSG;
+    else if (out.pos > 0 && !fn (user_data, src->out, out.pos))
+      err = ECANCELED;
+    }
+
+  if (err == 0 && (hint != 0 || !any)) err = EBADMSG;
+  ZSTD_freeDStream (ds);
+  errno = err;
+  return err == 0;
+  }
+#endif
+
+/*============================================================================
+  
+  fkre_decompress
+
+  ==========================================================================*/
+BOOL fkre_decompress (int fd, FKRECompression compression,
+      const BYTE *head, size_t head_length,
+      FKREDecompressFn fn, void *user_data)
+  {
+  KLOG_IN
+  FKRESource *src = malloc (sizeof (FKRESource));
+  src->fd = fd;
+  src->head = head;
+  src->head_length = head_length;
+  src->eof = FALSE;
+
+  BOOL ret = FALSE;
+  errno = ENOTSUP;
+  switch (compression)
+    {
+    case FKRE_COMPRESSION_GZIP:
+      ret = fkre_decompress_gzip (src, fn, user_data);
+      break;
+#ifdef HAVE_LZMA
+    case FKRE_COMPRESSION_XZ:
+      ret = fkre_decompress_xz (src, fn, user_data);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case FKRE_COMPRESSION_ZSTD:
+      ret = fkre_decompress_zstd (src, fn, user_data);
+      break;
+#endif
+    default:;
+    }
+
+  int e = errno;
+  free (src);
+  errno = e;
+  KLOG_OUT
+  return ret;
+  }
@@ -0,0 +1,51 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_decompress.h
+
+  Decompression of gzip, xz, and zstd streams, recognized by their
+  magic numbers. Support for xz and zstd is only built in if their
+  libraries are installed.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+
+// The longest magic number that identifies a compressed stream
+#define FKRE_MAGIC_MAX 6
+
+typedef enum
+  {
+  FKRE_COMPRESSION_NONE = 0,
+  FKRE_COMPRESSION_GZIP = 1,
+  FKRE_COMPRESSION_XZ = 2,
+  FKRE_COMPRESSION_ZSTD = 3
+  } FKRECompression;
+
+/** Called with each block of decompressed data. Returns FALSE to stop. */
+typedef BOOL (*FKREDecompressFn) (void *user_data, const BYTE *data,
+               size_t length);
+
+BEGIN_DECLS
+
+/** Identify the compression of a stream from its first bytes -- at
+    least FKRE_MAGIC_MAX of them, unless the stream is shorter. */
+extern FKRECompression fkre_compression_detect (const BYTE *data,
+                         size_t length);
+
+/** Decompress the stream read from 'fd', the first 'head_length' bytes
+    of which have already been read into 'head'. Concatenated streams
+    are decompressed one after another, as the command-line tools do.
+    Returns FALSE, with errno set, if the stream can't be read
+    (EBADMSG if it is corrupt or truncated, ENOTSUP if support for its
+    format is not built in), or 'fn' stopped it. */
+extern BOOL fkre_decompress (int fd, FKRECompression compression,
+              const BYTE *head, size_t head_length,
+              FKREDecompressFn fn, void *user_data);
+
+END_DECLS
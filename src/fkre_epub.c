@@ -0,0 +1,450 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_epub.c
+
+  META-INF/container.xml names the package document (the OPF file); its
+  manifest maps item IDs to files, and its spine lists the IDs in
+  reading order. These are small, and regular enough to be read by
+  scanning for the few elements that matter, rather than by a full
+  XML parser.
+
+  Each content document is decompressed straight into a scoring
+  context, so no document is ever held in memory, or written to disk,
+  as a whole.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <klib/klib.h>
+#include <klib/zipfile.h>
+#include <fkre/fkre.h>
+#include "fkre_epub.h"
+#include "fkre_stats.h"
+
+#define KLOG_CLASS "fkre.epub"
+
+/*============================================================================
+  
+  FKREChapter
+
+  ==========================================================================*/
+typedef struct _FKREChapter
+  {
+  // The path within the archive
+  char *path;
+  int entry;
+  BOOL ok;
+  FKREMetrics metrics;
+  } FKREChapter;
+
+/*============================================================================
+  
+  FKREBook
+
+  ==========================================================================*/
+typedef struct _FKREBook
+  {
+  ZipFile *zipfile;
+  FKREChapter *chapters;
+  int num_chapters;
+  // The next chapter to be scored, taken by each thread in turn
+  int next;
+  } FKREBook;
+
+/*============================================================================
+  
+  fkre_is_epub
+
+  ==========================================================================*/
+BOOL fkre_is_epub (const char *filename)
+  {
+  size_t l = strlen (filename);
+  return l > 5 && strcasecmp (filename + l - 5, ".epub") == 0;
+  }
+
+/*============================================================================
+  
+  fkre_epub_find_tag
+
+  Find the next start tag, from 'p', whose local name (ignoring any
+  namespace prefix) is 'name'. Returns a pointer to the '<', and sets
+  'end' to point to the closing '>', or returns NULL.
+
+  ==========================================================================*/
+static const char *fkre_epub_find_tag (const char *p, const char *name,
+      const char **end)
+  {
+  size_t l = strlen (name);
+  while ((p = strchr (p, '<')))
+    {
+    const char *n = p + 1;
+    const char *e = n;
+    while (*e && !strchr (" \t\r\n/>", *e)) e++;
+    const char *colon = memchr (n, ':', e - n);
+    if (colon) n = colon + 1;
+    if ((size_t)(e - n) == l && memcmp (n, name, l) == 0)
+      {
+      *end = strchr (e, '>');
+      if (!*end) return NULL;
+      return p;
+      }
+    p++;
+    }
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_epub_attribute
+
+  Get the value of an attribute of the tag from 'tag' to 'end', with
+  the common entities expanded, or NULL. The caller frees the result.
+
+  ==========================================================================*/
+static char *fkre_epub_attribute (const char *tag, const char *end,
+      const char *name)
+  {
+  size_t l = strlen (name);
+  for (const char *p = tag; p + l + 2 < end; p++)
+    {
+    if (!strchr (" \t\r\n", p[0]) || memcmp (p + 1, name, l) != 0)
+      continue;
+    const char *q = p + 1 + l;
+    while (q < end && strchr (" \t\r\n", *q)) q++;
+    if (q >= end || *q != '=') continue;
+    q++;
+    while (q < end && strchr (" \t\r\n", *q)) q++;
+    if (q >= end || (*q != '"' && *q != '\'')) continue;
+    char quote = *q++;
+    const char *v_end = memchr (q, quote, end - q);
+    if (!v_end) return NULL;
+
+    char *value = malloc (v_end - q + 1);
+    char *v = value;
+    static const char *entities[][2] =
+      {{"&amp;", "&"}, {"&apos;", "'"}, {"&quot;", "\""},
+       {"&lt;", "<"}, {"&gt;", ">"}};
+    while (q < v_end)
+      {
+      BOOL done = FALSE;
+      if (*q == '&')
+        {
+        for (int i = 0; i < 5 && !done; i++)
+          {
+          size_t el = strlen (entities[i][0]);
+          if ((size_t)(v_end - q) >= el
+               && memcmp (q, entities[i][0], el) == 0)
+            {
+            *v++ = entities[i][1][0];
+            q += el;
+            done = TRUE;
+            }
+          }
+        }
+      if (!done) *v++ = *q++;
+      }
+    *v = 0;
+    return value;
+    }
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_epub_resolve
+
+  Resolve an href from the package document, which is URL-encoded and
+  relative to the package document's directory, to a path in the
+  archive. The caller frees the result.
+
+  ==========================================================================*/
+static char *fkre_epub_resolve (const char *base_dir, const char *href)
+  {
+  char *path = malloc (strlen (base_dir) + strlen (href) + 2);
+  char *p = path;
+  if (*base_dir) p += sprintf (p, "%s/", base_dir);
+  for (const char *h = href; *h && *h != '#'; h++)
+    {
+    if (*h == '%' && isxdigit ((BYTE)h[1]) && isxdigit ((BYTE)h[2]))
+      {
+      char hex[3] = { h[1], h[2], 0 };
+      *p++ = (char)strtol (hex, NULL, 16);
+      h += 2;
+      }
+    else
+      *p++ = *h;
+    }
+  *p = 0;
+
+  // Remove "." and "dir/.." segments
+  char *out = path;
+  char *seg = path;
+  while (*seg)
+    {
+    char *slash = strchr (seg, '/');
+    size_t l = slash ? (size_t)(slash - seg) : strlen (seg);
+    if (l == 1 && seg[0] == '.')
+      ;
+    else if (l == 2 && seg[0] == '.' && seg[1] == '.')
+      {
+      if (out > path) out--;
+      while (out > path && out[-1] != '/') out--;
+      }
+    else
+      {
+      memmove (out, seg, l);
+      out += l;
+      if (slash) *out++ = '/';
+      }
+    seg += l;
+    if (*seg == '/') seg++;
+    }
+  *out = 0;
+  return path;
+  }
+
+/*============================================================================
+  
+  fkre_epub_extract_text
+
+  Extract a small text entry, such as the package document. Returns
+  NULL if it can't be found.
+
+  ==========================================================================*/
+static char *fkre_epub_extract_text (const ZipFile *zipfile,
+      const char *name)
+  {
+  int entry = kzipfile_find_entry (zipfile, name);
+  if (entry < 0) return NULL;
+  BYTE *data;
+  uint64_t length;
+  if (kzipfile_extract_to_memory (zipfile, entry, &data, &length) != ZE_OK)
+    return NULL;
+  return (char *)data;
+  }
+
+/*============================================================================
+  
+  fkre_epub_read_spine
+
+  Fill in the chapters of the book, from the package document. Returns
+  FALSE if the package document can't be found.
+
+  ==========================================================================*/
+static BOOL fkre_epub_read_spine (FKREBook *book, const char *filename)
+  {
+  KLOG_IN
+  char *container = fkre_epub_extract_text (book->zipfile,
+    "META-INF/container.xml");
+  if (!container)
+    {
+    klog_warn (KLOG_CLASS, "'%s' has no container.xml", filename);
+    KLOG_OUT
+    return FALSE;
+    }
+  const char *end;
+  const char *tag = fkre_epub_find_tag (container, "rootfile", &end);
+  char *opf_path = tag ? fkre_epub_attribute (tag, end, "full-path") : NULL;
+  free (container);
+  char *opf = opf_path ?
+    fkre_epub_extract_text (book->zipfile, opf_path) : NULL;
+  if (!opf)
+    {
+    klog_warn (KLOG_CLASS, "'%s' has no package document", filename);
+    free (opf_path);
+    KLOG_OUT
+    return FALSE;
+    }
+
+  char *base_dir = strdup (opf_path);
+  char *slash = strrchr (base_dir, '/');
+  if (slash) *slash = 0; else base_dir[0] = 0;
+
+  const char *spine = fkre_epub_find_tag (opf, "spine", &end);
+  const char *p = spine ? end : opf;
+  while (spine && (tag = fkre_epub_find_tag (p, "itemref", &end)))
+    {
+    p = end;
+    char *idref = fkre_epub_attribute (tag, end, "idref");
+    if (!idref) continue;
+
+    // The manifest is searched for each item in the spine; books have
+    //   few enough chapters that this costs nothing
+    const char *item_end;
+    const char *item = opf;
+    char *href = NULL, *media_type = NULL;
+    while ((item = fkre_epub_find_tag (item, "item", &item_end)))
+      {
+      char *id = fkre_epub_attribute (item, item_end, "id");
+      BOOL match = id && strcmp (id, idref) == 0;
+      free (id);
+      if (match)
+        {
+        href = fkre_epub_attribute (item, item_end, "href");
+        media_type = fkre_epub_attribute (item, item_end, "media-type");
+        break;
+        }
+      item = item_end;
+      }
+
+    if (href && media_type && (strcmp (media_type,
+          "application/xhtml+xml") == 0
+          || strcmp (media_type, "text/html") == 0))
+      {
+      char *path = fkre_epub_resolve (base_dir, href);
+      int entry = kzipfile_find_entry (book->zipfile, path);
+      if (entry >= 0)
+        {
+        book->chapters = realloc (book->chapters,
+          (book->num_chapters + 1) * sizeof (FKREChapter));
+        FKREChapter *chapter = &book->chapters[book->num_chapters++];
+        memset (chapter, 0, sizeof (FKREChapter));
+        chapter->path = path;
+        chapter->entry = entry;
+        }
+      else
+        {
+        klog_warn (KLOG_CLASS, "'%s' has no '%s'", filename, path);
+        free (path);
+        }
+      }
+    free (href);
+    free (media_type);
+    free (idref);
+    }
+
+  free (base_dir);
+  free (opf);
+  free (opf_path);
+  KLOG_OUT
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_epub_feed
+
+  ==========================================================================*/
+static BOOL fkre_epub_feed (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  fkre_context_feed ((FKREContext *)user_data, data, length);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_epub_thread
+
+  Score chapters until there are none left
+
+  ==========================================================================*/
+static void *fkre_epub_thread (void *arg)
+  {
+  FKREBook *book = arg;
+  FKREContext *context = fkre_context_new (FKRE_FLAG_HTML 
+    | fkre_stats_flags ());
+  // The chapters this thread would have scored are left to the others,
+  //   or, if there are none, reported as not extracted
+  if (!context) return NULL;
+  int i;
+  while ((i = __atomic_fetch_add (&book->next, 1, __ATOMIC_RELAXED))
+           < book->num_chapters)
+    {
+    FKREChapter *chapter = &book->chapters[i];
+    fkre_context_reset (context);
+    ZipError e = kzipfile_extract_to_function (book->zipfile,
+      chapter->entry, fkre_epub_feed, context);
+    if (e == ZE_OK)
+      {
+      fkre_context_finish (context);
+      chapter->metrics.size = sizeof (FKREMetrics);
+      fkre_context_get_metrics (context, &chapter->metrics);
+      chapter->ok = TRUE;
+      }
+    }
+  fkre_stats_add_context (context);
+  fkre_context_destroy (context);
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_epub_score
+
+  ==========================================================================*/
+BOOL fkre_epub_score (const char *filename, int threads,
+      FKREEpubFn fn, void *user_data)
+  {
+  KLOG_IN
+  FKREBook book;
+  memset (&book, 0, sizeof (FKREBook));
+  book.zipfile = kzipfile_create (filename);
+  ZipError e = kzipfile_read_contents (book.zipfile);
+  int err = errno;
+  BOOL ret = FALSE;
+  if (e == ZE_OPENREAD)
+    errno = err;
+  else if (e != ZE_OK || !fkre_epub_read_spine (&book, filename))
+    errno = EINVAL;
+  else
+    {
+    if (threads > book.num_chapters) threads = book.num_chapters;
+    if (threads <= 1)
+      fkre_epub_thread (&book);
+    else
+      {
+      pthread_t *ids = malloc (threads * sizeof (pthread_t));
+      int started = 0;
+      while (started < threads && pthread_create (&ids[started], NULL,
+               fkre_epub_thread, &book) == 0)
+        started++;
+      // If no thread could be started, do the work here
+      if (started == 0) fkre_epub_thread (&book);
+      for (int i = 0; i < started; i++) pthread_join (ids[i], NULL);
+      free (ids);
+      }
+
+    FKREMetrics total;
+    memset (&total, 0, sizeof (FKREMetrics));
+    total.size = sizeof (FKREMetrics);
+    total.flags = FKRE_FLAG_HTML;
+    for (int i = 0; i < book.num_chapters; i++)
+      {
+      FKREChapter *chapter = &book.chapters[i];
+      if (chapter->ok)
+        {
+        char *name;
+        if (asprintf (&name, "%s:%s", filename, chapter->path) >= 0)
+          {
+          fn (user_data, name, &chapter->metrics);
+          free (name);
+          }
+        fkre_metrics_add (&total, &chapter->metrics);
+        }
+      else
+        klog_warn (KLOG_CLASS, "Can't extract '%s' from '%s'",
+          chapter->path, filename);
+      }
+    fn (user_data, filename, &total);
+    ret = TRUE;
+    }
+
+  for (int i = 0; i < book.num_chapters; i++) free (book.chapters[i].path);
+  free (book.chapters);
+  kzipfile_destroy (book.zipfile);
+  KLOG_OUT
+  return ret;
+  }
+
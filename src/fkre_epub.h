@@ -0,0 +1,39 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_epub.h
+
+  Scoring EPUB e-books, straight from the archive. The content documents
+  are found from the package document's spine, scored as HTML, and
+  reported in reading order, followed by the totals for the book.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+/** Called for each content document, with a name of the form
+    "book.epub:OEBPS/chapter1.xhtml", and then for the whole book, with
+    the name of the EPUB file. */
+typedef void (*FKREEpubFn) (void *user_data, const char *name,
+               const FKREMetrics *metrics);
+
+BEGIN_DECLS
+
+/** Whether a file should be treated as an EPUB, judging by its name. */
+extern BOOL fkre_is_epub (const char *filename);
+
+/** Score the content documents of an EPUB, using up to 'threads'
+    threads, and passing the results to 'fn' -- always on the calling
+    thread, and in spine order. Documents that can't be extracted are
+    logged and left out. Returns FALSE, with errno set, if the file
+    can't be read, or is not an EPUB. */
+extern BOOL fkre_epub_score (const char *filename, int threads,
+              FKREEpubFn fn, void *user_data);
+
+END_DECLS
@@ -0,0 +1,212 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_hash.c
+
+  An implementation of XXH64, following the published specification.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <klib/klib.h> 
+#include "fkre_hash.h" 
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*============================================================================
+  
+  fkre_hash_read64, fkre_hash_read32
+
+  Little-endian reads, at any alignment
+
+  ==========================================================================*/
+static inline uint64_t fkre_hash_read64 (const BYTE *p)
+  {
+  uint64_t v;
+  memcpy (&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64 (v);
+#endif
+  return v;
+  }
+
+static inline uint32_t fkre_hash_read32 (const BYTE *p)
+  {
+  uint32_t v;
+  memcpy (&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32 (v);
+#endif
+  return v;
+  }
+
+/*============================================================================
+  
+  fkre_hash_round
+
+  ==========================================================================*/
+static inline uint64_t fkre_hash_round (uint64_t acc, uint64_t input)
+  {
+  acc += input * PRIME2;
+  acc = ROTL (acc, 31);
+  return acc * PRIME1;
+  }
+
+/*============================================================================
+  
+  fkre_hash_merge_round
+
+  ==========================================================================*/
+static inline uint64_t fkre_hash_merge_round (uint64_t acc, uint64_t val)
+  {
+  acc ^= fkre_hash_round (0, val);
+  return acc * PRIME1 + PRIME4;
+  }
+
+/*============================================================================
+  
+  fkre_hash_stripes
+
+  Process as many whole 32-byte stripes as there are, returning the 
+  number of bytes consumed
+
+  ==========================================================================*/
+static size_t fkre_hash_stripes (FKREHash *self, const BYTE *p, 
+      size_t length)
+  {
+  uint64_t v1 = self->v[0], v2 = self->v[1], v3 = self->v[2], 
+    v4 = self->v[3];
+  size_t n = 0;
+  while (length - n >= 32)
+    {
+    v1 = fkre_hash_round (v1, fkre_hash_read64 (p + n));
+    v2 = fkre_hash_round (v2, fkre_hash_read64 (p + n + 8));
+    v3 = fkre_hash_round (v3, fkre_hash_read64 (p + n + 16));
+    v4 = fkre_hash_round (v4, fkre_hash_read64 (p + n + 24));
+    n += 32;
+    }
+  self->v[0] = v1; self->v[1] = v2; self->v[2] = v3; self->v[3] = v4;
+  return n;
+  }
+
+/*============================================================================
+  
+  fkre_hash_init
+
+  ==========================================================================*/
+void fkre_hash_init (FKREHash *self, uint64_t seed)
+  {
+  memset (self, 0, sizeof (FKREHash));
+  self->seed = seed;
+  self->v[0] = seed + PRIME1 + PRIME2;
+  self->v[1] = seed + PRIME2;
+  self->v[2] = seed;
+  self->v[3] = seed - PRIME1;
+  }
+
+/*============================================================================
+  
+  fkre_hash_update
+
+  ==========================================================================*/
+void fkre_hash_update (FKREHash *self, const void *data, size_t length)
+  {
+  const BYTE *p = data;
+  self->total += length;
+
+  if (self->buffered + length < 32)
+    {
+    memcpy (self->buff + self->buffered, p, length);
+    self->buffered += length;
+    return;
+    }
+
+  if (self->buffered > 0)
+    {
+    size_t fill = 32 - self->buffered;
+    memcpy (self->buff + self->buffered, p, fill);
+    fkre_hash_stripes (self, self->buff, 32);
+    p += fill;
+    length -= fill;
+    self->buffered = 0;
+    }
+
+  size_t n = fkre_hash_stripes (self, p, length);
+  memcpy (self->buff, p + n, length - n);
+  self->buffered = length - n;
+  }
+
+/*============================================================================
+  
+  fkre_hash_final
+
+  ==========================================================================*/
+uint64_t fkre_hash_final (const FKREHash *self)
+  {
+  uint64_t h;
+  if (self->total >= 32)
+    {
+    const uint64_t *v = self->v;
+    h = ROTL (v[0], 1) + ROTL (v[1], 7) + ROTL (v[2], 12) + ROTL (v[3], 18);
+    h = fkre_hash_merge_round (h, v[0]);
+    h = fkre_hash_merge_round (h, v[1]);
+    h = fkre_hash_merge_round (h, v[2]);
+    h = fkre_hash_merge_round (h, v[3]);
+    }
+  else
+    h = self->seed + PRIME5;
+
+  h += self->total;
+
+  const BYTE *p = self->buff;
+  const BYTE *end = p + self->buffered;
+  while (p + 8 <= end)
+    {
+    h ^= fkre_hash_round (0, fkre_hash_read64 (p));
+    h = ROTL (h, 27) * PRIME1 + PRIME4;
+    p += 8;
+    }
+  if (p + 4 <= end)
+    {
+    h ^= (uint64_t)fkre_hash_read32 (p) * PRIME1;
+    h = ROTL (h, 23) * PRIME2 + PRIME3;
+    p += 4;
+    }
+  while (p < end)
+    {
+    h ^= (*p) * PRIME5;
+    h = ROTL (h, 11) * PRIME1;
+    p++;
+    }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+  }
+
+/*============================================================================
+  
+  fkre_hash64
+
+  ==========================================================================*/
+uint64_t fkre_hash64 (const void *data, size_t length, uint64_t seed)
+  {
+  FKREHash h;
+  fkre_hash_init (&h, seed);
+  fkre_hash_update (&h, data, length);
+  return fkre_hash_final (&h);
+  }
@@ -0,0 +1,41 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_hash.h
+
+  A fast, non-cryptographic 64-bit hash -- XXH64 -- for recognizing 
+  files whose contents have been seen before. Data can be hashed all 
+  at once, or a block at a time; the results are the same.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <klib/klib.h>
+
+typedef struct _FKREHash
+  {
+  uint64_t total;
+  uint64_t v[4];
+  BYTE buff[32];
+  size_t buffered;
+  uint64_t seed;
+  } FKREHash;
+
+BEGIN_DECLS
+
+extern void     fkre_hash_init (FKREHash *self, uint64_t seed);
+extern void     fkre_hash_update (FKREHash *self, const void *data, 
+                  size_t length);
+extern uint64_t fkre_hash_final (const FKREHash *self);
+
+/** Hash a block of data in one go. */
+extern uint64_t fkre_hash64 (const void *data, size_t length, 
+                  uint64_t seed);
+
+END_DECLS
@@ -0,0 +1,277 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_input.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <errno.h> 
+#include <unistd.h> 
+#include <fcntl.h> 
+#include <pthread.h> 
+#include <klib/klib.h> 
+#include <fkre/fkre.h> 
+#include "fkre_input.h" 
+#include "fkre_decompress.h" 
+#include "fkre_stats.h" 
+
+#define KLOG_CLASS "fkre.input"
+
+// The number of blocks of decompressed data that can be waiting
+//   to be tokenized
+#define FKRE_PIPE_BLOCKS 4
+
+/*============================================================================
+  
+  FKREPipe
+
+  Decompressed data on its way from the decompressing thread to the
+  consuming one: a ring of blocks, each of which the decompressor fills,
+  and the consumer empties. The blocks stay few, so however large the
+  file, memory use stays bounded.
+
+  ==========================================================================*/
+typedef struct _FKREPipe
+  {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  BYTE *blocks[FKRE_PIPE_BLOCKS];
+  size_t lengths[FKRE_PIPE_BLOCKS];
+  int first;     // The oldest full block
+  int full;      // The number of full blocks
+  BOOL done;     // The decompressor has finished
+  BOOL ok;       // ... and how
+  BOOL stopped;  // The consumer wants no more
+  int error;
+  int fd;
+  FKRECompression compression;
+  const BYTE *head;
+  size_t head_length;
+  } FKREPipe;
+
+/*============================================================================
+  
+  fkre_pipe_put
+
+  Copy a block of decompressed data into the pipe, waiting for room
+
+  ==========================================================================*/
+static BOOL fkre_pipe_put (void *user_data, const BYTE *data, size_t length)
+  {
+  FKREPipe *self = user_data;
+  pthread_mutex_lock (&self->lock);
+  while (self->full == FKRE_PIPE_BLOCKS && !self->stopped)
+    pthread_cond_wait (&self->cond, &self->lock);
+  BOOL stopped = self->stopped;
+  int slot = (self->first + self->full) % FKRE_PIPE_BLOCKS;
+  pthread_mutex_unlock (&self->lock);
+  if (stopped) return FALSE;
+
+  // The consumer won't touch an empty slot, so it can be filled unlocked
+  memcpy (self->blocks[slot], data, length);
+  self->lengths[slot] = length;
+
+  pthread_mutex_lock (&self->lock);
+  self->full++;
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->lock);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_pipe_thread
+
+  ==========================================================================*/
+static void *fkre_pipe_thread (void *arg)
+  {
+  FKREPipe *self = arg;
+  BOOL ok = fkre_decompress (self->fd, self->compression, self->head,
+    self->head_length, fkre_pipe_put, self);
+  int e = errno;
+  pthread_mutex_lock (&self->lock);
+  self->done = TRUE;
+  self->ok = ok;
+  self->error = e;
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->lock);
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_read_compressed
+
+  Decompress on a thread of its own, while this one consumes the data
+
+  ==========================================================================*/
+static BOOL fkre_read_compressed (int fd, FKRECompression compression, 
+      const BYTE *head, size_t head_length, FKREInputFn fn, 
+      void *user_data)
+  {
+  KLOG_IN
+  FKREPipe *self = malloc (sizeof (FKREPipe));
+  memset (self, 0, sizeof (FKREPipe));
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  self->blocks[0] = malloc (FKRE_PIPE_BLOCKS * FKRE_INPUT_BLOCK);
+  for (int i = 1; i < FKRE_PIPE_BLOCKS; i++)
+    self->blocks[i] = self->blocks[0] + i * FKRE_INPUT_BLOCK;
+  self->fd = fd;
+  self->compression = compression;
+  self->head = head;
+  self->head_length = head_length;
+
+  BOOL ret;
+  pthread_t thread;
+  if (pthread_create (&thread, NULL, fkre_pipe_thread, self) == 0)
+    {
+    pthread_mutex_lock (&self->lock);
+    for (;;)
+      {
+      FKREStatsClock clock;
+      fkre_stats_start (&clock);
+      while (self->full == 0 && !self->done)
+        pthread_cond_wait (&self->cond, &self->lock);
+      fkre_stats_stop (&clock, FKRE_PHASE_READ);
+      if (self->full == 0) break;
+      int slot = self->first;
+      pthread_mutex_unlock (&self->lock);
+
+      BOOL more = fn (user_data, self->blocks[slot], self->lengths[slot]);
+
+      pthread_mutex_lock (&self->lock);
+      self->first = (self->first + 1) % FKRE_PIPE_BLOCKS;
+      self->full--;
+      if (!more) self->stopped = TRUE;
+      pthread_cond_signal (&self->cond);
+      if (!more) break;
+      }
+    pthread_mutex_unlock (&self->lock);
+    pthread_join (thread, NULL);
+    ret = self->ok;
+    errno = self->error;
+    }
+  else
+    {
+    klog_debug (KLOG_CLASS, "Can't start decompressor thread: %s", 
+      strerror (errno));
+    ret = fkre_decompress (fd, compression, head, head_length, 
+      fn, user_data);
+    }
+
+  int e = errno;
+  pthread_cond_destroy (&self->cond);
+  pthread_mutex_destroy (&self->lock);
+  free (self->blocks[0]);
+  free (self);
+  errno = e;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_read_fd
+
+  ==========================================================================*/
+BOOL fkre_read_fd (int fd, FKREInputFn fn, void *user_data)
+  {
+  KLOG_IN
+  BYTE buff[FKRE_INPUT_BLOCK];
+  BOOL first = TRUE;
+  ssize_t n;
+  FKREStatsClock clock;
+  fkre_stats_start (&clock);
+  while ((n = read (fd, buff, sizeof (buff))) > 0 
+      || (n < 0 && errno == EINTR))
+    {
+    if (n <= 0) continue;
+    if (first)
+      {
+      first = FALSE;
+      // A short read could split a magic number, so make sure of
+      //   enough bytes to recognize one
+      while (n < FKRE_MAGIC_MAX)
+        {
+        ssize_t m = read (fd, buff + n, sizeof (buff) - n);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) break;
+        n += m;
+        }
+      fkre_stats_stop (&clock, FKRE_PHASE_READ);
+      FKRECompression compression = fkre_compression_detect (buff, n);
+      if (compression != FKRE_COMPRESSION_NONE)
+        {
+        klog_debug (KLOG_CLASS, "Input is compressed (%d)", compression);
+        BOOL ret = fkre_read_compressed (fd, compression, buff, n, 
+          fn, user_data);
+        KLOG_OUT
+        return ret;
+        }
+      }
+    else
+      fkre_stats_stop (&clock, FKRE_PHASE_READ);
+    if (!fn (user_data, buff, n))
+      {
+      errno = ECANCELED;
+      KLOG_OUT
+      return FALSE;
+      }
+    fkre_stats_start (&clock);
+    }
+  fkre_stats_stop (&clock, FKRE_PHASE_READ);
+  KLOG_OUT
+  return (n == 0);
+  }
+
+/*============================================================================
+  
+  fkre_feed_block
+
+  ==========================================================================*/
+static BOOL fkre_feed_block (void *user_data, const BYTE *data, 
+      size_t length)
+  {
+  fkre_context_feed ((FKREContext *)user_data, data, length);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_feed_fd
+
+  ==========================================================================*/
+BOOL fkre_feed_fd (FKREContext *context, int fd)
+  {
+  return fkre_read_fd (fd, fkre_feed_block, context);
+  }
+
+/*============================================================================
+  
+  fkre_feed_file
+
+  ==========================================================================*/
+BOOL fkre_feed_file (FKREContext *context, const char *filename)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  klog_debug (KLOG_CLASS, "Reading '%s'", filename);
+  int fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+    ret = fkre_feed_fd (context, fd);
+    int e = errno;
+    close (fd);
+    errno = e;
+    }
+  KLOG_OUT
+  return ret;
+  }
@@ -0,0 +1,42 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_input.h
+
+  Reading documents from files, and feeding them to a scoring context.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+// The size of the blocks in which files are read
+#define FKRE_INPUT_BLOCK 65536
+
+/** Called with each block of data read. Returns FALSE to stop. */
+typedef BOOL (*FKREInputFn) (void *user_data, const BYTE *data, 
+               size_t length);
+
+BEGIN_DECLS
+
+/** Feed a file to the context, a block at a time, so the whole file
+    need never be in memory. The context is not reset or finished. 
+    A file compressed with gzip, xz, or zstd is recognized by its
+    first bytes, and decompressed on another thread as it is fed.
+    Returns FALSE, with errno set, if the file can't be read. */
+extern BOOL fkre_feed_file (FKREContext *context, const char *filename);
+
+/** As fkre_feed_file(), but reading from a file that is already open. */
+extern BOOL fkre_feed_fd (FKREContext *context, int fd);
+
+/** Read a file that is already open, decompressing it if necessary,
+    and pass it to 'fn' a block at a time. Returns FALSE, with errno 
+    set, if the file can't be read, or 'fn' stopped. */
+extern BOOL fkre_read_fd (int fd, FKREInputFn fn, void *user_data);
+
+END_DECLS
@@ -0,0 +1,358 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_lines.c
+
+  The file is read into chunks of about FKRE_LINES_CHUNK bytes, each
+  cut at the end of a line, so every line falls in a single chunk.
+  There are a few more chunks than threads, used in turn: the reading
+  thread fills one while the others are being scored, and before it
+  reuses a chunk it reports the lines that were scored in it last
+  time. So the output comes out in order, from one thread, and the
+  memory used depends on the number of threads, not the size of the
+  file.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_lines.h"
+#include "fkre_stats.h"
+
+#define KLOG_CLASS "fkre.lines"
+
+// The size at which a chunk is handed over to be scored
+#define FKRE_LINES_CHUNK (1024 * 1024)
+
+// Chunks for each thread: one being scored, and one waiting
+#define FKRE_LINES_CHUNKS_PER_THREAD 2
+
+typedef enum
+  {
+  // Never used
+  FKRE_LINES_FREE = 0,
+  // Being filled by the reader
+  FKRE_LINES_FILLING = 1,
+  // Waiting for a thread to score it
+  FKRE_LINES_READY = 2,
+  FKRE_LINES_BUSY = 3,
+  // Scored, and waiting to be reported
+  FKRE_LINES_DONE = 4
+  } FKRELinesState;
+
+/*============================================================================
+  
+  FKRELinesChunk
+
+  ==========================================================================*/
+typedef struct _FKRELinesChunk
+  {
+  FKRELinesState state;
+  int64_t sequence;
+  BYTE *data;
+  size_t length;
+  size_t size;
+  // The results for the lines in the chunk
+  FKREMetrics *metrics;
+  size_t nlines;
+  size_t metrics_size;
+  } FKRELinesChunk;
+
+/*============================================================================
+  
+  FKRELines
+
+  ==========================================================================*/
+typedef struct _FKRELines
+  {
+  unsigned flags;
+  FKRELinesFn fn;
+  void *user_data;
+  FKRELinesChunk *chunks;
+  int nchunks;
+  // The chunk being filled
+  FKRELinesChunk *current;
+  int64_t sequence;
+  // The number of the last line reported
+  int64_t line;
+  // For scoring on the reading thread, when there are no others
+  FKREContext *context;
+  // Set when the reader has no more chunks to hand over
+  BOOL finished;
+  pthread_mutex_t lock;
+  // Signalled when a chunk is ready to be scored, and when one has
+  //   been scored
+  pthread_cond_t ready;
+  pthread_cond_t done;
+  } FKRELines;
+
+/*============================================================================
+  
+  fkre_lines_score_chunk
+
+  ==========================================================================*/
+static void fkre_lines_score_chunk (FKREContext *context,
+      FKRELinesChunk *chunk)
+  {
+  chunk->nlines = 0;
+  const BYTE *p = chunk->data;
+  const BYTE *end = chunk->data + chunk->length;
+  while (p < end)
+    {
+    const BYTE *eol = memchr (p, '\n', end - p);
+    if (!eol) eol = end;
+    size_t length = eol - p;
+    if (length > 0 && p[length - 1] == '\r') length--;
+
+    if (chunk->nlines == chunk->metrics_size)
+      {
+      chunk->metrics_size = chunk->metrics_size ?
+        chunk->metrics_size * 2 : 1024;
+      chunk->metrics = realloc (chunk->metrics,
+        chunk->metrics_size * sizeof (FKREMetrics));
+      }
+    FKREMetrics *metrics = &chunk->metrics[chunk->nlines++];
+    fkre_context_reset (context);
+    fkre_context_feed (context, p, length);
+    fkre_context_finish (context);
+    metrics->size = sizeof (FKREMetrics);
+    fkre_context_get_metrics (context, metrics);
+
+    p = eol + 1;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_lines_thread
+
+  Score chunks as they become ready, until the reader has finished
+
+  ==========================================================================*/
+static void *fkre_lines_thread (void *arg)
+  {
+  FKRELines *self = arg;
+  FKREContext *context = fkre_context_new (self->flags);
+  pthread_mutex_lock (&self->lock);
+  for (;;)
+    {
+    // The oldest chunk first, so that the reader isn't kept waiting
+    //   to report it
+    FKRELinesChunk *chunk = NULL;
+    for (int i = 0; i < self->nchunks; i++)
+      {
+      FKRELinesChunk *c = &self->chunks[i];
+      if (c->state == FKRE_LINES_READY
+          && (!chunk || c->sequence < chunk->sequence))
+        chunk = c;
+      }
+    if (chunk)
+      {
+      chunk->state = FKRE_LINES_BUSY;
+      pthread_mutex_unlock (&self->lock);
+      fkre_lines_score_chunk (context, chunk);
+      pthread_mutex_lock (&self->lock);
+      chunk->state = FKRE_LINES_DONE;
+      pthread_cond_broadcast (&self->done);
+      }
+    else if (self->finished)
+      break;
+    else
+      pthread_cond_wait (&self->ready, &self->lock);
+    }
+  pthread_mutex_unlock (&self->lock);
+  fkre_stats_add_context (context);
+  fkre_context_destroy (context);
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_lines_report
+
+  ==========================================================================*/
+static void fkre_lines_report (FKRELines *self, FKRELinesChunk *chunk)
+  {
+  for (size_t i = 0; i < chunk->nlines; i++)
+    self->fn (self->user_data, ++self->line, &chunk->metrics[i]);
+  chunk->nlines = 0;
+  chunk->state = FKRE_LINES_FREE;
+  }
+
+/*============================================================================
+  
+  fkre_lines_acquire
+
+  Get the next chunk to fill, reporting what it held last time
+
+  ==========================================================================*/
+static FKRELinesChunk *fkre_lines_acquire (FKRELines *self)
+  {
+  FKRELinesChunk *chunk = &self->chunks[self->sequence % self->nchunks];
+  pthread_mutex_lock (&self->lock);
+  while (chunk->state != FKRE_LINES_FREE && chunk->state != FKRE_LINES_DONE)
+    pthread_cond_wait (&self->done, &self->lock);
+  pthread_mutex_unlock (&self->lock);
+  if (chunk->state == FKRE_LINES_DONE) fkre_lines_report (self, chunk);
+  chunk->state = FKRE_LINES_FILLING;
+  chunk->sequence = self->sequence++;
+  chunk->length = 0;
+  return chunk;
+  }
+
+/*============================================================================
+  
+  fkre_lines_submit
+
+  Hand over the first 'length' bytes of the current chunk to be scored,
+  and carry the rest over into the next one
+
+  ==========================================================================*/
+static void fkre_lines_submit (FKRELines *self, size_t length)
+  {
+  FKRELinesChunk *chunk = self->current;
+  FKRELinesChunk *next = fkre_lines_acquire (self);
+  size_t rest = chunk->length - length;
+  if (rest > next->size)
+    {
+    next->size = rest > FKRE_LINES_CHUNK ? rest : FKRE_LINES_CHUNK;
+    next->data = realloc (next->data, next->size);
+    }
+  if (rest > 0) memcpy (next->data, chunk->data + length, rest);
+  next->length = rest;
+  chunk->length = length;
+  self->current = next;
+
+  if (self->context)
+    {
+    fkre_lines_score_chunk (self->context, chunk);
+    chunk->state = FKRE_LINES_DONE;
+    }
+  else
+    {
+    pthread_mutex_lock (&self->lock);
+    chunk->state = FKRE_LINES_READY;
+    pthread_cond_signal (&self->ready);
+    pthread_mutex_unlock (&self->lock);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_lines_block
+
+  ==========================================================================*/
+static BOOL fkre_lines_block (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  FKRELines *self = user_data;
+  FKRELinesChunk *chunk = self->current;
+  if (chunk->length + length > chunk->size)
+    {
+    // A chunk only grows beyond its usual size to hold a long line
+    size_t size = chunk->size ? chunk->size : FKRE_LINES_CHUNK;
+    while (size < chunk->length + length) size *= 2;
+    chunk->data = realloc (chunk->data, size);
+    chunk->size = size;
+    }
+  memcpy (chunk->data + chunk->length, data, length);
+  chunk->length += length;
+
+  if (chunk->length >= FKRE_LINES_CHUNK)
+    {
+    const BYTE *eol = memrchr (chunk->data, '\n', chunk->length);
+    if (eol) fkre_lines_submit (self, eol - chunk->data + 1);
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_lines_score_fd
+
+  ==========================================================================*/
+BOOL fkre_lines_score_fd (int fd, unsigned flags, int threads,
+      FKRELinesFn fn, void *user_data)
+  {
+  KLOG_IN
+  FKRELines self;
+  memset (&self, 0, sizeof (FKRELines));
+  self.flags = flags;
+  self.fn = fn;
+  self.user_data = user_data;
+  if (threads < 1) threads = 1;
+  self.nchunks = (threads + 1) * FKRE_LINES_CHUNKS_PER_THREAD;
+  self.chunks = calloc (self.nchunks, sizeof (FKRELinesChunk));
+  pthread_mutex_init (&self.lock, NULL);
+  pthread_cond_init (&self.ready, NULL);
+  pthread_cond_init (&self.done, NULL);
+
+  pthread_t *ids = NULL;
+  int started = 0;
+  if (threads > 1)
+    {
+    ids = malloc (threads * sizeof (pthread_t));
+    while (started < threads && pthread_create (&ids[started], NULL,
+             fkre_lines_thread, &self) == 0)
+      started++;
+    }
+  // If no thread could be started, or only one was wanted, the chunks
+  //   are scored as they are filled
+  if (started == 0) self.context = fkre_context_new (flags);
+
+  self.current = fkre_lines_acquire (&self);
+  BOOL ret = fkre_read_fd (fd, fkre_lines_block, &self);
+  int e = errno;
+
+  FKRELinesChunk *chunk = self.current;
+  if (!ret)
+    {
+    // Don't score what may be half a line
+    const BYTE *eol = chunk->length ?
+      memrchr (chunk->data, '\n', chunk->length) : NULL;
+    chunk->length = eol ? (size_t)(eol - chunk->data + 1) : 0;
+    }
+  fkre_lines_submit (&self, chunk->length);
+
+  pthread_mutex_lock (&self.lock);
+  self.finished = TRUE;
+  pthread_cond_broadcast (&self.ready);
+  pthread_mutex_unlock (&self.lock);
+  for (int i = 0; i < started; i++) pthread_join (ids[i], NULL);
+  free (ids);
+
+  // Report the chunks still held, oldest first
+  for (int i = 0; i < self.nchunks; i++)
+    {
+    FKRELinesChunk *c = &self.chunks[(self.sequence + i) % self.nchunks];
+    if (c->state == FKRE_LINES_DONE) fkre_lines_report (&self, c);
+    }
+
+  for (int i = 0; i < self.nchunks; i++)
+    {
+    free (self.chunks[i].data);
+    free (self.chunks[i].metrics);
+    }
+  free (self.chunks);
+  if (self.context) 
+    {
+    fkre_stats_add_context (self.context);
+    fkre_context_destroy (self.context);
+    }
+  pthread_cond_destroy (&self.done);
+  pthread_cond_destroy (&self.ready);
+  pthread_mutex_destroy (&self.lock);
+  errno = e;
+  KLOG_OUT
+  return ret;
+  }
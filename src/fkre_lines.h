@@ -0,0 +1,38 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_lines.h
+
+  Scoring each line of a file as a document of its own -- for files of
+  short records, one per line, that would otherwise have to be split
+  into millions of files.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+/** Called for each line, in order, with its number, counting from 1. */
+typedef void (*FKRELinesFn) (void *user_data, int64_t line,
+               const FKREMetrics *metrics);
+
+BEGIN_DECLS
+
+/** Score each line of the file read from 'fd' -- which may be
+    compressed -- as a separate document, with contexts created with
+    'flags'. The file is read in chunks that end at line ends, which
+    are scored on 'threads' threads, while the next chunks are read;
+    the results are passed to 'fn', on the calling thread, in the
+    order of the lines. A final line with no line end is scored like
+    the others. Returns FALSE, with errno set, if the file can't be
+    read, in which case the lines before the error have already been
+    passed to 'fn'. */
+extern BOOL fkre_lines_score_fd (int fd, unsigned flags, int threads,
+              FKRELinesFn fn, void *user_data);
+
+END_DECLS
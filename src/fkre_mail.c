@@ -0,0 +1,768 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_mail.c
+
+  The mailbox is read a line at a time, in a single pass. Each message,
+  and each part of a MIME message, starts with headers, which say what
+  the body is, and how it is encoded. The text parts are decoded as
+  they are read and fed to a scoring context -- a plain one or an HTML
+  one, depending on the first text part of the message -- and
+  everything else is skipped.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_mail.h"
+#include "fkre_stats.h"
+
+#define KLOG_CLASS "fkre.mail"
+
+// Longer lines are handled in pieces
+#define FKRE_MAIL_MAX_LINE 8192
+// Longer headers are truncated, but the ones that matter are short
+#define FKRE_MAIL_MAX_HEADER 8192
+// RFC 2046 limits boundaries to 70 characters
+#define FKRE_MAIL_MAX_BOUNDARY 80
+// How deeply multipart entities can nest
+#define FKRE_MAIL_MAX_DEPTH 8
+
+typedef enum
+  {
+  FKRE_MAIL_HEADERS = 0,
+  FKRE_MAIL_BODY = 1,
+  FKRE_MAIL_SKIP = 2
+  } FKREMailState;
+
+typedef enum
+  {
+  FKRE_MAIL_IDENTITY = 0,
+  FKRE_MAIL_QP = 1,
+  FKRE_MAIL_BASE64 = 2
+  } FKREMailEncoding;
+
+/*============================================================================
+  
+  FKREMailLevel
+
+  An enclosing multipart entity
+
+  ==========================================================================*/
+typedef struct _FKREMailLevel
+  {
+  char boundary[FKRE_MAIL_MAX_BOUNDARY + 1];
+  size_t length;
+  // In multipart/alternative, only one version of the text is scored
+  BOOL alternative;
+  BOOL chosen;
+  } FKREMailLevel;
+
+/*============================================================================
+  
+  FKREMail
+
+  ==========================================================================*/
+struct _FKREMail
+  {
+  FKREContext *plain;
+  FKREContext *html;
+  // The context this message is being scored with, once it has one
+  FKREContext *context;
+  FKREMailFn fn;
+  void *user_data;
+  const char *name;
+  BOOL mbox;
+  int64_t messages;
+  BOOL in_message;
+  // The line being assembled
+  char line[FKRE_MAIL_MAX_LINE];
+  size_t line_length;
+  BOOL line_continues;
+  BOOL last_blank;
+  FKREMailState state;
+  // The header being assembled, and what the headers so far say
+  char header[FKRE_MAIL_MAX_HEADER + 1];
+  size_t header_length;
+  char type[64];
+  char boundary[FKRE_MAIL_MAX_BOUNDARY + 1];
+  FKREMailEncoding encoding;
+  BOOL attachment;
+  // The body being decoded
+  FKREMailEncoding body_encoding;
+  BOOL body_html;
+  unsigned int b64_bits;
+  int b64_count;
+  BOOL text_line_start;
+  BOOL quoted;
+  FKREMailLevel levels[FKRE_MAIL_MAX_DEPTH];
+  int depth;
+  };
+
+/*============================================================================
+  
+  fkre_mail_new
+
+  ==========================================================================*/
+FKREMail *fkre_mail_new (void)
+  {
+  KLOG_IN
+  FKREMail *self = malloc (sizeof (FKREMail));
+  memset (self, 0, sizeof (FKREMail));
+  self->plain = fkre_context_new (fkre_stats_flags ());
+  self->html = fkre_context_new (FKRE_FLAG_HTML | fkre_stats_flags ());
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_mail_destroy
+
+  ==========================================================================*/
+void fkre_mail_destroy (FKREMail *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    fkre_stats_add_context (self->plain);
+    fkre_stats_add_context (self->html);
+    fkre_context_destroy (self->plain);
+    fkre_context_destroy (self->html);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_mail_start_entity
+
+  Get ready for the headers of a message or a part
+
+  ==========================================================================*/
+static void fkre_mail_start_entity (FKREMail *self)
+  {
+  self->state = FKRE_MAIL_HEADERS;
+  self->header_length = 0;
+  self->type[0] = 0;
+  self->boundary[0] = 0;
+  self->encoding = FKRE_MAIL_IDENTITY;
+  self->attachment = FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_start_message
+
+  ==========================================================================*/
+static void fkre_mail_start_message (FKREMail *self)
+  {
+  self->messages++;
+  self->in_message = TRUE;
+  self->context = NULL;
+  self->depth = 0;
+  fkre_mail_start_entity (self);
+  }
+
+/*============================================================================
+  
+  fkre_mail_end_message
+
+  ==========================================================================*/
+static void fkre_mail_end_message (FKREMail *self)
+  {
+  // A message with no text is still reported, with no words
+  FKREContext *context = self->context;
+  if (!context)
+    {
+    context = self->plain;
+    fkre_context_reset (context);
+    }
+  fkre_context_finish (context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (context, &metrics);
+
+  if (!self->mbox)
+    self->fn (self->user_data, self->name, &metrics);
+  else
+    {
+    char *name;
+    if (strcmp (self->name, "-") == 0)
+      asprintf (&name, "%" PRId64, self->messages);
+    else
+      asprintf (&name, "%s:%" PRId64, self->name, self->messages);
+    self->fn (self->user_data, name, &metrics);
+    free (name);
+    }
+  self->in_message = FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_text
+
+  Feed decoded text to the context. In plain text, lines that start
+  with '>' quote an earlier message, and are left out
+
+  ==========================================================================*/
+static void fkre_mail_text (FKREMail *self, const char *text, size_t length)
+  {
+  if (self->body_html)
+    {
+    fkre_context_feed (self->context, (const BYTE *)text, length);
+    return;
+    }
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++)
+    {
+    if (self->text_line_start)
+      {
+      self->text_line_start = FALSE;
+      self->quoted = (text[i] == '>');
+      start = i;
+      }
+    if (text[i] == '\n')
+      {
+      if (!self->quoted)
+        fkre_context_feed (self->context, (const BYTE *)text + start,
+          i + 1 - start);
+      self->text_line_start = TRUE;
+      }
+    }
+  if (!self->text_line_start && !self->quoted)
+    fkre_context_feed (self->context, (const BYTE *)text + start,
+      length - start);
+  }
+
+/*============================================================================
+  
+  fkre_mail_hex
+
+  ==========================================================================*/
+static int fkre_mail_hex (char c)
+  {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+  }
+
+/*============================================================================
+  
+  fkre_mail_decode_qp
+
+  ==========================================================================*/
+static void fkre_mail_decode_qp (FKREMail *self, const char *line,
+      size_t length, BOOL partial)
+  {
+  char out[FKRE_MAIL_MAX_LINE + 1];
+  size_t n = 0;
+  // Trailing white space is not part of the text
+  while (!partial && length > 0
+      && (line[length - 1] == ' ' || line[length - 1] == '\t'))
+    length--;
+  BOOL soft_break = FALSE;
+  for (size_t i = 0; i < length; i++)
+    {
+    if (line[i] != '=')
+      out[n++] = line[i];
+    else if (i + 1 == length)
+      soft_break = TRUE;
+    else if (i + 2 < length && fkre_mail_hex (line[i + 1]) >= 0
+        && fkre_mail_hex (line[i + 2]) >= 0)
+      {
+      out[n++] = (char)(fkre_mail_hex (line[i + 1]) * 16
+        + fkre_mail_hex (line[i + 2]));
+      i += 2;
+      }
+    else
+      out[n++] = '=';
+    }
+  if (!partial && !soft_break) out[n++] = '\n';
+  fkre_mail_text (self, out, n);
+  }
+
+/*============================================================================
+  
+  fkre_mail_decode_base64
+
+  ==========================================================================*/
+static void fkre_mail_decode_base64 (FKREMail *self, const char *line,
+      size_t length)
+  {
+  char out[FKRE_MAIL_MAX_LINE];
+  size_t n = 0;
+  for (size_t i = 0; i < length; i++)
+    {
+    char c = line[i];
+    int v;
+    if (c >= 'A' && c <= 'Z') v = c - 'A';
+    else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+    else if (c >= '0' && c <= '9') v = c - '0' + 52;
+    else if (c == '+') v = 62;
+    else if (c == '/') v = 63;
+    else continue;
+    self->b64_bits = (self->b64_bits << 6) | v;
+    if (++self->b64_count == 4)
+      {
+      out[n++] = (char)(self->b64_bits >> 16);
+      out[n++] = (char)(self->b64_bits >> 8);
+      out[n++] = (char)self->b64_bits;
+      self->b64_bits = 0;
+      self->b64_count = 0;
+      }
+    }
+  // Padding ends the data, with one or two bytes left over
+  if (length > 0 && line[length - 1] == '=' && self->b64_count >= 2)
+    {
+    unsigned int bits = self->b64_bits << (6 * (4 - self->b64_count));
+    out[n++] = (char)(bits >> 16);
+    if (self->b64_count == 3) out[n++] = (char)(bits >> 8);
+    self->b64_bits = 0;
+    self->b64_count = 0;
+    }
+  fkre_mail_text (self, out, n);
+  }
+
+/*============================================================================
+  
+  fkre_mail_parameter
+
+  Find a parameter, like 'boundary="xyz"', in a header value
+
+  ==========================================================================*/
+static BOOL fkre_mail_parameter (const char *value, const char *name,
+      char *out, size_t size)
+  {
+  size_t name_length = strlen (name);
+  const char *p = value;
+  while ((p = strchr (p, ';')))
+    {
+    p++;
+    while (isspace ((unsigned char)*p)) p++;
+    if (strncasecmp (p, name, name_length) == 0 && p[name_length] == '=')
+      {
+      p += name_length + 1;
+      const char *end;
+      if (*p == '"')
+        {
+        p++;
+        end = strchr (p, '"');
+        if (!end) end = p + strlen (p);
+        }
+      else
+        {
+        end = p;
+        while (*end && *end != ';' && !isspace ((unsigned char)*end))
+          end++;
+        }
+      size_t length = end - p;
+      if (length >= size) return FALSE;
+      memcpy (out, p, length);
+      out[length] = 0;
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_header
+
+  Note anything important in a complete header
+
+  ==========================================================================*/
+static void fkre_mail_header (FKREMail *self)
+  {
+  self->header[self->header_length] = 0;
+  char *colon = strchr (self->header, ':');
+  if (!colon) return;
+  *colon = 0;
+  char *value = colon + 1;
+  while (isspace ((unsigned char)*value)) value++;
+
+  if (strcasecmp (self->header, "Content-Type") == 0)
+    {
+    size_t i = 0;
+    while (value[i] && value[i] != ';' && !isspace ((unsigned char)value[i])
+        && i < sizeof (self->type) - 1)
+      {
+      self->type[i] = tolower ((unsigned char)value[i]);
+      i++;
+      }
+    self->type[i] = 0;
+    if (!fkre_mail_parameter (value, "boundary", self->boundary,
+         sizeof (self->boundary)))
+      self->boundary[0] = 0;
+    }
+  else if (strcasecmp (self->header, "Content-Transfer-Encoding") == 0)
+    {
+    if (strncasecmp (value, "quoted-printable", 16) == 0)
+      self->encoding = FKRE_MAIL_QP;
+    else if (strncasecmp (value, "base64", 6) == 0)
+      self->encoding = FKRE_MAIL_BASE64;
+    else
+      self->encoding = FKRE_MAIL_IDENTITY;
+    }
+  else if (strcasecmp (self->header, "Content-Disposition") == 0)
+    self->attachment = (strncasecmp (value, "attachment", 10) == 0);
+  }
+
+/*============================================================================
+  
+  fkre_mail_end_headers
+
+  Decide what to do with the body that follows
+
+  ==========================================================================*/
+static void fkre_mail_end_headers (FKREMail *self)
+  {
+  self->state = FKRE_MAIL_SKIP;
+  if (strncmp (self->type, "multipart/", 10) == 0)
+    {
+    // The parts follow, after a preamble that is skipped
+    if (self->boundary[0] && self->depth < FKRE_MAIL_MAX_DEPTH)
+      {
+      FKREMailLevel *level = &self->levels[self->depth++];
+      strcpy (level->boundary, self->boundary);
+      level->length = strlen (self->boundary);
+      level->alternative = strcmp (self->type, "multipart/alternative") == 0;
+      level->chosen = FALSE;
+      }
+    return;
+    }
+
+  // With no Content-Type, the body is plain text
+  BOOL html = strcmp (self->type, "text/html") == 0;
+  BOOL text = html || !self->type[0] || strcmp (self->type, "text/plain") == 0;
+  if (!text || self->attachment) return;
+  FKREMailLevel *parent = self->depth > 0 ?
+    &self->levels[self->depth - 1] : NULL;
+  if (parent && parent->alternative && parent->chosen) return;
+
+  // A document is either HTML or not, so the first text part decides
+  if (!self->context)
+    {
+    self->context = html ? self->html : self->plain;
+    fkre_context_reset (self->context);
+    }
+  if ((self->context == self->html) != html) return;
+
+  if (parent) parent->chosen = TRUE;
+  self->state = FKRE_MAIL_BODY;
+  self->body_encoding = self->encoding;
+  self->body_html = html;
+  self->b64_bits = 0;
+  self->b64_count = 0;
+  self->text_line_start = TRUE;
+  self->quoted = FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_boundary
+
+  Check whether a line is a MIME boundary, of this multipart entity or
+  any that enclose it
+
+  ==========================================================================*/
+static BOOL fkre_mail_boundary (FKREMail *self, const char *line,
+      size_t length)
+  {
+  if (length < 2 || line[0] != '-' || line[1] != '-') return FALSE;
+  for (int i = self->depth - 1; i >= 0; i--)
+    {
+    FKREMailLevel *level = &self->levels[i];
+    if (length >= 2 + level->length
+        && memcmp (line + 2, level->boundary, level->length) == 0)
+      {
+      const char *rest = line + 2 + level->length;
+      if (length >= 4 + level->length && rest[0] == '-' && rest[1] == '-')
+        {
+        // The end of this multipart entity
+        self->depth = i;
+        self->state = FKRE_MAIL_SKIP;
+        }
+      else
+        {
+        self->depth = i + 1;
+        fkre_mail_start_entity (self);
+        }
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_line
+
+  Handle a line, or, if 'partial', the first part of a long one. If
+  'continued', this is the rest of a long line
+
+  ==========================================================================*/
+static void fkre_mail_line (FKREMail *self, char *line, size_t length,
+      BOOL continued, BOOL partial)
+  {
+  if (!continued)
+    {
+    if (!partial && length > 0 && line[length - 1] == '\r') length--;
+    // In an mbox, a line starting "From " after a blank line separates
+    //   messages
+    if (self->mbox && (self->messages == 0 || self->last_blank)
+        && length >= 5 && memcmp (line, "From ", 5) == 0)
+      {
+      if (self->in_message) fkre_mail_end_message (self);
+      fkre_mail_start_message (self);
+      self->last_blank = FALSE;
+      return;
+      }
+    if (!self->in_message) fkre_mail_start_message (self);
+    self->last_blank = (!partial && length == 0);
+    // mboxrd escapes "From " in bodies as ">From ", ">>From ", ...
+    if (self->mbox && length > 5 && line[0] == '>')
+      {
+      size_t i = 0;
+      while (i < length && line[i] == '>') i++;
+      if (length - i >= 5 && memcmp (line + i, "From ", 5) == 0)
+        {
+        line++;
+        length--;
+        }
+      }
+    }
+  else
+    self->last_blank = FALSE;
+
+  switch (self->state)
+    {
+    case FKRE_MAIL_HEADERS:
+      if (!continued && length == 0)
+        {
+        fkre_mail_header (self);
+        fkre_mail_end_headers (self);
+        return;
+        }
+      if (!continued && line[0] != ' ' && line[0] != '\t')
+        {
+        fkre_mail_header (self);
+        self->header_length = 0;
+        }
+      if (self->header_length + length > FKRE_MAIL_MAX_HEADER)
+        length = FKRE_MAIL_MAX_HEADER - self->header_length;
+      memcpy (self->header + self->header_length, line, length);
+      self->header_length += length;
+      break;
+
+    case FKRE_MAIL_BODY:
+    case FKRE_MAIL_SKIP:
+      if (!continued && fkre_mail_boundary (self, line, length)) return;
+      if (self->state == FKRE_MAIL_SKIP) return;
+      switch (self->body_encoding)
+        {
+        case FKRE_MAIL_QP:
+          fkre_mail_decode_qp (self, line, length, partial);
+          break;
+        case FKRE_MAIL_BASE64:
+          fkre_mail_decode_base64 (self, line, length);
+          break;
+        default:
+          fkre_mail_text (self, line, length);
+          if (!partial) fkre_mail_text (self, "\n", 1);
+        }
+      break;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_mail_block
+
+  Called with each block of the mailbox as it is read, to split it
+  into lines
+
+  ==========================================================================*/
+static BOOL fkre_mail_block (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  FKREMail *self = user_data;
+  while (length > 0)
+    {
+    const BYTE *nl = memchr (data, '\n', length);
+    size_t n = nl ? (size_t)(nl - data) : length;
+    size_t room = FKRE_MAIL_MAX_LINE - self->line_length;
+    if (n > room) n = room;
+    memcpy (self->line + self->line_length, data, n);
+    self->line_length += n;
+    data += n;
+    length -= n;
+    if (length > 0 && *data == '\n')
+      {
+      fkre_mail_line (self, self->line, self->line_length,
+        self->line_continues, FALSE);
+      self->line_length = 0;
+      self->line_continues = FALSE;
+      data++;
+      length--;
+      }
+    else if (self->line_length == FKRE_MAIL_MAX_LINE)
+      {
+      fkre_mail_line (self, self->line, self->line_length,
+        self->line_continues, TRUE);
+      self->line_length = 0;
+      self->line_continues = TRUE;
+      }
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_mail_score_fd
+
+  ==========================================================================*/
+static BOOL fkre_mail_score_fd (FKREMail *self, int fd, BOOL mbox,
+      const char *name, FKREMailFn fn, void *user_data)
+  {
+  self->fn = fn;
+  self->user_data = user_data;
+  self->name = name;
+  self->mbox = mbox;
+  self->messages = 0;
+  self->in_message = FALSE;
+  self->line_length = 0;
+  self->line_continues = FALSE;
+  self->last_blank = FALSE;
+
+  BOOL ret = fkre_read_fd (fd, fkre_mail_block, self);
+  if (ret)
+    {
+    if (self->line_length > 0)
+      fkre_mail_line (self, self->line, self->line_length,
+        self->line_continues, FALSE);
+    if (self->in_message || !mbox)
+      fkre_mail_end_message (self);
+    }
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_mail_compare
+
+  ==========================================================================*/
+static int fkre_mail_compare (const void *a, const void *b)
+  {
+  return strcmp (*(char *const *)a, *(char *const *)b);
+  }
+
+/*============================================================================
+  
+  fkre_mail_score_maildir
+
+  Score the messages in a Maildir's cur and new directories, one per
+  file, in name order -- which, for Maildir, is roughly delivery order
+
+  ==========================================================================*/
+static BOOL fkre_mail_score_maildir (FKREMail *self, const char *path,
+      FKREMailFn fn, void *user_data)
+  {
+  KLOG_IN
+  static const char *const subdirs[] = { "cur", "new" };
+  BOOL ret = FALSE;
+  for (int s = 0; s < 2; s++)
+    {
+    char *dirname;
+    asprintf (&dirname, "%s/%s", path, subdirs[s]);
+    DIR *dir = opendir (dirname);
+    if (dir)
+      {
+      ret = TRUE;
+      char **names = NULL;
+      int nnames = 0;
+      struct dirent *de;
+      while ((de = readdir (dir)))
+        {
+        if (de->d_name[0] == '.') continue;
+        names = realloc (names, (nnames + 1) * sizeof (char *));
+        names[nnames++] = strdup (de->d_name);
+        }
+      closedir (dir);
+      qsort (names, nnames, sizeof (char *), fkre_mail_compare);
+
+      for (int i = 0; i < nnames; i++)
+        {
+        char *filename;
+        asprintf (&filename, "%s/%s", dirname, names[i]);
+        int fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || !fkre_mail_score_fd (self, fd, FALSE, filename,
+              fn, user_data))
+          klog_warn (KLOG_CLASS, "Can't read '%s': %s", filename,
+            strerror (errno));
+        if (fd >= 0) close (fd);
+        free (filename);
+        free (names[i]);
+        }
+      free (names);
+      }
+    free (dirname);
+    }
+  // A directory with neither cur nor new is not a Maildir
+  if (!ret) errno = ENOTDIR;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_mail_score
+
+  ==========================================================================*/
+BOOL fkre_mail_score (FKREMail *self, const char *path,
+      FKREMailFn fn, void *user_data)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (strcmp (path, "-") == 0)
+    ret = fkre_mail_score_fd (self, STDIN_FILENO, TRUE, path, fn,
+      user_data);
+  else
+    {
+    struct stat sb;
+    if (stat (path, &sb) == 0 && S_ISDIR (sb.st_mode))
+      ret = fkre_mail_score_maildir (self, path, fn, user_data);
+    else
+      {
+      int fd = open (path, O_RDONLY | O_CLOEXEC);
+      if (fd >= 0)
+        {
+        ret = fkre_mail_score_fd (self, fd, TRUE, path, fn, user_data);
+        int e = errno;
+        close (fd);
+        errno = e;
+        }
+      }
+    }
+  KLOG_OUT
+  return ret;
+  }
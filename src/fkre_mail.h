@@ -0,0 +1,43 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_mail.h
+
+  Scoring e-mail messages, one document per message, from mbox files
+  and Maildir directories. Only the text of each message is scored --
+  not its headers, attachments, or the lines it quotes from earlier
+  messages.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+struct _FKREMail;
+typedef struct _FKREMail FKREMail;
+
+/** Called for each message, with a name of the form "inbox:12" (the
+    twelfth message in an mbox), or the path of the message file in a
+    Maildir. */
+typedef void (*FKREMailFn) (void *user_data, const char *name,
+               const FKREMetrics *metrics);
+
+BEGIN_DECLS
+
+extern FKREMail *fkre_mail_new (void);
+
+extern void      fkre_mail_destroy (FKREMail *self);
+
+/** Score each message in a mailbox -- an mbox file (which may be
+    compressed), a Maildir directory, or, if 'path' is "-", an mbox on
+    stdin, whose messages are named just by number. Returns FALSE, with
+    errno set, if the mailbox can't be read. */
+extern BOOL      fkre_mail_score (FKREMail *self, const char *path,
+                   FKREMailFn fn, void *user_data);
+
+END_DECLS
@@ -0,0 +1,541 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_office.c
+
+  The XML is read by a small state machine, a byte at a time, as it
+  comes out of the decompressor, so that no part of the document --
+  still less a tree of its elements -- is ever held in memory. Only
+  the elements that carry text, or mark structure, are looked at:
+
+  Word:          text is in <w:t>; paragraphs are <w:p>; a paragraph is
+                 a heading if its style is "Heading...", "Title" or
+                 "Subtitle", or it has an outline level.
+  OpenDocument:  text is in <text:p> and <text:h>; <text:h> is a
+                 heading. Notes, annotations, and the record of
+                 tracked changes are left out.
+
+  The namespace prefixes are the ones that Word and LibreOffice always
+  use, rather than being looked up from the namespace declarations.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include <klib/zipfile.h>
+#include <fkre/fkre.h>
+#include "fkre_office.h"
+#include "fkre_stats.h"
+
+#define KLOG_CLASS "fkre.office"
+
+// Tags longer than this are cut short; only the name, and a few short
+//   attributes, are of interest
+#define FKRE_OFFICE_TAG_MAX 256
+
+// Text is collected into blocks of this size before being scored
+#define FKRE_OFFICE_OUT 4096
+
+/*============================================================================
+  
+  FKREOfficeFormat
+
+  ==========================================================================*/
+typedef enum
+  {
+  FKRE_OFFICE_DOCX = 0,
+  FKRE_OFFICE_ODT = 1
+  } FKREOfficeFormat;
+
+/*============================================================================
+  
+  FKREXmlState
+
+  ==========================================================================*/
+typedef enum
+  {
+  XML_TEXT = 0,
+  XML_TAG = 1,
+  XML_ENTITY = 2,
+  XML_COMMENT = 3,
+  XML_CDATA = 4
+  } FKREXmlState;
+
+/*============================================================================
+  
+  FKREOfficeParser
+
+  ==========================================================================*/
+typedef struct _FKREOfficeParser
+  {
+  FKREOfficeFormat format;
+  FKREContext *context;
+  FKREXmlState state;
+  char tag[FKRE_OFFICE_TAG_MAX];
+  size_t tag_length;
+  // The quote character, while inside an attribute value
+  char quote;
+  char entity[16];
+  size_t entity_length;
+  // How much of the terminator of a comment or CDATA section has
+  //   been seen
+  int matched;
+  // Inside an element whose character data is text
+  int text_depth;
+  // Inside an element whose contents are not part of the main text
+  int skip_depth;
+  // The current Word paragraph has already been marked as a heading
+  BOOL heading;
+  char out[FKRE_OFFICE_OUT];
+  size_t out_length;
+  } FKREOfficeParser;
+
+/*============================================================================
+  
+  fkre_office_format
+
+  Work out the format of a document from its name
+
+  ==========================================================================*/
+static BOOL fkre_office_format (const char *filename,
+      FKREOfficeFormat *format)
+  {
+  size_t l = strlen (filename);
+  if (l > 5 && strcasecmp (filename + l - 5, ".docx") == 0)
+    {
+    *format = FKRE_OFFICE_DOCX;
+    return TRUE;
+    }
+  if (l > 4 && strcasecmp (filename + l - 4, ".odt") == 0)
+    {
+    *format = FKRE_OFFICE_ODT;
+    return TRUE;
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_is_office
+
+  ==========================================================================*/
+BOOL fkre_is_office (const char *filename)
+  {
+  FKREOfficeFormat format;
+  return fkre_office_format (filename, &format);
+  }
+
+/*============================================================================
+  
+  fkre_office_flush
+
+  ==========================================================================*/
+static void fkre_office_flush (FKREOfficeParser *p)
+  {
+  if (p->out_length > 0)
+    {
+    fkre_context_feed (p->context, p->out, p->out_length);
+    p->out_length = 0;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_office_emit
+
+  Add text to the output, if the parser is inside a text element --
+  or, if 'always', anywhere that is not being skipped
+
+  ==========================================================================*/
+static inline void fkre_office_emit (FKREOfficeParser *p, const char *s,
+      size_t n, BOOL always)
+  {
+  if (p->skip_depth > 0 || (p->text_depth == 0 && !always)) return;
+  for (size_t i = 0; i < n; i++)
+    {
+    if (p->out_length == FKRE_OFFICE_OUT) fkre_office_flush (p);
+    p->out[p->out_length++] = s[i];
+    }
+  }
+
+/*============================================================================
+  
+  fkre_office_mark
+
+  ==========================================================================*/
+static void fkre_office_mark (FKREOfficeParser *p, FKREMark mark)
+  {
+  if (p->skip_depth > 0) return;
+  // Whatever follows is a separate word, even without white space
+  fkre_office_emit (p, " ", 1, TRUE);
+  fkre_office_flush (p);
+  fkre_context_mark (p->context, mark);
+  }
+
+/*============================================================================
+  
+  fkre_office_attribute
+
+  Find an attribute in the current tag, copying its value into 'value'
+  (truncated if necessary). Returns FALSE if it's not there.
+
+  ==========================================================================*/
+static BOOL fkre_office_attribute (const FKREOfficeParser *p,
+      const char *name, char *value, size_t max)
+  {
+  size_t l = strlen (name);
+  const char *end = p->tag + p->tag_length;
+  for (const char *s = p->tag; s + l + 3 <= end; s++)
+    {
+    if ((s[0] == ' ' || s[0] == '\t' || s[0] == '\n' || s[0] == '\r')
+         && memcmp (s + 1, name, l) == 0 && s[l + 1] == '='
+         && (s[l + 2] == '"' || s[l + 2] == '\''))
+      {
+      const char *v = s + l + 3;
+      size_t n = 0;
+      while (v < end && *v != s[l + 2] && n < max - 1) value[n++] = *v++;
+      value[n] = 0;
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_office_docx_element
+
+  ==========================================================================*/
+static void fkre_office_docx_element (FKREOfficeParser *p,
+      const char *name, BOOL end, BOOL empty)
+  {
+  if (strcmp (name, "w:t") == 0)
+    {
+    if (!empty) p->text_depth += end ? -1 : 1;
+    }
+  else if (strcmp (name, "w:p") == 0)
+    {
+    if (end || empty)
+      fkre_office_mark (p, FKRE_MARK_PARAGRAPH);
+    else
+      p->heading = FALSE;
+    }
+  else if (strcmp (name, "w:tab") == 0 || strcmp (name, "w:br") == 0
+        || strcmp (name, "w:cr") == 0)
+    {
+    if (!end) fkre_office_emit (p, " ", 1, TRUE);
+    }
+  else if ((strcmp (name, "w:pStyle") == 0
+        || strcmp (name, "w:outlineLvl") == 0) && !end)
+    {
+    char style[32];
+    BOOL heading = name[2] == 'o';
+    if (!heading && fkre_office_attribute (p, "w:val", style,
+          sizeof (style)))
+      heading = strncasecmp (style, "heading", 7) == 0
+        || strcasecmp (style, "title") == 0
+        || strcasecmp (style, "subtitle") == 0;
+    if (heading && !p->heading)
+      {
+      p->heading = TRUE;
+      fkre_office_mark (p, FKRE_MARK_SUBHEADING);
+      }
+    }
+  // Alternative content for programs that don't understand the
+  //   preferred version -- it would repeat the text
+  else if (strcmp (name, "mc:Fallback") == 0)
+    {
+    if (!empty) p->skip_depth += end ? -1 : 1;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_office_odt_element
+
+  ==========================================================================*/
+static void fkre_office_odt_element (FKREOfficeParser *p,
+      const char *name, BOOL end, BOOL empty)
+  {
+  if (strcmp (name, "text:p") == 0 || strcmp (name, "text:h") == 0)
+    {
+    if (empty) return;
+    if (end)
+      {
+      p->text_depth--;
+      fkre_office_mark (p, FKRE_MARK_PARAGRAPH);
+      }
+    else
+      {
+      if (name[5] == 'h') fkre_office_mark (p, FKRE_MARK_SUBHEADING);
+      p->text_depth++;
+      }
+    }
+  else if (strcmp (name, "text:s") == 0 || strcmp (name, "text:tab") == 0
+        || strcmp (name, "text:line-break") == 0)
+    {
+    if (!end) fkre_office_emit (p, " ", 1, FALSE);
+    }
+  else if (strcmp (name, "text:note") == 0
+        || strcmp (name, "office:annotation") == 0
+        || strcmp (name, "text:tracked-changes") == 0)
+    {
+    if (!empty) p->skip_depth += end ? -1 : 1;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_office_tag
+
+  Handle a complete tag, whose contents (without the angle brackets)
+  are in p->tag
+
+  ==========================================================================*/
+static void fkre_office_tag (FKREOfficeParser *p)
+  {
+  const char *t = p->tag;
+  size_t l = p->tag_length;
+  // Processing instructions, and declarations
+  if (l == 0 || t[0] == '?' || t[0] == '!') return;
+
+  BOOL end = (t[0] == '/');
+  BOOL empty = (t[l - 1] == '/');
+  if (end) { t++; l--; }
+
+  char name[64];
+  size_t n = 0;
+  while (n < l && n < sizeof (name) - 1 && t[n] != ' ' && t[n] != '\t'
+         && t[n] != '\r' && t[n] != '\n' && t[n] != '/')
+    {
+    name[n] = t[n];
+    n++;
+    }
+  name[n] = 0;
+
+  if (p->format == FKRE_OFFICE_DOCX)
+    fkre_office_docx_element (p, name, end, empty);
+  else
+    fkre_office_odt_element (p, name, end, empty);
+  if (p->skip_depth < 0) p->skip_depth = 0;
+  if (p->text_depth < 0) p->text_depth = 0;
+  }
+
+/*============================================================================
+  
+  fkre_office_entity
+
+  Emit the character for the entity in p->entity, as UTF-8
+
+  ==========================================================================*/
+static void fkre_office_entity (FKREOfficeParser *p)
+  {
+  const char *e = p->entity;
+  unsigned long c = 0;
+  if (strcmp (e, "amp") == 0) c = '&';
+  else if (strcmp (e, "lt") == 0) c = '<';
+  else if (strcmp (e, "gt") == 0) c = '>';
+  else if (strcmp (e, "quot") == 0) c = '"';
+  else if (strcmp (e, "apos") == 0) c = '\'';
+  else if (e[0] == '#' && (e[1] == 'x' || e[1] == 'X'))
+    c = strtoul (e + 2, NULL, 16);
+  else if (e[0] == '#')
+    c = strtoul (e + 1, NULL, 10);
+
+  char utf8[4];
+  size_t n;
+  if (c == 0 || c > 0x10FFFF)
+    return;
+  else if (c < 0x80)
+    {
+    utf8[0] = c;
+    n = 1;
+    }
+  else if (c < 0x800)
+    {
+    utf8[0] = 0xC0 | (c >> 6);
+    utf8[1] = 0x80 | (c & 0x3F);
+    n = 2;
+    }
+  else if (c < 0x10000)
+    {
+    utf8[0] = 0xE0 | (c >> 12);
+    utf8[1] = 0x80 | ((c >> 6) & 0x3F);
+    utf8[2] = 0x80 | (c & 0x3F);
+    n = 3;
+    }
+  else
+    {
+    utf8[0] = 0xF0 | (c >> 18);
+    utf8[1] = 0x80 | ((c >> 12) & 0x3F);
+    utf8[2] = 0x80 | ((c >> 6) & 0x3F);
+    utf8[3] = 0x80 | (c & 0x3F);
+    n = 4;
+    }
+  fkre_office_emit (p, utf8, n, FALSE);
+  }
+
+/*============================================================================
+  
+  fkre_office_feed
+
+  ==========================================================================*/
+static BOOL fkre_office_feed (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  FKREOfficeParser *p = user_data;
+  for (size_t i = 0; i < length; i++)
+    {
+    char c = data[i];
+    switch (p->state)
+      {
+      case XML_TEXT:
+        if (c == '<')
+          {
+          p->state = XML_TAG;
+          p->tag_length = 0;
+          p->quote = 0;
+          }
+        else if (c == '&')
+          {
+          p->state = XML_ENTITY;
+          p->entity_length = 0;
+          }
+        else
+          fkre_office_emit (p, &c, 1, FALSE);
+        break;
+
+      case XML_TAG:
+        if (p->quote)
+          {
+          if (c == p->quote) p->quote = 0;
+          }
+        else if (c == '"' || c == '\'')
+          p->quote = c;
+        else if (c == '>')
+          {
+          fkre_office_tag (p);
+          p->state = XML_TEXT;
+          break;
+          }
+        if (p->tag_length < FKRE_OFFICE_TAG_MAX - 1)
+          p->tag[p->tag_length++] = c;
+        if (p->tag_length == 3 && memcmp (p->tag, "!--", 3) == 0)
+          {
+          p->state = XML_COMMENT;
+          p->matched = 0;
+          }
+        else if (p->tag_length == 8 && memcmp (p->tag, "![CDATA[", 8) == 0)
+          {
+          p->state = XML_CDATA;
+          p->matched = 0;
+          }
+        break;
+
+      case XML_ENTITY:
+        if (c == ';')
+          {
+          p->entity[p->entity_length] = 0;
+          fkre_office_entity (p);
+          p->state = XML_TEXT;
+          }
+        else if (p->entity_length < sizeof (p->entity) - 1)
+          p->entity[p->entity_length++] = c;
+        break;
+
+      case XML_COMMENT:
+        if (c == '>' && p->matched >= 2)
+          p->state = XML_TEXT;
+        else if (c == '-')
+          p->matched++;
+        else
+          p->matched = 0;
+        break;
+
+      case XML_CDATA:
+        if (c == '>' && p->matched >= 2)
+          p->state = XML_TEXT;
+        else if (c == ']')
+          {
+          if (p->matched == 2) fkre_office_emit (p, "]", 1, FALSE);
+          else p->matched++;
+          }
+        else
+          {
+          fkre_office_emit (p, "]]", p->matched, FALSE);
+          p->matched = 0;
+          fkre_office_emit (p, &c, 1, FALSE);
+          }
+        break;
+      }
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_office_score
+
+  ==========================================================================*/
+BOOL fkre_office_score (const char *filename, FKREMetrics *metrics)
+  {
+  KLOG_IN
+  FKREOfficeFormat format;
+  if (!fkre_office_format (filename, &format))
+    {
+    errno = EINVAL;
+    KLOG_OUT
+    return FALSE;
+    }
+
+  BOOL ret = FALSE;
+  ZipFile *zipfile = kzipfile_create (filename);
+  ZipError e = kzipfile_read_contents (zipfile);
+  int err = errno;
+  int entry = -1;
+  if (e == ZE_OK)
+    entry = kzipfile_find_entry (zipfile,
+      format == FKRE_OFFICE_DOCX ? "word/document.xml" : "content.xml");
+  if (e == ZE_OPENREAD)
+    errno = err;
+  else if (entry < 0)
+    {
+    klog_warn (KLOG_CLASS, "'%s' has no document text", filename);
+    errno = EINVAL;
+    }
+  else
+    {
+    FKREOfficeParser *p = malloc (sizeof (FKREOfficeParser));
+    memset (p, 0, sizeof (FKREOfficeParser));
+    p->format = format;
+    p->context = fkre_context_new (fkre_stats_flags ());
+    e = kzipfile_extract_to_function (zipfile, entry, fkre_office_feed, p);
+    if (e == ZE_OK)
+      {
+      fkre_office_flush (p);
+      fkre_context_finish (p->context);
+      fkre_context_get_metrics (p->context, metrics);
+      ret = TRUE;
+      }
+    else
+      {
+      klog_warn (KLOG_CLASS, "Can't extract the text of '%s'", filename);
+      errno = EINVAL;
+      }
+    fkre_stats_add_context (p->context);
+    fkre_context_destroy (p->context);
+    free (p);
+    }
+  kzipfile_destroy (zipfile);
+  KLOG_OUT
+  return ret;
+  }
+
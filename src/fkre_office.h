@@ -0,0 +1,32 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_office.h
+
+  Scoring word-processor documents -- Word (.docx) and OpenDocument
+  (.odt) -- by streaming the document's XML straight out of the archive,
+  and extracting the text as it goes.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+BEGIN_DECLS
+
+/** Whether a file should be treated as a word-processor document,
+    judging by its name. */
+extern BOOL fkre_is_office (const char *filename);
+
+/** Score a word-processor document. Paragraphs end sentences, and
+    headings count as subheadings. Returns FALSE, with errno set, if
+    the file can't be read, or is not a document of the kind its name
+    suggests. */
+extern BOOL fkre_office_score (const char *filename, FKREMetrics *metrics);
+
+END_DECLS
@@ -0,0 +1,368 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_output.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <inttypes.h> 
+#include <klib/klib.h> 
+#include <fkre/fkre.h> 
+#include "fkre_writer.h" 
+#include "fkre_output.h" 
+#include "fkre_stats.h" 
+
+#define KLOG_CLASS "fkre.output"
+
+typedef enum
+  {
+  RECORD_NONE = 0,
+  RECORD_DOCUMENT = 1,
+  RECORD_WINDOW = 2
+  } RecordType;
+
+/*============================================================================
+  
+  FKREOutput 
+
+  ==========================================================================*/
+struct _FKREOutput
+  {
+  FKREWriter *writer;
+  FKREFormat format;
+  BOOL multiple;
+  int records;
+  // The type of record written first -- this determines the CSV header
+  RecordType type;
+  };
+
+/*============================================================================
+  
+  fkre_output_new
+
+  ==========================================================================*/
+FKREOutput *fkre_output_new (FKREWriter *writer, FKREFormat format,
+      BOOL multiple)
+  {
+  KLOG_IN
+  FKREOutput *self = malloc (sizeof (FKREOutput));
+  self->writer = writer;
+  self->format = format;
+  self->multiple = multiple;
+  self->records = 0;
+  self->type = RECORD_NONE;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_output_destroy
+
+  ==========================================================================*/
+void fkre_output_destroy (FKREOutput *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    if (self->format == FKRE_FORMAT_JSON)
+      {
+      if (self->records == 0)
+        fkre_writer_puts (self->writer, "[]\n");
+      else
+        fkre_writer_puts (self->writer, "\n]\n");
+      }
+    fkre_writer_flush (self->writer);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_output_start_record
+
+  Write whatever has to come before a record -- a CSV header or a JSON
+  array opener before the first one, a separator before the others.
+
+  ==========================================================================*/
+static void fkre_output_start_record (FKREOutput *self, RecordType type)
+  {
+  FKREWriter *w = self->writer;
+  if (self->records == 0)
+    {
+    self->type = type;
+    if (self->format == FKRE_FORMAT_JSON)
+      fkre_writer_puts (w, "[\n");
+    else if (self->format == FKRE_FORMAT_CSV)
+      {
+      if (type == RECORD_DOCUMENT)
+        fkre_writer_puts (w, "file,words,sentences,syllables,"
+          "max_sentence_length,average_sentence_length,score,rating,"
+          "passive_sentences,passive_proportion,subheadings,"
+          "max_words_per_subheading,average_words_per_subheading\n");
+      else
+        fkre_writer_puts (w, "file,start,end,score\n");
+      }
+    }
+  else
+    {
+    if (self->format == FKRE_FORMAT_JSON)
+      fkre_writer_puts (w, ",\n");
+    else if (self->format == FKRE_FORMAT_TEXT && type == RECORD_DOCUMENT)
+      fkre_writer_puts (w, "\n");
+    }
+  self->records++;
+  }
+
+/*============================================================================
+  
+  fkre_output_text
+
+  The traditional human-readable format
+
+  ==========================================================================*/
+static void fkre_output_text (FKREOutput *self, const char *filename, 
+      const FKREMetrics *r)
+  {
+  FKREWriter *w = self->writer;
+  if (self->multiple && filename)
+    fkre_writer_printf (w, "File: %s\n", filename);
+  fkre_writer_printf (w, "Words: %" PRId64 "\n", r->words);
+  fkre_writer_printf (w, "Sentences: %" PRId64 "\n", r->sentences);
+  fkre_writer_printf (w, "Longest sentence: %" PRId64 " words\n", 
+    r->max_sentence_length);
+  if (r->sentences > 0)
+    fkre_writer_printf (w, "Average sentence: %" PRId64 " words\n", 
+      r->words / r->sentences);
+  fkre_writer_printf (w, "Syllables: %" PRId64 "\n", r->syllables);
+  if (r->have_score)
+    {
+    fkre_writer_printf (w, "FK score: %.0f\n", r->score);
+    fkre_writer_printf (w, "FK rating: %s\n", fkre_rating (r->score));
+    fkre_writer_printf (w, "Passive sentences: %" PRId64 "\n", 
+      r->passive_sentences);
+    if (r->sentences > 0)
+      fkre_writer_printf (w, "Proportion of passive sentences: %.0f%%\n", 
+        (double)r->passive_sentences / (double)r->sentences * 100.0);
+    }
+  if (r->flags & (FKRE_FLAG_HTML | FKRE_FLAG_MARKDOWN 
+      | FKRE_FLAG_LATEX))
+    {
+    fkre_writer_printf (w, "Subheadings: %" PRId64 "\n", r->subheadings);
+    fkre_writer_printf (w, "Maximum words in a subheading: %" PRId64 "\n", 
+       r->max_words_per_subheading);
+    if (r->subheadings != 0)
+      {
+      fkre_writer_printf (w, "Average words per subheading: %.0f\n", 
+         (double)r->words / (double)r->subheadings);
+      }
+    }
+  }
+
+/*============================================================================
+  
+  fkre_output_json
+
+  Used for both JSON and NDJSON -- the only difference is what separates
+  the records. Metrics that can't be calculated are null.
+
+  ==========================================================================*/
+static void fkre_output_json (FKREOutput *self, const char *filename, 
+      const FKREMetrics *r)
+  {
+  FKREWriter *w = self->writer;
+  fkre_writer_puts (w, "{\"file\":");
+  fkre_writer_json_string (w, filename);
+  fkre_writer_printf (w, ",\"words\":%" PRId64 ",\"sentences\":%" PRId64 
+    ",\"syllables\":%" PRId64 ",\"max_sentence_length\":%" PRId64, 
+    r->words, r->sentences, r->syllables, r->max_sentence_length);
+  if (r->sentences > 0)
+    fkre_writer_printf (w, ",\"average_sentence_length\":%.3f",
+      (double)r->words / (double)r->sentences);
+  else
+    fkre_writer_puts (w, ",\"average_sentence_length\":null");
+  if (r->have_score)
+    fkre_writer_printf (w, ",\"score\":%.3f,\"rating\":\"%s\"", 
+      r->score, fkre_rating (r->score));
+  else
+    fkre_writer_puts (w, ",\"score\":null,\"rating\":null");
+  fkre_writer_printf (w, ",\"passive_sentences\":%" PRId64, 
+    r->passive_sentences);
+  if (r->sentences > 0)
+    fkre_writer_printf (w, ",\"passive_proportion\":%.4f",
+      (double)r->passive_sentences / (double)r->sentences);
+  else
+    fkre_writer_puts (w, ",\"passive_proportion\":null");
+  fkre_writer_printf (w, ",\"subheadings\":%" PRId64 
+    ",\"max_words_per_subheading\":%" PRId64, r->subheadings, 
+    r->max_words_per_subheading);
+  if (r->subheadings > 0)
+    fkre_writer_printf (w, ",\"average_words_per_subheading\":%.3f}",
+      (double)r->words / (double)r->subheadings);
+  else
+    fkre_writer_puts (w, ",\"average_words_per_subheading\":null}");
+  if (self->format == FKRE_FORMAT_NDJSON)
+    fkre_writer_puts (w, "\n");
+  }
+
+/*============================================================================
+  
+  fkre_output_csv
+
+  Metrics that can't be calculated are empty fields.
+
+  ==========================================================================*/
+static void fkre_output_csv (FKREOutput *self, const char *filename, 
+      const FKREMetrics *r)
+  {
+  FKREWriter *w = self->writer;
+  fkre_writer_csv_string (w, filename);
+  fkre_writer_printf (w, ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",", 
+    r->words, r->sentences, r->syllables, r->max_sentence_length);
+  if (r->sentences > 0)
+    fkre_writer_printf (w, "%.3f", (double)r->words / (double)r->sentences);
+  if (r->have_score)
+    fkre_writer_printf (w, ",%.3f,%s", r->score, fkre_rating (r->score));
+  else
+    fkre_writer_puts (w, ",,");
+  fkre_writer_printf (w, ",%" PRId64 ",", r->passive_sentences);
+  if (r->sentences > 0)
+    fkre_writer_printf (w, "%.4f", 
+      (double)r->passive_sentences / (double)r->sentences);
+  fkre_writer_printf (w, ",%" PRId64 ",%" PRId64 ",", r->subheadings, 
+    r->max_words_per_subheading);
+  if (r->subheadings > 0)
+    fkre_writer_printf (w, "%.3f", 
+      (double)r->words / (double)r->subheadings);
+  fkre_writer_puts (w, "\n");
+  }
+
+/*============================================================================
+  
+  fkre_output_document
+
+  ==========================================================================*/
+void fkre_output_document (FKREOutput *self, const char *filename, 
+      const FKREMetrics *metrics)
+  {
+  KLOG_IN
+  FKREStatsClock clock;
+  fkre_stats_start (&clock);
+  fkre_output_start_record (self, RECORD_DOCUMENT);
+  switch (self->format)
+    {
+    case FKRE_FORMAT_TEXT:
+      fkre_output_text (self, filename, metrics);
+      break;
+    case FKRE_FORMAT_JSON:
+    case FKRE_FORMAT_NDJSON:
+      fkre_output_json (self, filename, metrics);
+      break;
+    case FKRE_FORMAT_CSV:
+      fkre_output_csv (self, filename, metrics);
+      break;
+    }
+  fkre_stats_stop (&clock, FKRE_PHASE_OUTPUT);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_output_removed
+
+  In CSV, a removed document is a record with only the filename; in 
+  JSON, an object with a 'removed' member and no metrics.
+
+  ==========================================================================*/
+void fkre_output_removed (FKREOutput *self, const char *filename)
+  {
+  KLOG_IN
+  FKREWriter *w = self->writer;
+  fkre_output_start_record (self, RECORD_DOCUMENT);
+  switch (self->format)
+    {
+    case FKRE_FORMAT_TEXT:
+      fkre_writer_printf (w, "File: %s\nRemoved\n", filename);
+      break;
+    case FKRE_FORMAT_JSON:
+    case FKRE_FORMAT_NDJSON:
+      fkre_writer_puts (w, "{\"file\":");
+      fkre_writer_json_string (w, filename);
+      fkre_writer_puts (w, ",\"removed\":true}");
+      if (self->format == FKRE_FORMAT_NDJSON)
+        fkre_writer_puts (w, "\n");
+      break;
+    case FKRE_FORMAT_CSV:
+      fkre_writer_csv_string (w, filename);
+      fkre_writer_puts (w, ",,,,,,,,,,,,\n");
+      break;
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_output_window
+
+  ==========================================================================*/
+void fkre_output_window (FKREOutput *self, const char *filename, 
+      int64_t start, int64_t end, double score)
+  {
+  KLOG_IN
+  FKREWriter *w = self->writer;
+  fkre_output_start_record (self, RECORD_WINDOW);
+  switch (self->format)
+    {
+    case FKRE_FORMAT_TEXT:
+      if (self->multiple)
+        fkre_writer_printf (w, "%s\t", filename);
+      fkre_writer_printf (w, "%" PRId64 "\t%" PRId64 "\t%.1f\n", 
+        start, end, score);
+      break;
+    case FKRE_FORMAT_JSON:
+    case FKRE_FORMAT_NDJSON:
+      fkre_writer_puts (w, "{\"file\":");
+      fkre_writer_json_string (w, filename);
+      fkre_writer_printf (w, ",\"start\":%" PRId64 ",\"end\":%" PRId64 
+        ",\"score\":%.3f}", start, end, score);
+      if (self->format == FKRE_FORMAT_NDJSON)
+        fkre_writer_puts (w, "\n");
+      break;
+    case FKRE_FORMAT_CSV:
+      fkre_writer_csv_string (w, filename);
+      fkre_writer_printf (w, ",%" PRId64 ",%" PRId64 ",%.3f\n", 
+        start, end, score);
+      break;
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_format_from_utf8
+
+  ==========================================================================*/
+BOOL fkre_format_from_utf8 (const char *s, FKREFormat *format)
+  {
+  KLOG_IN
+  BOOL ret = TRUE;
+  if (strcmp (s, "text") == 0)
+    *format = FKRE_FORMAT_TEXT;
+  else if (strcmp (s, "json") == 0)
+    *format = FKRE_FORMAT_JSON;
+  else if (strcmp (s, "ndjson") == 0)
+    *format = FKRE_FORMAT_NDJSON;
+  else if (strcmp (s, "csv") == 0)
+    *format = FKRE_FORMAT_CSV;
+  else
+    ret = FALSE;
+  KLOG_OUT
+  return ret;
+  }
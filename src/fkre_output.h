@@ -0,0 +1,63 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_output.h
+
+  Definition of the FKREOutput class
+
+  FKREOutput formats per-document results (and sliding-window scores)
+  as human-readable text, or as JSON, NDJSON, or CSV records, and writes
+  them through an FKREWriter. There is one record per document (or 
+  window) in all the machine-readable formats.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_writer.h"
+
+typedef enum
+  {
+  FKRE_FORMAT_TEXT = 0,
+  FKRE_FORMAT_JSON = 1,
+  FKRE_FORMAT_NDJSON = 2,
+  FKRE_FORMAT_CSV = 3
+  } FKREFormat;
+
+struct _FKREOutput;
+typedef struct _FKREOutput FKREOutput;
+
+BEGIN_DECLS
+
+/** Create an output formatter. The writer belongs to the caller. If
+    'multiple' is TRUE, text-format output is labelled with the filename
+    of each document. */
+extern FKREOutput  *fkre_output_new (FKREWriter *writer, FKREFormat format,
+                      BOOL multiple);
+/** Finish the output (for example, close a JSON array) and free the
+    formatter. */
+extern void         fkre_output_destroy (FKREOutput *self);
+
+/** Format the results for one document. The filename may be NULL, if 
+    the document did not come from a file. */
+extern void         fkre_output_document (FKREOutput *self, 
+                      const char *filename, const FKREMetrics *metrics);
+/** Report that a document no longer exists -- used when watching files
+    for changes. */
+extern void         fkre_output_removed (FKREOutput *self, 
+                      const char *filename);
+extern void         fkre_output_window (FKREOutput *self, 
+                      const char *filename, int64_t start, int64_t end, 
+                      double score);
+
+/** Parse a format name -- 'text', 'json', 'ndjson', or 'csv'. Returns
+    FALSE if the name is not recognized. */
+extern BOOL         fkre_format_from_utf8 (const char *s, 
+                      FKREFormat *format);
+
+END_DECLS
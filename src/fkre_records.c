@@ -0,0 +1,989 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_records.c
+
+  Both formats are parsed a byte at a time, by state machines that
+  carry on from one block to the next, so no record -- let alone the
+  file -- need be held in memory. The bytes of the field being scored
+  are unescaped as they are parsed, and passed to the scoring context
+  in batches; a JSON object is never built, only the path to the value
+  being parsed is tracked, to see whether it is the one wanted.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_records.h"
+
+#define KLOG_CLASS "fkre.records"
+
+// Longer keys, column names, and JSON object keys are truncated
+#define FKRE_RECORDS_MAX_NAME 256
+// How deeply JSON arrays and objects can nest
+#define FKRE_RECORDS_MAX_DEPTH 64
+// The most components in a JSON path
+#define FKRE_RECORDS_MAX_PATH 16
+// Text is passed to the context in batches of this size
+#define FKRE_RECORDS_BATCH 4096
+// For a \u escape that is half a surrogate pair
+#define FKRE_RECORDS_REPLACEMENT 0xFFFD
+
+// The two fields that are looked for: the one scored, and the key
+#define FKRE_RECORDS_TEXT 0
+#define FKRE_RECORDS_KEY  1
+
+typedef enum
+  {
+  FKRE_CSV_FIELD_START = 0,
+  FKRE_CSV_UNQUOTED,
+  FKRE_CSV_QUOTED,
+  // A quote in a quoted field, which either ends it or is doubled
+  FKRE_CSV_QUOTE
+  } FKRECsvState;
+
+typedef enum
+  {
+  FKRE_JSON_VALUE = 0,
+  FKRE_JSON_STRING,
+  FKRE_JSON_ESCAPE,
+  FKRE_JSON_UNICODE,
+  FKRE_JSON_LITERAL,
+  FKRE_JSON_AFTER_VALUE,
+  FKRE_JSON_KEY,
+  FKRE_JSON_COLON
+  } FKREJsonState;
+
+// How much of a number a literal could be, so far
+typedef enum
+  {
+  FKRE_NUMBER_START = 0,
+  FKRE_NUMBER_MINUS,
+  FKRE_NUMBER_ZERO,
+  FKRE_NUMBER_INTEGER,
+  FKRE_NUMBER_POINT,
+  FKRE_NUMBER_FRACTION,
+  FKRE_NUMBER_E,
+  FKRE_NUMBER_EXPONENT_SIGN,
+  FKRE_NUMBER_EXPONENT,
+  // Not a number, although it might be true, false, or null
+  FKRE_NUMBER_NONE
+  } FKRENumberState;
+
+// Where the bytes of the string being parsed go
+typedef enum
+  {
+  FKRE_SINK_NONE = 0,
+  FKRE_SINK_TEXT,
+  FKRE_SINK_KEY,
+  // A CSV column name, or a JSON object key
+  FKRE_SINK_NAME
+  } FKRESink;
+
+/*============================================================================
+  
+  FKREPath
+
+  A JSON path, and how much of it the containers being parsed match
+
+  ==========================================================================*/
+typedef struct _FKREPath
+  {
+  char *components[FKRE_RECORDS_MAX_PATH];
+  // The array index a component stands for, or -1
+  int64_t indices[FKRE_RECORDS_MAX_PATH];
+  int length;
+  // The number of components matched by the innermost container that
+  //   matches
+  int matched;
+  } FKREPath;
+
+typedef struct _FKREJsonLevel
+  {
+  BYTE type;
+  int64_t index;
+  } FKREJsonLevel;
+
+/*============================================================================
+  
+  FKRERecords
+
+  ==========================================================================*/
+struct _FKRERecords
+  {
+  FKRERecordsFormat format;
+  // CSV: the columns, counting from 0, or -1 until the header is read
+  int columns[2];
+  char *names[2];
+  // JSON
+  FKREPath paths[2];
+
+  // The rest is the state of the current file
+  FKREContext *context;
+  FKRERecordsFn fn;
+  void *user_data;
+  int64_t record;
+  int error;
+  BOOL started;
+  FKRESink sink;
+  BYTE batch[FKRE_RECORDS_BATCH];
+  size_t batch_length;
+  char key[FKRE_RECORDS_MAX_NAME + 1];
+  size_t key_length;
+  BOOL key_present;
+  char name[FKRE_RECORDS_MAX_NAME + 1];
+  size_t name_length;
+  BOOL name_truncated;
+
+  FKRECsvState csv_state;
+  int column;
+  BOOL header;
+  BOOL in_record;
+
+  FKREJsonState json_state;
+  FKREJsonLevel stack[FKRE_RECORDS_MAX_DEPTH];
+  int depth;
+  // The literal being parsed: enough of it to tell true, false, and null
+  //   from anything else, and how much of a number it is
+  char literal[6];
+  size_t literal_length;
+  FKRENumberState number;
+  UTF32 unicode;
+  int unicode_digits;
+  UTF32 surrogate;
+  };
+
+/*============================================================================
+  
+  fkre_records_parse_path
+
+  ==========================================================================*/
+static BOOL fkre_records_parse_path (FKREPath *path, const char *s)
+  {
+  char *copy = strdup (s);
+  BOOL ok = TRUE;
+  // strtok() would skip empty components, which are errors
+  char *p = copy;
+  while (ok)
+    {
+    char *dot = strchr (p, '.');
+    if (dot) *dot = 0;
+    if (*p == 0 || path->length == FKRE_RECORDS_MAX_PATH)
+      ok = FALSE;
+    else
+      {
+      int i = path->length++;
+      path->components[i] = strdup (p);
+      path->indices[i] = -1;
+      if (strspn (p, "0123456789") == strlen (p))
+        path->indices[i] = atoll (p);
+      }
+    if (!dot) break;
+    p = dot + 1;
+    }
+  free (copy);
+  return ok;
+  }
+
+/*============================================================================
+  
+  fkre_records_parse_column
+
+  ==========================================================================*/
+static BOOL fkre_records_parse_column (FKRERecords *self, int field,
+      const char *s)
+  {
+  if (*s && strspn (s, "0123456789") == strlen (s))
+    {
+    self->columns[field] = atoi (s) - 1;
+    return self->columns[field] >= 0;
+    }
+  self->columns[field] = -1;
+  self->names[field] = strdup (s);
+  return *s != 0;
+  }
+
+/*============================================================================
+  
+  fkre_records_new
+
+  ==========================================================================*/
+FKRERecords *fkre_records_new (FKRERecordsFormat format,
+      const char *field, const char *key)
+  {
+  KLOG_IN
+  FKRERecords *self = calloc (1, sizeof (FKRERecords));
+  self->format = format;
+  BOOL ok;
+  if (format == FKRE_RECORDS_CSV)
+    {
+    ok = fkre_records_parse_column (self, FKRE_RECORDS_TEXT, field);
+    if (ok && key)
+      ok = fkre_records_parse_column (self, FKRE_RECORDS_KEY, key);
+    else if (!key)
+      self->columns[FKRE_RECORDS_KEY] = -1;
+    }
+  else
+    {
+    ok = fkre_records_parse_path (&self->paths[FKRE_RECORDS_TEXT], field);
+    if (ok && key)
+      ok = fkre_records_parse_path (&self->paths[FKRE_RECORDS_KEY], key);
+    }
+  if (!ok)
+    {
+    fkre_records_destroy (self);
+    self = NULL;
+    errno = EINVAL;
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_records_destroy
+
+  ==========================================================================*/
+void fkre_records_destroy (FKRERecords *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int f = 0; f < 2; f++)
+      {
+      free (self->names[f]);
+      for (int i = 0; i < self->paths[f].length; i++)
+        free (self->paths[f].components[i]);
+      }
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_records_flush
+
+  Pass the batched text to the context
+
+  ==========================================================================*/
+static void fkre_records_flush (FKRERecords *self)
+  {
+  if (self->batch_length > 0)
+    {
+    fkre_context_feed (self->context, self->batch, self->batch_length);
+    self->batch_length = 0;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_records_put
+
+  A byte of the string being parsed
+
+  ==========================================================================*/
+static void fkre_records_put (FKRERecords *self, BYTE b)
+  {
+  switch (self->sink)
+    {
+    case FKRE_SINK_TEXT:
+      if (self->batch_length == FKRE_RECORDS_BATCH) fkre_records_flush (self);
+      self->batch[self->batch_length++] = b;
+      break;
+    case FKRE_SINK_KEY:
+      if (self->key_length < FKRE_RECORDS_MAX_NAME)
+        self->key[self->key_length++] = (char)b;
+      break;
+    case FKRE_SINK_NAME:
+      if (self->name_length < FKRE_RECORDS_MAX_NAME)
+        self->name[self->name_length++] = (char)b;
+      else
+        self->name_truncated = TRUE;
+      break;
+    default:;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_records_put_code
+
+  A character from a JSON \u escape, as UTF-8
+
+  ==========================================================================*/
+static void fkre_records_put_code (FKRERecords *self, UTF32 c)
+  {
+  if (c < 0x80)
+    fkre_records_put (self, (BYTE)c);
+  else if (c < 0x800)
+    {
+    fkre_records_put (self, (BYTE)(0xC0 | (c >> 6)));
+    fkre_records_put (self, (BYTE)(0x80 | (c & 0x3F)));
+    }
+  else if (c < 0x10000)
+    {
+    fkre_records_put (self, (BYTE)(0xE0 | (c >> 12)));
+    fkre_records_put (self, (BYTE)(0x80 | ((c >> 6) & 0x3F)));
+    fkre_records_put (self, (BYTE)(0x80 | (c & 0x3F)));
+    }
+  else
+    {
+    fkre_records_put (self, (BYTE)(0xF0 | (c >> 18)));
+    fkre_records_put (self, (BYTE)(0x80 | ((c >> 12) & 0x3F)));
+    fkre_records_put (self, (BYTE)(0x80 | ((c >> 6) & 0x3F)));
+    fkre_records_put (self, (BYTE)(0x80 | (c & 0x3F)));
+    }
+  }
+
+/*============================================================================
+  
+  fkre_records_end_record
+
+  ==========================================================================*/
+static void fkre_records_end_record (FKRERecords *self)
+  {
+  fkre_records_flush (self);
+  fkre_context_finish (self->context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (self->context, &metrics);
+  self->key[self->key_length] = 0;
+  self->fn (self->user_data, ++self->record,
+    self->key_present && self->key_length > 0 ? self->key : NULL,
+    &metrics);
+  fkre_context_reset (self->context);
+  self->key_present = FALSE;
+  self->key_length = 0;
+  }
+
+/*============================================================================
+  
+  fkre_records_fail
+
+  ==========================================================================*/
+static BOOL fkre_records_fail (FKRERecords *self, int error)
+  {
+  self->error = error;
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_csv_start_field
+
+  ==========================================================================*/
+static void fkre_csv_start_field (FKRERecords *self)
+  {
+  if (self->header)
+    {
+    self->sink = FKRE_SINK_NAME;
+    self->name_length = 0;
+    self->name_truncated = FALSE;
+    }
+  else if (self->column == self->columns[FKRE_RECORDS_TEXT])
+    self->sink = FKRE_SINK_TEXT;
+  else if (self->column == self->columns[FKRE_RECORDS_KEY])
+    {
+    self->sink = FKRE_SINK_KEY;
+    self->key_present = TRUE;
+    self->key_length = 0;
+    }
+  else
+    self->sink = FKRE_SINK_NONE;
+  }
+
+/*============================================================================
+  
+  fkre_csv_end_field
+
+  ==========================================================================*/
+static void fkre_csv_end_field (FKRERecords *self)
+  {
+  if (self->header)
+    {
+    self->name[self->name_length] = 0;
+    for (int f = 0; f < 2; f++)
+      if (self->names[f] && self->columns[f] < 0 && !self->name_truncated
+          && strcmp (self->names[f], self->name) == 0)
+        self->columns[f] = self->column;
+    }
+  self->column++;
+  self->csv_state = FKRE_CSV_FIELD_START;
+  fkre_csv_start_field (self);
+  }
+
+/*============================================================================
+  
+  fkre_csv_end_record
+
+  ==========================================================================*/
+static BOOL fkre_csv_end_record (FKRERecords *self)
+  {
+  fkre_csv_end_field (self);
+  BOOL ok = TRUE;
+  if (self->header)
+    {
+    self->header = FALSE;
+    for (int f = 0; f < 2; f++)
+      if (self->names[f] && self->columns[f] < 0)
+        {
+        klog_error (KLOG_CLASS, "No column is named '%s'", self->names[f]);
+        ok = fkre_records_fail (self, EINVAL);
+        }
+    }
+  else
+    fkre_records_end_record (self);
+  self->column = 0;
+  self->in_record = FALSE;
+  fkre_csv_start_field (self);
+  return ok;
+  }
+
+/*============================================================================
+  
+  fkre_csv_parse
+
+  ==========================================================================*/
+static BOOL fkre_csv_parse (FKRERecords *self, const BYTE *data,
+      size_t length)
+  {
+  for (size_t i = 0; i < length; i++)
+    {
+    BYTE c = data[i];
+    if (c == '\r' && self->csv_state != FKRE_CSV_QUOTED) continue;
+    if (c != '\n') self->in_record = TRUE;
+    switch (self->csv_state)
+      {
+      case FKRE_CSV_FIELD_START:
+      case FKRE_CSV_UNQUOTED:
+        if (c == ',')
+          fkre_csv_end_field (self);
+        else if (c == '\n')
+          {
+          // A blank line is not a record
+          if (self->in_record && !fkre_csv_end_record (self)) return FALSE;
+          }
+        else if (c == '"' && self->csv_state == FKRE_CSV_FIELD_START)
+          self->csv_state = FKRE_CSV_QUOTED;
+        else
+          {
+          self->csv_state = FKRE_CSV_UNQUOTED;
+          fkre_records_put (self, c);
+          }
+        break;
+      case FKRE_CSV_QUOTED:
+        if (c == '"')
+          self->csv_state = FKRE_CSV_QUOTE;
+        else
+          fkre_records_put (self, c);
+        break;
+      case FKRE_CSV_QUOTE:
+        if (c == '"')
+          {
+          fkre_records_put (self, c);
+          self->csv_state = FKRE_CSV_QUOTED;
+          }
+        else if (c == ',')
+          fkre_csv_end_field (self);
+        else if (c == '\n')
+          {
+          if (!fkre_csv_end_record (self)) return FALSE;
+          }
+        else
+          {
+          // Text after the closing quote is kept, as most readers do
+          self->csv_state = FKRE_CSV_UNQUOTED;
+          fkre_records_put (self, c);
+          }
+        break;
+      }
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_json_child
+
+  Whether a value that is about to start, in the innermost container,
+  matches the first 'n' components of a path, where 'n' is the depth
+
+  ==========================================================================*/
+static BOOL fkre_json_child (const FKRERecords *self, const FKREPath *path)
+  {
+  int s = self->depth;
+  if (s == 0 || s > path->length || path->matched != s - 1) return FALSE;
+  const FKREJsonLevel *top = &self->stack[s - 1];
+  if (top->type == '[')
+    return path->indices[s - 1] == top->index;
+  return !self->name_truncated
+    && strcmp (path->components[s - 1], self->name) == 0;
+  }
+
+/*============================================================================
+  
+  fkre_json_end_value
+
+  ==========================================================================*/
+static void fkre_json_end_value (FKRERecords *self)
+  {
+  fkre_records_flush (self);
+  self->sink = FKRE_SINK_NONE;
+  if (self->depth == 0)
+    {
+    fkre_records_end_record (self);
+    self->json_state = FKRE_JSON_VALUE;
+    }
+  else
+    self->json_state = FKRE_JSON_AFTER_VALUE;
+  }
+
+/*============================================================================
+  
+  fkre_json_number_next
+
+  The state of a number after the byte 'c', as JSON defines numbers
+
+  ==========================================================================*/
+static FKRENumberState fkre_json_number_next (FKRENumberState state, BYTE c)
+  {
+  BOOL digit = isdigit (c);
+  switch (state)
+    {
+    case FKRE_NUMBER_START:
+      if (c == '-') return FKRE_NUMBER_MINUS;
+      // Fall through
+    case FKRE_NUMBER_MINUS:
+      if (c == '0') return FKRE_NUMBER_ZERO;
+      if (digit) return FKRE_NUMBER_INTEGER;
+      break;
+    case FKRE_NUMBER_INTEGER:
+      if (digit) return FKRE_NUMBER_INTEGER;
+      // Fall through
+    case FKRE_NUMBER_ZERO:
+      if (c == '.') return FKRE_NUMBER_POINT;
+      if (c == 'e' || c == 'E') return FKRE_NUMBER_E;
+      break;
+    case FKRE_NUMBER_POINT:
+    case FKRE_NUMBER_FRACTION:
+      if (digit) return FKRE_NUMBER_FRACTION;
+      if (state == FKRE_NUMBER_FRACTION && (c == 'e' || c == 'E'))
+        return FKRE_NUMBER_E;
+      break;
+    case FKRE_NUMBER_E:
+      if (c == '+' || c == '-') return FKRE_NUMBER_EXPONENT_SIGN;
+      // Fall through
+    case FKRE_NUMBER_EXPONENT_SIGN:
+    case FKRE_NUMBER_EXPONENT:
+      if (digit) return FKRE_NUMBER_EXPONENT;
+      break;
+    case FKRE_NUMBER_NONE:
+      break;
+    }
+  return FKRE_NUMBER_NONE;
+  }
+
+/*============================================================================
+  
+  fkre_json_put_literal
+
+  A byte of a literal, which goes to the sink like a byte of a string
+
+  ==========================================================================*/
+static void fkre_json_put_literal (FKRERecords *self, BYTE c)
+  {
+  if (self->literal_length < sizeof (self->literal))
+    self->literal[self->literal_length] = (char)c;
+  self->literal_length++;
+  self->number = fkre_json_number_next (self->number, c);
+  fkre_records_put (self, c);
+  }
+
+/*============================================================================
+  
+  fkre_json_is_literal
+
+  ==========================================================================*/
+static BOOL fkre_json_is_literal (const FKRERecords *self, const char *word)
+  {
+  size_t length = strlen (word);
+  return self->literal_length == length
+    && memcmp (self->literal, word, length) == 0;
+  }
+
+/*============================================================================
+  
+  fkre_json_end_literal
+
+  Returns FALSE if the literal is not true, false, null, or a number
+
+  ==========================================================================*/
+static BOOL fkre_json_end_literal (FKRERecords *self)
+  {
+  BOOL null = fkre_json_is_literal (self, "null");
+  switch (self->number)
+    {
+    case FKRE_NUMBER_ZERO:
+    case FKRE_NUMBER_INTEGER:
+    case FKRE_NUMBER_FRACTION:
+    case FKRE_NUMBER_EXPONENT:
+      break;
+    default:
+      if (!null && !fkre_json_is_literal (self, "true")
+          && !fkre_json_is_literal (self, "false"))
+        return fkre_records_fail (self, EBADMSG);
+    }
+  // A key of null is no key
+  if (self->sink == FKRE_SINK_KEY && null)
+    self->key_present = FALSE;
+  fkre_json_end_value (self);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_json_close
+
+  Close the innermost container, if it is of the right type
+
+  ==========================================================================*/
+static BOOL fkre_json_close (FKRERecords *self, BYTE c)
+  {
+  if (self->depth == 0
+      || self->stack[self->depth - 1].type != (c == '}' ? '{' : '['))
+    return fkre_records_fail (self, EBADMSG);
+  self->depth--;
+  for (int f = 0; f < 2; f++)
+    if (self->paths[f].matched == self->depth && self->depth > 0)
+      self->paths[f].matched--;
+  fkre_json_end_value (self);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_json_start_value
+
+  ==========================================================================*/
+static BOOL fkre_json_start_value (FKRERecords *self, BYTE c)
+  {
+  BOOL prefix[2];
+  FKRESink sink = FKRE_SINK_NONE;
+  for (int f = 1; f >= 0; f--)
+    {
+    FKREPath *path = &self->paths[f];
+    BOOL child = fkre_json_child (self, path);
+    prefix[f] = child && self->depth < path->length;
+    if (child && self->depth == path->length)
+      sink = (f == FKRE_RECORDS_TEXT) ? FKRE_SINK_TEXT : FKRE_SINK_KEY;
+    }
+  if (sink == FKRE_SINK_KEY)
+    {
+    self->key_present = TRUE;
+    self->key_length = 0;
+    }
+
+  // Each record is an object
+  if (self->depth == 0 && c != '{')
+    return fkre_records_fail (self, EBADMSG);
+
+  if (c == '{' || c == '[')
+    {
+    if (self->depth == FKRE_RECORDS_MAX_DEPTH)
+      return fkre_records_fail (self, EBADMSG);
+    if (self->depth == 0)
+      for (int f = 0; f < 2; f++) self->paths[f].matched = 0;
+    for (int f = 0; f < 2; f++)
+      if (prefix[f]) self->paths[f].matched = self->depth;
+    self->stack[self->depth].type = c;
+    self->stack[self->depth].index = 0;
+    self->depth++;
+    self->json_state = (c == '{') ? FKRE_JSON_KEY : FKRE_JSON_VALUE;
+    }
+  else if (c == '"')
+    {
+    self->sink = sink;
+    self->json_state = FKRE_JSON_STRING;
+    }
+  else if (isalnum (c) || c == '-')
+    {
+    self->sink = sink;
+    self->json_state = FKRE_JSON_LITERAL;
+    self->literal_length = 0;
+    self->number = FKRE_NUMBER_START;
+    fkre_json_put_literal (self, c);
+    }
+  else
+    return fkre_records_fail (self, EBADMSG);
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_json_parse
+
+  ==========================================================================*/
+static BOOL fkre_json_parse (FKRERecords *self, const BYTE *data,
+      size_t length)
+  {
+  size_t i = 0;
+  while (i < length)
+    {
+    BYTE c = data[i];
+    BOOL white = (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    // Whether c has been dealt with, or must be looked at again in the
+    //   new state
+    BOOL consumed = TRUE;
+    switch (self->json_state)
+      {
+      case FKRE_JSON_VALUE:
+        if (white)
+          ;
+        else if (c == ']' && self->depth > 0
+            && self->stack[self->depth - 1].type == '[')
+          {
+          // An empty array
+          if (!fkre_json_close (self, c)) return FALSE;
+          }
+        else if (!fkre_json_start_value (self, c))
+          return FALSE;
+        break;
+
+      case FKRE_JSON_KEY:
+        if (white)
+          ;
+        else if (c == '"')
+          {
+          self->sink = FKRE_SINK_NAME;
+          self->name_length = 0;
+          self->name_truncated = FALSE;
+          self->json_state = FKRE_JSON_STRING;
+          }
+        else if (c == '}')
+          {
+          if (!fkre_json_close (self, c)) return FALSE;
+          }
+        else
+          return fkre_records_fail (self, EBADMSG);
+        break;
+
+      case FKRE_JSON_COLON:
+        if (c == ':')
+          self->json_state = FKRE_JSON_VALUE;
+        else if (!white)
+          return fkre_records_fail (self, EBADMSG);
+        break;
+
+      case FKRE_JSON_AFTER_VALUE:
+        if (white)
+          ;
+        else if (c == ',')
+          {
+          FKREJsonLevel *top = &self->stack[self->depth - 1];
+          top->index++;
+          self->json_state = (top->type == '{') ?
+            FKRE_JSON_KEY : FKRE_JSON_VALUE;
+          }
+        else if (c == '}' || c == ']')
+          {
+          if (!fkre_json_close (self, c)) return FALSE;
+          }
+        else
+          return fkre_records_fail (self, EBADMSG);
+        break;
+
+      case FKRE_JSON_STRING:
+        if (self->surrogate && c != '\\')
+          {
+          // Half a surrogate pair
+          fkre_records_put_code (self, FKRE_RECORDS_REPLACEMENT);
+          self->surrogate = 0;
+          }
+        if (c == '\\')
+          self->json_state = FKRE_JSON_ESCAPE;
+        else if (c == '"')
+          {
+          if (self->sink == FKRE_SINK_NAME)
+            {
+            self->name[self->name_length] = 0;
+            self->sink = FKRE_SINK_NONE;
+            self->json_state = FKRE_JSON_COLON;
+            }
+          else
+            fkre_json_end_value (self);
+          }
+        else
+          fkre_records_put (self, c);
+        break;
+
+      case FKRE_JSON_ESCAPE:
+        self->json_state = FKRE_JSON_STRING;
+        if (c == 'u')
+          {
+          self->json_state = FKRE_JSON_UNICODE;
+          self->unicode = 0;
+          self->unicode_digits = 0;
+          break;
+          }
+        if (self->surrogate)
+          {
+          fkre_records_put_code (self, FKRE_RECORDS_REPLACEMENT);
+          self->surrogate = 0;
+          }
+        switch (c)
+          {
+          case '"': case '\\': case '/': fkre_records_put (self, c); break;
+          case 'b': fkre_records_put (self, '\b'); break;
+          case 'f': fkre_records_put (self, '\f'); break;
+          case 'n': fkre_records_put (self, '\n'); break;
+          case 'r': fkre_records_put (self, '\r'); break;
+          case 't': fkre_records_put (self, '\t'); break;
+          default: return fkre_records_fail (self, EBADMSG);
+          }
+        break;
+
+      case FKRE_JSON_UNICODE:
+        if (!isxdigit (c)) return fkre_records_fail (self, EBADMSG);
+        self->unicode = self->unicode * 16
+          + (isdigit (c) ? c - '0' : (tolower (c) - 'a' + 10));
+        if (++self->unicode_digits == 4)
+          {
+          UTF32 u = self->unicode;
+          if (u >= 0xDC00 && u <= 0xDFFF && self->surrogate)
+            {
+            fkre_records_put_code (self, 0x10000
+              + ((self->surrogate - 0xD800) << 10) + (u - 0xDC00));
+            self->surrogate = 0;
+            }
+          else
+            {
+            if (self->surrogate)
+              fkre_records_put_code (self, FKRE_RECORDS_REPLACEMENT);
+            self->surrogate = 0;
+            if (u >= 0xD800 && u <= 0xDBFF)
+              self->surrogate = u;
+            else if (u >= 0xDC00 && u <= 0xDFFF)
+              fkre_records_put_code (self, FKRE_RECORDS_REPLACEMENT);
+            else
+              fkre_records_put_code (self, u);
+            }
+          self->json_state = FKRE_JSON_STRING;
+          }
+        break;
+
+      case FKRE_JSON_LITERAL:
+        if (isalnum (c) || c == '+' || c == '-' || c == '.')
+          fkre_json_put_literal (self, c);
+        else
+          {
+          if (!fkre_json_end_literal (self)) return FALSE;
+          consumed = FALSE;
+          }
+        break;
+      }
+    if (consumed) i++;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_records_block
+
+  ==========================================================================*/
+static BOOL fkre_records_block (void *user_data, const BYTE *data,
+      size_t length)
+  {
+  FKRERecords *self = user_data;
+  if (!self->started)
+    {
+    // Skip a UTF-8 byte order mark, which some exporters write
+    self->started = TRUE;
+    if (length >= 3 && memcmp (data, "\xEF\xBB\xBF", 3) == 0)
+      {
+      data += 3;
+      length -= 3;
+      }
+    }
+  if (self->format == FKRE_RECORDS_CSV)
+    return fkre_csv_parse (self, data, length);
+  return fkre_json_parse (self, data, length);
+  }
+
+/*============================================================================
+  
+  fkre_records_score_fd
+
+  ==========================================================================*/
+BOOL fkre_records_score_fd (FKRERecords *self, int fd,
+      FKREContext *context, FKRERecordsFn fn, void *user_data)
+  {
+  KLOG_IN
+  self->context = context;
+  self->fn = fn;
+  self->user_data = user_data;
+  self->record = 0;
+  self->error = 0;
+  self->started = FALSE;
+  self->batch_length = 0;
+  self->key_present = FALSE;
+  self->key_length = 0;
+  self->csv_state = FKRE_CSV_FIELD_START;
+  self->column = 0;
+  self->in_record = FALSE;
+  self->json_state = FKRE_JSON_VALUE;
+  self->depth = 0;
+  self->surrogate = 0;
+  self->sink = FKRE_SINK_NONE;
+  if (self->format == FKRE_RECORDS_CSV)
+    {
+    // Columns given by name are looked up in the header
+    self->header = FALSE;
+    for (int f = 0; f < 2; f++)
+      if (self->names[f])
+        {
+        self->columns[f] = -1;
+        self->header = TRUE;
+        }
+    fkre_csv_start_field (self);
+    }
+  fkre_context_reset (context);
+
+  BOOL ret = fkre_read_fd (fd, fkre_records_block, self);
+  if (!ret && self->error) errno = self->error;
+  if (ret)
+    {
+    // The last record may have no line end
+    if (self->format == FKRE_RECORDS_CSV)
+      {
+      if (self->csv_state == FKRE_CSV_QUOTED)
+        {
+        errno = EBADMSG;
+        ret = FALSE;
+        }
+      else if (self->in_record)
+        {
+        ret = fkre_csv_end_record (self);
+        if (!ret) errno = self->error;
+        }
+      }
+    else if (self->depth > 0 || self->json_state != FKRE_JSON_VALUE)
+      {
+      errno = EBADMSG;
+      ret = FALSE;
+      }
+    }
+  KLOG_OUT
+  return ret;
+  }
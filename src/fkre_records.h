@@ -0,0 +1,57 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_records.h
+
+  Scoring one field of each record in a CSV file, or of each object in
+  a file of newline-delimited JSON, without extracting the field first.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+struct _FKRERecords;
+typedef struct _FKRERecords FKRERecords;
+
+typedef enum
+  {
+  FKRE_RECORDS_CSV = 0,
+  FKRE_RECORDS_JSON = 1
+  } FKRERecordsFormat;
+
+/** Called for each record, with its number, counting from 1, and the
+    value of its key field, or NULL if no key field was asked for, or
+    the record has none. */
+typedef void (*FKRERecordsFn) (void *user_data, int64_t record,
+               const char *key, const FKREMetrics *metrics);
+
+BEGIN_DECLS
+
+/** Create a reader for records in 'format'. In CSV, 'field' and 'key'
+    are column numbers, counting from 1, or column names, in which case
+    the first record is the header that names the columns. In JSON,
+    where each record is an object, they are paths of object keys,
+    separated by '.', in which an array element is given by its index
+    -- "review.text", or "lines.0". 'key' may be NULL. Returns NULL,
+    with errno set to EINVAL, if a path is not valid. */
+extern FKRERecords *fkre_records_new (FKRERecordsFormat format,
+                      const char *field, const char *key);
+
+extern void         fkre_records_destroy (FKRERecords *self);
+
+/** Score the field of each record read from 'fd', which may be
+    compressed, using 'context', and pass the results to 'fn' in
+    order. Returns FALSE, with errno set, if the file can't be read,
+    or is not valid CSV or JSON (EBADMSG), or a named column is not in
+    the header (EINVAL). */
+extern BOOL         fkre_records_score_fd (FKRERecords *self, int fd,
+                      FKREContext *context, FKRERecordsFn fn,
+                      void *user_data);
+
+END_DECLS
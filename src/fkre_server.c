@@ -0,0 +1,487 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_server.c
+
+  The server is a single-threaded epoll loop. Scoring a typical 
+  document takes much less time than a context switch, so there is
+  nothing to gain from handing documents to other threads. Each 
+  connection owns an input buffer, an output writer, and a scoring 
+  context, which are reused for every document it sends. The buffers
+  only grow if a document is larger than any seen before on that 
+  connection.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <errno.h> 
+#include <signal.h> 
+#include <unistd.h> 
+#include <fcntl.h> 
+#include <sys/types.h> 
+#include <sys/stat.h> 
+#include <sys/socket.h> 
+#include <sys/un.h> 
+#include <sys/epoll.h> 
+#include <klib/klib.h> 
+#include <fkre/fkre.h> 
+#include "fkre_writer.h" 
+#include "fkre_output.h" 
+#include "fkre_server.h" 
+
+#define KLOG_CLASS "fkre.server"
+
+// Stop reading from a client that has this much unsent output -- it
+//   isn't reading its replies
+#define MAX_PENDING_OUTPUT (4 * 1024 * 1024)
+
+#define INITIAL_INPUT_SIZE 4096
+
+#define MAX_EVENTS 64
+
+/*============================================================================
+  
+  Connection
+
+  ==========================================================================*/
+typedef struct _Connection
+  {
+  int fd;
+  BYTE *in;
+  // Unprocessed input runs from in + in_start to in + in_length
+  size_t in_start;
+  size_t in_length;
+  size_t in_size;
+  FKREWriter *writer;
+  FKREOutput *output;
+  // One scoring context for each connection, reset between documents.
+  //   The HTML flag can vary from document to document, so we keep one
+  //   of each kind, created when first needed
+  FKREContext *context[2];
+  // Set when the client has closed its end. Frames already received
+  //   are still scored, and we close once the replies are sent
+  BOOL eof;
+  // Set when the connection has failed, or the client sent something 
+  //   we can't process. Nothing more is scored
+  BOOL closing;
+  uint32_t events;
+  } Connection;
+
+static volatile sig_atomic_t stop = 0;
+
+// The address of this variable tags the listening socket's epoll events
+static int listener_tag;
+
+/*============================================================================
+  
+  fkre_server_signal
+
+  ==========================================================================*/
+static void fkre_server_signal (int sig)
+  {
+  stop = 1;
+  }
+
+/*============================================================================
+  
+  fkre_server_connection_new
+
+  ==========================================================================*/
+static Connection *fkre_server_connection_new (int fd)
+  {
+  Connection *self = malloc (sizeof (Connection));
+  self->fd = fd;
+  self->in_size = INITIAL_INPUT_SIZE;
+  self->in = malloc (self->in_size);
+  self->in_start = 0;
+  self->in_length = 0;
+  self->writer = fkre_writer_new_memory ();
+  self->output = fkre_output_new (self->writer, FKRE_FORMAT_NDJSON, FALSE);
+  self->eof = FALSE;
+  self->closing = FALSE;
+  self->context[0] = NULL;
+  self->context[1] = NULL;
+  self->events = 0;
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_server_connection_destroy
+
+  ==========================================================================*/
+static void fkre_server_connection_destroy (Connection *self)
+  {
+  close (self->fd);
+  fkre_output_destroy (self->output);
+  fkre_writer_destroy (self->writer);
+  fkre_context_destroy (self->context[0]);
+  fkre_context_destroy (self->context[1]);
+  free (self->in);
+  free (self);
+  }
+
+/*============================================================================
+  
+  fkre_server_score
+
+  Score one document, and add its NDJSON record to the connection's 
+  output.
+
+  ==========================================================================*/
+static void fkre_server_score (Connection *c, const BYTE *text, 
+     size_t length, BOOL html)
+  {
+  FKREContext *context = c->context[html ? 1 : 0];
+  if (context)
+    fkre_context_reset (context);
+  else
+    {
+    context = fkre_context_new (html ? FKRE_FLAG_HTML : 0);
+    c->context[html ? 1 : 0] = context;
+    }
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_feed (context, text, length);
+  fkre_context_finish (context);
+  fkre_context_get_metrics (context, &metrics);
+  fkre_output_document (c->output, NULL, &metrics);
+  }
+
+/*============================================================================
+  
+  fkre_server_process
+
+  Score every complete frame in the input buffer, stopping early if the
+  client has too much unread output.
+
+  ==========================================================================*/
+static void fkre_server_process (Connection *c, BOOL html, 
+     uint32_t max_document)
+  {
+  size_t pending;
+  while (!c->closing && c->in_length - c->in_start >= 4)
+    {
+    fkre_writer_get_data (c->writer, &pending);
+    if (pending >= MAX_PENDING_OUTPUT) break;
+
+    const BYTE *h = c->in + c->in_start;
+    uint32_t header = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) 
+      | ((uint32_t)h[2] << 8) | (uint32_t)h[3];
+    uint32_t length = header & FKRE_SERVER_LENGTH_MASK;
+    if (length > max_document)
+      {
+      fkre_writer_printf (c->writer, 
+        "{\"error\":\"document of %u bytes exceeds limit of %u\"}\n", 
+        length, max_document);
+      c->closing = TRUE;
+      break;
+      }
+    if (c->in_length - c->in_start - 4 < length) break;
+
+    fkre_server_score (c, c->in + c->in_start + 4, length, 
+      html || (header & FKRE_SERVER_HTML_FLAG));
+    c->in_start += 4 + length;
+    }
+
+  // Move any partial frame to the start of the buffer
+  if (c->in_start > 0)
+    {
+    memmove (c->in, c->in + c->in_start, c->in_length - c->in_start);
+    c->in_length -= c->in_start;
+    c->in_start = 0;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_server_have_frame
+
+  ==========================================================================*/
+static BOOL fkre_server_have_frame (const Connection *c)
+  {
+  size_t avail = c->in_length - c->in_start;
+  if (avail < 4) return FALSE;
+  const BYTE *h = c->in + c->in_start;
+  uint32_t length = (((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) 
+      | ((uint32_t)h[2] << 8) | (uint32_t)h[3]) & FKRE_SERVER_LENGTH_MASK;
+  return avail - 4 >= length;
+  }
+
+/*============================================================================
+  
+  fkre_server_read
+
+  Read until the socket would block, or the buffer is full and holds 
+  at least one complete frame. In the latter case epoll will report the
+  socket as readable again once the frames have been processed, so the
+  buffer never grows much beyond the size of the largest document. 
+  Returns FALSE if the connection failed.
+
+  ==========================================================================*/
+static BOOL fkre_server_read (Connection *c)
+  {
+  for (;;)
+    {
+    if (c->in_size == c->in_length)
+      {
+      if (fkre_server_have_frame (c)) return TRUE;
+      c->in_size *= 2;
+      c->in = realloc (c->in, c->in_size);
+      }
+    ssize_t n = read (c->fd, c->in + c->in_length, 
+      c->in_size - c->in_length);
+    if (n > 0)
+      c->in_length += n;
+    else if (n == 0)
+      {
+      c->eof = TRUE;
+      return TRUE;
+      }
+    else if (errno == EINTR)
+      continue;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return TRUE;
+    else
+      return FALSE;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_server_write
+
+  Send as much pending output as the socket will take. Returns FALSE if
+  the connection failed.
+
+  ==========================================================================*/
+static BOOL fkre_server_write (Connection *c)
+  {
+  size_t length;
+  const char *data = fkre_writer_get_data (c->writer, &length);
+  while (length > 0)
+    {
+    ssize_t n = send (c->fd, data, length, MSG_NOSIGNAL);
+    if (n > 0)
+      {
+      fkre_writer_consume (c->writer, n);
+      data = fkre_writer_get_data (c->writer, &length);
+      }
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return TRUE;
+    else
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_server_update
+
+  Work out which events we're interested in. Returns FALSE if the
+  connection should be closed.
+
+  ==========================================================================*/
+static BOOL fkre_server_update (int epfd, Connection *c)
+  {
+  size_t pending;
+  fkre_writer_get_data (c->writer, &pending);
+  if (c->closing && pending == 0) return FALSE;
+  if (c->eof && pending == 0 && !fkre_server_have_frame (c)) return FALSE;
+
+  uint32_t events = 0;
+  if (!c->closing && !c->eof && pending < MAX_PENDING_OUTPUT) 
+    events |= EPOLLIN;
+  // Frames held back for want of room for their output may be all 
+  //   there is left to do -- the client may have sent everything, or 
+  //   be waiting for the replies before it sends more -- so the socket
+  //   being writable has to wake the connection to process them 
+  if (pending > 0 || fkre_server_have_frame (c)) events |= EPOLLOUT;
+  if (events != c->events)
+    {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl (epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) return FALSE;
+    c->events = events;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_server_accept
+
+  ==========================================================================*/
+static void fkre_server_accept (int epfd, int lfd)
+  {
+  for (;;)
+    {
+    int fd = accept4 (lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        klog_warn (KLOG_CLASS, "accept() failed: %s", strerror (errno));
+      if (errno != EINTR) return;
+      continue;
+      }
+    Connection *c = fkre_server_connection_new (fd);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    c->events = EPOLLIN;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+      {
+      klog_warn (KLOG_CLASS, "Can't watch connection: %s", strerror (errno));
+      fkre_server_connection_destroy (c);
+      }
+    else
+      klog_debug (KLOG_CLASS, "Accepted connection %d", fd);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_server_listen
+
+  Create the listening socket. A stale socket left behind by an earlier
+  server is removed, but nothing else is.
+
+  ==========================================================================*/
+static int fkre_server_listen (const char *socket_path)
+  {
+  struct sockaddr_un addr;
+  if (strlen (socket_path) >= sizeof (addr.sun_path))
+    {
+    errno = ENAMETOOLONG;
+    return -1;
+    }
+
+  struct stat sb;
+  if (lstat (socket_path, &sb) == 0)
+    {
+    if (!S_ISSOCK (sb.st_mode))
+      {
+      errno = EEXIST;
+      return -1;
+      }
+    unlink (socket_path);
+    }
+
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_path);
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0 
+      || listen (fd, SOMAXCONN) < 0)
+    {
+    int e = errno;
+    close (fd);
+    errno = e;
+    return -1;
+    }
+  return fd;
+  }
+
+/*============================================================================
+  
+  fkre_server_run
+
+  ==========================================================================*/
+int fkre_server_run (const char *socket_path, BOOL html, 
+      uint32_t max_document)
+  {
+  KLOG_IN
+  int ret = 0;
+
+  int lfd = fkre_server_listen (socket_path);
+  if (lfd < 0)
+    {
+    ret = errno;
+    klog_error (KLOG_CLASS, "Can't listen on '%s': %s", socket_path, 
+      strerror (errno));
+    KLOG_OUT
+    return ret;
+    }
+
+  int epfd = epoll_create1 (EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listener_tag;
+  epoll_ctl (epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+  // No SA_RESTART, so that a signal interrupts epoll_wait()
+  struct sigaction sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = fkre_server_signal;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  klog_info (KLOG_CLASS, "Listening on '%s'", socket_path);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (!stop)
+    {
+    int n = epoll_wait (epfd, events, MAX_EVENTS, -1);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      ret = errno;
+      klog_error (KLOG_CLASS, "epoll_wait() failed: %s", strerror (errno));
+      break;
+      }
+    for (int i = 0; i < n; i++)
+      {
+      if (events[i].data.ptr == &listener_tag)
+        {
+        fkre_server_accept (epfd, lfd);
+        continue;
+        }
+
+      Connection *c = events[i].data.ptr;
+      BOOL ok = TRUE;
+      if (events[i].events & EPOLLERR)
+        c->closing = TRUE;
+      if (events[i].events & (EPOLLIN | EPOLLHUP))
+        ok = fkre_server_read (c);
+      if (ok)
+        {
+        fkre_server_process (c, html, max_document);
+        ok = fkre_server_write (c);
+        }
+      // Writing may have made room for more output, so any frames
+      //   held back can now be processed
+      if (ok && fkre_server_have_frame (c))
+        {
+        fkre_server_process (c, html, max_document);
+        ok = fkre_server_write (c);
+        }
+      if (!ok || !fkre_server_update (epfd, c))
+        {
+        klog_debug (KLOG_CLASS, "Closing connection %d", c->fd);
+        // Closing the descriptor removes it from the epoll set
+        fkre_server_connection_destroy (c);
+        }
+      }
+    }
+
+  // Connections still open at shutdown are not tracked outside epoll,
+  //   and the process is about to exit, so they are simply abandoned
+  close (epfd);
+  close (lfd);
+  unlink (socket_path);
+  klog_info (KLOG_CLASS, "Server stopped");
+  KLOG_OUT
+  return ret;
+  }
@@ -0,0 +1,40 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_server.h
+
+  A persistent scoring server, listening on a Unix domain socket.
+
+  Clients send documents as frames: a four-byte, big-endian header 
+  followed by the document text. The low 31 bits of the header are the
+  length of the text in bytes; the top bit, if set, asks for the 
+  document to be scored as HTML. The server replies to each frame, in 
+  order, with one line of NDJSON on the same connection. Any number of
+  frames can be sent on a connection, and they can be pipelined.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+
+// The header bit that marks a document as HTML
+#define FKRE_SERVER_HTML_FLAG 0x80000000U
+#define FKRE_SERVER_LENGTH_MASK 0x7FFFFFFFU
+
+// The largest document the server will accept, by default
+#define FKRE_SERVER_MAX_DOCUMENT (64 * 1024 * 1024)
+
+BEGIN_DECLS
+
+/** Run the server until it is interrupted by SIGINT or SIGTERM. If 'html'
+    is TRUE, every document is treated as HTML, whatever its header says.
+    Returns zero on a clean shutdown, or an errno value if the server
+    could not be started. */
+extern int fkre_server_run (const char *socket_path, BOOL html, 
+             uint32_t max_document);
+
+END_DECLS
@@ -0,0 +1,195 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_stats.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_stats.h"
+
+#define KLOG_CLASS "fkre.stats"
+
+static const char *state_names[FKRE_STATS_STATES] =
+  {
+  "start", "tag", "white", "text"
+  };
+
+/*============================================================================
+  
+  The totals
+
+  ==========================================================================*/
+static BOOL enabled = FALSE;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FKREStatsClock started;
+static double phase_wall[FKRE_PHASE_COUNT];
+static double phase_cpu[FKRE_PHASE_COUNT];
+static FKREStats totals;
+
+/*============================================================================
+  
+  fkre_stats_clock
+
+  The wall-clock time, and this thread's CPU time, in seconds
+
+  ==========================================================================*/
+static void fkre_stats_clock (FKREStatsClock *clock)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  clock->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+  clock->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+/*============================================================================
+  
+  fkre_stats_enable
+
+  ==========================================================================*/
+void fkre_stats_enable (void)
+  {
+  enabled = TRUE;
+  kalloc_set_counting (TRUE);
+  fkre_stats_clock (&started);
+  }
+
+/*============================================================================
+  
+  fkre_stats_flags
+
+  ==========================================================================*/
+unsigned fkre_stats_flags (void)
+  {
+  return enabled ? FKRE_FLAG_STATS : 0;
+  }
+
+/*============================================================================
+  
+  fkre_stats_start
+
+  ==========================================================================*/
+void fkre_stats_start (FKREStatsClock *clock)
+  {
+  if (enabled) fkre_stats_clock (clock);
+  }
+
+/*============================================================================
+  
+  fkre_stats_stop
+
+  ==========================================================================*/
+void fkre_stats_stop (const FKREStatsClock *clock, FKREPhase phase)
+  {
+  if (!enabled) return;
+  FKREStatsClock now;
+  fkre_stats_clock (&now);
+  pthread_mutex_lock (&lock);
+  phase_wall[phase] += now.wall - clock->wall;
+  phase_cpu[phase] += now.cpu - clock->cpu;
+  pthread_mutex_unlock (&lock);
+  }
+
+/*============================================================================
+  
+  fkre_stats_add_context
+
+  ==========================================================================*/
+void fkre_stats_add_context (const FKREContext *context)
+  {
+  if (!enabled) return;
+  FKREStats stats;
+  stats.size = sizeof (FKREStats);
+  if (fkre_context_get_stats (context, &stats) != 0) return;
+  pthread_mutex_lock (&lock);
+  totals.documents += stats.documents;
+  totals.bytes += stats.bytes;
+  totals.characters += stats.characters;
+  totals.words += stats.words;
+  totals.decode_seconds += stats.decode_seconds;
+  totals.decode_cpu_seconds += stats.decode_cpu_seconds;
+  totals.tokenize_seconds += stats.tokenize_seconds;
+  totals.tokenize_cpu_seconds += stats.tokenize_cpu_seconds;
+  totals.finish_seconds += stats.finish_seconds;
+  totals.finish_cpu_seconds += stats.finish_cpu_seconds;
+  for (int i = 0; i < FKRE_STATS_STATES; i++)
+    for (int j = 0; j < FKRE_STATS_STATES; j++)
+      totals.transitions[i][j] += stats.transitions[i][j];
+  pthread_mutex_unlock (&lock);
+  }
+
+/*============================================================================
+  
+  fkre_stats_report
+
+  ==========================================================================*/
+void fkre_stats_report (FILE *f)
+  {
+  if (!enabled) return;
+  FKREStatsClock now;
+  fkre_stats_clock (&now);
+  double elapsed = now.wall - started.wall;
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+  // With several threads, the times for each phase are the sums over 
+  //   all of them, and the total is the elapsed time of the process
+  pthread_mutex_lock (&lock);
+  fprintf (f, "Stats:\n");
+  fprintf (f, "  %-10s %12s %12s\n", "phase", "wall (s)", "CPU (s)");
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "read",
+    phase_wall[FKRE_PHASE_READ], phase_cpu[FKRE_PHASE_READ]);
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "decode",
+    totals.decode_seconds, totals.decode_cpu_seconds);
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "tokenize",
+    totals.tokenize_seconds, totals.tokenize_cpu_seconds);
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "score",
+    totals.finish_seconds, totals.finish_cpu_seconds);
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "output",
+    phase_wall[FKRE_PHASE_OUTPUT], phase_cpu[FKRE_PHASE_OUTPUT]);
+  fprintf (f, "  %-10s %12.6f %12.6f\n", "total", elapsed, cpu);
+
+  double rate = elapsed > 0 ? 1 / elapsed : 0;
+  fprintf (f, "  %" PRId64 " documents, %" PRId64 " bytes (%.2f MB/s), %"
+    PRId64 " words (%.0f words/s)\n", totals.documents, totals.bytes,
+    totals.bytes * rate / 1048576, totals.words, totals.words * rate);
+  KAllocStats alloc;
+  kalloc_get_stats (&alloc);
+  double mb = totals.bytes / 1048576.0;
+  fprintf (f, "  Allocations: %" PRId64 " (%.0f per MB), %" PRId64 
+    " reallocations, %" PRId64 " frees, %" PRId64 " bytes\n", 
+    alloc.mallocs, mb > 0 ? alloc.mallocs / mb : 0, alloc.reallocs, 
+    alloc.frees, alloc.bytes);
+  fprintf (f, "  Peak RSS: %ld KB, most allocated at once: %" PRId64 
+    " bytes, by one thread: %" PRId64 " bytes\n", ru.ru_maxrss, 
+    alloc.peak, alloc.thread_peak);
+
+  fprintf (f, "  Tokenizer transitions (rows from, columns to):\n");
+  fprintf (f, "  %-10s", "");
+  for (int j = 0; j < FKRE_STATS_STATES; j++)
+    fprintf (f, " %12s", state_names[j]);
+  fprintf (f, "\n");
+  for (int i = 0; i < FKRE_STATS_STATES; i++)
+    {
+    fprintf (f, "  %-10s", state_names[i]);
+    for (int j = 0; j < FKRE_STATS_STATES; j++)
+      fprintf (f, " %12" PRId64, totals.transitions[i][j]);
+    fprintf (f, "\n");
+    }
+  pthread_mutex_unlock (&lock);
+  }
@@ -0,0 +1,65 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_stats.h
+
+  The --stats report: where the time went in a run, and how much work
+  was done. The statistics are process-wide, and can be added to from
+  any thread. Each phase is timed by reading the clocks at its start
+  and end -- a document, or a block of text, at a time -- never for
+  each character.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdio.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+// The phases timed outside the library, which times decoding, 
+//   tokenizing, and finishing documents itself
+typedef enum
+  {
+  // Reading files, or waiting for them to be decompressed
+  FKRE_PHASE_READ = 0,
+  // Formatting and writing the results
+  FKRE_PHASE_OUTPUT = 1,
+  FKRE_PHASE_COUNT = 2
+  } FKREPhase;
+
+/** The clock readings at the start of a phase. */
+typedef struct _FKREStatsClock
+  {
+  double wall;
+  double cpu;
+  } FKREStatsClock;
+
+BEGIN_DECLS
+
+/** Start collecting statistics, including counting klib's allocations.
+    Until this is called, the other functions do nothing. */
+extern void     fkre_stats_enable (void);
+
+/** FKRE_FLAG_STATS if statistics are being collected, or 0 -- for
+    adding to the flags with which contexts are created. */
+extern unsigned fkre_stats_flags (void);
+
+/** Read the clocks at the start of a phase. */
+extern void     fkre_stats_start (FKREStatsClock *clock);
+
+/** Add the time since fkre_stats_start() to 'phase'. */
+extern void     fkre_stats_stop (const FKREStatsClock *clock,
+                  FKREPhase phase);
+
+/** Add the statistics of a context, created with fkre_stats_flags(), to
+    the totals. Called just before the context is destroyed. */
+extern void     fkre_stats_add_context (const FKREContext *context);
+
+/** Write the report. */
+extern void     fkre_stats_report (FILE *f);
+
+END_DECLS
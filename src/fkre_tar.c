@@ -0,0 +1,387 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_tar.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_input.h"
+#include "fkre_tar.h"
+
+#define KLOG_CLASS "fkre.tar"
+
+#define FKRE_TAR_BLOCK 512
+
+// The largest pax or GNU long-name header that will be read; these
+//   only hold names and the like
+#define FKRE_TAR_MAX_EXTRA (1024 * 1024)
+
+// Offsets of the header fields that are used
+#define FKRE_TAR_NAME     0
+#define FKRE_TAR_SIZE     124
+#define FKRE_TAR_CHKSUM   148
+#define FKRE_TAR_TYPE     156
+#define FKRE_TAR_MAGIC    257
+#define FKRE_TAR_PREFIX   345
+
+typedef enum
+  {
+  FKRE_TAR_STATE_HEADER = 0,
+  FKRE_TAR_STATE_DATA = 1,
+  FKRE_TAR_STATE_END = 2
+  } FKRETarState;
+
+// What to do with a member's data
+typedef enum
+  {
+  FKRE_TAR_SKIP = 0,
+  FKRE_TAR_FILE = 1,
+  FKRE_TAR_PAX = 2,
+  FKRE_TAR_LONGNAME = 3
+  } FKRETarKind;
+
+/*============================================================================
+  
+  FKRETar
+
+  ==========================================================================*/
+typedef struct _FKRETar
+  {
+  FKREContext *context;
+  FKRETarFn fn;
+  void *user_data;
+  FKRETarState state;
+  BYTE header[FKRE_TAR_BLOCK];
+  size_t header_length;
+  int zero_blocks;
+  // The member whose data is being read
+  FKRETarKind kind;
+  char *name;
+  uint64_t remaining;
+  size_t padding;
+  // The contents of a pax or long-name header
+  char *extra;
+  size_t extra_length;
+  // What pax and long-name headers say about the next member
+  char *next_name;
+  int64_t next_size;
+  int error;
+  } FKRETar;
+
+/*============================================================================
+  
+  fkre_tar_number
+
+  Parse a numeric header field -- octal, or GNU's base-256 for values
+  too large for that
+
+  ==========================================================================*/
+static uint64_t fkre_tar_number (const BYTE *field, size_t length)
+  {
+  uint64_t n = 0;
+  if (field[0] & 0x80)
+    {
+    for (size_t i = 1; i < length; i++)
+      n = (n << 8) | field[i];
+    return n;
+    }
+  size_t i = 0;
+  while (i < length && (field[i] == ' ' || field[i] == 0)) i++;
+  while (i < length && field[i] >= '0' && field[i] <= '7')
+    n = (n << 3) | (field[i++] - '0');
+  return n;
+  }
+
+/*============================================================================
+  
+  fkre_tar_checksum_ok
+
+  ==========================================================================*/
+static BOOL fkre_tar_checksum_ok (const BYTE *header)
+  {
+  uint64_t sum = 0;
+  for (int i = 0; i < FKRE_TAR_BLOCK; i++)
+    {
+    if (i >= FKRE_TAR_CHKSUM && i < FKRE_TAR_CHKSUM + 8)
+      sum += ' ';
+    else
+      sum += header[i];
+    }
+  return sum == fkre_tar_number (header + FKRE_TAR_CHKSUM, 8);
+  }
+
+/*============================================================================
+  
+  fkre_tar_parse_pax
+
+  Pick the path and size out of a pax extended header, whose records
+  are of the form "length key=value\n"
+
+  ==========================================================================*/
+static BOOL fkre_tar_parse_pax (FKRETar *self)
+  {
+  const char *p = self->extra;
+  const char *end = p + self->extra_length;
+  while (p < end && *p)
+    {
+    char *q;
+    long length = strtol (p, &q, 10);
+    if (length <= 0 || length > end - p || *q != ' ') return FALSE;
+    const char *record_end = p + length - 1;
+    if (*record_end != '\n') return FALSE;
+    const char *key = q + 1;
+    const char *eq = memchr (key, '=', record_end - key);
+    if (!eq) return FALSE;
+    size_t key_length = eq - key;
+    const char *value = eq + 1;
+    if (key_length == 4 && memcmp (key, "path", 4) == 0)
+      {
+      free (self->next_name);
+      self->next_name = strndup (value, record_end - value);
+      }
+    else if (key_length == 4 && memcmp (key, "size", 4) == 0)
+      self->next_size = strtoll (value, NULL, 10);
+    p += length;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_tar_end_member
+
+  ==========================================================================*/
+static BOOL fkre_tar_end_member (FKRETar *self)
+  {
+  switch (self->kind)
+    {
+    case FKRE_TAR_FILE:
+      {
+      FKREMetrics metrics;
+      metrics.size = sizeof (FKREMetrics);
+      fkre_context_finish (self->context);
+      fkre_context_get_metrics (self->context, &metrics);
+      self->fn (self->user_data, self->name, &metrics);
+      break;
+      }
+    case FKRE_TAR_PAX:
+      if (!fkre_tar_parse_pax (self)) return FALSE;
+      break;
+    case FKRE_TAR_LONGNAME:
+      free (self->next_name);
+      self->next_name = strndup (self->extra, self->extra_length);
+      break;
+    default:;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_tar_header
+
+  Work out what to do with the member a header describes
+
+  ==========================================================================*/
+static BOOL fkre_tar_header (FKRETar *self)
+  {
+  const BYTE *h = self->header;
+  BOOL zero = TRUE;
+  for (int i = 0; i < FKRE_TAR_BLOCK && zero; i++)
+    if (h[i]) zero = FALSE;
+  if (zero)
+    {
+    // Two zero blocks end the archive
+    if (++self->zero_blocks == 2) self->state = FKRE_TAR_STATE_END;
+    return TRUE;
+    }
+  self->zero_blocks = 0;
+
+  if (!fkre_tar_checksum_ok (h))
+    {
+    klog_debug (KLOG_CLASS, "Bad header checksum");
+    return FALSE;
+    }
+
+  uint64_t size = fkre_tar_number (h + FKRE_TAR_SIZE, 12);
+  char type = h[FKRE_TAR_TYPE];
+  self->extra_length = 0;
+  switch (type)
+    {
+    case 'x':
+      self->kind = FKRE_TAR_PAX;
+      break;
+    case 'L':
+      self->kind = FKRE_TAR_LONGNAME;
+      break;
+    case 'g': case 'K':
+      // Global pax headers and long link names don't affect scoring
+      self->kind = FKRE_TAR_SKIP;
+      break;
+    default:
+      {
+      if (self->next_size >= 0) size = self->next_size;
+      free (self->name);
+      if (self->next_name)
+        self->name = self->next_name;
+      else
+        {
+        const char *name = (const char *)h + FKRE_TAR_NAME;
+        const char *prefix = (const char *)h + FKRE_TAR_PREFIX;
+        // Old GNU archives ("ustar  ") use the prefix field for other
+        //   things
+        if (memcmp (h + FKRE_TAR_MAGIC, "ustar", 6) == 0 && prefix[0])
+          asprintf (&self->name, "%.155s/%.100s", prefix, name);
+        else
+          self->name = strndup (name, 100);
+        }
+      self->next_name = NULL;
+      self->next_size = -1;
+      size_t l = strlen (self->name);
+      // Very old archives mark directories only by a trailing '/'
+      BOOL regular = (type == '0' || type == 0 || type == '7')
+        && !(l > 0 && self->name[l - 1] == '/');
+      self->kind = regular ? FKRE_TAR_FILE : FKRE_TAR_SKIP;
+      }
+    }
+
+  if ((self->kind == FKRE_TAR_PAX || self->kind == FKRE_TAR_LONGNAME)
+      && size > FKRE_TAR_MAX_EXTRA)
+    {
+    klog_debug (KLOG_CLASS, "Extended header too large");
+    return FALSE;
+    }
+  if (self->kind == FKRE_TAR_FILE)
+    {
+    klog_debug (KLOG_CLASS, "Scoring member '%s'", self->name);
+    fkre_context_reset (self->context);
+    }
+
+  self->remaining = size;
+  self->padding = (FKRE_TAR_BLOCK - size % FKRE_TAR_BLOCK) % FKRE_TAR_BLOCK;
+  if (size == 0) return fkre_tar_end_member (self);
+  self->state = FKRE_TAR_STATE_DATA;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_tar_block
+
+  Called with each block of the archive as it is read
+
+  ==========================================================================*/
+static BOOL fkre_tar_block (void *user_data, const BYTE *data, size_t length)
+  {
+  FKRETar *self = user_data;
+  while (length > 0)
+    {
+    switch (self->state)
+      {
+      case FKRE_TAR_STATE_HEADER:
+        {
+        size_t n = FKRE_TAR_BLOCK - self->header_length;
+        if (n > length) n = length;
+        memcpy (self->header + self->header_length, data, n);
+        self->header_length += n;
+        data += n;
+        length -= n;
+        if (self->header_length == FKRE_TAR_BLOCK)
+          {
+          self->header_length = 0;
+          if (!fkre_tar_header (self))
+            {
+            self->error = EBADMSG;
+            return FALSE;
+            }
+          }
+        break;
+        }
+
+      case FKRE_TAR_STATE_DATA:
+        if (self->remaining > 0)
+          {
+          size_t n = self->remaining < length ? self->remaining : length;
+          if (self->kind == FKRE_TAR_FILE)
+            fkre_context_feed (self->context, data, n);
+          else if (self->kind != FKRE_TAR_SKIP)
+            {
+            memcpy (self->extra + self->extra_length, data, n);
+            self->extra_length += n;
+            }
+          data += n;
+          length -= n;
+          self->remaining -= n;
+          if (self->remaining == 0 && !fkre_tar_end_member (self))
+            {
+            self->error = EBADMSG;
+            return FALSE;
+            }
+          }
+        else
+          {
+          size_t n = self->padding < length ? self->padding : length;
+          data += n;
+          length -= n;
+          self->padding -= n;
+          }
+        if (self->remaining == 0 && self->padding == 0)
+          self->state = FKRE_TAR_STATE_HEADER;
+        break;
+
+      case FKRE_TAR_STATE_END:
+        // Whatever follows the end of the archive is just padding
+        return TRUE;
+      }
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_tar_score_fd
+
+  ==========================================================================*/
+BOOL fkre_tar_score_fd (int fd, FKREContext *context,
+      FKRETarFn fn, void *user_data)
+  {
+  KLOG_IN
+  FKRETar *self = malloc (sizeof (FKRETar));
+  memset (self, 0, sizeof (FKRETar));
+  self->context = context;
+  self->fn = fn;
+  self->user_data = user_data;
+  self->next_size = -1;
+  self->extra = malloc (FKRE_TAR_MAX_EXTRA);
+
+  BOOL ret = fkre_read_fd (fd, fkre_tar_block, self);
+  if (!ret && self->error)
+    errno = self->error;
+  else if (ret && (self->state == FKRE_TAR_STATE_DATA
+      || self->header_length > 0))
+    {
+    klog_debug (KLOG_CLASS, "Archive is truncated");
+    errno = EBADMSG;
+    ret = FALSE;
+    }
+
+  int e = errno;
+  free (self->name);
+  free (self->next_name);
+  free (self->extra);
+  free (self);
+  errno = e;
+  KLOG_OUT
+  return ret;
+  }
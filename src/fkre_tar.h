@@ -0,0 +1,34 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_tar.h
+
+  Scoring the members of a tar archive as it streams past, without
+  extracting them. ustar, pax, and GNU headers are understood, and the
+  archive may be compressed.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+
+/** Called for each regular file in the archive, with its name as
+    stored in the archive. */
+typedef void (*FKRETarFn) (void *user_data, const char *name,
+               const FKREMetrics *metrics);
+
+BEGIN_DECLS
+
+/** Score each regular file in the tar archive read from 'fd', using
+    'context', and pass the results to 'fn' in archive order. Other
+    kinds of member are skipped. Returns FALSE, with errno set, if the
+    archive can't be read, or is corrupt or truncated (EBADMSG). */
+extern BOOL fkre_tar_score_fd (int fd, FKREContext *context,
+              FKRETarFn fn, void *user_data);
+
+END_DECLS
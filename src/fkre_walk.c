@@ -0,0 +1,495 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_walk.c
+
+  Directories are read with getdents64(), and opened with openat()
+  relative to their parent, so the kernel never has to resolve a full
+  path. The type of each entry comes from the directory itself, so
+  fstatat() is only needed on filesystems that don't record it. Each
+  open directory is shared, with a reference count, by the jobs for
+  its entries, and closed when the last of them is done.
+
+  Work is kept on two stacks: directories to read, and files to pass
+  to the callback. Threads take files in preference to directories,
+  so that the number of files waiting -- and so the number of open
+  directories -- stays small; and both are stacks, so the walk is
+  broadly depth-first, which also keeps few directories open at once.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <klib/klib.h>
+#include "fkre_walk.h"
+
+#define KLOG_CLASS "fkre.walk"
+
+#define DIRENT_BUFFER 32768
+
+/*============================================================================
+  
+  LinuxDirent64
+
+  The record format of getdents64()
+
+  ==========================================================================*/
+typedef struct _LinuxDirent64
+  {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+  } LinuxDirent64;
+
+/*============================================================================
+  
+  Node
+
+  An open directory
+
+  ==========================================================================*/
+typedef struct _Node
+  {
+  int fd;
+  char *path;
+  // The length of the path of the directory the walk started from, so
+  //   that relative paths can be matched against patterns
+  size_t root_length;
+  int refs;
+  } Node;
+
+/*============================================================================
+  
+  Job
+
+  A directory to read, or a file to process. 'dir' is the directory
+  the entry is in -- NULL for the starting points.
+
+  ==========================================================================*/
+typedef struct _Job
+  {
+  Node *dir;
+  char *path;
+  const char *name;
+  size_t root_length;
+  BOOL is_dir;
+  struct _Job *next;
+  } Job;
+
+/*============================================================================
+  
+  FKREWalk
+
+  ==========================================================================*/
+struct _FKREWalk
+  {
+  int threads;
+  char **includes;
+  int nincludes;
+  char **excludes;
+  int nexcludes;
+
+  // Everything from here on is protected by the lock
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Job *dirs;
+  Job *files;
+  // Jobs waiting or being worked on. When this reaches zero, the walk
+  //   is done
+  int64_t outstanding;
+
+  FKREWalkFn fn;
+  void *user_data;
+  };
+
+/*============================================================================
+  
+  Worker
+
+  ==========================================================================*/
+typedef struct _Worker
+  {
+  FKREWalk *walk;
+  int index;
+  pthread_t thread;
+  } Worker;
+
+/*============================================================================
+  
+  fkre_walk_new
+
+  ==========================================================================*/
+FKREWalk *fkre_walk_new (void)
+  {
+  KLOG_IN
+  FKREWalk *self = malloc (sizeof (FKREWalk));
+  memset (self, 0, sizeof (FKREWalk));
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_walk_destroy
+
+  ==========================================================================*/
+void fkre_walk_destroy (FKREWalk *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->nincludes; i++) free (self->includes[i]);
+    for (int i = 0; i < self->nexcludes; i++) free (self->excludes[i]);
+    free (self->includes);
+    free (self->excludes);
+    pthread_mutex_destroy (&self->lock);
+    pthread_cond_destroy (&self->cond);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_walk_include
+
+  ==========================================================================*/
+void fkre_walk_include (FKREWalk *self, const char *pattern)
+  {
+  self->includes = realloc (self->includes,
+    (self->nincludes + 1) * sizeof (char *));
+  self->includes[self->nincludes++] = strdup (pattern);
+  }
+
+/*============================================================================
+  
+  fkre_walk_exclude
+
+  ==========================================================================*/
+void fkre_walk_exclude (FKREWalk *self, const char *pattern)
+  {
+  self->excludes = realloc (self->excludes,
+    (self->nexcludes + 1) * sizeof (char *));
+  self->excludes[self->nexcludes++] = strdup (pattern);
+  }
+
+/*============================================================================
+  
+  fkre_walk_match
+
+  Whether an entry matches any of the patterns
+
+  ==========================================================================*/
+static BOOL fkre_walk_match (char *const *patterns, int n, const char *path,
+      const char *name, size_t root_length)
+  {
+  const char *relative = path + root_length;
+  while (*relative == '/') relative++;
+  for (int i = 0; i < n; i++)
+    {
+    if (strchr (patterns[i], '/'))
+      {
+      if (fnmatch (patterns[i], relative, FNM_PATHNAME) == 0) return TRUE;
+      }
+    else if (fnmatch (patterns[i], name, 0) == 0)
+      return TRUE;
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  
+  fkre_walk_release
+
+  ==========================================================================*/
+static void fkre_walk_release (Node *node)
+  {
+  if (node && __atomic_sub_fetch (&node->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+    close (node->fd);
+    free (node->path);
+    free (node);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_walk_new_job
+
+  ==========================================================================*/
+static Job *fkre_walk_new_job (Node *dir, const char *name, BOOL is_dir)
+  {
+  Job *job = malloc (sizeof (Job));
+  size_t pl = strlen (dir->path);
+  size_t nl = strlen (name);
+  job->path = malloc (pl + nl + 2);
+  memcpy (job->path, dir->path, pl);
+  job->path[pl] = '/';
+  memcpy (job->path + pl + 1, name, nl + 1);
+  job->name = job->path + pl + 1;
+  job->dir = dir;
+  job->root_length = dir->root_length;
+  job->is_dir = is_dir;
+  __atomic_add_fetch (&dir->refs, 1, __ATOMIC_RELAXED);
+  return job;
+  }
+
+/*============================================================================
+  
+  fkre_walk_push
+
+  Add a list of jobs to the stacks. The caller holds the lock.
+
+  ==========================================================================*/
+static void fkre_walk_push (FKREWalk *self, Job *jobs)
+  {
+  while (jobs)
+    {
+    Job *next = jobs->next;
+    if (jobs->is_dir)
+      {
+      jobs->next = self->dirs;
+      self->dirs = jobs;
+      }
+    else
+      {
+      jobs->next = self->files;
+      self->files = jobs;
+      }
+    self->outstanding++;
+    jobs = next;
+    }
+  pthread_cond_broadcast (&self->cond);
+  }
+
+/*============================================================================
+  
+  fkre_walk_read_dir
+
+  ==========================================================================*/
+static void fkre_walk_read_dir (FKREWalk *self, Job *job)
+  {
+  KLOG_IN
+  int fd;
+  if (job->dir)
+    fd = openat (job->dir->fd, job->name,
+      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  else
+    fd = open (job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    {
+    klog_warn (KLOG_CLASS, "Can't read '%s': %s", job->path,
+      strerror (errno));
+    KLOG_OUT
+    return;
+    }
+
+  Node *node = malloc (sizeof (Node));
+  node->fd = fd;
+  node->path = strdup (job->path);
+  node->root_length = job->root_length;
+  // The reference held while the directory is being read
+  node->refs = 1;
+
+  char *buff = malloc (DIRENT_BUFFER);
+  long n;
+  while ((n = syscall (SYS_getdents64, fd, buff, DIRENT_BUFFER)) > 0)
+    {
+    Job *found = NULL;
+    for (long p = 0; p < n; )
+      {
+      LinuxDirent64 *de = (LinuxDirent64 *)(buff + p);
+      p += de->d_reclen;
+      const char *name = de->d_name;
+      if (name[0] == '.' && (name[1] == 0 ||
+           (name[1] == '.' && name[2] == 0)))
+        continue;
+
+      int type = de->d_type;
+      if (type == DT_UNKNOWN)
+        {
+        struct stat sb;
+        if (fstatat (fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+          type = S_ISDIR (sb.st_mode) ? DT_DIR :
+                 S_ISREG (sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+      if (type != DT_DIR && type != DT_REG) continue;
+
+      Job *j = fkre_walk_new_job (node, name, type == DT_DIR);
+      BOOL wanted = !fkre_walk_match (self->excludes, self->nexcludes,
+        j->path, j->name, j->root_length);
+      if (wanted && type == DT_REG && self->nincludes > 0)
+        wanted = fkre_walk_match (self->includes, self->nincludes,
+          j->path, j->name, j->root_length);
+      if (wanted)
+        {
+        j->next = found;
+        found = j;
+        }
+      else
+        {
+        __atomic_sub_fetch (&node->refs, 1, __ATOMIC_RELAXED);
+        free (j->path);
+        free (j);
+        }
+      }
+    if (found)
+      {
+      pthread_mutex_lock (&self->lock);
+      fkre_walk_push (self, found);
+      pthread_mutex_unlock (&self->lock);
+      }
+    }
+  if (n < 0)
+    klog_warn (KLOG_CLASS, "Can't read '%s': %s", job->path,
+      strerror (errno));
+  free (buff);
+  fkre_walk_release (node);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_walk_thread
+
+  ==========================================================================*/
+static void *fkre_walk_thread (void *arg)
+  {
+  Worker *worker = arg;
+  FKREWalk *self = worker->walk;
+  pthread_mutex_lock (&self->lock);
+  for (;;)
+    {
+    while (!self->files && !self->dirs && self->outstanding > 0)
+      pthread_cond_wait (&self->cond, &self->lock);
+    if (self->outstanding == 0) break;
+
+    Job *job;
+    if (self->files)
+      {
+      job = self->files;
+      self->files = job->next;
+      }
+    else
+      {
+      job = self->dirs;
+      self->dirs = job->next;
+      }
+    pthread_mutex_unlock (&self->lock);
+
+    if (job->is_dir)
+      fkre_walk_read_dir (self, job);
+    else
+      self->fn (self->user_data, worker->index, job->path,
+        job->dir ? job->dir->fd : AT_FDCWD, job->name);
+    fkre_walk_release (job->dir);
+    free (job->path);
+    free (job);
+
+    pthread_mutex_lock (&self->lock);
+    if (--self->outstanding == 0)
+      pthread_cond_broadcast (&self->cond);
+    }
+  pthread_mutex_unlock (&self->lock);
+  return NULL;
+  }
+
+/*============================================================================
+  
+  fkre_walk_raise_limit
+
+  Each thread can have a few directories open per level of the tree,
+  so allow as many open files as the system will
+
+  ==========================================================================*/
+static void fkre_walk_raise_limit (void)
+  {
+  struct rlimit rl;
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &rl);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_walk_run
+
+  ==========================================================================*/
+int fkre_walk_run (FKREWalk *self, char *const *roots, int nroots,
+      int threads, FKREWalkFn fn, void *user_data)
+  {
+  KLOG_IN
+  self->threads = threads > 0 ? threads : 1;
+  self->fn = fn;
+  self->user_data = user_data;
+  fkre_walk_raise_limit ();
+
+  Job *jobs = NULL;
+  for (int i = nroots - 1; i >= 0; i--)
+    {
+    struct stat sb;
+    if (stat (roots[i], &sb) != 0)
+      {
+      klog_error (KLOG_CLASS, "Can't read '%s': %s", roots[i],
+        strerror (errno));
+      continue;
+      }
+    Job *job = malloc (sizeof (Job));
+    memset (job, 0, sizeof (Job));
+    job->path = strdup (roots[i]);
+    // Paths are built by appending to the root, so it shouldn't end
+    //   with a separator
+    size_t l = strlen (job->path);
+    while (l > 1 && job->path[l - 1] == '/') job->path[--l] = 0;
+    job->name = job->path;
+    job->root_length = l;
+    job->is_dir = S_ISDIR (sb.st_mode);
+    job->next = jobs;
+    jobs = job;
+    }
+  pthread_mutex_lock (&self->lock);
+  fkre_walk_push (self, jobs);
+  pthread_mutex_unlock (&self->lock);
+
+  int ret = 0;
+  Worker *workers = malloc (self->threads * sizeof (Worker));
+  int started = 0;
+  for (int i = 0; i < self->threads; i++)
+    {
+    workers[i].walk = self;
+    workers[i].index = i;
+    ret = pthread_create (&workers[i].thread, NULL, fkre_walk_thread,
+      &workers[i]);
+    if (ret != 0) break;
+    started++;
+    }
+  if (started > 0) ret = 0;
+  for (int i = 0; i < started; i++)
+    pthread_join (workers[i].thread, NULL);
+  if (started == 0)
+    klog_error (KLOG_CLASS, "Can't start threads: %s", strerror (ret));
+  free (workers);
+  KLOG_OUT
+  return ret;
+  }
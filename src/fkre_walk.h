@@ -0,0 +1,57 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_walk.h
+
+  A parallel, recursive directory walker. A pool of threads reads
+  directories and hands each file it finds to a callback, which is
+  called on the same pool -- so the files found early are being
+  processed while the rest of the tree is still being read.
+
+  Include and exclude patterns are shell globs, as for fnmatch(). A
+  pattern without a '/' is matched against the name of each file or
+  directory; one with a '/' is matched against its path, relative to
+  the directory the walk started from. Excluded directories are not
+  read at all. If there are any include patterns, only files that
+  match one of them are passed to the callback. Symbolic links are
+  not followed.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+
+struct _FKREWalk;
+typedef struct _FKREWalk FKREWalk;
+
+/** Called, on one of the walker's threads, for each file found.
+    'thread' is the index of the thread, from 0 to one less than the
+    number of threads, so that the callback can keep per-thread state.
+    The file can be opened by 'path', or by 'name' relative to the
+    open directory 'dirfd'; the directory stays open until the
+    callback returns. */
+typedef void (*FKREWalkFn) (void *user_data, int thread, const char *path,
+               int dirfd, const char *name);
+
+BEGIN_DECLS
+
+extern FKREWalk *fkre_walk_new (void);
+extern void      fkre_walk_destroy (FKREWalk *self);
+
+extern void      fkre_walk_include (FKREWalk *self, const char *pattern);
+extern void      fkre_walk_exclude (FKREWalk *self, const char *pattern);
+
+/** Walk the directory trees 'roots' (which may also be plain files),
+    using 'threads' threads to call 'fn' for every file, and returning
+    when all have been
+    processed. Directories that can't be read are logged and skipped.
+    Returns zero, or an errno value if the threads can't be started. */
+extern int       fkre_walk_run (FKREWalk *self, char *const *roots,
+                   int nroots, int threads, FKREWalkFn fn, 
+                   void *user_data);
+
+END_DECLS
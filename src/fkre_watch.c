@@ -0,0 +1,582 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_watch.c
+
+  Each directory in the tree has its own inotify watch, since inotify
+  does not watch subdirectories. Events only mark files as needing to
+  be scored; the scoring is done once the events stop arriving, so
+  that a file that gets several events from one save is scored only
+  once. The results for every file are kept in a hash table, keyed by
+  path, so that a new result can be compared with the old one.
+
+  Hidden files and directories, and backup files ending in '~', are
+  ignored -- editors write these all the time, and we don't want to
+  score them, or version-control metadata.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_writer.h"
+#include "fkre_output.h"
+#include "fkre_input.h"
+#include "fkre_watch.h"
+
+#define KLOG_CLASS "fkre.watch"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+   | IN_DELETE | IN_CREATE | IN_ONLYDIR)
+
+#define INITIAL_TABLE_SIZE 1024
+
+/*============================================================================
+  
+  Entry
+
+  A file that is, or has been, in the tree.
+
+  ==========================================================================*/
+typedef struct _Entry
+  {
+  char *path;
+  FKREMetrics metrics;
+  // FALSE if the file has not been scored yet, or has been removed
+  BOOL exists;
+  BOOL pending;
+  } Entry;
+
+/*============================================================================
+  
+  Watch
+
+  ==========================================================================*/
+typedef struct _Watch
+  {
+  int fd;
+  unsigned flags;
+  FKREContext *context;
+  FKREOutput *output;
+  FKREWriter *writer;
+  // Hash table of entries, with open addressing. Entries are never
+  //   removed, so there are no tombstones to worry about
+  Entry **table;
+  size_t table_size;
+  size_t table_count;
+  // Entries marked as needing to be scored
+  Entry **pending;
+  size_t npending;
+  size_t pending_size;
+  // The path of the directory for each watch descriptor
+  char **dirs;
+  int ndirs;
+  } Watch;
+
+static volatile sig_atomic_t stop = 0;
+
+/*============================================================================
+  
+  fkre_watch_signal
+
+  ==========================================================================*/
+static void fkre_watch_signal (int sig)
+  {
+  stop = 1;
+  }
+
+/*============================================================================
+  
+  fkre_watch_now_ms
+
+  ==========================================================================*/
+static int64_t fkre_watch_now_ms (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+/*============================================================================
+  
+  fkre_watch_hash
+
+  FNV-1a
+
+  ==========================================================================*/
+static size_t fkre_watch_hash (const char *s)
+  {
+  uint64_t h = 14695981039346656037ULL;
+  while (*s)
+    {
+    h ^= (BYTE)*s++;
+    h *= 1099511628211ULL;
+    }
+  return (size_t)h;
+  }
+
+/*============================================================================
+  
+  fkre_watch_grow_table
+
+  ==========================================================================*/
+static void fkre_watch_grow_table (Watch *self)
+  {
+  size_t size = self->table_size * 2;
+  Entry **table = calloc (size, sizeof (Entry *));
+  for (size_t i = 0; i < self->table_size; i++)
+    {
+    Entry *e = self->table[i];
+    if (e)
+      {
+      size_t j = fkre_watch_hash (e->path) & (size - 1);
+      while (table[j]) j = (j + 1) & (size - 1);
+      table[j] = e;
+      }
+    }
+  free (self->table);
+  self->table = table;
+  self->table_size = size;
+  }
+
+/*============================================================================
+  
+  fkre_watch_lookup
+
+  Find the entry for a path, creating it if necessary.
+
+  ==========================================================================*/
+static Entry *fkre_watch_lookup (Watch *self, const char *path)
+  {
+  size_t mask = self->table_size - 1;
+  size_t i = fkre_watch_hash (path) & mask;
+  while (self->table[i])
+    {
+    if (strcmp (self->table[i]->path, path) == 0)
+      return self->table[i];
+    i = (i + 1) & mask;
+    }
+
+  Entry *e = malloc (sizeof (Entry));
+  memset (e, 0, sizeof (Entry));
+  e->path = strdup (path);
+  self->table[i] = e;
+  self->table_count++;
+  if (self->table_count * 4 > self->table_size * 3)
+    fkre_watch_grow_table (self);
+  return e;
+  }
+
+/*============================================================================
+  
+  fkre_watch_mark
+
+  Mark a file as needing to be scored.
+
+  ==========================================================================*/
+static void fkre_watch_mark (Watch *self, const char *path)
+  {
+  Entry *e = fkre_watch_lookup (self, path);
+  if (!e->pending)
+    {
+    if (self->npending == self->pending_size)
+      {
+      self->pending_size = self->pending_size ? self->pending_size * 2 : 64;
+      self->pending = realloc (self->pending,
+        self->pending_size * sizeof (Entry *));
+      }
+    self->pending[self->npending++] = e;
+    e->pending = TRUE;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_watch_mark_under
+
+  Mark every file known to be under a directory, when the directory
+  has gone.
+
+  ==========================================================================*/
+static void fkre_watch_mark_under (Watch *self, const char *dir)
+  {
+  size_t l = strlen (dir);
+  for (size_t i = 0; i < self->table_size; i++)
+    {
+    Entry *e = self->table[i];
+    if (e && e->exists && strncmp (e->path, dir, l) == 0
+          && e->path[l] == '/')
+      fkre_watch_mark (self, e->path);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_watch_ignored
+
+  ==========================================================================*/
+static BOOL fkre_watch_ignored (const char *name)
+  {
+  size_t l = strlen (name);
+  return name[0] == '.' || (l > 0 && name[l - 1] == '~');
+  }
+
+/*============================================================================
+  
+  fkre_watch_add_tree
+
+  Watch a directory and everything below it, and mark all the files
+  in it. Directories that can't be watched or read are logged and
+  skipped; returns an errno value only if the top one can't be.
+
+  ==========================================================================*/
+static int fkre_watch_add_tree (Watch *self, const char *dir)
+  {
+  KLOG_IN
+  int wd = inotify_add_watch (self->fd, dir, WATCH_MASK);
+  if (wd < 0)
+    {
+    int ret = errno;
+    klog_warn (KLOG_CLASS, "Can't watch '%s': %s", dir, strerror (ret));
+    KLOG_OUT
+    return ret;
+    }
+  if (wd >= self->ndirs)
+    {
+    int n = wd * 2 + 16;
+    self->dirs = realloc (self->dirs, n * sizeof (char *));
+    memset (self->dirs + self->ndirs, 0, (n - self->ndirs) * sizeof (char *));
+    self->ndirs = n;
+    }
+  // The same directory can be added twice, if it is created just as
+  //   its parent is scanned
+  free (self->dirs[wd]);
+  self->dirs[wd] = strdup (dir);
+
+  int ret = 0;
+  DIR *d = opendir (dir);
+  if (d)
+    {
+    struct dirent *de;
+    while ((de = readdir (d)) != NULL)
+      {
+      if (fkre_watch_ignored (de->d_name)) continue;
+      char *path;
+      if (asprintf (&path, "%s/%s", dir, de->d_name) < 0) continue;
+      int type = de->d_type;
+      if (type == DT_UNKNOWN)
+        {
+        struct stat sb;
+        if (lstat (path, &sb) == 0)
+          type = S_ISDIR (sb.st_mode) ? DT_DIR :
+                 S_ISREG (sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+      if (type == DT_DIR)
+        fkre_watch_add_tree (self, path);
+      else if (type == DT_REG)
+        fkre_watch_mark (self, path);
+      free (path);
+      }
+    closedir (d);
+    }
+  else
+    {
+    ret = errno;
+    klog_warn (KLOG_CLASS, "Can't read '%s': %s", dir, strerror (ret));
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_watch_remove_tree
+
+  Stop watching a directory that has been moved away, and everything
+  below it. The watches would otherwise carry on reporting changes,
+  under the old path.
+
+  ==========================================================================*/
+static void fkre_watch_remove_tree (Watch *self, const char *dir)
+  {
+  size_t l = strlen (dir);
+  for (int wd = 0; wd < self->ndirs; wd++)
+    {
+    const char *d = self->dirs[wd];
+    if (d && strncmp (d, dir, l) == 0 && (d[l] == '/' || d[l] == 0))
+      {
+      inotify_rm_watch (self->fd, wd);
+      free (self->dirs[wd]);
+      self->dirs[wd] = NULL;
+      }
+    }
+  fkre_watch_mark_under (self, dir);
+  }
+
+/*============================================================================
+  
+  fkre_watch_event
+
+  ==========================================================================*/
+static void fkre_watch_event (Watch *self, const struct inotify_event *ev)
+  {
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+    // Events were lost, so we don't know what has changed. Check
+    //   everything
+    klog_warn (KLOG_CLASS, "Event queue overflowed; rescanning");
+    for (size_t i = 0; i < self->table_size; i++)
+      if (self->table[i] && self->table[i]->exists)
+        fkre_watch_mark (self, self->table[i]->path);
+    for (int wd = 0; wd < self->ndirs; wd++)
+      {
+      if (self->dirs[wd])
+        {
+        char *dir = strdup (self->dirs[wd]);
+        fkre_watch_add_tree (self, dir);
+        free (dir);
+        }
+      }
+    return;
+    }
+
+  if (ev->wd < 0 || ev->wd >= self->ndirs || !self->dirs[ev->wd]) return;
+
+  if (ev->mask & IN_IGNORED)
+    {
+    // The directory has been deleted, or we removed the watch
+    free (self->dirs[ev->wd]);
+    self->dirs[ev->wd] = NULL;
+    return;
+    }
+
+  if (ev->len == 0 || fkre_watch_ignored (ev->name)) return;
+
+  char *path;
+  if (asprintf (&path, "%s/%s", self->dirs[ev->wd], ev->name) < 0) return;
+  klog_debug (KLOG_CLASS, "Event %08x on '%s'", ev->mask, path);
+  if (ev->mask & IN_ISDIR)
+    {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+      fkre_watch_add_tree (self, path);
+    else if (ev->mask & IN_MOVED_FROM)
+      fkre_watch_remove_tree (self, path);
+    else if (ev->mask & IN_DELETE)
+      fkre_watch_mark_under (self, path);
+    }
+  else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+             | IN_DELETE))
+    {
+    // A file that is only created is not scored until it has been
+    //   written and closed
+    fkre_watch_mark (self, path);
+    }
+  free (path);
+  }
+
+/*============================================================================
+  
+  fkre_watch_score
+
+  Score a pending file, and output its results if they have changed.
+
+  ==========================================================================*/
+static void fkre_watch_score (Watch *self, Entry *e)
+  {
+  KLOG_IN
+  struct stat sb;
+  BOOL exists = FALSE;
+  if (stat (e->path, &sb) == 0 && S_ISREG (sb.st_mode))
+    {
+    fkre_context_reset (self->context);
+    if (fkre_feed_file (self->context, e->path))
+      {
+      fkre_context_finish (self->context);
+      FKREMetrics m;
+      m.size = sizeof (FKREMetrics);
+      fkre_context_get_metrics (self->context, &m);
+      if (!e->exists || memcmp (&m, &e->metrics, sizeof (m)) != 0)
+        {
+        e->metrics = m;
+        fkre_output_document (self->output, e->path, &m);
+        }
+      exists = TRUE;
+      }
+    else if (errno != ENOENT)
+      {
+      // Keep the old results -- the file might be readable next time
+      klog_warn (KLOG_CLASS, "Can't read '%s': %s", e->path,
+        strerror (errno));
+      exists = e->exists;
+      }
+    }
+  if (e->exists && !exists)
+    fkre_output_removed (self->output, e->path);
+  e->exists = exists;
+  e->pending = FALSE;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_watch_process
+
+  ==========================================================================*/
+static void fkre_watch_process (Watch *self)
+  {
+  KLOG_IN
+  for (size_t i = 0; i < self->npending; i++)
+    fkre_watch_score (self, self->pending[i]);
+  klog_debug (KLOG_CLASS, "Scored %ld files", (long)self->npending);
+  self->npending = 0;
+  fkre_writer_flush (self->writer);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_watch_read
+
+  Read and handle all the events that are waiting. Returns an errno
+  value if the read fails.
+
+  ==========================================================================*/
+static int fkre_watch_read (Watch *self)
+  {
+  char buff[65536]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  for (;;)
+    {
+    ssize_t n = read (self->fd, buff, sizeof (buff));
+    if (n < 0)
+      {
+      if (errno == EAGAIN || errno == EINTR) return 0;
+      return errno;
+      }
+    for (char *p = buff; p < buff + n; )
+      {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      fkre_watch_event (self, ev);
+      p += sizeof (struct inotify_event) + ev->len;
+      }
+    }
+  }
+
+/*============================================================================
+  
+  fkre_watch_run
+
+  ==========================================================================*/
+int fkre_watch_run (const char *dir, unsigned flags, FKREOutput *output,
+      FKREWriter *writer)
+  {
+  KLOG_IN
+  Watch self;
+  memset (&self, 0, sizeof (Watch));
+  self.flags = flags;
+  self.output = output;
+  self.writer = writer;
+  self.table_size = INITIAL_TABLE_SIZE;
+  self.table = calloc (self.table_size, sizeof (Entry *));
+
+  int ret = 0;
+  self.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (self.fd < 0)
+    {
+    ret = errno;
+    klog_error (KLOG_CLASS, "Can't initialize inotify: %s", strerror (ret));
+    }
+
+  // Paths are built by appending to the directory name, so it shouldn't
+  //   end with a separator
+  char *root = strdup (dir);
+  size_t l = strlen (root);
+  while (l > 1 && root[l - 1] == '/') root[--l] = 0;
+
+  self.context = fkre_context_new (flags);
+  if (ret == 0)
+    {
+    ret = fkre_watch_add_tree (&self, root);
+    if (ret == 0) fkre_watch_process (&self);
+    }
+
+  if (ret == 0)
+    {
+    // No SA_RESTART, so that a signal interrupts poll()
+    struct sigaction sa;
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = fkre_watch_signal;
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    klog_info (KLOG_CLASS, "Watching '%s'", root);
+    int64_t first_pending = 0;
+    while (!stop && ret == 0)
+      {
+      int timeout = -1;
+      if (self.npending > 0)
+        {
+        int64_t left = first_pending + FKRE_WATCH_MAX_DELAY_MS
+          - fkre_watch_now_ms ();
+        timeout = left < FKRE_WATCH_SETTLE_MS ? (int)left
+          : FKRE_WATCH_SETTLE_MS;
+        if (timeout < 0) timeout = 0;
+        }
+
+      struct pollfd pfd;
+      pfd.fd = self.fd;
+      pfd.events = POLLIN;
+      int n = poll (&pfd, 1, timeout);
+      if (n < 0)
+        {
+        if (errno != EINTR) ret = errno;
+        }
+      else if (n > 0)
+        {
+        size_t before = self.npending;
+        ret = fkre_watch_read (&self);
+        if (before == 0 && self.npending > 0)
+          first_pending = fkre_watch_now_ms ();
+        }
+      if (ret == 0 && self.npending > 0 && (n == 0 ||
+            fkre_watch_now_ms () - first_pending >= FKRE_WATCH_MAX_DELAY_MS))
+        fkre_watch_process (&self);
+      }
+    klog_info (KLOG_CLASS, "Stopped watching");
+    }
+
+  if (self.fd >= 0) close (self.fd);
+  fkre_context_destroy (self.context);
+  for (size_t i = 0; i < self.table_size; i++)
+    {
+    if (self.table[i])
+      {
+      free (self.table[i]->path);
+      free (self.table[i]);
+      }
+    }
+  free (self.table);
+  free (self.pending);
+  for (int wd = 0; wd < self.ndirs; wd++)
+    free (self.dirs[wd]);
+  free (self.dirs);
+  free (root);
+  KLOG_OUT
+  return ret;
+  }
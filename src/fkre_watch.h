@@ -0,0 +1,42 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_watch.h
+
+  Watch a directory tree, and re-score files as they change.
+
+  Every file in the tree is scored at the start, and the results kept.
+  After that, only files that are written, moved, or deleted are
+  scored again, and a record is output only if a file's results have
+  changed, or it has gone.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <klib/klib.h>
+#include "fkre_writer.h"
+#include "fkre_output.h"
+
+// Changes are not scored until no more have arrived for this long, so
+//   that a burst of events from a single save is handled at once
+#define FKRE_WATCH_SETTLE_MS 10
+
+// ... but a continual stream of changes is not allowed to hold up the
+//   results longer than this
+#define FKRE_WATCH_MAX_DELAY_MS 250
+
+BEGIN_DECLS
+
+/** Watch the directory until interrupted by SIGINT or SIGTERM, writing
+    the results to 'output', and flushing 'writer' after each set of
+    changes. Returns zero on a clean shutdown, or an errno value if
+    the directory could not be watched. Documents are scored with
+    contexts created with 'flags'. */
+extern int fkre_watch_run (const char *dir, unsigned flags,
+             FKREOutput *output, FKREWriter *writer);
+
+END_DECLS
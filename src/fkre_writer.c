@@ -0,0 +1,344 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_writer.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> 
+#include <stdarg.h> 
+#include <errno.h> 
+#include <unistd.h> 
+#include <klib/klib.h> 
+#include "fkre_writer.h" 
+
+#define KLOG_CLASS "fkre.writer"
+
+#define FKRE_WRITER_BUFFER_SIZE 65536
+// Memory writers start small, and grow only if they need to
+#define FKRE_WRITER_MEMORY_SIZE 4096
+
+/*============================================================================
+  
+  FKREWriter 
+
+  ==========================================================================*/
+struct _FKREWriter
+  {
+  // fd is -1 for a writer that accumulates output in memory
+  int fd;
+  char *buffer;
+  size_t length;
+  size_t size;
+  BOOL failed;
+  };
+
+/*============================================================================
+  
+  fkre_writer_new
+
+  ==========================================================================*/
+FKREWriter *fkre_writer_new (int fd)
+  {
+  KLOG_IN
+  FKREWriter *self = malloc (sizeof (FKREWriter));
+  self->fd = fd;
+  self->size = fd < 0 ? FKRE_WRITER_MEMORY_SIZE : FKRE_WRITER_BUFFER_SIZE;
+  self->buffer = malloc (self->size);
+  self->length = 0;
+  self->failed = FALSE;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_writer_new_memory
+
+  ==========================================================================*/
+FKREWriter *fkre_writer_new_memory (void)
+  {
+  KLOG_IN
+  FKREWriter *self = fkre_writer_new (-1);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+  
+  fkre_writer_destroy
+
+  ==========================================================================*/
+void fkre_writer_destroy (FKREWriter *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    fkre_writer_flush (self);
+    free (self->buffer);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  fkre_writer_write_fully
+
+  ==========================================================================*/
+static BOOL fkre_writer_write_fully (int fd, const char *s, size_t len)
+  {
+  while (len > 0)
+    {
+    ssize_t n = write (fd, s, len);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      return FALSE;
+      }
+    s += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  fkre_writer_flush
+
+  ==========================================================================*/
+BOOL fkre_writer_flush (FKREWriter *self)
+  {
+  KLOG_IN
+  BOOL ret = TRUE;
+  if (self->fd < 0) 
+    {
+    // A memory writer's output stays where it is until it is consumed
+    KLOG_OUT
+    return TRUE;
+    }
+  if (self->length > 0 && !self->failed)
+    {
+    if (!fkre_writer_write_fully (self->fd, self->buffer, self->length))
+      {
+      // Report the first failure only -- there's no point in repeating
+      //   the same error for every subsequent record
+      klog_error (KLOG_CLASS, "Can't write output: %s", strerror (errno));
+      self->failed = TRUE;
+      ret = FALSE;
+      }
+    }
+  self->length = 0;
+  if (self->failed) ret = FALSE;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  fkre_writer_get_data
+
+  ==========================================================================*/
+const char *fkre_writer_get_data (const FKREWriter *self, size_t *length)
+  {
+  *length = self->length;
+  return self->buffer;
+  }
+
+/*============================================================================
+  
+  fkre_writer_consume
+
+  ==========================================================================*/
+void fkre_writer_consume (FKREWriter *self, size_t n)
+  {
+  if (n >= self->length)
+    self->length = 0;
+  else
+    {
+    memmove (self->buffer, self->buffer + n, self->length - n);
+    self->length -= n;
+    }
+  }
+
+/*============================================================================
+  
+  fkre_writer_reserve
+
+  Make room in a memory writer for 'len' more bytes. The buffer is never
+  shrunk, so a writer that is reused settles at the size of its
+  largest output.
+
+  ==========================================================================*/
+static void fkre_writer_reserve (FKREWriter *self, size_t len)
+  {
+  if (self->length + len > self->size)
+    {
+    while (self->length + len > self->size)
+      self->size *= 2;
+    self->buffer = realloc (self->buffer, self->size);
+    }
+  }
+
+/*============================================================================
+  
+  fkre_writer_write
+
+  ==========================================================================*/
+void fkre_writer_write (FKREWriter *self, const char *s, size_t len)
+  {
+  if (self->fd < 0)
+    fkre_writer_reserve (self, len);
+  else if (self->length + len > FKRE_WRITER_BUFFER_SIZE)
+    {
+    fkre_writer_flush (self);
+    if (len > FKRE_WRITER_BUFFER_SIZE)
+      {
+      // Too big to buffer at all -- write it straight through
+      if (!self->failed && !fkre_writer_write_fully (self->fd, s, len))
+        {
+        klog_error (KLOG_CLASS, "Can't write output: %s", strerror (errno));
+        self->failed = TRUE;
+        }
+      return;
+      }
+    }
+  memcpy (self->buffer + self->length, s, len);
+  self->length += len;
+  }
+
+/*============================================================================
+  
+  fkre_writer_puts
+
+  ==========================================================================*/
+void fkre_writer_puts (FKREWriter *self, const char *s)
+  {
+  fkre_writer_write (self, s, strlen (s));
+  }
+
+/*============================================================================
+  
+  fkre_writer_printf
+
+  Format directly into the buffer if there is room; if there isn't,
+  flush (or, for a memory writer, grow the buffer) and try again. Only
+  if the formatted text is larger than the whole buffer do we need a
+  temporary allocation.
+
+  ==========================================================================*/
+void fkre_writer_printf (FKREWriter *self, const char *fmt, ...)
+  {
+  va_list ap;
+  size_t space = self->size - self->length;
+  va_start (ap, fmt);
+  int n = vsnprintf (self->buffer + self->length, space, fmt, ap);
+  va_end (ap);
+  if (n < 0) return;
+  if ((size_t)n < space)
+    {
+    self->length += n;
+    return;
+    }
+
+  if (self->fd < 0)
+    {
+    fkre_writer_reserve (self, n + 1);
+    va_start (ap, fmt);
+    vsnprintf (self->buffer + self->length, n + 1, fmt, ap);
+    va_end (ap);
+    self->length += n;
+    return;
+    }
+
+  fkre_writer_flush (self);
+  if (n < FKRE_WRITER_BUFFER_SIZE)
+    {
+    va_start (ap, fmt);
+    vsnprintf (self->buffer, FKRE_WRITER_BUFFER_SIZE, fmt, ap);
+    va_end (ap);
+    self->length = n;
+    }
+  else
+    {
+    char *s;
+    va_start (ap, fmt);
+    n = vasprintf (&s, fmt, ap);
+    va_end (ap);
+    if (n >= 0)
+      {
+      fkre_writer_write (self, s, n);
+      free (s);
+      }
+    }
+  }
+
+/*============================================================================
+  
+  fkre_writer_json_string
+
+  ==========================================================================*/
+void fkre_writer_json_string (FKREWriter *self, const char *s)
+  {
+  if (s == NULL)
+    {
+    fkre_writer_write (self, "null", 4);
+    return;
+    }
+  fkre_writer_write (self, "\"", 1);
+  const char *run = s;
+  for (; *s; s++)
+    {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\' || c < 0x20)
+      {
+      fkre_writer_write (self, run, s - run);
+      switch (c)
+        {
+        case '"': fkre_writer_write (self, "\\\"", 2); break;
+        case '\\': fkre_writer_write (self, "\\\\", 2); break;
+        case '\n': fkre_writer_write (self, "\\n", 2); break;
+        case '\r': fkre_writer_write (self, "\\r", 2); break;
+        case '\t': fkre_writer_write (self, "\\t", 2); break;
+        default: fkre_writer_printf (self, "\\u%04x", c);
+        }
+      run = s + 1;
+      }
+    }
+  fkre_writer_write (self, run, s - run);
+  fkre_writer_write (self, "\"", 1);
+  }
+
+/*============================================================================
+  
+  fkre_writer_csv_string
+
+  ==========================================================================*/
+void fkre_writer_csv_string (FKREWriter *self, const char *s)
+  {
+  if (s == NULL) return;
+  if (strpbrk (s, ",\"\r\n") == NULL)
+    {
+    fkre_writer_puts (self, s);
+    return;
+    }
+  fkre_writer_write (self, "\"", 1);
+  const char *run = s;
+  for (; *s; s++)
+    {
+    if (*s == '"')
+      {
+      // Quotes are escaped by doubling them
+      fkre_writer_write (self, run, s - run + 1);
+      run = s;
+      }
+    }
+  fkre_writer_write (self, run, s - run);
+  fkre_writer_write (self, "\"", 1);
+  }
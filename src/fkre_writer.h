@@ -0,0 +1,62 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre_writer.h
+
+  Definition of the FKREWriter class
+
+  An FKREWriter accumulates output in a fixed-size buffer, and writes
+  it to a file descriptor only when the buffer fills, or when it is
+  flushed. This avoids a system call (or a trip through stdio) for 
+  every field of every record, when scoring large numbers of documents.
+
+  A memory writer has no file descriptor -- its buffer grows as needed,
+  and the owner takes the data from it with fkre_writer_get_data() and
+  fkre_writer_consume().
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <klib/klib.h>
+
+struct _FKREWriter;
+typedef struct _FKREWriter FKREWriter;
+
+BEGIN_DECLS
+
+extern FKREWriter *fkre_writer_new (int fd);
+extern FKREWriter *fkre_writer_new_memory (void);
+/** Flushes any buffered output, then frees the writer. The file
+    descriptor is not closed. */
+extern void        fkre_writer_destroy (FKREWriter *self);
+
+/** Returns FALSE, and sets errno, if the data could not be written. */
+extern BOOL        fkre_writer_flush (FKREWriter *self);
+
+extern void        fkre_writer_write (FKREWriter *self, const char *s, 
+                     size_t len);
+extern void        fkre_writer_puts (FKREWriter *self, const char *s);
+extern void        fkre_writer_printf (FKREWriter *self, 
+                     const char *fmt, ...);
+
+/** Get the data buffered in the writer. For a memory writer, this is
+    all the output that has not been consumed. */
+extern const char *fkre_writer_get_data (const FKREWriter *self, 
+                     size_t *length);
+/** Discard the first n bytes of buffered data. */
+extern void        fkre_writer_consume (FKREWriter *self, size_t n);
+
+/** Write a string as a JSON string literal, with quotes and escapes. 
+    A NULL string is written as null. */
+extern void        fkre_writer_json_string (FKREWriter *self, 
+                     const char *s);
+/** Write a string as a CSV field, quoted if it needs to be. */
+extern void        fkre_writer_csv_string (FKREWriter *self, 
+                     const char *s);
+
+END_DECLS
@@ -10,55 +10,35 @@
   GNU Public Licence, v3.0
 
   ==========================================================================*/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> 
 #include <errno.h> 
+#include <inttypes.h> 
 #include <getopt.h> 
+#include <unistd.h> 
+#include <fcntl.h> 
+#include <pthread.h> 
 #include <klib/klib.h> 
-
-// These are the code points of characters we will treat as vowel sounds,
-//   for the purposes of splitting a word into syllables
-#define VOWELS  { 'a', 'e', 'i', 'o', 'u', 'y', \
-                     0xE1 /*'á'*/, 0xE9 /*'é'*/, 0xEF /*'ï'*/}
+#include <fkre/fkre.h> 
+#include "fkre_writer.h" 
+#include "fkre_output.h" 
+#include "fkre_server.h" 
+#include "fkre_input.h" 
+#include "fkre_watch.h" 
+#include "fkre_cache.h" 
+#include "fkre_walk.h" 
+#include "fkre_epub.h" 
+#include "fkre_office.h" 
+#include "fkre_tar.h" 
+#include "fkre_mail.h" 
+#include "fkre_lines.h" 
+#include "fkre_records.h" 
+#include "fkre_stats.h" 
 
 #define KLOG_CLASS "fkre"
 
-// Types and state for the finite-state machine used to split text 
-
-typedef enum 
-  {
-  STATE_START = 0, 
-  STATE_TAG = 1,
-  STATE_WHITE = 2,
-  STATE_TEXT = 3 
-  } State;
-
-typedef enum 
-  {
-  TYPE_UNKNOWN = 0, 
-  TYPE_STARTTAG = 1, 
-  TYPE_ENDTAG = 2, 
-  TYPE_WHITE = 3, 
-  TYPE_TEXT = 4, 
-  } Type;
-
-typedef struct _FKREContext
-  {
-  BOOL html;
-  int words;
-  int sentences;
-  int current_sentence_length;
-  int max_sentence_length;
-  int syllables;
-  double score;
-  int words_in_this_subheading;
-  int subheadings;
-  int maximum_words_per_subheading;
-  KString *last_word;
-  int passive_sentences;
-  } FKREContext;
-
 /*============================================================================
   
   fkre_log_handler
@@ -74,416 +54,229 @@ void fkre_log_handler (KLogLevel level, const char *cls,
 
 /*============================================================================
   
-  fkre_count_syllables
+  FKREWindowTarget
 
-  Split a word into syllables. The word is assumed to consist only of
-  pronounceable letters. The algorithm is very simple -- essentially a
-  syllable is a group of consonants separated by a group of vowels.
-
-  There are far more accurate ways to count syllables but, since all we
-  care about here is the average number of syllables per word, it hardly
-  seems worth burning a heap of extra CPU cycles.
+  Where to send the scores from a sliding window
 
   ==========================================================================*/
-int fkre_count_syllables (const KString *word)
+typedef struct _FKREWindowTarget
   {
-  static UTF32 vowels[] = VOWELS; 
-  static int nvowels = sizeof (vowels) / sizeof (UTF32);
-  int n = 0;
-  BOOL last_vowel = FALSE;
-  int l = kstring_length (word); 
-  for (int i = 0 ; i < l; i++)
-    {
-    UTF32 wc = kstring_get (word, i);
-    BOOL got_vowel = FALSE;
-    for (int j = 0; j < nvowels; j++)
-      {
-      UTF32 v = vowels[j];
-      // Convert to lower case
-      if (v >= 65 && v <= 90) v += 32; // ASCII
-      if (v >= 192 && v <= 222) v += 32; // Extended latin
-      if ((v == wc) && last_vowel)
-        {
-        got_vowel = TRUE;
-        last_vowel = TRUE;
-        break;
-        }
-      else if (v == wc && !last_vowel)
-        {
-        n++;
-        got_vowel = TRUE;
-        last_vowel = TRUE;
-        break;
-        }
-      }
-    if (!got_vowel)
-      last_vowel = FALSE;
-    }
-  // 'es' on the end of a work is often not sounded as an extra syllable
-  if (kstring_ends_with_utf8 (word, (UTF8 *)"es")) 
-    n--;
-  // 'e' on the end of a work is usually not sounded
-  else if (kstring_ends_with_utf8 (word, (UTF8 *)"e"))
-    n--;
-  return n;
-  }
-
+  FKREOutput *output;
+  const char *filename;
+  } FKREWindowTarget;
 
 /*============================================================================
   
-  fkre_classify 
+  fkre_window_callback
 
   ==========================================================================*/
-Type fkre_classify (BOOL html, int c)
+static void fkre_window_callback (void *user_data, int64_t start, 
+      int64_t end, double score)
   {
-  KLOG_IN
-  Type ret = TYPE_UNKNOWN;
-
-  if (html)
-    {
-    if (c == '<') ret = TYPE_STARTTAG; 
-    if (c == '>') ret = TYPE_ENDTAG; 
-    }
-
-  if (ret == TYPE_UNKNOWN)
-    {
-    // Various Unicode spaces
-    if (c >= 0x2000 && c <= 0x200A)
-      {
-      ret = TYPE_WHITE;
-      }
-    }
-
-  if (ret == TYPE_UNKNOWN)
-    {
-    switch (c)
-      {
-      case ' ':
-      case '\t':
-      case '\r':
-      case '\n':
-      case 0x0B: // Line tab
-      case 0x85: // Next line 
-      case 0xA0: // NBSP 
-      case 0x2028: // Line sep 
-      case 0x2029: // Para sep 
-      case 0x202F: // Narrow NBSP 
-        ret = TYPE_WHITE;
-        break;
-      }
-    }
-
-  if (ret == TYPE_UNKNOWN)
-    ret = TYPE_TEXT;
-  return ret;
-  KLOG_OUT
+  FKREWindowTarget *target = user_data;
+  fkre_output_window (target->output, target->filename, start, end, score);
   }
 
 /*============================================================================
   
-  fkre_got_subheading
+  fkre_epub_callback
 
   ==========================================================================*/
-void fkre_got_subheading (FKREContext *context)
+static void fkre_epub_callback (void *user_data, const char *name, 
+      const FKREMetrics *metrics)
   {
-  if (context->words_in_this_subheading > context->maximum_words_per_subheading)
-    context->maximum_words_per_subheading = context->words_in_this_subheading;
-  context->words_in_this_subheading = 0;
+  fkre_output_document ((FKREOutput *)user_data, name, metrics);
   }
 
-
 /*============================================================================
   
-  fkre_do_tag
+  FKRETarTarget
+
+  Where to send the scores of the members of a tar archive
 
   ==========================================================================*/
-void fkre_do_tag (FKREContext *context, const KString *tag)
+typedef struct _FKRETarTarget
   {
-  KLOG_IN
-  // Be aware that tags have attributes
-  // printf ("** TAG %S\n", kstring_cstr (tag));
+  FKREOutput *output;
+  const char *filename;
+  } FKRETarTarget;
+
+/*============================================================================
+  
+  fkre_tar_callback
 
-  if (kstring_length(tag) >= 1)
+  ==========================================================================*/
+static void fkre_tar_callback (void *user_data, const char *name, 
+      const FKREMetrics *metrics)
+  {
+  FKRETarTarget *target = user_data;
+  // Members of an archive read from stdin are named just as they are
+  //   in the archive
+  if (strcmp (target->filename, "-") == 0)
+    fkre_output_document (target->output, name, metrics);
+  else
     {
-    if (kstring_get (tag, 0) == 'h'
-       || kstring_get (tag, 0) == 'H')
-      {
-      int c1 = kstring_get (tag, 1);
-      if (c1 >= '1' && c1 <= '9')
-        {
-        context->subheadings++; 
-        fkre_got_subheading (context); 
-        }
-      }
+    char *s;
+    asprintf (&s, "%s:%s", target->filename, name);
+    fkre_output_document (target->output, s, metrics);
+    free (s);
     }
-
-  KLOG_OUT
   }
 
 /*============================================================================
   
-  fkre_extract_letters
+  fkre_mail_callback
 
   ==========================================================================*/
-KString *fkre_extract_letters (const KString *word)
+static void fkre_mail_callback (void *user_data, const char *name, 
+      const FKREMetrics *metrics)
   {
-  KLOG_IN
-  KString *ret = kstring_new_empty();
-  int l = kstring_length (word);
-  for (int i = 0; i < l; i++)
-    {
-    UTF32 c = kstring_get (word, i);
-    if (
-       (c >= 'a' && c <= 'z') ||
-       (c >= 'A' && c <= 'Z') ||
-       (c >= 192 && c <= 255) // iso-8859-1 extended latin 
-       )
-    kstring_append_char (ret, c);
-    }
-  KLOG_OUT
-  return ret;
+  fkre_output_document ((FKREOutput *)user_data, name, metrics);
   }
 
 /*============================================================================
   
-  fkre_do_word
+  FKRELinesTarget
+
+  Where to send the scores of the lines of a file
 
   ==========================================================================*/
-void fkre_do_word (FKREContext *context, const KString *word)
+typedef struct _FKRELinesTarget
   {
-  KLOG_IN
-  // TODO remove HTML entities
-  klog_debug (KLOG_CLASS, "Got word %S", kstring_cstr (word));
-
-  BOOL end_sentence = FALSE;
-  if (kstring_ends_with_utf8 (word, (UTF8*)".")) 
-    end_sentence = TRUE;
-  if (kstring_ends_with_utf8 (word, (UTF8*)"?")) 
-    end_sentence = TRUE;
-  if (end_sentence)
-    {
-    klog_debug (KLOG_CLASS, "sentence length: %d",   
-                  context->current_sentence_length);
-    if (context->current_sentence_length > context->max_sentence_length)
-      context->max_sentence_length = context->current_sentence_length;
-    context->sentences++;
-    context->current_sentence_length = 0;
-    }
+  FKREOutput *output;
+  const char *filename;
+  // Room for the filename and a line number
+  char *name;
+  } FKRELinesTarget;
 
-  // Now we've figured out whether this word ends a sentence or not,
-  //  strip all but letters.
+/*============================================================================
+  
+  fkre_lines_callback
 
-  KString *clean_word = fkre_extract_letters (word);
-  klog_debug (KLOG_CLASS, "Depunctuated word %S",  
-               kstring_cstr (clean_word));
-  if (kstring_length (clean_word) > 0)
-    {
-    int syls = fkre_count_syllables (clean_word);
-    context->syllables += syls;
-    context->current_sentence_length++;
-    context->words++;
-    context->words_in_this_subheading++; 
+  ==========================================================================*/
+static void fkre_lines_callback (void *user_data, int64_t line, 
+      const FKREMetrics *metrics)
+  {
+  FKRELinesTarget *target = user_data;
+  // Lines read from stdin are named just by number
+  if (strcmp (target->filename, "-") == 0)
+    sprintf (target->name, "%" PRId64, line);
+  else
+    sprintf (target->name, "%s:%" PRId64, target->filename, line);
+  fkre_output_document (target->output, target->name, metrics);
+  }
 
-    if (syls > 1) 
-      {
-      if (kstring_ends_with_utf8 (clean_word, (UTF8*)"ed"))
-        { 
-        if ((kstring_strcmp_utf8 (context->last_word, (UTF8*)"is") == 0)
-         || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"was") == 0)
-         || (kstring_strcmp_utf8 (context->last_word, (UTF8*)"being") == 0))
-          {
-          klog_debug (KLOG_CLASS, "Passive expression %S %S", 
-            kstring_cstr (context->last_word), kstring_cstr(clean_word));
-          context->passive_sentences++;
-          }
-        }
-      }
-    kstring_destroy (context->last_word);
-    context->last_word = kstring_strdup (clean_word);
-    }
+/*============================================================================
+  
+  fkre_records_callback
+
+  A record is named by its key, if it has one, and otherwise as a line
+  is
 
-  kstring_destroy (clean_word);
-  KLOG_OUT
+  ==========================================================================*/
+static void fkre_records_callback (void *user_data, int64_t record, 
+      const char *key, const FKREMetrics *metrics)
+  {
+  FKRELinesTarget *target = user_data;
+  if (key)
+    fkre_output_document (target->output, key, metrics);
+  else
+    fkre_lines_callback (user_data, record, metrics);
   }
 
 /*============================================================================
   
-  fkre_process 
+  FKRETreeTarget
+
+  Where to send the scores of files found by the walker, which may be
+  on any of its threads
 
   ==========================================================================*/
-void fkre_process (FKREContext *context, KString *text)
+typedef struct _FKRETreeTarget
   {
-  size_t l = kstring_length (text);
-  State state = STATE_START;
-  
-  KString *tag = kstring_new_empty();
-  KString *word = kstring_new_empty();
-  context->last_word = kstring_new_empty();
+  FKREOutput *output;
+  FKREWriter *writer;
+  FKRECache *cache;
+  // One per thread
+  FKREContext **contexts;
+  pthread_mutex_t lock;
+  } FKRETreeTarget;
 
-  for (int i = 0; i < l; i++)
-    {
-    int c = kstring_get (text, i);
-    Type type = fkre_classify (context->html, c);
-    if (state == STATE_TAG && type != TYPE_ENDTAG)
-      {
-      // If we've seen a start tag marker, then we don't pay any attention
-      //  to the contents, until we get to the end tag, even if we
-      //  hit end of file. Just buffer up the tag.
-      kstring_append_char (tag, c);
-      }
-    else
-      {
-      switch (state * 1000 + type)
-	{
-        //
-        // *** Events in START state *** 
-        //
-	case STATE_START * 1000 + TYPE_STARTTAG:
-          klog_trace (KLOG_CLASS, "Start tag at pos %ld; new state TAG");
-	  state = STATE_TAG;
-	  break;
-
-	case STATE_START * 1000 + TYPE_ENDTAG:
-	  // This should never happen in well-formed HTML. We ignore
-	  //   the end tag and carry on in start state
-          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
-                                     "new state START");
-	  state = STATE_START;
-	  break;
-
-	case STATE_START * 1000 + TYPE_WHITE:
-          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
-                                     "new state WHITE", i);
-	  state = STATE_WHITE;
-	  break;
-
-	case STATE_START * 1000 + TYPE_TEXT:
-          klog_trace (KLOG_CLASS, "Text at pos %ld; "
-                                     "new state TEXT", i);
-          kstring_append_char (word, c);
-	  state = STATE_TEXT;
-	  break;
-
-        //
-        // *** Events in TAG state *** 
-        //
-	case STATE_TAG * 1000 + TYPE_ENDTAG:
-	  // Finished a tag. Go back to start state
-          klog_trace (KLOG_CLASS, "End tag at pos %ld", i);
-          fkre_do_tag (context, tag);
-          kstring_clear (tag);
-	  state = STATE_START;
-	  break;
-
-        //
-        // *** Events in WHITE state *** 
-        //
-	case STATE_WHITE * 1000 + TYPE_WHITE:
-          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
-                                     "stay in state WHITE", i);
-	  state = STATE_WHITE;
-	  break;
-
-	case STATE_WHITE * 1000 + TYPE_STARTTAG:
-          klog_trace (KLOG_CLASS, "Start tag at pos %ld; "
-                                     "new state TAG", i);
-	  state = STATE_TAG;
-	  break;
-
-	case STATE_WHITE * 1000 + TYPE_ENDTAG:
-          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
-                                     "new state START", i);
-	  state = STATE_START;
-	  break;
-
-	case STATE_WHITE * 1000 + TYPE_TEXT:
-          klog_trace (KLOG_CLASS, "Text at pos %ld; "
-                                     "new state TEXT", i);
-          kstring_append_char (word, c);
-	  state = STATE_TEXT;
-	  break;
-
-        //
-        // *** Events in TEXT state *** 
-        //
-	case STATE_TEXT * 1000 + TYPE_WHITE:
-          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
-                                     "new state WHITE", i);
-          fkre_do_word (context, word);
-          kstring_clear (word);
-	  state = STATE_WHITE;
-	  break;
-
-	case STATE_TEXT * 1000 + TYPE_STARTTAG:
-          klog_trace (KLOG_CLASS, "Start tag at pos %ld; "
-                                     "new state TAG");
-          fkre_do_word (context, word);
-          kstring_clear (word);
-	  state = STATE_TAG;
-	  break;
-
-	case STATE_TEXT * 1000 + TYPE_ENDTAG:
-	  // This should never happen in well-formed HTML. We ignore
-	  //   the end tag and carry on in TEXT state
-          klog_trace (KLOG_CLASS, "Unexpected end tag at pos %ld; "
-                                     "stay in TEXT state");
-	  state = STATE_TEXT;
-	  break;
-
-	case STATE_TEXT * 1000 + TYPE_TEXT:
-          klog_trace (KLOG_CLASS, "Whitespace at pos %ld; "
-                                     "stay in state WHITE", i);
-          kstring_append_char (word, c);
-	  state = STATE_TEXT;
-	  break;
-
-	default:
-          // This should never happen
-	  klog_error (KLOG_CLASS, 
-	    "Internal error: char %d(%c) of type %d "
-              "in state %d at position %ld", 
-              c, (char)c, type, state, i);
-	  exit (-1);
-	}
-      }
-    }
+/*============================================================================
   
-  // End of file is essentially a subheading, so far as calculating
-  //   the number of words per subheading
-  if (context->html) fkre_got_subheading (context);
+  fkre_tree_epub_callback
 
-  kstring_destroy (word);
-  kstring_destroy (tag);
-  kstring_destroy (context->last_word);
+  ==========================================================================*/
+static void fkre_tree_epub_callback (void *user_data, const char *name, 
+      const FKREMetrics *metrics)
+  {
+  FKRETreeTarget *target = user_data;
+  pthread_mutex_lock (&target->lock);
+  fkre_output_document (target->output, name, metrics);
+  pthread_mutex_unlock (&target->lock);
   }
 
 /*============================================================================
   
-  fkre_calculate_score 
+  fkre_tree_callback
 
   ==========================================================================*/
-BOOL fkre_calculate_score (FKREContext *context)
+static void fkre_tree_callback (void *user_data, int thread, 
+      const char *path, int dirfd, const char *name)
   {
-  KLOG_IN
-  BOOL ret = FALSE;
-  if (context->sentences > 0 && context->words > 0)
+  FKRETreeTarget *target = user_data;
+  if (fkre_is_epub (path))
     {
-    double twords = context->words;
-    double tsents = context->sentences;
-    double tsylls = context->syllables;
-    context->score = 206.835 
-       - 1.015 * (twords / tsents) 
-       - 84.6 * (tsylls / twords);
-    ret = TRUE;
+    // The walker's threads are already busy, so the book's chapters
+    //   are scored on this one
+    if (!fkre_epub_score (path, 1, fkre_tree_epub_callback, target))
+      {
+      int e = errno;
+      pthread_mutex_lock (&target->lock);
+      fkre_writer_flush (target->writer);
+      klog_error (KLOG_CLASS, "Can't read '%s': %s", path, strerror (e)); 
+      pthread_mutex_unlock (&target->lock);
+      }
+    return;
     }
+
+  FKREContext *context = target->contexts[thread];
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  BOOL ok;
+  if (fkre_is_office (path))
+    ok = fkre_office_score (path, &metrics);
+  else if (target->cache)
+    ok = fkre_cache_score_file (target->cache, context, path, &metrics);
   else
     {
-    klog_warn (KLOG_CLASS, "Can't calculate FKRE score because some "
-                              "divisors are zero");
+    ok = FALSE;
+    int fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+      {
+      fkre_context_reset (context);
+      ok = fkre_feed_fd (context, fd);
+      int e = errno;
+      close (fd);
+      errno = e;
+      if (ok)
+        {
+        fkre_context_finish (context);
+        fkre_context_get_metrics (context, &metrics);
+        }
+      }
     }
 
-  KLOG_OUT
-  return ret;
+  int e = errno;
+  pthread_mutex_lock (&target->lock);
+  if (ok)
+    fkre_output_document (target->output, path, &metrics);
+  else
+    {
+    fkre_writer_flush (target->writer);
+    klog_error (KLOG_CLASS, "Can't read '%s': %s", path, strerror (e)); 
+    }
+  pthread_mutex_unlock (&target->lock);
   }
 
 /*============================================================================
@@ -493,9 +286,39 @@ BOOL fkre_calculate_score (FKREContext *context)
   ==========================================================================*/
 void fkre_show_usage (const char *argv0, FILE *f) 
   {
-  fprintf (f, "Usage: %s [options] {filename}\n", argv0);
-  fprintf (f, "    -t, --html     File is HTML\n");
-  fprintf (f, "    -v, --version  Show version\n");
+  fprintf (f, "Usage: %s [options] {filenames...}\n", argv0);
+  fprintf (f, "    -a, --tar              "
+    "Files are tar archives; '-' is stdin\n");
+  fprintf (f, "    -e, --lines            "
+    "Score each line separately; '-' is stdin\n");
+  fprintf (f, "    -c, --cache=DIR        "
+    "Keep results in, and reuse them from, DIR\n");
+  fprintf (f, "    -C, --csv-column=COL   "
+    "Score column COL of each CSV record\n");
+  fprintf (f, "    -f, --format=F         Output: text, json, ndjson, csv\n");
+  fprintf (f, "    -i, --include=GLOB     "
+    "With -r, only score files matching GLOB\n");
+  fprintf (f, "    -J, --json-field=PATH  "
+    "Score field PATH of each NDJSON record\n");
+  fprintf (f, "    -j, --jobs=N           "
+    "Use N threads for -r, -e, and EPUB files\n");
+  fprintf (f, "    -k, --key=COL|PATH     "
+    "Name CSV or NDJSON records by this field\n");
+  fprintf (f, "    -L, --latex            File is LaTeX source\n");
+  fprintf (f, "    -m, --mbox             Files are mailboxes; '-' is stdin\n");
+  fprintf (f, "    -M, --markdown         File is Markdown\n");
+  fprintf (f, "    -r, --recurse=DIR      Score all files in the tree DIR\n");
+  fprintf (f, "    -t, --html             File is HTML\n");
+  fprintf (f, "    -T, --stats            Report times and counts on stderr\n");
+  fprintf (f, "    -S, --serve=SOCKET     Run a scoring server on SOCKET\n");
+  fprintf (f, "    -W, --watch=DIR        "
+    "Re-score files in DIR as they change\n");
+  fprintf (f, "    -n, --window=N         Score a sliding window of N units\n");
+  fprintf (f, "    -s, --stride=N         Score the window every N units\n");
+  fprintf (f, "    -u, --window-unit=U    Window unit: sentences or words\n");
+  fprintf (f, "    -v, --version          Show version\n");
+  fprintf (f, "    -x, --exclude=GLOB     "
+    "With -r, skip files and directories matching GLOB\n");
   }
 
 /*============================================================================
@@ -525,6 +348,26 @@ int main (int argc, char **argv)
   BOOL show_version = FALSE;
   BOOL show_usage = FALSE;
   BOOL html = FALSE;
+  BOOL tar = FALSE;
+  BOOL mbox = FALSE;
+  BOOL lines = FALSE;
+  const char *csv_column = NULL;
+  const char *json_field = NULL;
+  const char *key = NULL;
+  BOOL markdown = FALSE;
+  BOOL latex = FALSE;
+  BOOL stats = FALSE;
+  int window_size = 0;
+  int window_stride = 1;
+  FKREWindowUnit window_unit = FKRE_WINDOW_SENTENCES;
+  FKREFormat format = FKRE_FORMAT_TEXT;
+  const char *serve = NULL;
+  const char *watch = NULL;
+  const char *cache_dir = NULL;
+  char **roots = NULL;
+  int nroots = 0;
+  int jobs = (int)sysconf (_SC_NPROCESSORS_ONLN);
+  FKREWalk *walk = fkre_walk_new ();
 
   int width = 80;
   int log_level = KLOG_ERROR;
@@ -536,6 +379,26 @@ int main (int argc, char **argv)
       {"log-level", required_argument, NULL, 'l'},
       {"html", no_argument, NULL, 't'},
       {"width", required_argument, NULL, 'w'},
+      {"window", required_argument, NULL, 'n'},
+      {"stride", required_argument, NULL, 's'},
+      {"window-unit", required_argument, NULL, 'u'},
+      {"format", required_argument, NULL, 'f'},
+      {"serve", required_argument, NULL, 'S'},
+      {"watch", required_argument, NULL, 'W'},
+      {"cache", required_argument, NULL, 'c'},
+      {"recurse", required_argument, NULL, 'r'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"include", required_argument, NULL, 'i'},
+      {"exclude", required_argument, NULL, 'x'},
+      {"tar", no_argument, NULL, 'a'},
+      {"mbox", no_argument, NULL, 'm'},
+      {"lines", no_argument, NULL, 'e'},
+      {"csv-column", required_argument, NULL, 'C'},
+      {"json-field", required_argument, NULL, 'J'},
+      {"key", required_argument, NULL, 'k'},
+      {"markdown", no_argument, NULL, 'M'},
+      {"latex", no_argument, NULL, 'L'},
+      {"stats", no_argument, NULL, 'T'},
       {0, 0, 0, 0}
     };
 
@@ -544,7 +407,7 @@ int main (int argc, char **argv)
    while (ret == 0)
      {
      int option_index = 0;
-     opt = getopt_long (argc, argv, "hvl:w:t",
+     opt = getopt_long (argc, argv, "hvl:w:tn:s:u:f:S:W:c:r:j:i:x:amMLeC:J:k:T",
      long_options, &option_index);
 
      if (opt == -1) break;
@@ -571,10 +434,84 @@ int main (int argc, char **argv)
          show_version = TRUE; break;
        case 't': 
          html = TRUE; break;
+       case 'a': 
+         tar = TRUE; break;
+       case 'm': 
+         mbox = TRUE; break;
+       case 'e': 
+         lines = TRUE; break;
+       case 'C': 
+         csv_column = optarg; break;
+       case 'J': 
+         json_field = optarg; break;
+       case 'k': 
+         key = optarg; break;
+       case 'M': 
+         markdown = TRUE; break;
+       case 'L': 
+         latex = TRUE; break;
+       case 'T': 
+         stats = TRUE; break;
        case 'l': 
            log_level = atoi (optarg); break;
        case 'w':
            width = atoi (optarg); break;
+       case 'n':
+           window_size = atoi (optarg); 
+           if (window_size <= 0)
+             {
+             klog_error (KLOG_CLASS, "Window size must be at least 1");
+             ret = EINVAL;
+             }
+           break;
+       case 's':
+           window_stride = atoi (optarg); 
+           if (window_stride <= 0)
+             {
+             klog_error (KLOG_CLASS, "Window stride must be at least 1");
+             ret = EINVAL;
+             }
+           break;
+       case 'u':
+           if (strcmp (optarg, "sentences") == 0)
+             window_unit = FKRE_WINDOW_SENTENCES;
+           else if (strcmp (optarg, "words") == 0)
+             window_unit = FKRE_WINDOW_WORDS;
+           else
+             {
+             klog_error (KLOG_CLASS, "Unknown window unit '%s'", optarg);
+             ret = EINVAL;
+             }
+           break;
+       case 'S':
+           serve = optarg; break;
+       case 'W':
+           watch = optarg; break;
+       case 'c':
+           cache_dir = optarg; break;
+       case 'r':
+           roots = realloc (roots, (nroots + 1) * sizeof (char *));
+           roots[nroots++] = optarg;
+           break;
+       case 'j':
+           jobs = atoi (optarg); 
+           if (jobs <= 0)
+             {
+             klog_error (KLOG_CLASS, "Number of jobs must be at least 1");
+             ret = EINVAL;
+             }
+           break;
+       case 'i':
+           fkre_walk_include (walk, optarg); break;
+       case 'x':
+           fkre_walk_exclude (walk, optarg); break;
+       case 'f':
+           if (!fkre_format_from_utf8 (optarg, &format))
+             {
+             klog_error (KLOG_CLASS, "Unknown output format '%s'", optarg);
+             ret = EINVAL;
+             }
+           break;
        default:
            ret = EINVAL;
        }
@@ -596,73 +533,365 @@ int main (int argc, char **argv)
   klog_set_log_level (log_level);
   klog_set_handler (fkre_log_handler);
 
+  if (ret == 0 && html + markdown + latex > 1)
+    {
+    klog_error (KLOG_CLASS, 
+      "Only one of --html, --markdown, and --latex can be used");
+    ret = EINVAL;
+    }
+  unsigned flags = (html ? FKRE_FLAG_HTML : 0) 
+    | (markdown ? FKRE_FLAG_MARKDOWN : 0)
+    | (latex ? FKRE_FLAG_LATEX : 0);
+
+  if (ret == 0 && serve && (markdown || latex))
+    {
+    klog_error (KLOG_CLASS, 
+      "--serve can't be used with --markdown or --latex");
+    ret = EINVAL;
+    }
+
+  if (ret == 0 && stats && (serve || watch))
+    {
+    klog_error (KLOG_CLASS, "--stats can't be used with --serve or --watch");
+    ret = EINVAL;
+    }
+  if (stats) fkre_stats_enable ();
+  // Only contexts collect statistics; the cache and the output use
+  //   the flags without it
+  unsigned context_flags = flags | fkre_stats_flags ();
+
+  if (ret == 0 && serve)
+    {
+    ret = fkre_server_run (serve, html, FKRE_SERVER_MAX_DOCUMENT);
+    if (ret == 0) ret = -1;
+    }
+
+  if (ret == 0 && watch)
+    {
+    if (window_size > 0)
+      {
+      klog_error (KLOG_CLASS, "--watch can't be used with --window");
+      ret = EINVAL;
+      }
+    else
+      {
+      // The output never ends, so a JSON array would never be closed
+      if (format == FKRE_FORMAT_JSON) format = FKRE_FORMAT_NDJSON;
+      FKREWriter *writer = fkre_writer_new (STDOUT_FILENO);
+      FKREOutput *output = fkre_output_new (writer, format, TRUE);
+      ret = fkre_watch_run (watch, flags, output, writer);
+      fkre_output_destroy (output);
+      fkre_writer_destroy (writer);
+      if (ret == 0) ret = -1;
+      }
+    }
+
+  if (ret == 0 && nroots > 0 && window_size > 0)
+    {
+    klog_error (KLOG_CLASS, "--recurse can't be used with --window");
+    ret = EINVAL;
+    }
+
+  if (ret == 0 && tar && window_size > 0)
+    {
+    klog_error (KLOG_CLASS, "--tar can't be used with --window");
+    ret = EINVAL;
+    }
+
+  if (ret == 0 && mbox && (window_size > 0 || tar))
+    {
+    klog_error (KLOG_CLASS, "--mbox can't be used with --window or --tar");
+    ret = EINVAL;
+    }
+
+  if (ret == 0 && lines && (window_size > 0 || tar || mbox || nroots > 0))
+    {
+    klog_error (KLOG_CLASS, 
+      "--lines can't be used with --window, --tar, --mbox, or --recurse");
+    ret = EINVAL;
+    }
+
+  FKRERecords *records = NULL;
+  if (ret == 0 && (csv_column || json_field))
+    {
+    if (csv_column && json_field)
+      {
+      klog_error (KLOG_CLASS, 
+        "--csv-column can't be used with --json-field");
+      ret = EINVAL;
+      }
+    else if (window_size > 0 || tar || mbox || lines || nroots > 0)
+      {
+      klog_error (KLOG_CLASS, "--csv-column and --json-field can't be "
+        "used with --window, --tar, --mbox, --lines, or --recurse");
+      ret = EINVAL;
+      }
+    else 
+      {
+      records = csv_column ? 
+        fkre_records_new (FKRE_RECORDS_CSV, csv_column, key)
+        : fkre_records_new (FKRE_RECORDS_JSON, json_field, key);
+      if (!records)
+        {
+        klog_error (KLOG_CLASS, "Invalid %s '%s'", 
+          csv_column ? "column" : "field path", 
+          csv_column ? csv_column : json_field);
+        ret = EINVAL;
+        }
+      }
+    }
+  if (ret == 0 && key && !records)
+    {
+    klog_error (KLOG_CLASS, 
+      "--key can only be used with --csv-column or --json-field");
+    ret = EINVAL;
+    }
+
+  // With --tar, --mbox, --lines, --csv-column, or --json-field, and no 
+  //   files, stdin is read
+  char **files = argv + optind;
+  int nfiles = argc - optind;
+  static char *files_stdin[] = { "-" };
+  if ((tar || mbox || lines || records) && nfiles == 0 && nroots == 0)
+    {
+    files = files_stdin;
+    nfiles = 1;
+    }
+
   if (ret == 0)
     {
-    if (argc - optind != 1)
+    if (nfiles < 1 && nroots == 0)
       {
       fkre_show_usage (argv[0], stderr); 
       ret = -1;
       }
     }
+
+  FKRECache *cache = NULL;
+  if (ret == 0 && cache_dir)
+    {
+    // Window and line scores aren't cached, so there's no point in a 
+    //   cache
+    if (window_size > 0 || lines || records)
+      klog_warn (KLOG_CLASS, 
+        "The cache is not used with --window, --lines, or records");
+    else
+      {
+      cache = fkre_cache_new (cache_dir, flags);
+      if (!cache)
+        {
+        klog_error (KLOG_CLASS, "Can't use cache directory '%s': %s",  
+          cache_dir, strerror (errno)); 
+        ret = errno;
+        }
+      }
+    }
   
   if (ret == 0)
     {
-    const char *filename = argv[optind];
-    KPath *test = kpath_new_from_utf8 ((UTF8*)filename);
+    FKREWriter *writer = fkre_writer_new (STDOUT_FILENO);
+    // An EPUB produces a record for each chapter, as well as the book
+    BOOL multiple = nfiles > 1 || nroots > 0 || tar || mbox || lines
+      || records;
+    for (int i = 0; i < nfiles; i++)
+      if (fkre_is_epub (files[i])) multiple = TRUE;
+    FKREOutput *output = fkre_output_new (writer, format, multiple);
+
+    FKREContext *context = fkre_context_new (context_flags);
+    FKREMail *mail = mbox ? fkre_mail_new () : NULL;
+    FKREWindowTarget target;
+    target.output = output;
+    if (window_size > 0)
+      {
+      // In window mode, the only output is the per-window scores
+      fkre_context_set_window (context, window_unit, window_size, 
+        window_stride, fkre_window_callback, &target);
+      }
 
-    KString *text = kpath_read_to_string (test);
-    if (text)
+    for (int i = 0; i < nfiles; i++)
       {
-      FKREContext context;
-      memset (&context, 0, sizeof (FKREContext));
-      context.html = html; 
-      fkre_process (&context, text); 
-      printf ("Words: %d\n", context.words);
-      printf ("Sentences: %d\n", context.sentences);
-      printf ("Longest sentence: %d words\n", context.max_sentence_length);
-      if (context.sentences > 0)
-        printf ("Average sentence: %d words\n", 
-          context.words / context.sentences);
-      printf ("Syllables: %d\n", context.syllables);
-      if (fkre_calculate_score (&context))
-	{
-	printf ("FK score: %.0f\n", context.score);
-        printf ("FK rating: ");
-        if (context.score > 90) printf ("very easy");
-        else if (context.score > 80) printf ("easy");
-        else if (context.score > 70) printf ("fairly easy");
-        else if (context.score > 60) printf ("plain English");
-        else if (context.score > 50) printf ("fairly difficult");
-        else if (context.score > 30) printf ("difficult");
-        else if (context.score > 10) printf ("very difficult");
-        else printf ("extremely difficult");
-        printf ("\n");
-        printf ("Passive sentences: %d\n", context.passive_sentences);
-        if (context.sentences > 0)
-          printf ("Proportion of passive sentences: %.0f%%\n", 
-            (double)context.passive_sentences / (double)context.sentences 
-               * 100.0);
-	}
-      if (html)
+      const char *filename = files[i];
+      target.filename = filename;
+
+      if (mbox)
         {
-        printf ("Subheadings: %d\n", context.subheadings);
-        printf ("Maximum words in a subheading: %d\n", 
-           context.maximum_words_per_subheading);
-        if (context.subheadings != 0)
+        if (!fkre_mail_score (mail, filename, fkre_mail_callback, output))
           {
-          printf ("Average words per subheading: %.0f\n", 
-             (double)context.words / (double)context.subheadings);
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
           }
+        continue;
         }
-      kstring_destroy (text);
+
+      if (lines || records)
+        {
+        FKRELinesTarget lines_target;
+        lines_target.output = output;
+        lines_target.filename = filename;
+        lines_target.name = malloc (strlen (filename) + 32);
+        BOOL is_stdin = strcmp (filename, "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO 
+          : open (filename, O_RDONLY | O_CLOEXEC);
+        BOOL ok = FALSE;
+        if (fd >= 0)
+          {
+          if (records)
+            ok = fkre_records_score_fd (records, fd, context, 
+              fkre_records_callback, &lines_target);
+          else
+            ok = fkre_lines_score_fd (fd, context_flags, jobs, 
+              fkre_lines_callback, &lines_target);
+          int e = errno;
+          if (!is_stdin) close (fd);
+          errno = e;
+          }
+        free (lines_target.name);
+        if (!ok)
+          {
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
+          }
+        continue;
+        }
+
+      if (tar)
+        {
+        FKRETarTarget tar_target;
+        tar_target.output = output;
+        tar_target.filename = filename;
+        BOOL is_stdin = strcmp (filename, "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO 
+          : open (filename, O_RDONLY | O_CLOEXEC);
+        BOOL ok = FALSE;
+        if (fd >= 0)
+          {
+          ok = fkre_tar_score_fd (fd, context, fkre_tar_callback, 
+            &tar_target);
+          int e = errno;
+          if (!is_stdin) close (fd);
+          errno = e;
+          }
+        if (!ok)
+          {
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
+          }
+        continue;
+        }
+
+      if (fkre_is_epub (filename))
+        {
+        if (window_size > 0)
+          klog_error (KLOG_CLASS, "Can't use --window with EPUB '%s'",  
+            filename); 
+        else if (!fkre_epub_score (filename, jobs, fkre_epub_callback, 
+              output))
+          {
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
+          }
+        continue;
+        }
+
+      FKREMetrics metrics;
+      metrics.size = sizeof (FKREMetrics);
+      if (fkre_is_office (filename))
+        {
+        if (window_size > 0)
+          klog_error (KLOG_CLASS, "Can't use --window with '%s'",  
+            filename); 
+        else if (fkre_office_score (filename, &metrics))
+          fkre_output_document (output, filename, &metrics);
+        else
+          {
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
+          }
+        continue;
+        }
+
+      if (cache)
+        {
+        if (fkre_cache_score_file (cache, context, filename, &metrics))
+          fkre_output_document (output, filename, &metrics);
+        else
+          {
+          fkre_writer_flush (writer);
+          klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+            filename, strerror (errno)); 
+          }
+        continue;
+        }
+
+      fkre_context_reset (context);
+      if (fkre_feed_file (context, filename))
+        {
+        fkre_context_finish (context);
+        if (window_size == 0)
+          {
+          fkre_context_get_metrics (context, &metrics);
+          fkre_output_document (output, filename, &metrics);
+          }
+        }
+      else
+        {
+        // Make sure the error message doesn't overtake earlier output
+        fkre_writer_flush (writer);
+        klog_error (KLOG_CLASS, "Can't read '%s': %s",  
+          filename, strerror (errno)); 
+        }
+      }
+
+    fkre_stats_add_context (context);
+    fkre_context_destroy (context);
+    fkre_mail_destroy (mail);
+    fkre_records_destroy (records);
+
+    if (nroots > 0)
+      {
+      FKRETreeTarget tree;
+      tree.output = output;
+      tree.writer = writer;
+      tree.cache = cache;
+      tree.contexts = malloc (jobs * sizeof (FKREContext *));
+      for (int i = 0; i < jobs; i++)
+        tree.contexts[i] = fkre_context_new (context_flags);
+      pthread_mutex_init (&tree.lock, NULL);
+
+      ret = fkre_walk_run (walk, roots, nroots, jobs, 
+        fkre_tree_callback, &tree);
+
+      pthread_mutex_destroy (&tree.lock);
+      for (int i = 0; i < jobs; i++)
+        {
+        fkre_stats_add_context (tree.contexts[i]);
+        fkre_context_destroy (tree.contexts[i]);
+        }
+      free (tree.contexts);
       }
-   else
-      klog_error (KLOG_CLASS, "Can't read '%s': %s",  
-        filename, strerror (errno)); 
 
-    kpath_destroy (test);
+    fkre_output_destroy (output);
+    fkre_writer_destroy (writer);
+    }
+
+  if (cache)
+    {
+    int64_t hits, stat_hits, misses;
+    fkre_cache_get_stats (cache, &hits, &stat_hits, &misses);
+    fprintf (stderr, "Cache: %" PRId64 " hits (%" PRId64 
+      " unchanged), %" PRId64 " misses\n", hits, stat_hits, misses);
+    fkre_cache_destroy (cache);
     }
 
+  if (ret == 0) fkre_stats_report (stderr);
+
+  fkre_walk_destroy (walk);
+  free (roots);
   klog_info (KLOG_CLASS, "Done");
   if (ret == -1) ret = 0;
   return ret;
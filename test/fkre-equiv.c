@@ -0,0 +1,828 @@
+/*============================================================================
+  
+  FKRE 
+  
+  fkre-equiv.c
+
+  Check that every way the library has of scoring a document counts
+  exactly what the reference does. The reference decodes the text a
+  byte at a time, and passes it to fkre_process() a character at a
+  time, so that it depends on no block size, and goes through no path
+  but the character-at-a-time state machine. The other ways are
+
+    feed     -- fkre_context_feed(), on the whole text at once
+    chunks   -- fkre_context_feed(), on pieces of random sizes, split
+                anywhere, including inside multi-byte characters; on
+                alternate runs with FKRE_FLAG_STATS, which feeds the
+                text through a separate, timed, path; with a sliding
+                window, whose reports must also match; and with a
+                context that has been used before, and reset
+    document -- an FKREDocument, loaded with the text, and then edited
+                at random, compared with the reference on the text as
+                it is after the edits
+    merge    -- the text split between words into pieces, which are
+                tokenized on separate threads, and whose FKREPartials
+                are merged in order (plain and HTML only, which are
+                the modes in which any white space outside a tag is a
+                safe place to split)
+    lines    -- each line scored as a separate document, on one thread
+                and on several, by fkre_lines_score_fd(), as 'fkre
+                --lines' does, compared with the reference for each
+                line
+
+  Each is run, in every mode, on the files named on the command line --
+  normally corpora made by fkre-corpus -- and on fuzzed slices of them,
+  with markup, punctuation, broken UTF-8 and NULs thrown in. Any
+  difference in any counter, the score, or a window's report is
+  printed, and the program fails.
+
+  A new fast path in the library -- a faster decoder, or tokenizer,
+  or syllable counter -- must pass this with no changes to the
+  reference.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <klib/klib.h>
+#include <fkre/fkre.h>
+#include "fkre_internal.h"
+#include "fkre_lines.h"
+
+// The most threads the merge and lines checks use
+#define EQUIV_THREADS 4
+
+// The largest slice of a corpus that is fuzzed
+#define EQUIV_FUZZ_SIZE 8192
+
+static const unsigned modes[] =
+  {
+  0, FKRE_FLAG_HTML, FKRE_FLAG_MARKDOWN, FKRE_FLAG_LATEX
+  };
+#define NMODES (sizeof (modes) / sizeof (modes[0]))
+
+// Bits of text that the tokenizer, and the parsers in front of it,
+//   treat specially, for the fuzzer to insert
+static const char *fragments[] =
+  {
+  "<", ">", "<h1>", "</h1>", "<h3 class=\"x\">", "<p>", "</p>", "<!-- ",
+  " -->", ".", "?", "!", ". ", "? ", "\n", "\n\n", "\r\n", " ", "\t",
+  "\xc2\xa0", "\xe2\x80\x83", "\xe2\x80\xa8", "\xc3", "\xe2\x80", "\xf0",
+  "\x80", "\xff", "\xc3\xa9", "\xf0\x9f\x98\x80", "\0", "was walked ",
+  "is completed", "being considered. ", "# ", "## Heading\n", "===\n",
+  "```\n", "    ", "* ", "[link](http://x.org/y)", "`code`",
+  "\\section{", "\\emph{", "}", "{", "$", "$$", "%", "\\\\",
+  "\\begin{verbatim}", "\\end{verbatim}", "\\begin{document}",
+  "\\end{document}", "\\documentclass{article}\n", "\\cite{x}"
+  };
+#define NFRAGMENTS (sizeof (fragments) / sizeof (fragments[0]))
+
+/*============================================================================
+  
+  Random numbers
+
+  ==========================================================================*/
+static uint64_t rng_state = 1;
+
+static uint64_t rng_next (void)
+  {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+  }
+
+static size_t rng_below (size_t n)
+  {
+  return n > 0 ? rng_next () % n : 0;
+  }
+
+/*============================================================================
+  
+  Text
+
+  A growable buffer of bytes
+
+  ==========================================================================*/
+typedef struct _Text
+  {
+  BYTE *data;
+  size_t length;
+  size_t size;
+  } Text;
+
+static void text_replace (Text *t, size_t offset, size_t remove,
+      const void *bytes, size_t length)
+  {
+  size_t need = t->length - remove + length;
+  if (need + 1 > t->size)
+    {
+    t->size = (need + 1) * 2;
+    t->data = realloc (t->data, t->size);
+    }
+  memmove (t->data + offset + length, t->data + offset + remove,
+    t->length - offset - remove);
+  memcpy (t->data + offset, bytes, length);
+  t->length = need;
+  }
+
+static void text_append (Text *t, const void *bytes, size_t length)
+  {
+  text_replace (t, t->length, 0, bytes, length);
+  }
+
+/*============================================================================
+  
+  Windows
+
+  The reports of a sliding window, as a list
+
+  ==========================================================================*/
+typedef struct _WindowReport
+  {
+  int64_t start;
+  int64_t end;
+  double score;
+  } WindowReport;
+
+typedef struct _Windows
+  {
+  WindowReport *reports;
+  size_t count;
+  size_t size;
+  } Windows;
+
+static void windows_callback (void *user_data, int64_t start, int64_t end,
+      double score)
+  {
+  Windows *w = user_data;
+  if (w->count == w->size)
+    {
+    w->size = w->size ? w->size * 2 : 64;
+    w->reports = realloc (w->reports, w->size * sizeof (WindowReport));
+    }
+  w->reports[w->count].start = start;
+  w->reports[w->count].end = end;
+  w->reports[w->count].score = score;
+  w->count++;
+  }
+
+/*============================================================================
+  
+  Checking
+
+  ==========================================================================*/
+static int checks = 0;
+static int failures = 0;
+static const char *current = "";
+
+static void equiv_fail (const char *variant, unsigned flags,
+      const char *fmt, ...)
+  {
+  va_list ap;
+  va_start (ap, fmt);
+  fprintf (stderr, "FAIL %s, %s, flags 0x%x: ", current, variant, flags);
+  vfprintf (stderr, fmt, ap);
+  fprintf (stderr, "\n");
+  va_end (ap);
+  failures++;
+  }
+
+#define EQUIV_FIELD(f) \
+  if (a->f != b->f) \
+    { \
+    equiv_fail (variant, flags, "%s is %lld, but %lld in the reference", \
+      #f, (long long)b->f, (long long)a->f); \
+    ok = FALSE; \
+    }
+
+/*============================================================================
+  
+  equiv_metrics
+
+  Compare metrics with the reference's
+
+  ==========================================================================*/
+static BOOL equiv_metrics (const char *variant, unsigned flags,
+      const FKREMetrics *a, const FKREMetrics *b)
+  {
+  BOOL ok = TRUE;
+  checks++;
+  EQUIV_FIELD (words);
+  EQUIV_FIELD (sentences);
+  EQUIV_FIELD (syllables);
+  EQUIV_FIELD (max_sentence_length);
+  EQUIV_FIELD (passive_sentences);
+  EQUIV_FIELD (subheadings);
+  EQUIV_FIELD (max_words_per_subheading);
+  EQUIV_FIELD (have_score);
+  if (ok && a->score != b->score)
+    {
+    equiv_fail (variant, flags, "score is %.17g, but %.17g in the "
+      "reference", b->score, a->score);
+    ok = FALSE;
+    }
+  return ok;
+  }
+
+/*============================================================================
+  
+  equiv_partial
+
+  Compare partial counts with the reference's
+
+  ==========================================================================*/
+static BOOL equiv_partial (const char *variant, unsigned flags,
+      const FKREPartial *a, const FKREPartial *b)
+  {
+  BOOL ok = TRUE;
+  checks++;
+  EQUIV_FIELD (words);
+  EQUIV_FIELD (syllables);
+  EQUIV_FIELD (passive_sentences);
+  EQUIV_FIELD (sentences);
+  EQUIV_FIELD (sentence_head);
+  EQUIV_FIELD (sentence_max);
+  EQUIV_FIELD (sentence_tail);
+  EQUIV_FIELD (subheadings);
+  EQUIV_FIELD (subheading_head);
+  EQUIV_FIELD (subheading_max);
+  EQUIV_FIELD (subheading_tail);
+  EQUIV_FIELD (first_participle);
+  EQUIV_FIELD (last_auxiliary);
+  return ok;
+  }
+
+/*============================================================================
+  
+  equiv_windows
+
+  ==========================================================================*/
+static void equiv_windows (const char *variant, unsigned flags,
+      const Windows *a, const Windows *b)
+  {
+  checks++;
+  if (a->count != b->count)
+    {
+    equiv_fail (variant, flags, "%zu window reports, but %zu in the "
+      "reference", b->count, a->count);
+    return;
+    }
+  for (size_t i = 0; i < a->count; i++)
+    {
+    const WindowReport *x = &a->reports[i];
+    const WindowReport *y = &b->reports[i];
+    if (x->start != y->start || x->end != y->end || x->score != y->score)
+      {
+      equiv_fail (variant, flags, "window %zu is %lld-%lld, %.17g, but "
+        "%lld-%lld, %.17g in the reference", i, (long long)y->start,
+        (long long)y->end, y->score, (long long)x->start,
+        (long long)x->end, x->score);
+      return;
+      }
+    }
+  }
+
+/*============================================================================
+  
+  reference_feed
+
+  Decode a byte at a time, and tokenize a character at a time
+
+  ==========================================================================*/
+static void reference_feed (FKREContext *context, const BYTE *data,
+      size_t length)
+  {
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  while (p < end)
+    {
+    UTF32 c;
+    if (fkre_decode (context, &p, p + 1, &c, 1) == 1)
+      fkre_process (context, &c, 1);
+    }
+  }
+
+/*============================================================================
+  
+  reference_score
+
+  The reference metrics for a text, and the window reports if
+  'windows' isn't NULL
+
+  ==========================================================================*/
+static void reference_score (unsigned flags, const BYTE *data,
+      size_t length, FKREMetrics *metrics, Windows *windows,
+      FKREWindowUnit unit)
+  {
+  FKREContext *context = fkre_context_new (flags);
+  if (windows)
+    fkre_context_set_window (context, unit, 10, 3, windows_callback,
+      windows);
+  reference_feed (context, data, length);
+  fkre_context_finish (context);
+  metrics->size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (context, metrics);
+  fkre_context_destroy (context);
+  }
+
+/*============================================================================
+  
+  check_feed
+
+  ==========================================================================*/
+static void check_feed (unsigned flags, const BYTE *data, size_t length,
+      const FKREMetrics *reference)
+  {
+  FKREContext *context = fkre_context_new (flags);
+  fkre_context_feed (context, data, length);
+  fkre_context_finish (context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (context, &metrics);
+  equiv_metrics ("feed", flags, reference, &metrics);
+  fkre_context_destroy (context);
+  }
+
+/*============================================================================
+  
+  check_chunks
+
+  ==========================================================================*/
+static void check_chunks (unsigned flags, const BYTE *data, size_t length,
+      const FKREMetrics *reference, BOOL stats)
+  {
+  FKREWindowUnit unit = rng_below (2) ? FKRE_WINDOW_WORDS
+    : FKRE_WINDOW_SENTENCES;
+  Windows ref_windows, windows;
+  memset (&ref_windows, 0, sizeof (Windows));
+  memset (&windows, 0, sizeof (Windows));
+  FKREMetrics ref_metrics;
+  reference_score (flags, data, length, &ref_metrics, &ref_windows, unit);
+  equiv_metrics ("reference with window", flags, reference, &ref_metrics);
+
+  unsigned f = flags | (stats ? FKRE_FLAG_STATS : 0);
+  FKREContext *context = fkre_context_new (f);
+  fkre_context_set_window (context, unit, 10, 3, windows_callback,
+    &windows);
+  // Used once already, so that reset is checked too
+  fkre_context_feed (context, data, length < 1000 ? length : 1000);
+  fkre_context_reset (context);
+  windows.count = 0;
+
+  size_t offset = 0;
+  while (offset < length)
+    {
+    size_t n;
+    switch (rng_below (3))
+      {
+      case 0: n = 1 + rng_below (4); break;
+      case 1: n = 1 + rng_below (100); break;
+      default: n = 1 + rng_below (65536); break;
+      }
+    if (n > length - offset) n = length - offset;
+    fkre_context_feed (context, data + offset, n);
+    offset += n;
+    }
+  fkre_context_finish (context);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_context_get_metrics (context, &metrics);
+  const char *variant = stats ? "chunks with stats" : "chunks";
+  equiv_metrics (variant, flags, reference, &metrics);
+  equiv_windows (variant, flags, &ref_windows, &windows);
+  fkre_context_destroy (context);
+  free (ref_windows.reports);
+  free (windows.reports);
+  }
+
+/*============================================================================
+  
+  equiv_offset
+
+  A random offset in the text that isn't inside a multi-byte character
+
+  ==========================================================================*/
+static size_t equiv_offset (const Text *t)
+  {
+  size_t offset = rng_below (t->length + 1);
+  while (offset < t->length && (t->data[offset] & 0xC0) == 0x80)
+    offset++;
+  return offset;
+  }
+
+/*============================================================================
+  
+  check_document
+
+  Load the text into a document, and make 'edits' random edits,
+  checking the metrics against the reference after every 'every'
+  edits, and after the last
+
+  ==========================================================================*/
+static void check_document (unsigned flags, const BYTE *data,
+      size_t length, const FKREMetrics *reference, int edits, int every)
+  {
+  FKREDocument *doc = fkre_document_new (flags);
+  Text shadow;
+  memset (&shadow, 0, sizeof (Text));
+  text_append (&shadow, data, length);
+  fkre_document_replace (doc, 0, 0, data, length);
+  FKREMetrics metrics;
+  metrics.size = sizeof (FKREMetrics);
+  fkre_document_get_metrics (doc, &metrics);
+  equiv_metrics ("document", flags, reference, &metrics);
+
+  for (int e = 1; e <= edits; e++)
+    {
+    size_t offset = equiv_offset (&shadow);
+    size_t remove = 0;
+    if (rng_below (2) && offset < shadow.length)
+      {
+      size_t end = offset + 1 + rng_below (rng_below (2) ? 16 : 4096);
+      if (end > shadow.length) end = shadow.length;
+      while (end < shadow.length && (shadow.data[end] & 0xC0) == 0x80)
+        end++;
+      remove = end - offset;
+      }
+    // Insert a fragment, or some of the original text
+    const BYTE *insert;
+    size_t n;
+    if (rng_below (2))
+      {
+      const char *f = fragments[rng_below (NFRAGMENTS)];
+      insert = (const BYTE *)f;
+      n = *f ? strlen (f) : 1;
+      }
+    else
+      {
+      size_t from = rng_below (length);
+      n = rng_below (length - from < 2048 ? length - from : 2048);
+      insert = data + from;
+      }
+    if (rng_below (4) == 0) n = 0;
+    text_replace (&shadow, offset, remove, insert, n);
+    fkre_document_replace (doc, offset, remove, insert, n);
+
+    if (e % every == 0 || e == edits)
+      {
+      FKREMetrics ref;
+      reference_score (flags, shadow.data, shadow.length, &ref, NULL, 0);
+      fkre_document_get_metrics (doc, &metrics);
+      char variant[64];
+      snprintf (variant, sizeof (variant), "document after %d edits", e);
+      if (!equiv_metrics (variant, flags, &ref, &metrics)) break;
+      if (fkre_document_length (doc) != shadow.length)
+        {
+        equiv_fail (variant, flags, "length is %zu, not %zu",
+          fkre_document_length (doc), shadow.length);
+        break;
+        }
+      }
+    }
+  free (shadow.data);
+  fkre_document_destroy (doc);
+  }
+
+/*============================================================================
+  
+  Merging
+
+  ==========================================================================*/
+typedef struct _Piece
+  {
+  unsigned flags;
+  const BYTE *data;
+  size_t length;
+  FKREPartial partial;
+  } Piece;
+
+static void *merge_thread (void *arg)
+  {
+  Piece *piece = arg;
+  FKREContext *context = fkre_context_new (piece->flags);
+  fkre_context_feed (context, piece->data, piece->length);
+  fkre_context_flush (context);
+  fkre_partial_from_context (context, &piece->partial);
+  fkre_context_destroy (context);
+  return NULL;
+  }
+
+/*============================================================================
+  
+  check_merge
+
+  Split the text after white space that is outside any tag, and whose
+  byte ends any multi-byte character before it, so that the tokenizer
+  is in the same state as at the start of the text
+
+  ==========================================================================*/
+static void check_merge (unsigned flags, const BYTE *data, size_t length)
+  {
+  FKREContext *context = fkre_context_new (flags);
+  reference_feed (context, data, length);
+  fkre_context_flush (context);
+  FKREPartial reference;
+  fkre_partial_from_context (context, &reference);
+  fkre_context_destroy (context);
+
+  BOOL html = (flags & FKRE_FLAG_HTML) != 0;
+  int npieces = 2 + rng_below (EQUIV_THREADS - 1);
+  Piece pieces[EQUIV_THREADS];
+  size_t start = 0;
+  BOOL in_tag = FALSE;
+  int n = 0;
+  size_t target = length / npieces;
+  for (size_t i = 0; i < length && n < npieces - 1; i++)
+    {
+    BYTE b = data[i];
+    if (html && b == '<') in_tag = TRUE;
+    else if (html && b == '>') in_tag = FALSE;
+    else if (!in_tag && (b == ' ' || b == '\n' || b == '\t')
+        && i + 1 - start >= target)
+      {
+      pieces[n].data = data + start;
+      pieces[n].length = i + 1 - start;
+      start = i + 1;
+      n++;
+      }
+    }
+  pieces[n].data = data + start;
+  pieces[n].length = length - start;
+  n++;
+
+  pthread_t ids[EQUIV_THREADS];
+  for (int i = 0; i < n; i++)
+    {
+    pieces[i].flags = flags;
+    pthread_create (&ids[i], NULL, merge_thread, &pieces[i]);
+    }
+  for (int i = 0; i < n; i++)
+    pthread_join (ids[i], NULL);
+
+  FKREPartial total = pieces[0].partial;
+  for (int i = 1; i < n; i++)
+    fkre_partial_merge (&total, &pieces[i].partial);
+  equiv_partial ("merge", flags, &reference, &total);
+  }
+
+/*============================================================================
+  
+  Lines
+
+  ==========================================================================*/
+typedef struct _Lines
+  {
+  const FKREMetrics *expected;
+  int64_t count;
+  int64_t seen;
+  int64_t period;
+  BOOL failed;
+  unsigned flags;
+  const char *variant;
+  } Lines;
+
+static void lines_callback (void *user_data, int64_t line,
+      const FKREMetrics *metrics)
+  {
+  Lines *lines = user_data;
+  if (lines->failed) return;
+  if (line != lines->seen + 1)
+    {
+    equiv_fail (lines->variant, lines->flags, "line %lld came after %lld",
+      (long long)line, (long long)lines->seen);
+    lines->failed = TRUE;
+    return;
+    }
+  lines->seen = line;
+  if (!equiv_metrics (lines->variant, lines->flags,
+      &lines->expected[(line - 1) % lines->period], metrics))
+    {
+    fprintf (stderr, "  at line %lld\n", (long long)line);
+    lines->failed = TRUE;
+    }
+  }
+
+/*============================================================================
+  
+  check_lines
+
+  The text, which must end with a line end, is written to a file
+  'copies' times over, so that the file is large enough to be read in
+  several chunks, and the lines scored on 1 and on EQUIV_THREADS
+  threads
+
+  ==========================================================================*/
+static void check_lines (unsigned flags, const BYTE *data, size_t length,
+      int copies, const char *dir)
+  {
+  // The reference for each line of one copy
+  int64_t period = 0;
+  size_t size = 1024;
+  FKREMetrics *expected = malloc (size * sizeof (FKREMetrics));
+  const BYTE *p = data;
+  const BYTE *end = data + length;
+  while (p < end)
+    {
+    const BYTE *eol = memchr (p, '\n', end - p);
+    size_t n = eol - p;
+    if (n > 0 && p[n - 1] == '\r') n--;
+    if (period == size)
+      {
+      size *= 2;
+      expected = realloc (expected, size * sizeof (FKREMetrics));
+      }
+    reference_score (flags, p, n, &expected[period++], NULL, 0);
+    p = eol + 1;
+    }
+
+  char path[PATH_MAX];
+  snprintf (path, sizeof (path), "%s/lines-XXXXXX", dir);
+  int fd = mkstemp (path);
+  if (fd < 0)
+    {
+    equiv_fail ("lines", flags, "can't create '%s': %s", path,
+      strerror (errno));
+    free (expected);
+    return;
+    }
+  unlink (path);
+  for (int i = 0; i < copies; i++)
+    if (write (fd, data, length) != (ssize_t)length)
+      {
+      equiv_fail ("lines", flags, "can't write: %s", strerror (errno));
+      close (fd);
+      free (expected);
+      return;
+      }
+
+  int threads[] = { 1, EQUIV_THREADS };
+  for (int t = 0; t < 2; t++)
+    {
+    char variant[64];
+    snprintf (variant, sizeof (variant), "lines on %d threads",
+      threads[t]);
+    Lines lines;
+    memset (&lines, 0, sizeof (Lines));
+    lines.expected = expected;
+    lines.period = period;
+    lines.count = period * copies;
+    lines.flags = flags;
+    lines.variant = variant;
+    lseek (fd, 0, SEEK_SET);
+    if (!fkre_lines_score_fd (fd, flags, threads[t], lines_callback,
+          &lines))
+      equiv_fail (variant, flags, "can't read: %s", strerror (errno));
+    else if (!lines.failed && lines.seen != lines.count)
+      equiv_fail (variant, flags, "%lld lines, not %lld",
+        (long long)lines.seen, (long long)lines.count);
+    }
+  close (fd);
+  free (expected);
+  }
+
+/*============================================================================
+  
+  check_all
+
+  Run every check on one text, in every mode
+
+  ==========================================================================*/
+static void check_all (const BYTE *data, size_t length, int edits,
+      int every)
+  {
+  for (int m = 0; m < NMODES; m++)
+    {
+    unsigned flags = modes[m];
+    FKREMetrics reference;
+    reference_score (flags, data, length, &reference, NULL, 0);
+    check_feed (flags, data, length, &reference);
+    check_chunks (flags, data, length, &reference, FALSE);
+    check_chunks (flags, data, length, &reference, TRUE);
+    check_document (flags, data, length, &reference, edits, every);
+    if (!(flags & (FKRE_FLAG_MARKDOWN | FKRE_FLAG_LATEX)))
+      check_merge (flags, data, length);
+    }
+  }
+
+/*============================================================================
+  
+  fuzz
+
+  A random slice of the text, with random fragments inserted into it
+
+  ==========================================================================*/
+static void fuzz (const BYTE *data, size_t length, Text *out)
+  {
+  out->length = 0;
+  size_t n = 1 + rng_below (EQUIV_FUZZ_SIZE);
+  if (n > length) n = length;
+  size_t from = rng_below (length - n + 1);
+  text_append (out, data + from, n);
+  int mutations = rng_below (64);
+  for (int i = 0; i < mutations; i++)
+    {
+    const char *f = fragments[rng_below (NFRAGMENTS)];
+    size_t offset = rng_below (out->length + 1);
+    text_replace (out, offset, 0, f, *f ? strlen (f) : 1);
+    }
+  }
+
+/*============================================================================
+  
+  check_file
+
+  ==========================================================================*/
+static void check_file (const char *path, int rounds, const char *dir)
+  {
+  int fd = open (path, O_RDONLY);
+  struct stat sb;
+  if (fd < 0 || fstat (fd, &sb) != 0)
+    {
+    fprintf (stderr, "Can't read '%s': %s\n", path, strerror (errno));
+    failures++;
+    if (fd >= 0) close (fd);
+    return;
+    }
+  Text text;
+  memset (&text, 0, sizeof (Text));
+  BYTE block[65536];
+  ssize_t r;
+  while ((r = read (fd, block, sizeof (block))) > 0)
+    text_append (&text, block, r);
+  close (fd);
+
+  char *copy = strdup (path);
+  char name[256];
+  snprintf (name, sizeof (name), "%s", basename (copy));
+  free (copy);
+  int before = failures;
+
+  current = name;
+  check_all (text.data, text.length, 20, 10);
+
+  // Lines need a line end at the end
+  if (text.length > 0 && text.data[text.length - 1] != '\n')
+    text_append (&text, "\n", 1);
+  for (int m = 0; m < NMODES; m++)
+    check_lines (modes[m], text.data, text.length,
+      1 + (5 << 18) / (text.length + 1), dir);
+
+  char fuzzed[300];
+  Text f;
+  memset (&f, 0, sizeof (Text));
+  for (int i = 0; i < rounds; i++)
+    {
+    snprintf (fuzzed, sizeof (fuzzed), "%s, fuzzed %d", name, i);
+    current = fuzzed;
+    fuzz (text.data, text.length, &f);
+    check_all (f.data, f.length, 30, 1);
+    }
+  free (f.data);
+  free (text.data);
+  printf ("%-24s %s\n", name, failures == before ? "ok" : "FAILED");
+  }
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int rounds = 20;
+  const char *dir = "/tmp";
+  int opt;
+  while ((opt = getopt (argc, argv, "f:r:d:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'f': rounds = atoi (optarg); break;
+      case 'r': rng_state = strtoull (optarg, NULL, 10) * 2 + 1; break;
+      case 'd': dir = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-f fuzz_rounds] [-r seed] "
+          "[-d temp_dir] {corpus files...}\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+
+  for (int i = optind; i < argc; i++)
+    check_file (argv[i], rounds, dir);
+
+  printf ("%d checks, %d failures\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+  }
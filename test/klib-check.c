@@ -0,0 +1,452 @@
+/*============================================================================
+  
+  FKRE 
+  
+  klib-check.c
+
+  Checks of the klib classes, on cases that the equivalence tests in
+  fkre-equiv.c don't reach:
+
+    klist   -- appending, getting, removing and clearing, across the
+               points at which the list grows, compared with a plain
+               array of what the list should hold
+    zipfile -- archives built here, byte by byte, including malformed
+               ones, which must be refused without harm
+
+  Each group prints 'ok' or 'FAILED', and each failure is described.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <klib/klib.h>
+#include <klib/klist.h>
+#include <klib/zipfile.h>
+
+/*============================================================================
+  
+  Failures
+
+  ==========================================================================*/
+static int checks = 0;
+static int failures = 0;
+static const char *current = "";
+
+static void check (BOOL ok, const char *fmt, ...)
+  {
+  checks++;
+  if (ok) return;
+  va_list ap;
+  va_start (ap, fmt);
+  fprintf (stderr, "FAIL %s: ", current);
+  vfprintf (stderr, fmt, ap);
+  fprintf (stderr, "\n");
+  va_end (ap);
+  failures++;
+  }
+
+/*============================================================================
+  
+  List items
+
+  Each item is an int, allocated for the list, whose value is recorded
+  when it is freed, so that the checks can tell which were freed, and
+  how often
+
+  ==========================================================================*/
+#define LIST_MAX 1000
+
+static int freed[LIST_MAX];
+
+static void *item_new (int value)
+  {
+  int *item = malloc (sizeof (int));
+  *item = value;
+  return item;
+  }
+
+static void item_free (void *item)
+  {
+  freed[*(int *)item]++;
+  free (item);
+  }
+
+static int item_compare (const void *i1, const void *i2, void *user_data)
+  {
+  return *(const int *)i1 - *(const int *)i2;
+  }
+
+/*============================================================================
+  
+  list_matches
+
+  Whether the list holds the 'length' values in 'expected', in order
+
+  ==========================================================================*/
+static BOOL list_matches (const KList *list, const int *expected,
+      size_t length)
+  {
+  if (klist_length (list) != length) return FALSE;
+  for (size_t i = 0; i < length; i++)
+    if (*(int *)klist_get (list, i) != expected[i]) return FALSE;
+  return TRUE;
+  }
+
+/*============================================================================
+  
+  freed_count
+
+  The number of times the items with values from 'first' up to, but
+  not including, 'last' have been freed
+
+  ==========================================================================*/
+static int freed_count (int first, int last)
+  {
+  int n = 0;
+  for (int i = first; i < last; i++) n += freed[i];
+  return n;
+  }
+
+/*============================================================================
+  
+  check_klist
+
+  ==========================================================================*/
+static void check_klist (void)
+  {
+  current = "klist";
+  int expected[LIST_MAX];
+  memset (freed, 0, sizeof (freed));
+
+  KList *list = klist_new_empty (item_free);
+  check (klist_length (list) == 0, "new list has %zu items",
+    klist_length (list));
+
+  // Every length up to well past several reallocations
+  for (int i = 0; i < 100; i++)
+    {
+    klist_append (list, item_new (i));
+    expected[i] = i;
+    if (!list_matches (list, expected, i + 1))
+      {
+      check (FALSE, "wrong contents after appending %d items", i + 1);
+      break;
+      }
+    }
+  check (list_matches (list, expected, 100), "wrong contents after "
+    "appending 100 items");
+  check (freed_count (0, LIST_MAX) == 0, "items freed by appending");
+
+  // The first, the last, and one in the middle, by reference
+  klist_remove_ref (list, klist_get (list, 0));
+  klist_remove_ref (list, klist_get (list, klist_length (list) - 1));
+  klist_remove_ref (list, klist_get (list, 49));
+  size_t n = 0;
+  for (int i = 0; i < 100; i++)
+    if (i != 0 && i != 99 && i != 50) expected[n++] = i;
+  check (list_matches (list, expected, n), "wrong contents after "
+    "removing the first, last, and middle items");
+  check (freed[0] == 1 && freed[99] == 1 && freed[50] == 1 
+    && freed_count (0, LIST_MAX) == 3, "wrong items freed by "
+    "klist_remove_ref()");
+
+  // A reference that isn't in the list changes nothing
+  int absent = 7;
+  klist_remove_ref (list, &absent);
+  check (list_matches (list, expected, n), "list changed by removing "
+    "a reference not in it");
+
+  // Every third item by value, which shifts all the others down
+  for (int i = 3; i < 100; i += 3)
+    {
+    int value = i;
+    klist_remove (list, &value, item_compare);
+    }
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++)
+    if (expected[i] % 3 != 0) expected[m++] = expected[i];
+  n = m;
+  check (list_matches (list, expected, n), "wrong contents after "
+    "removing every third item by value");
+
+  // Equal values are all removed
+  klist_append (list, item_new (200));
+  klist_append (list, item_new (201));
+  klist_append (list, item_new (200));
+  int value = 200;
+  klist_remove (list, &value, item_compare);
+  expected[n] = 201;
+  check (list_matches (list, expected, n + 1) && freed[200] == 2,
+    "klist_remove() didn't remove every equal item");
+  n++;
+
+  // Removing everything, one at a time from the front
+  while (klist_length (list) > 0)
+    klist_remove_ref (list, klist_get (list, 0));
+  check (klist_length (list) == 0, "%zu items left after removing all",
+    klist_length (list));
+
+  // A cleared list can be used again, and grows again
+  memset (freed, 0, sizeof (freed));
+  for (int i = 0; i < 20; i++) klist_append (list, item_new (300 + i));
+  klist_clear (list);
+  check (klist_length (list) == 0 && freed_count (300, 320) == 20,
+    "klist_clear() left %zu items, and freed %d of 20",
+    klist_length (list), freed_count (300, 320));
+  for (int i = 0; i < 500; i++)
+    {
+    klist_append (list, item_new (400 + i));
+    expected[i] = 400 + i;
+    }
+  check (list_matches (list, expected, 500), "wrong contents after "
+    "appending to a cleared list");
+  check (freed_count (300, 320) == 20, "items freed twice after "
+    "klist_clear()");
+
+  klist_destroy (list);
+  check (freed_count (400, 900) == 500, "klist_destroy() freed %d of "
+    "500 items", freed_count (400, 900));
+  check (freed_count (0, LIST_MAX) == 520, "%d items freed in all, "
+    "not 520", freed_count (0, LIST_MAX));
+  }
+
+/*============================================================================
+  
+  Archive
+
+  A ZIP archive with one entry, built in memory
+
+  ==========================================================================*/
+typedef struct _Archive
+  {
+  BYTE data[1024];
+  size_t length;
+  } Archive;
+
+static void archive_16 (Archive *a, uint32_t v)
+  {
+  a->data[a->length++] = v & 0xFF;
+  a->data[a->length++] = (v >> 8) & 0xFF;
+  }
+
+static void archive_32 (Archive *a, uint32_t v)
+  {
+  archive_16 (a, v & 0xFFFF);
+  archive_16 (a, v >> 16);
+  }
+
+static void archive_64 (Archive *a, uint64_t v)
+  {
+  archive_32 (a, v & 0xFFFFFFFF);
+  archive_32 (a, v >> 32);
+  }
+
+static void archive_bytes (Archive *a, const void *bytes, size_t length)
+  {
+  memcpy (a->data + a->length, bytes, length);
+  a->length += length;
+  }
+
+/*============================================================================
+  
+  archive_build
+
+  An archive with one entry called 'name', whose contents as stored
+  in the archive are the 'length' bytes at 'contents'. If 'size64' is
+  not zero, the central directory gives the size as 0xFFFFFFFF, and
+  'size64' in a ZIP64 extra field, whatever the contents really are.
+
+  ==========================================================================*/
+static void archive_build (Archive *a, const char *name, int method,
+      const char *contents, size_t length, uint32_t crc, uint64_t size64)
+  {
+  size_t name_length = strlen (name);
+  a->length = 0;
+
+  archive_32 (a, 0x04034b50);
+  archive_16 (a, 20);
+  archive_16 (a, 0);
+  archive_16 (a, method);
+  archive_32 (a, 0);
+  archive_32 (a, crc);
+  archive_32 (a, length);
+  archive_32 (a, length);
+  archive_16 (a, name_length);
+  archive_16 (a, 0);
+  archive_bytes (a, name, name_length);
+  archive_bytes (a, contents, length);
+
+  size_t dir_offset = a->length;
+  archive_32 (a, 0x02014b50);
+  archive_16 (a, 45);
+  archive_16 (a, 45);
+  archive_16 (a, 0);
+  archive_16 (a, method);
+  archive_32 (a, 0);
+  archive_32 (a, crc);
+  archive_32 (a, length);
+  archive_32 (a, size64 ? 0xFFFFFFFF : length);
+  archive_16 (a, name_length);
+  archive_16 (a, size64 ? 12 : 0);
+  archive_16 (a, 0);
+  archive_16 (a, 0);
+  archive_16 (a, 0);
+  archive_32 (a, 0);
+  archive_32 (a, 0);
+  archive_bytes (a, name, name_length);
+  if (size64)
+    {
+    archive_16 (a, 0x0001);
+    archive_16 (a, 8);
+    archive_64 (a, size64);
+    }
+  size_t dir_size = a->length - dir_offset;
+
+  archive_32 (a, 0x06054b50);
+  archive_16 (a, 0);
+  archive_16 (a, 0);
+  archive_16 (a, 1);
+  archive_16 (a, 1);
+  archive_32 (a, dir_size);
+  archive_32 (a, dir_offset);
+  archive_16 (a, 0);
+  }
+
+/*============================================================================
+  
+  archive_extract
+
+  Write the archive to a file, open it, and extract its entry to
+  memory, returning the error, and the contents in 'out' if there is no
+  error
+
+  ==========================================================================*/
+static ZipError archive_extract (const Archive *a, const char *dir,
+      char *out, size_t max_out)
+  {
+  char path[PATH_MAX];
+  snprintf (path, sizeof (path), "%s/klib-check-%d.zip", dir, getpid());
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || write (fd, a->data, a->length) != (ssize_t)a->length)
+    {
+    fprintf (stderr, "Can't write '%s': %s\n", path, strerror (errno));
+    if (fd >= 0) close (fd);
+    return ZE_INTERNAL;
+    }
+  close (fd);
+
+  ZipFile *zipfile = kzipfile_create (path);
+  ZipError e = kzipfile_read_contents (zipfile);
+  if (e == ZE_OK)
+    {
+    BYTE *data;
+    uint64_t length;
+    e = kzipfile_extract_to_memory (zipfile, 0, &data, &length);
+    if (e == ZE_OK)
+      {
+      snprintf (out, max_out, "%.*s", (int)length, data);
+      free (data);
+      }
+    }
+  kzipfile_destroy (zipfile);
+  unlink (path);
+  return e;
+  }
+
+/*============================================================================
+  
+  check_zipfile
+
+  ==========================================================================*/
+static void check_zipfile (const char *dir)
+  {
+  current = "zipfile";
+  Archive a;
+  char out[64];
+  // CRC-32 of "Hello"
+  const uint32_t crc = 0xF7D18982;
+  // "Hello" in a DEFLATE stored block, which inflates to five bytes
+  const char deflated[] = "\x01\x05\x00\xFA\xFFHello";
+
+  archive_build (&a, "hello.txt", 0, "Hello", 5, crc, 0);
+  ZipError e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_OK && strcmp (out, "Hello") == 0,
+    "stored entry: error %d", e);
+
+  archive_build (&a, "hello.txt", 8, deflated, 10, crc, 5);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_OK && strcmp (out, "Hello") == 0,
+    "deflated entry with a ZIP64 size: error %d", e);
+
+  archive_build (&a, "hello.txt", 0, "Hello", 5, crc, 5);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_OK && strcmp (out, "Hello") == 0,
+    "stored entry with a ZIP64 size: error %d", e);
+
+  archive_build (&a, "hello.txt", 0, "Hello", 5, crc ^ 1, 0);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_CORRUPT, "entry with a bad CRC: error %d", e);
+
+  // A size that wraps around to nothing when the terminator is added
+  archive_build (&a, "big.txt", 0, "Hello", 5, crc, 0xFFFFFFFFFFFFFFFFULL);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_TOOBIG, "ZIP64 size of 2^64-1: error %d", e);
+
+  archive_build (&a, "big.txt", 8, deflated, 10, crc, 
+    0xFFFFFFFFFFFFFFFFULL);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_TOOBIG, "deflated, ZIP64 size of 2^64-1: error %d", e);
+
+  archive_build (&a, "big.txt", 8, deflated, 10, crc, 
+    KZIPFILE_MEMORY_MAX + 1);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_TOOBIG, "ZIP64 size over the limit: error %d", e);
+
+  // A size smaller than the contents stops the extraction
+  archive_build (&a, "small.txt", 0, "Hello", 5, crc, 2);
+  e = archive_extract (&a, dir, out, sizeof (out));
+  check (e == ZE_CORRUPT, "ZIP64 size smaller than the entry: error %d",
+    e);
+  }
+
+/*============================================================================
+  
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  const char *dir = "/tmp";
+  int opt;
+  while ((opt = getopt (argc, argv, "d:h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'd': dir = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-d temp_dir]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+      }
+    }
+
+  int before = failures;
+  check_klist ();
+  printf ("%-24s %s\n", "klist", failures == before ? "ok" : "FAILED");
+
+  before = failures;
+  check_zipfile (dir);
+  printf ("%-24s %s\n", "zipfile", failures == before ? "ok" : "FAILED");
+
+  printf ("%d checks, %d failures\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+  }